@@ -0,0 +1,404 @@
+/*
+ * Portable LIN core shared by the phase0 sniffer, the phase1 controller and
+ * the host tools: PID table, enhanced checksum, a raw frame record and the
+ * receive framer with its optional slave response.
+ *
+ * The framer is a template over a small UART/clock HAL so the hot path has
+ * no virtual calls on any target. A HAL needs:
+ *
+ *   void begin(unsigned long baud);
+ *   int available();              // bytes ready to read
+ *   int read();                   // next byte, or -1
+ *   size_t write(const uint8_t* data, size_t length);
+ *   unsigned long micros();       // free-running microsecond clock
+ *
+ * micros() wraps at 32 bits on every target, so times are only ever
+ * subtracted as uint32_t, which also holds where unsigned long is 64 bits.
+ *
+ * Backends live next to this file: lin_hal_arduino.h (any Arduino serial
+ * port, used on the RP2040 and against the host Arduino shim) and
+ * lin_hal_esp32.h (ESP-IDF UART driver).
+*/
+
+#ifndef LIN_CORE_H
+#define LIN_CORE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+namespace lincore {
+
+static const uint8_t SYNC = 0x55;
+static const short MAX_FRAME_BYTES = 11; // sync, PID, up to 8 data bytes, checksum
+static const unsigned long BAUD = 19200;
+// Break is 14 sets of 52 us (728)
+static const unsigned long BREAK_THRESHOLD = 650; // microseconds, smaller than 728 to allow some margin
+
+// Protected identifier (frame ID plus its two parity bits) for IDs 0-63
+static const uint8_t PID_TABLE[64] = {
+    0x80, 0xC1, 0x42, 0x03, 0xC4, 0x85, 0x06, 0x47, 0x08, 0x49, 0xCA, 0x8B, 0x4C, 0x0D, 0x8E, 0xCF,
+    0x50, 0x11, 0x92, 0xD3, 0x14, 0x55, 0xD6, 0x97, 0xD8, 0x99, 0x1A, 0x5B, 0x9C, 0xDD, 0x5E, 0x1F,
+    0x20, 0x61, 0xE2, 0xA3, 0x64, 0x25, 0xA6, 0xE7, 0xA8, 0xE9, 0x6A, 0x2B, 0xEC, 0xAD, 0x2E, 0x6F,
+    0xF0, 0xB1, 0x32, 0x73, 0xB4, 0xF5, 0x76, 0x37, 0x78, 0x39, 0xBA, 0xFB, 0x3C, 0x7D, 0xFE, 0xBF,
+};
+
+inline uint8_t pidFor(uint8_t id) {
+    return PID_TABLE[id & 0x3F];
+}
+
+inline bool pidValid(uint8_t pid) {
+    return PID_TABLE[pid & 0x3F] == pid;
+}
+
+// Frame filters are a bit per frame ID (0-63), taken from the low six bits
+// of the PID so a PID with bad parity is filtered as the ID it claims
+static const uint64_t ALL_IDS = ~(uint64_t)0;
+
+inline uint64_t idBit(uint8_t pidOrId) {
+    return (uint64_t)1 << (pidOrId & 0x3F);
+}
+
+// Enhanced checksum over a frame as received, skipping the sync byte at
+// index 0, so it covers the PID and data
+inline uint8_t checksum(const uint8_t frame[], short length) {
+    unsigned int sum = 0;
+    for (short i = 1; i < length; i++) {
+        sum += frame[i];
+        if (sum > 0xFF) {
+            sum -= 0xFF;
+        }
+    }
+
+    // invert the checksum bits
+    return (uint8_t)~sum;
+}
+
+// Raw frame as it came off the bus
+struct Frame {
+    unsigned long timestamp; // microseconds, when the frame was read
+    short length;
+    uint8_t data[MAX_FRAME_BYTES];
+};
+
+template <class Hal>
+class Framer {
+    public:
+        explicit Framer(const Hal& hal) : hal(hal) {}
+
+        void begin() {
+            hal.begin(BAUD);
+            reset();
+        }
+
+        void reset() {
+            dataIndex = 0;
+            frameState = WAIT_SYNC;
+            frameOverflow = false;
+            hasSavedFrame = false;
+        }
+
+        // Reads whatever the UART has and returns the length of the frame in
+        // dataBuffer once one is complete, 0 otherwise. Frames end on a gap of
+        // BREAK_THRESHOLD, a new sync byte or MAX_FRAME_BYTES. Call it until
+        // it returns 0 to drain the UART.
+        short updateFrame(uint8_t expectedPID = 0);
+
+        // For HALs that detect the break in hardware: ends the frame in
+        // progress and returns its length like updateFrame(), dropping the
+        // 0x00 the break itself reads as
+        short endFrameOnBreak();
+
+        // Frames whose ID isn't in the bitmap are dropped at their PID byte,
+        // before they are buffered or checksummed. All IDs by default.
+        void setFilter(uint64_t ids) { filterIds = ids; }
+        uint64_t filter() const { return filterIds; }
+
+        // Keep one in every factor frames with this ID (or PID), also decided
+        // at the PID byte. 1, the default, keeps them all.
+        void setDecimation(uint8_t pidOrId, uint8_t factor);
+
+        // Slave response: answer a header with this PID with the given data,
+        // the enhanced checksum is added here. Length 0 disables it.
+        void setResponse(uint8_t pid, const uint8_t data[], short length);
+        void clearResponse() { responseLength = 0; }
+
+        // Whether a frame has started that updateFrame() hasn't returned yet,
+        // and micros() when its sync byte was read. Merging several buses
+        // holds back frames from the others that came after it.
+        bool receiving(unsigned long& syncMicros) const {
+            if (hasSavedFrame) {
+                syncMicros = lastReceivedTime;
+                return true;
+            }
+            if (frameState == RECEIVING) {
+                syncMicros = frameMicros;
+                return true;
+            }
+            return false;
+        }
+
+        uint8_t dataBuffer[MAX_FRAME_BYTES];
+        // micros() when the frame in dataBuffer had its sync byte read
+        unsigned long frameMicros = 0;
+
+        // Response timing, from the last time the RX FIFO was seen empty (the
+        // PID can't have arrived before that) to handing the response to the
+        // UART, so it is an upper bound on the real latency
+        unsigned long responsesSent = 0;
+        unsigned long responsesSkipped = 0; // too late to fit in the response window
+        unsigned long lastResponseLatency = 0;
+        unsigned long maxResponseLatency = 0;
+
+        unsigned long framesFiltered = 0; // dropped by the filter, expectedPID or decimation
+
+    protected:
+        Hal hal;
+
+    private:
+        void sendResponse();
+        short finishFrame();
+        bool wanted(uint8_t pid, uint8_t expectedPID);
+
+        enum { WAIT_SYNC, RECEIVING } frameState = WAIT_SYNC;
+        short dataIndex = 0;
+        unsigned long lastReceivedTime = 0;
+        bool frameOverflow = false;
+        bool hasSavedFrame = false; // a sync byte ended the last frame and starts the next
+
+        uint8_t responsePID = 0;
+        uint8_t responseBuffer[9]; // up to 8 data bytes and the checksum
+        short responseLength = 0;
+        unsigned long responseWindow = 0;
+        unsigned long lastIdlePoll = 0;
+
+        uint64_t filterIds = ALL_IDS;
+        uint64_t decimatedIds = 0; // so IDs without decimation cost one bit test
+        uint8_t decimation[64];
+        uint8_t decimationCount[64];
+};
+
+template <class Hal>
+void Framer<Hal>::setDecimation(uint8_t pidOrId, uint8_t factor) {
+    uint8_t id = pidOrId & 0x3F;
+    decimation[id] = factor;
+    decimationCount[id] = 0;
+    if (factor > 1) {
+        decimatedIds |= idBit(id);
+    } else {
+        decimatedIds &= ~idBit(id);
+    }
+}
+
+template <class Hal>
+bool Framer<Hal>::wanted(uint8_t pid, uint8_t expectedPID) {
+    if (expectedPID > 0 && pid != expectedPID) {
+        return false;
+    }
+    uint64_t bit = idBit(pid);
+    if (!(filterIds & bit)) {
+        return false;
+    }
+    if (decimatedIds & bit) {
+        uint8_t id = pid & 0x3F;
+        if (++decimationCount[id] < decimation[id]) {
+            return false;
+        }
+        decimationCount[id] = 0;
+    }
+    return true;
+}
+
+template <class Hal>
+short Framer<Hal>::finishFrame() {
+    short length = dataIndex;
+    bool droppedFrame = frameOverflow;
+    dataIndex = 0;
+    frameState = WAIT_SYNC;
+    frameOverflow = false;
+    if (!droppedFrame && length >= 2) {
+        return length;
+    }
+    return 0;
+}
+
+template <class Hal>
+short Framer<Hal>::updateFrame(uint8_t expectedPID) {
+    // If we have a pending new frame start (sync byte), restore it
+    if (hasSavedFrame) {
+        frameMicros = lastReceivedTime;
+        dataBuffer[0] = SYNC;
+        dataIndex = 1;
+        frameState = RECEIVING;
+        frameOverflow = false;
+        hasSavedFrame = false;
+    }
+
+    // Process all available bytes to clear the buffer quickly
+    while (hal.available()) {
+        unsigned long currentTime = hal.micros();
+
+        // If we were waiting for a break (idle time) to terminate the frame,
+        // do it before we consume the next byte sitting in the FIFO. This
+        // keeps us from treating the checksum as just another data byte when
+        // frames arrive back-to-back.
+        if (frameState == RECEIVING && (uint32_t)(currentTime - lastReceivedTime) >= BREAK_THRESHOLD) {
+            short length = finishFrame();
+            if (length) {
+                return length;
+            }
+            // Frame was invalid, restart loop without consuming the pending byte
+            continue;
+        }
+
+        uint8_t inByte = hal.read();
+        currentTime = hal.micros();
+
+        // Check if this is a new frame start
+        // If we see a sync byte (0x55) while already receiving, it's almost certainly
+        // a new frame. Accept that we might occasionally split a frame that has 0x55
+        // as data, but that's better than concatenating multiple frames together.
+        if (frameState == RECEIVING && inByte == SYNC && dataIndex >= 2 && !frameOverflow) {
+            // We've hit a new frame - save this sync byte for next call
+            hasSavedFrame = true;
+            lastReceivedTime = currentTime;
+
+            // Return the current frame
+            return dataIndex;
+        }
+
+        lastReceivedTime = currentTime;
+
+        // Look for sync byte if we haven't started a frame
+        if (frameState == WAIT_SYNC) {
+            if (inByte == SYNC) {
+                frameMicros = currentTime;
+                dataBuffer[0] = inByte;
+                dataIndex = 1;
+                frameState = RECEIVING;
+                frameOverflow = false;
+            }
+        } else {
+            // Answer our header before anything else so the response starts
+            // as early as possible, the filter below doesn't matter for it
+            if (dataIndex == 1 && responseLength > 0 && inByte == responsePID) {
+                sendResponse();
+            }
+
+            // Filter on the PID byte (expected PID, ID bitmap, decimation),
+            // the rest of an unwanted frame is skipped while waiting for sync
+            if (dataIndex == 1 && !wanted(inByte, expectedPID)) {
+                // Not a frame we want, reset
+                framesFiltered++;
+                dataIndex = 0;
+                frameState = WAIT_SYNC;
+                frameOverflow = false;
+                if (inByte == SYNC) {
+                    frameMicros = currentTime;
+                    dataBuffer[0] = inByte;
+                    dataIndex = 1;
+                    frameState = RECEIVING;
+                }
+            } else if (dataIndex < MAX_FRAME_BYTES) {
+                dataBuffer[dataIndex++] = inByte;
+
+                // Hard stop at MAX_FRAME_BYTES so a missing break or sync
+                // never lets the frame grow unbounded and corrupt the buffer.
+                if (dataIndex == MAX_FRAME_BYTES) {
+                    short length = dataIndex;
+                    dataIndex = 0;
+                    frameState = WAIT_SYNC;
+                    frameOverflow = false;
+                    return length;
+                }
+            } else {
+                // Buffer overflow - frame is too long
+                // Save current byte if it's a sync for next call
+                if (inByte == SYNC) {
+                    hasSavedFrame = true;
+                }
+
+                // Reset to look for next sync
+                frameOverflow = true;
+                dataIndex = 0;
+                frameState = WAIT_SYNC;
+
+                // Return the overflowed frame (limited to MAX_FRAME_BYTES to prevent buffer overrun)
+                return MAX_FRAME_BYTES;
+            }
+        }
+    }
+
+    lastIdlePoll = hal.micros();
+
+    // Check if we have a complete frame due to timeout (no more bytes available)
+    if (frameState == RECEIVING && (uint32_t)(hal.micros() - lastReceivedTime) >= BREAK_THRESHOLD) {
+        return finishFrame();
+    }
+
+    return 0; // No complete frame available yet
+}
+
+template <class Hal>
+short Framer<Hal>::endFrameOnBreak() {
+    if (hasSavedFrame) {
+        // Only a sync byte so far, nothing to end
+        return 0;
+    }
+    // The break reads as a 0x00 just before it is reported. A frame that
+    // really ends in a 0x00 checksum can't be told apart here and shows as a
+    // checksum error.
+    if (frameState == RECEIVING && dataIndex > 2 && dataBuffer[dataIndex - 1] == 0x00) {
+        dataIndex--;
+    }
+    if (frameState != RECEIVING) {
+        return 0;
+    }
+    return finishFrame();
+}
+
+template <class Hal>
+void Framer<Hal>::setResponse(uint8_t pid, const uint8_t data[], short length) {
+    if (length <= 0 || length > 8) {
+        clearResponse();
+        return;
+    }
+    // Enhanced checksum covers the PID and the data, build it like a
+    // received frame so checksum() can be reused
+    uint8_t frame[MAX_FRAME_BYTES];
+    frame[0] = SYNC;
+    frame[1] = pid;
+    memcpy(&frame[2], data, length);
+    memcpy(responseBuffer, data, length);
+    responseBuffer[length] = checksum(frame, length + 2);
+
+    // A frame may take up to 1.4x its nominal time (34 header bits plus 10
+    // per response byte), whatever is left after the nominal frame is all
+    // we can spend before the first response byte goes out
+    unsigned long nominalBits = 34 + 10 * (length + 1);
+    responseWindow = (nominalBits * 4 / 10) * 1000000UL / BAUD;
+    responsePID = pid;
+    responseLength = length + 1;
+}
+
+template <class Hal>
+void Framer<Hal>::sendResponse() {
+    unsigned long latency = (uint32_t)(hal.micros() - lastIdlePoll);
+    if (latency > responseWindow) {
+        // Too late, talking now would run into the next header
+        responsesSkipped++;
+        return;
+    }
+    // The whole response fits in the UART FIFO, so the bytes go out
+    // back-to-back at the hardware's bit timing
+    hal.write(responseBuffer, responseLength);
+    lastResponseLatency = latency;
+    if (latency > maxResponseLatency) {
+        maxResponseLatency = latency;
+    }
+    responsesSent++;
+}
+
+} // namespace lincore
+
+#endif // LIN_CORE_H
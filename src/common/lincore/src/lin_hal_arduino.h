@@ -0,0 +1,31 @@
+/*
+ * LIN HAL over an Arduino serial port. Templated on the concrete port type
+ * (SerialUART on the RP2040, HardwareSerial on the host shim) so calls are
+ * direct rather than through Stream's virtuals.
+*/
+
+#ifndef LIN_HAL_ARDUINO_H
+#define LIN_HAL_ARDUINO_H
+
+#include <Arduino.h>
+
+namespace lincore {
+
+template <class SerialPort>
+class ArduinoUart {
+    public:
+        explicit ArduinoUart(SerialPort& port) : port(&port) {}
+
+        void begin(unsigned long baud) { port->begin(baud); }
+        int available() { return port->available(); }
+        int read() { return port->read(); }
+        size_t write(const uint8_t* data, size_t length) { return port->write(data, length); }
+        unsigned long micros() { return ::micros(); }
+
+    private:
+        SerialPort* port;
+};
+
+} // namespace lincore
+
+#endif // LIN_HAL_ARDUINO_H
@@ -0,0 +1,45 @@
+/*
+ * LIN HAL over the ESP-IDF UART driver. The driver (and its event queue, if
+ * the owner wants break events) is installed by the owner before begin(),
+ * this only reads and writes through it.
+*/
+
+#ifndef LIN_HAL_ESP32_H
+#define LIN_HAL_ESP32_H
+
+#include <driver/uart.h>
+#include <esp_timer.h>
+
+namespace lincore {
+
+class Esp32Uart {
+    public:
+        explicit Esp32Uart(uart_port_t port) : port(port) {}
+
+        void begin(unsigned long baud) { uart_set_baudrate(port, baud); }
+
+        int available() {
+            size_t buffered = 0;
+            uart_get_buffered_data_len(port, &buffered);
+            return (int)buffered;
+        }
+
+        int read() {
+            uint8_t value;
+            return uart_read_bytes(port, &value, 1, 0) == 1 ? value : -1;
+        }
+
+        size_t write(const uint8_t* data, size_t length) {
+            int written = uart_write_bytes(port, (const char*)data, length);
+            return written < 0 ? 0 : (size_t)written;
+        }
+
+        unsigned long micros() { return (unsigned long)esp_timer_get_time(); }
+
+    private:
+        uart_port_t port;
+};
+
+} // namespace lincore
+
+#endif // LIN_HAL_ESP32_H
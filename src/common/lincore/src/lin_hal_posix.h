@@ -0,0 +1,92 @@
+/*
+ * LIN HAL over a POSIX terminal: a USB serial adapter or one end of a pty,
+ * so the master emulator and the controller's host build can talk without
+ * hardware. A pty has no line state, so there the break is sent as the 0x00
+ * byte a UART would read for it, followed by the rest of the break time.
+*/
+
+#ifndef LIN_HAL_POSIX_H
+#define LIN_HAL_POSIX_H
+
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lin_core.h"
+
+namespace lincore {
+
+class PosixUart {
+    public:
+        static const unsigned long BREAK_US = 14 * 1000000UL / BAUD;
+        static const unsigned long DELIMITER_US = 1000000UL / BAUD;
+
+        // pty: send the break as a 0x00 byte, a pty silently ignores break
+        // requests
+        PosixUart(int fd, bool pty) : fd(fd), pty(pty) {}
+
+        void begin(unsigned long baud) {
+            struct termios tio;
+            if (tcgetattr(fd, &tio) == 0) {
+                cfmakeraw(&tio);
+                cfsetspeed(&tio, baud == 19200 ? B19200 : B9600);
+                tcsetattr(fd, TCSANOW, &tio);
+            }
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        }
+
+        int available() {
+            int count = 0;
+            return ioctl(fd, FIONREAD, &count) == 0 ? count : 0;
+        }
+
+        int read() {
+            uint8_t value;
+            return ::read(fd, &value, 1) == 1 ? value : -1;
+        }
+
+        size_t write(const uint8_t* data, size_t length) {
+            ssize_t written = ::write(fd, data, length);
+            return written < 0 ? 0 : (size_t)written;
+        }
+
+        unsigned long micros() {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            return now.tv_sec * 1000000UL + now.tv_nsec / 1000;
+        }
+
+        void sendBreak() {
+            unsigned long start = micros();
+            if (pty) {
+                const uint8_t breakByte = 0x00;
+                write(&breakByte, 1);
+            } else {
+                ioctl(fd, TIOCSBRK);
+                sleepUntil(start + BREAK_US);
+                ioctl(fd, TIOCCBRK);
+            }
+            sleepUntil(start + BREAK_US + DELIMITER_US);
+        }
+
+    private:
+        void sleepUntil(unsigned long target) {
+            // Sleep most of the way and spin the rest, the scheduler's wakeup
+            // jitter is a good fraction of a bit time
+            long remaining;
+            while ((remaining = (long)(target - micros())) > 0) {
+                if (remaining > 200) {
+                    usleep(remaining - 150);
+                }
+            }
+        }
+
+        int fd;
+        bool pty;
+};
+
+} // namespace lincore
+
+#endif // LIN_HAL_POSIX_H
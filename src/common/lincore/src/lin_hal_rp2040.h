@@ -0,0 +1,46 @@
+/*
+ * LIN HAL for an RP2040 UART driving a transceiver, as used by the master
+ * emulator. Same as the Arduino backend, plus a break generated by the
+ * UART's own break control rather than by switching baud rates.
+*/
+
+#ifndef LIN_HAL_RP2040_H
+#define LIN_HAL_RP2040_H
+
+#include <Arduino.h>
+#include <hardware/uart.h>
+
+#include "lin_core.h"
+
+namespace lincore {
+
+class Rp2040Uart {
+    public:
+        static const unsigned long BREAK_US = 14 * 1000000UL / BAUD; // same as the car
+        static const unsigned long DELIMITER_US = 1000000UL / BAUD;
+
+        Rp2040Uart(SerialUART& port, uart_inst_t* uart) : port(&port), uart(uart) {}
+
+        void begin(unsigned long baud) { port->begin(baud); }
+        int available() { return port->available(); }
+        int read() { return port->read(); }
+        size_t write(const uint8_t* data, size_t length) { return port->write(data, length); }
+        unsigned long micros() { return ::micros(); }
+
+        void sendBreak() {
+            // Holding the line low mid-byte would corrupt the previous frame
+            uart_tx_wait_blocking(uart);
+            uart_set_break(uart, true);
+            busy_wait_us(BREAK_US);
+            uart_set_break(uart, false);
+            busy_wait_us(DELIMITER_US);
+        }
+
+    private:
+        SerialUART* port;
+        uart_inst_t* uart;
+};
+
+} // namespace lincore
+
+#endif // LIN_HAL_RP2040_H
@@ -0,0 +1,115 @@
+/*
+ * LIN master side: a schedule table runner that plays the car's side of the
+ * bus. Each slot sends a break, sync and PID, plus data and the enhanced
+ * checksum when the master publishes the frame, or just the header when a
+ * slave is expected to answer.
+ *
+ * The HAL is the framer's (see lin_core.h) plus:
+ *
+ *   void sendBreak();             // break and delimiter, returns once done
+*/
+
+#ifndef LIN_MASTER_H
+#define LIN_MASTER_H
+
+#include "lin_core.h"
+
+namespace lincore {
+
+struct ScheduleEntry {
+    uint8_t pid;
+    uint8_t length; // data bytes the master sends, 0 for a header a slave answers
+    uint8_t data[8];
+    unsigned long slotMicros; // from this frame's break to the next one's
+};
+
+template <class Hal>
+class Master {
+    public:
+        explicit Master(const Hal& hal) : hal(hal) {}
+
+        void begin() { hal.begin(BAUD); }
+
+        // Start running a table from its first entry. With repeat the table
+        // loops forever, otherwise running() goes false after the last slot.
+        void start(const ScheduleEntry* entries, size_t count, bool repeat = true) {
+            table = entries;
+            tableSize = count;
+            loop = repeat;
+            index = 0;
+            nextSlot = hal.micros();
+        }
+
+        void stop() { table = nullptr; }
+        bool running() const { return table && (loop || index < tableSize); }
+
+        // Sends the next frame once its slot has come up, returns true if it
+        // did. Slots are scheduled from the previous slot's start rather than
+        // from now, so a late poll doesn't drift the rest of the schedule.
+        bool poll() {
+            if (!running()) {
+                return false;
+            }
+            unsigned long now = hal.micros();
+            if ((int32_t)(now - nextSlot) < 0) {
+                return false;
+            }
+            unsigned long late = (uint32_t)(now - nextSlot);
+            if (late > maxLateness) {
+                maxLateness = late;
+            }
+            const ScheduleEntry& entry = table[index];
+            lastSlotStart = now;
+            sendFrame(entry);
+            nextSlot += entry.slotMicros;
+            index++;
+            if (loop && index == tableSize) {
+                index = 0;
+            }
+            return true;
+        }
+
+        // Micros until the next slot, for sleeping between polls
+        unsigned long timeToNextSlot() {
+            long remaining = (int32_t)(nextSlot - hal.micros());
+            return remaining > 0 ? (unsigned long)remaining : 0;
+        }
+
+        size_t currentIndex() const { return index; }
+
+        unsigned long framesSent = 0;
+        unsigned long maxLateness = 0; // worst slot start behind schedule, micros
+        unsigned long lastSlotStart = 0;
+
+    protected:
+        Hal hal;
+
+    private:
+        void sendFrame(const ScheduleEntry& entry) {
+            uint8_t frame[MAX_FRAME_BYTES];
+            short length = 2;
+            frame[0] = SYNC;
+            frame[1] = entry.pid;
+            if (entry.length > 0) {
+                short dataLength = entry.length > 8 ? 8 : entry.length;
+                memcpy(&frame[2], entry.data, dataLength);
+                length += dataLength;
+                frame[length] = checksum(frame, length);
+                length++;
+            }
+            hal.sendBreak();
+            // One write, so the bytes go out back-to-back
+            hal.write(frame, length);
+            framesSent++;
+        }
+
+        const ScheduleEntry* table = nullptr;
+        size_t tableSize = 0;
+        size_t index = 0;
+        bool loop = true;
+        unsigned long nextSlot = 0;
+};
+
+} // namespace lincore
+
+#endif // LIN_MASTER_H
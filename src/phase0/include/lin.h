@@ -2,14 +2,48 @@
 #define LIN_H
 
 #include <Arduino.h>
-#include <HardwareSerial.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+#include <lin_core.h>
+#include <lin_hal_esp32.h>
 
+// LIN receive on UART1 using the ESP-IDF UART driver and the shared framer
+// in src/common/lincore. A receive task pinned to the app core sleeps on the
+// driver's event queue, so it only runs when bytes or a break arrive. Break
+// events end frames, and complete frames are handed to readFrame() through a
+// FreeRTOS queue.
 class lin {
     public:
-        static const short MAX_BYTES = 11; // Store max of 11 bytes: sync, id, up to 8 data bytes, checksum
+        static const short MAX_BYTES = lincore::MAX_FRAME_BYTES; // sync, id, up to 8 data bytes, checksum
+        static const int FRAME_QUEUE_DEPTH = 32;
+        static const int RECEIVE_TASK_CORE = 1; // WiFi lives on core 0
+        static const int RECEIVE_TASK_PRIORITY = 10; // above loop(), which runs at 1
+
+        typedef lincore::Frame Frame;
+
+        lin();
         void setupSerial(int rxPin);
-        short readFrame(byte dataBuffer[], byte pid = 0);
-        byte calculateChecksum(byte dataBuffer[], short length);
+        // Copies the next frame matching pid (0 for any) into dataBuffer and
+        // returns its length, waiting up to wait ticks for one to arrive.
+        // Returns 0 if none did.
+        short readFrame(byte dataBuffer[], byte pid = 0, TickType_t wait = 0);
+        byte calculateChecksum(byte dataBuffer[], short length) { return lincore::checksum(dataBuffer, length); }
+
+        // Receive task counters
+        volatile unsigned long framesReceived = 0;
+        volatile unsigned long framesDropped = 0; // frame queue was full
+        volatile unsigned long overflows = 0; // UART FIFO or ring buffer overran
+
+    private:
+        static void receiveTask(void* arg);
+        void drainFrames();
+        void publish(short length);
+
+        QueueHandle_t uartEvents = nullptr;
+        QueueHandle_t frames = nullptr;
+        TaskHandle_t task = nullptr;
+        lincore::Framer<lincore::Esp32Uart> framer; // only touched by the receive task
 };
 
-#endif // LIN_H
\ No newline at end of file
+#endif // LIN_H
@@ -1,52 +1,104 @@
 #include "lin.h"
 
-HardwareSerial linSerial(1);
+#define LIN_UART UART_NUM_1
+#define LIN_RX_BUFFER 1024 // driver ring buffer, about half a second of bus time
+#define LIN_EVENT_QUEUE_DEPTH 32
+// Idle time in symbols before the driver reports buffered bytes, so the last
+// bytes of a frame don't wait for the FIFO threshold
+#define LIN_RX_TIMEOUT_SYMBOLS 2
 
-// Break is 14 sets of 52 us, go lower for safety
-const unsigned long BREAK_THRESHOLD = 728;
-unsigned long lastReceivedTime = 0;
+lin::lin() : framer(lincore::Esp32Uart(LIN_UART)) {}
 
 void lin::setupSerial(int rxPin) {
     Serial.begin(115200); // For debugging output
-    linSerial.begin(19200, SERIAL_8N1, rxPin); // LIN Serial
+
+    uart_config_t config = {};
+    config.baud_rate = lincore::BAUD;
+    config.data_bits = UART_DATA_8_BITS;
+    config.parity = UART_PARITY_DISABLE;
+    config.stop_bits = UART_STOP_BITS_1;
+    config.flow_ctrl = UART_HW_FLOWCTRL_DISABLE;
+    uart_driver_install(LIN_UART, LIN_RX_BUFFER, 0, LIN_EVENT_QUEUE_DEPTH, &uartEvents, 0);
+    uart_param_config(LIN_UART, &config);
+    uart_set_pin(LIN_UART, UART_PIN_NO_CHANGE, rxPin, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE);
+    uart_set_rx_timeout(LIN_UART, LIN_RX_TIMEOUT_SYMBOLS);
+    framer.begin();
+
+    frames = xQueueCreate(FRAME_QUEUE_DEPTH, sizeof(Frame));
+    xTaskCreatePinnedToCore(receiveTask, "lin_rx", 4096, this, RECEIVE_TASK_PRIORITY, &task, RECEIVE_TASK_CORE);
 }
 
-short lin::readFrame(byte dataBuffer[], byte pid) {
-    short dataIndex = 0;
-    lastReceivedTime = micros();
-    while (micros() - lastReceivedTime < BREAK_THRESHOLD) {
-        while (linSerial.available() && dataIndex < MAX_BYTES) {
-            // Read the incoming byte
-            dataBuffer[dataIndex++] = linSerial.read();
-            lastReceivedTime = micros(); // Update the last received time
-            if (dataBuffer[0] != 0x55) {
-                dataIndex = 0; // Reset the index if the first byte is not 0x55 (sync byte)
-            }
-            if (pid > 0 && dataIndex == 2 && dataBuffer[1] != pid) {
-                dataIndex = 0; // Reset the index if the second byte is not the expected PID
-            }
-            if (dataIndex >= MAX_BYTES) {
+void lin::receiveTask(void* arg) {
+    lin* self = (lin*)arg;
+    uart_event_t event;
+    for (;;) {
+        if (xQueueReceive(self->uartEvents, &event, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+        switch (event.type) {
+            case UART_DATA:
+                self->drainFrames();
+                break;
+            case UART_BREAK: {
+                // Anything still buffered belongs to the frame before the break
+                self->drainFrames();
+                short length = self->framer.endFrameOnBreak();
+                if (length > 0) {
+                    self->publish(length);
+                }
                 break;
             }
+            case UART_FIFO_OVF:
+            case UART_BUFFER_FULL:
+                // Bytes were lost, so the frame in progress can't be trusted
+                uart_flush_input(LIN_UART);
+                xQueueReset(self->uartEvents);
+                self->framer.reset();
+                self->overflows++;
+                break;
+            default:
+                // Frame errors are the break character itself
+                break;
         }
     }
-    if (dataIndex < 2) {
-        return 0; // Return 0 if less than 2 bytes are read
+}
+
+void lin::drainFrames() {
+    short length;
+    while ((length = framer.updateFrame()) > 0) {
+        publish(length);
     }
+}
 
-    // Return the count of bytes read
-    return dataIndex;
+void lin::publish(short length) {
+    Frame frame;
+    frame.timestamp = micros();
+    frame.length = length;
+    memcpy(frame.data, framer.dataBuffer, length);
+    if (xQueueSend(frames, &frame, 0) == pdTRUE) {
+        framesReceived++;
+    } else {
+        framesDropped++;
+    }
 }
 
-byte lin::calculateChecksum(byte dataBuffer[], short length) {
-    int checksum = 0;
-    for (short i = 1; i < length; i++) { // skip the first byte, it's the sync byte
-        checksum += dataBuffer[i];
-        if (checksum > 0xFF) {
-            checksum -= 0xFF;
+short lin::readFrame(byte dataBuffer[], byte pid, TickType_t wait) {
+    if (!frames) {
+        return 0;
+    }
+    Frame frame;
+    TickType_t start = xTaskGetTickCount();
+    for (;;) {
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        if (xQueueReceive(frames, &frame, elapsed < wait ? wait - elapsed : 0) != pdTRUE) {
+            return 0;
+        }
+        if (pid == 0 || frame.data[1] == pid) {
+            break;
         }
     }
+    memcpy(dataBuffer, frame.data, frame.length);
 
-    // invert the checksum bits
-    return (byte)~checksum;
-}
\ No newline at end of file
+    // Return the count of bytes read
+    return frame.length;
+}
@@ -21,13 +21,6 @@ AsyncWebServer server(80);
 unsigned long ota_progress_millis = 0;
 
 // LIN Variables
-// const byte ident = 1; // Identification Byte
-// const byte data_size=8; // length of byte array
-// const byte frame_size = data_size+3; // length of LIN frame
-// byte data[frame_size]; // byte array for received data
-
-// lin_stack_esp32 LIN1(2,ident); // 2 - channel (GPIO 16 & 17), ident - Identification Byte
-
 lin linStack;
 byte data[lin::MAX_BYTES];
 
@@ -115,7 +108,6 @@ void setup(void) {
   }
 
   // Setup LIN
-  //LIN1.setSerial();
   linStack.setupSerial(16);
 
   server.on("/", HTTP_GET, [](AsyncWebServerRequest *request) {
@@ -137,7 +129,9 @@ void setup(void) {
 void loop(void) {
   ElegantOTA.loop();
 
-  int bytesRead = linStack.readFrame(data, 0xCF);
+  // Frames arrive from the receive task, sleep here for a while if there
+  // aren't any rather than spin, ElegantOTA still gets a turn every 10 ms
+  int bytesRead = linStack.readFrame(data, 0xCF, pdMS_TO_TICKS(10));
   if (bytesRead > 2) {
     byte calculatedChecksum = linStack.calculateChecksum(data, bytesRead - 1);
     for (int i = 0; i < bytesRead; i++) {
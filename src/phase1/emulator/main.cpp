@@ -0,0 +1,102 @@
+/*
+ * Vehicle side LIN master for bench testing, on a spare Pico W with a LIN
+ * transceiver on Serial1 (GP0 TX, GP1 RX) wired to the controller's bus.
+ *
+ * Plays the car's trailer schedule (see schedule.cpp), or replays
+ * /replay.lcz or /replay.txt from LittleFS if present, a lin_capture.lcz
+ * downloaded from the controller or one unpacked to text. Prints slot timing and the 0x10 responses it hears on USB
+ * serial every few seconds.
+*/
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <lin_master.h>
+#include <lin_hal_rp2040.h>
+
+#include "schedule.h"
+
+#define REPLAY_FILE "/replay.txt"
+#define REPLAY_PACKED_FILE "/replay.lcz"
+#define REPORT_INTERVAL_MS 5000
+
+lincore::Master<lincore::Rp2040Uart> master(lincore::Rp2040Uart(Serial1, uart0));
+std::vector<lincore::ScheduleEntry> schedule;
+
+// The transceiver echoes our own bytes back, so after a 0x10 header the
+// sync, PID and anything past them is the slave's response
+unsigned long responses = 0;
+unsigned long silentHeaders = 0;
+size_t rxCount = 0;
+bool expectResponse = false;
+unsigned long lastReport = 0;
+
+void loadSchedule() {
+  if (LittleFS.begin()) {
+    File packed = LittleFS.open(REPLAY_PACKED_FILE, "r");
+    if (packed) {
+      CaptureDecoder decoder;
+      decoder.begin();
+      LINFrame frame;
+      unsigned long lastUs = 0;
+      int value;
+      while ((value = packed.read()) >= 0 && decoder.valid()) {
+        if (decoder.push(value, frame)) {
+          appendCaptureFrame(schedule, lastUs, frame);
+        }
+      }
+      packed.close();
+      Serial.printf("Replaying %u frames from %s\n", (unsigned)schedule.size(), REPLAY_PACKED_FILE);
+    }
+    File file = schedule.empty() ? LittleFS.open(REPLAY_FILE, "r") : File();
+    if (file) {
+      unsigned long lastUs = 0;
+      while (file.available()) {
+        String line = file.readStringUntil('\n');
+        appendCaptureLine(schedule, lastUs, line.c_str());
+      }
+      file.close();
+      Serial.printf("Replaying %u frames from %s\n", (unsigned)schedule.size(), REPLAY_FILE);
+    }
+  }
+  if (schedule.empty()) {
+    buildCarSchedule(schedule);
+    Serial.printf("Playing the car schedule, %u slots\n", (unsigned)schedule.size());
+  }
+}
+
+void finishSlot() {
+  if (expectResponse) {
+    if (rxCount > 2) {
+      responses++;
+    } else {
+      silentHeaders++;
+    }
+  }
+}
+
+void setup() {
+  Serial.begin(115200);
+  loadSchedule();
+  master.begin();
+  master.start(schedule.data(), schedule.size());
+}
+
+void loop() {
+  size_t index = master.currentIndex();
+  if (master.running() && master.timeToNextSlot() == 0) {
+    finishSlot();
+    expectResponse = schedule[index].length == 0;
+    rxCount = 0;
+    master.poll();
+  }
+  while (Serial1.available()) {
+    Serial1.read();
+    rxCount++;
+  }
+
+  if (millis() - lastReport >= REPORT_INTERVAL_MS) {
+    lastReport = millis();
+    Serial.printf("frames=%lu late_max_us=%lu responses=%lu silent=%lu\n",
+                  master.framesSent, master.maxLateness, responses, silentHeaders);
+  }
+}
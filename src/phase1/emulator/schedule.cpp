@@ -0,0 +1,78 @@
+#include "schedule.h"
+#include "capture.h"
+
+// Break, sync and PID plus data and checksum, with a little interframe space
+static unsigned long frameMicros(const lincore::ScheduleEntry& entry) {
+  unsigned long bits = 34 + (entry.length ? 10 * (entry.length + 1) : 0);
+  return bits * 1000000UL / lincore::BAUD + 200;
+}
+
+void buildCarSchedule(std::vector<lincore::ScheduleEntry>& schedule) {
+  // Light byte per phase, see docs/LIN-Decoding.md
+  static const byte phases[] = {0x00, 0x01, 0x02, 0x04, 0x0B};
+  const unsigned long phaseUs = 2000000;
+  const unsigned long blinkUs = 333000;
+
+  schedule.clear();
+  for (byte lights : phases) {
+    for (unsigned long t = 0; t < phaseUs; t += 2 * CAR_SLOT_US) {
+      byte value = lights;
+      // Turn signals blink, brakes hold them on
+      if ((lights == 0x01 || lights == 0x02) && (t / blinkUs) % 2 == 1) {
+        value = 0x00;
+      }
+      lincore::ScheduleEntry light = {CAR_LIGHT_PID, 1, {value}, CAR_SLOT_US};
+      lincore::ScheduleEntry status = {CAR_STATUS_PID, 0, {0}, CAR_SLOT_US};
+      schedule.push_back(light);
+      schedule.push_back(status);
+    }
+  }
+}
+
+// Headers the car sends for a slave to answer, see docs/LIN-Decoding.md. A
+// capture holds the answer as the frame's data, but the master only sends
+// the header, the controller under test answers 0x10 itself.
+static bool slavePublished(byte pid) {
+  switch (pid) {
+    case CAR_STATUS_PID: // 0x10, the trailer module's status
+    case 0x11: // 0x11, also from the trailer module
+    case 0xD8: // 0x18
+    case 0x99: // 0x19
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool appendCaptureLine(std::vector<lincore::ScheduleEntry>& schedule, unsigned long& lastUs, const char* line) {
+  LINFrame frame;
+  if (!parseCaptureLine(line, frame)) {
+    return false;
+  }
+  appendCaptureFrame(schedule, lastUs, frame);
+  return true;
+}
+
+void appendCaptureFrame(std::vector<lincore::ScheduleEntry>& schedule, unsigned long& lastUs, const LINFrame& frame) {
+  if (frame.bus != 0) {
+    return;
+  }
+  lincore::ScheduleEntry entry = {frame.pid, 0, {0}, 0};
+  if (!slavePublished(frame.pid)) {
+    entry.length = frame.dataLength;
+    memcpy(entry.data, frame.data, frame.dataLength);
+  }
+  entry.slotMicros = frameMicros(entry);
+
+  // Frames logged closer together than a frame takes (older captures only
+  // have millisecond timestamps) go out back-to-back
+  if (!schedule.empty()) {
+    lincore::ScheduleEntry& previous = schedule.back();
+    unsigned long gap = frame.timestampUs - lastUs;
+    if (gap > previous.slotMicros) {
+      previous.slotMicros = gap;
+    }
+  }
+  lastUs = frame.timestampUs;
+  schedule.push_back(entry);
+}
@@ -0,0 +1,31 @@
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+#include <Arduino.h>
+#include <lin_master.h>
+#include <vector>
+
+#include "capture.h"
+
+#define CAR_SLOT_US 10000 // 0x0F and the 0x10 header alternate every 10 ms
+#define CAR_LIGHT_PID 0xCF
+#define CAR_STATUS_PID 0x50
+
+// The car's trailer schedule: the 0x0F light states and the 0x10 header,
+// which a trailer module answers. The light byte steps through idle, left
+// and right signals (blinking at 1.5 Hz), lights on and brakes, two seconds
+// each, then repeats.
+void buildCarSchedule(std::vector<lincore::ScheduleEntry>& schedule);
+
+// Append one lin_capture.txt line as a schedule slot, timed from the capture
+// timestamps. lastUs carries the previous line's timestamp between calls.
+// Returns false for lines that aren't frames (comments, headers). Frames a
+// slave answered (0x10, 0x11, 0x18 and 0x19) become bare headers, so the
+// controller under test gives its own response instead of the master
+// sending the captured one. Frames a multi-bus capture has from any bus but
+// 0 are skipped, they weren't on the trailer bus.
+bool appendCaptureLine(std::vector<lincore::ScheduleEntry>& schedule, unsigned long& lastUs, const char* line);
+// The same for a frame unpacked from a lin_capture.lcz
+void appendCaptureFrame(std::vector<lincore::ScheduleEntry>& schedule, unsigned long& lastUs, const LINFrame& frame);
+
+#endif // SCHEDULE_H
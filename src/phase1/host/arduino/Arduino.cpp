@@ -0,0 +1,621 @@
+#include "Arduino.h"
+
+#include <algorithm>
+#include <ctype.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+
+// 64 bits, micros() and millis() wrap as the core's 32 bit counts do
+static uint64_t virtualMicros = 0;
+static bool realClock = false;
+static clockid_t realClockId = CLOCK_MONOTONIC;
+static struct timespec realEpoch;
+int hostPinState[HOST_PIN_COUNT];
+// Pins handed to a PWM slice by analogWrite(), until pinMode() takes them back
+static bool pinPwm[HOST_PIN_COUNT];
+float hostTemperatureC = 25.0f;
+
+HardwareSerial Serial(true);
+HardwareSerial Serial1;
+HardwareSerial Serial2;
+RP2040 rp2040;
+
+#pragma region Time and IO
+
+static uint64_t clockMicros() {
+    if (realClock) {
+        struct timespec now;
+        clock_gettime(realClockId, &now);
+        // Not kept in virtualMicros, test clients read it from other threads
+        return (now.tv_sec - realEpoch.tv_sec) * 1000000ULL + (now.tv_nsec - realEpoch.tv_nsec) / 1000;
+    }
+    return virtualMicros;
+}
+
+unsigned long micros() {
+    return (uint32_t)clockMicros();
+}
+
+unsigned long millis() {
+    return (uint32_t)(clockMicros() / 1000);
+}
+
+void delay(unsigned long ms) {
+    delayMicroseconds(ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us) {
+    if (realClock && realClockId != CLOCK_MONOTONIC) {
+        // Sleeping wouldn't move a CPU time clock
+        unsigned long start = micros();
+        while ((uint32_t)(micros() - start) < us) {
+        }
+        return;
+    }
+    if (realClock) {
+        usleep(us);
+        return;
+    }
+    virtualMicros += us;
+}
+
+static void startRealClock(clockid_t id) {
+    realClockId = id;
+    clock_gettime(realClockId, &realEpoch);
+    realClock = true;
+    virtualMicros = 0;
+}
+
+void hostUseRealClock() {
+    startRealClock(CLOCK_MONOTONIC);
+}
+
+void hostUseThreadClock() {
+    clockid_t id;
+    pthread_getcpuclockid(pthread_self(), &id);
+    startRealClock(id);
+}
+
+void yield() {
+}
+
+uint64_t hostMicros64() {
+    return clockMicros();
+}
+
+void hostSetMicros(unsigned long us) {
+    virtualMicros = us;
+}
+
+void hostAdvanceMicros(unsigned long us) {
+    virtualMicros += us;
+}
+
+// Back to a plain GPIO driven low, as gpio_init() leaves it
+void pinMode(int pin, int mode) {
+    (void)mode;
+    if (pin >= 0 && pin < HOST_PIN_COUNT) {
+        pinPwm[pin] = false;
+        hostPinState[pin] = LOW;
+    }
+}
+
+// Only reaches the pin while it is a GPIO, not while PWM drives it
+void digitalWrite(int pin, int value) {
+    if (pin >= 0 && pin < HOST_PIN_COUNT && !pinPwm[pin]) {
+        hostPinState[pin] = value;
+    }
+}
+
+int digitalRead(int pin) {
+    if (pin >= 0 && pin < HOST_PIN_COUNT) {
+        return hostPinState[pin];
+    }
+    return LOW;
+}
+
+void analogWrite(int pin, int value) {
+    if (pin >= 0 && pin < HOST_PIN_COUNT) {
+        pinPwm[pin] = true;
+        hostPinState[pin] = value;
+    }
+}
+
+float analogReadTemp() {
+    return hostTemperatureC;
+}
+
+#pragma endregion Time and IO
+
+#pragma region String
+
+String::String(const char* cstr) : heap(nullptr), capacity(SSO_CAPACITY), len(0) {
+    sso[0] = 0;
+    if (cstr) {
+        copy(cstr, strlen(cstr));
+    }
+}
+
+String::String(const String& str) : heap(nullptr), capacity(SSO_CAPACITY), len(0) {
+    sso[0] = 0;
+    copy(str.c_str(), str.len);
+}
+
+String::String(String&& str) : heap(str.heap), capacity(str.capacity), len(str.len) {
+    memcpy(sso, str.sso, sizeof(sso));
+    str.heap = nullptr;
+    str.capacity = SSO_CAPACITY;
+    str.len = 0;
+    str.sso[0] = 0;
+}
+
+String::String(char c) : String() {
+    concat(c);
+}
+
+String::String(unsigned char value, unsigned char base) : String((unsigned long)value, base) {
+}
+
+String::String(int value, unsigned char base) : String((long)value, base) {
+}
+
+String::String(unsigned int value, unsigned char base) : String((unsigned long)value, base) {
+}
+
+String::String(long value, unsigned char base) : String() {
+    if (value < 0 && base == DEC) {
+        concat('-');
+        String digits((unsigned long)-value, base);
+        concat(digits);
+    } else {
+        String digits((unsigned long)value, base);
+        concat(digits);
+    }
+}
+
+String::String(unsigned long value, unsigned char base) : heap(nullptr), capacity(SSO_CAPACITY), len(0) {
+    char buf[8 * sizeof(unsigned long) + 1];
+    char* p = &buf[sizeof(buf) - 1];
+    *p = 0;
+    do {
+        unsigned long digit = value % base;
+        *--p = (char)(digit < 10 ? '0' + digit : 'a' + digit - 10);
+        value /= base;
+    } while (value);
+    sso[0] = 0;
+    copy(p, strlen(p));
+}
+
+String::String(float value, unsigned char decimalPlaces) : String((double)value, decimalPlaces) {
+}
+
+String::String(double value, unsigned char decimalPlaces) : heap(nullptr), capacity(SSO_CAPACITY), len(0) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%.*f", decimalPlaces, value);
+    sso[0] = 0;
+    copy(buf, strlen(buf));
+}
+
+String::~String() {
+    delete[] heap;
+}
+
+String& String::operator=(const String& rhs) {
+    if (this != &rhs) {
+        copy(rhs.c_str(), rhs.len);
+    }
+    return *this;
+}
+
+String& String::operator=(String&& rhs) {
+    if (this != &rhs) {
+        delete[] heap;
+        heap = rhs.heap;
+        capacity = rhs.capacity;
+        len = rhs.len;
+        memcpy(sso, rhs.sso, sizeof(sso));
+        rhs.heap = nullptr;
+        rhs.capacity = SSO_CAPACITY;
+        rhs.len = 0;
+        rhs.sso[0] = 0;
+    }
+    return *this;
+}
+
+String& String::operator=(const char* cstr) {
+    copy(cstr ? cstr : "", cstr ? strlen(cstr) : 0);
+    return *this;
+}
+
+// Grows to exactly the requested size like the device String does, so every
+// growth is one reallocation.
+bool String::reserve(unsigned int size) {
+    if (size <= capacity) {
+        return true;
+    }
+    char* newBuffer = new char[size + 1];
+    memcpy(newBuffer, buffer(), len + 1);
+    delete[] heap;
+    heap = newBuffer;
+    capacity = size;
+    return true;
+}
+
+void String::copy(const char* cstr, unsigned int length) {
+    reserve(length);
+    memmove(buffer(), cstr, length);
+    len = length;
+    buffer()[len] = 0;
+}
+
+bool String::concat(const char* cstr, unsigned int length) {
+    if (length == 0) {
+        return true;
+    }
+    // Growing by half again each time, a String built a character at a time
+    // isn't copied over once per character. The Pico's realloc() mostly
+    // extends in place, so this is closer to what it costs there.
+    if (len + length > capacity) {
+        reserve(std::max(len + length, capacity + capacity / 2));
+    }
+    memmove(buffer() + len, cstr, length);
+    len += length;
+    buffer()[len] = 0;
+    return true;
+}
+
+bool String::equals(const String& s) const {
+    return len == s.len && memcmp(buffer(), s.buffer(), len) == 0;
+}
+
+bool String::equals(const char* cstr) const {
+    return strcmp(buffer(), cstr ? cstr : "") == 0;
+}
+
+bool String::startsWith(const String& prefix) const {
+    return prefix.len <= len && memcmp(buffer(), prefix.buffer(), prefix.len) == 0;
+}
+
+bool String::endsWith(const String& suffix) const {
+    return suffix.len <= len && memcmp(buffer() + len - suffix.len, suffix.buffer(), suffix.len) == 0;
+}
+
+char String::charAt(unsigned int index) const {
+    return index < len ? buffer()[index] : 0;
+}
+
+int String::indexOf(char ch, unsigned int fromIndex) const {
+    if (fromIndex >= len) {
+        return -1;
+    }
+    const char* found = strchr(buffer() + fromIndex, ch);
+    return found ? (int)(found - buffer()) : -1;
+}
+
+int String::indexOf(const String& str, unsigned int fromIndex) const {
+    if (fromIndex >= len) {
+        return -1;
+    }
+    const char* found = strstr(buffer() + fromIndex, str.buffer());
+    return found ? (int)(found - buffer()) : -1;
+}
+
+String String::substring(unsigned int beginIndex, unsigned int endIndex) const {
+    if (beginIndex > endIndex) {
+        unsigned int temp = beginIndex;
+        beginIndex = endIndex;
+        endIndex = temp;
+    }
+    if (beginIndex >= len) {
+        return String();
+    }
+    if (endIndex > len) {
+        endIndex = len;
+    }
+    String out;
+    out.concat(buffer() + beginIndex, endIndex - beginIndex);
+    return out;
+}
+
+void String::toCharArray(char* buf, unsigned int bufsize, unsigned int index) const {
+    if (!bufsize || !buf) {
+        return;
+    }
+    if (index >= len) {
+        buf[0] = 0;
+        return;
+    }
+    unsigned int n = bufsize - 1;
+    if (n > len - index) {
+        n = len - index;
+    }
+    memcpy(buf, buffer() + index, n);
+    buf[n] = 0;
+}
+
+void String::replace(const String& find, const String& replace) {
+    if (find.len == 0) {
+        return;
+    }
+    String out;
+    const char* start = buffer();
+    const char* found;
+    while ((found = strstr(start, find.buffer())) != nullptr) {
+        out.concat(start, (unsigned int)(found - start));
+        out.concat(replace);
+        start = found + find.len;
+    }
+    if (start == buffer()) {
+        return;
+    }
+    out.concat(start);
+    *this = static_cast<String&&>(out);
+}
+
+void String::remove(unsigned int index, unsigned int count) {
+    if (index >= len) {
+        return;
+    }
+    if (count > len - index) {
+        count = len - index;
+    }
+    memmove(buffer() + index, buffer() + index + count, len - index - count + 1);
+    len -= count;
+}
+
+void String::trim() {
+    char* begin = buffer();
+    while (isspace((unsigned char)*begin)) {
+        begin++;
+    }
+    char* end = buffer() + len;
+    while (end > begin && isspace((unsigned char)end[-1])) {
+        end--;
+    }
+    len = (unsigned int)(end - begin);
+    memmove(buffer(), begin, len);
+    buffer()[len] = 0;
+}
+
+void String::toUpperCase() {
+    for (unsigned int i = 0; i < len; i++) {
+        buffer()[i] = (char)toupper((unsigned char)buffer()[i]);
+    }
+}
+
+void String::toLowerCase() {
+    for (unsigned int i = 0; i < len; i++) {
+        buffer()[i] = (char)tolower((unsigned char)buffer()[i]);
+    }
+}
+
+long String::toInt() const {
+    return atol(buffer());
+}
+
+float String::toFloat() const {
+    return (float)atof(buffer());
+}
+
+String operator+(const String& lhs, const String& rhs) {
+    String out(lhs);
+    out.concat(rhs);
+    return out;
+}
+
+String operator+(const String& lhs, const char* rhs) {
+    String out(lhs);
+    out.concat(rhs);
+    return out;
+}
+
+String operator+(const char* lhs, const String& rhs) {
+    String out(lhs);
+    out.concat(rhs);
+    return out;
+}
+
+String operator+(const String& lhs, char rhs) {
+    String out(lhs);
+    out.concat(rhs);
+    return out;
+}
+
+#pragma endregion String
+
+#pragma region Print and Stream
+
+size_t Print::write(const uint8_t* buffer, size_t size) {
+    size_t n = 0;
+    while (size--) {
+        n += write(*buffer++);
+    }
+    return n;
+}
+
+size_t Print::print(long value, int base) {
+    if (value < 0 && base == DEC) {
+        return print('-') + print((unsigned long)-value, base);
+    }
+    return print((unsigned long)value, base);
+}
+
+size_t Print::print(unsigned long value, int base) {
+    // Format on the stack like the device core, no String involved
+    char buf[8 * sizeof(unsigned long) + 1];
+    char* p = &buf[sizeof(buf) - 1];
+    *p = 0;
+    if (base < 2) {
+        base = 10;
+    }
+    do {
+        unsigned long digit = value % base;
+        *--p = (char)(digit < 10 ? '0' + digit : 'A' + digit - 10);
+        value /= base;
+    } while (value);
+    return write(p);
+}
+
+size_t Print::print(double value, int digits) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%.*f", digits, value);
+    return write(buf);
+}
+
+size_t Print::printf(const char* format, ...) {
+    char buf[256];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    if (n < 0) {
+        return 0;
+    }
+    return write((const uint8_t*)buf, strlen(buf));
+}
+
+String Stream::readString() {
+    String out;
+    int c;
+    while ((c = read()) >= 0) {
+        out.concat((char)c);
+    }
+    return out;
+}
+
+String Stream::readStringUntil(char terminator) {
+    String out;
+    int c;
+    while ((c = read()) >= 0 && c != terminator) {
+        out.concat((char)c);
+    }
+    return out;
+}
+
+long Stream::parseInt() {
+    int c;
+    while ((c = peek()) >= 0 && c != '-' && !isdigit(c)) {
+        read();
+    }
+    bool negative = false;
+    if (c == '-') {
+        negative = true;
+        read();
+    }
+    long value = 0;
+    while ((c = peek()) >= 0 && isdigit(c)) {
+        value = value * 10 + (c - '0');
+        read();
+    }
+    return negative ? -value : value;
+}
+
+#pragma endregion Print and Stream
+
+#pragma region HardwareSerial
+
+void HardwareSerial::advanceReady() {
+    if (hostFd >= 0) {
+        uint8_t buffer[64];
+        ssize_t count;
+        while ((count = ::read(hostFd, buffer, sizeof(buffer))) > 0) {
+            unsigned long arrival = micros();
+            for (ssize_t i = 0; i < count; i++) {
+                rx.push_back({arrival, buffer[i]});
+            }
+        }
+    }
+    unsigned long now = micros();
+    while (ready < rx.size() && (int32_t)(rx[ready].time - now) <= 0) {
+        ready++;
+        // This one arrived with the buffer already full
+        if (hostFifoSize && ready - head > hostFifoSize) {
+            overflowed = true;
+        }
+    }
+}
+
+bool HardwareSerial::overflow() {
+    bool result = overflowed;
+    overflowed = false;
+    return result;
+}
+
+int HardwareSerial::available() {
+    advanceReady();
+    return (int)(ready - head);
+}
+
+int HardwareSerial::read() {
+    advanceReady();
+    if (head == ready) {
+        return -1;
+    }
+    uint8_t value = rx[head++].value;
+    if (head == rx.size()) {
+        rx.clear();
+        head = 0;
+        ready = 0;
+    }
+    return value;
+}
+
+int HardwareSerial::peek() {
+    advanceReady();
+    if (head == ready) {
+        return -1;
+    }
+    return rx[head].value;
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+    if (hostEcho) {
+        fputc(c, stdout);
+    }
+    if (hostFd >= 0) {
+        return ::write(hostFd, &c, 1) == 1 ? 1 : 0;
+    }
+    if (hostLoopback && baudRate) {
+        unsigned long now = micros();
+        unsigned long start = (int32_t)(txBusyUntil - now) > 0 ? txBusyUntil : now;
+        txBusyUntil = (uint32_t)(start + 10 * 1000000UL / baudRate);
+        hostTxLog.push_back({txBusyUntil, c});
+        hostQueue(c, txBusyUntil);
+    }
+    return 1;
+}
+
+void HardwareSerial::hostQueue(uint8_t b, unsigned long arrivalMicros) {
+    // Usually appended in order, echoed TX bytes can land among queued bytes
+    size_t pos = rx.size();
+    while (pos > ready && (int32_t)(rx[pos - 1].time - arrivalMicros) > 0) {
+        pos--;
+    }
+    rx.insert(rx.begin() + pos, {(uint32_t)arrivalMicros, b});
+}
+
+bool HardwareSerial::hostNextArrival(unsigned long& arrivalMicros) const {
+    if (ready == rx.size()) {
+        return false;
+    }
+    arrivalMicros = rx[ready].time;
+    return true;
+}
+
+void HardwareSerial::hostAttach(int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    hostFd = fd;
+}
+
+void HardwareSerial::hostClear() {
+    rx.clear();
+    head = 0;
+    ready = 0;
+    txBusyUntil = 0;
+    hostTxLog.clear();
+}
+
+#pragma endregion HardwareSerial
@@ -0,0 +1,263 @@
+/*
+ * Minimal Arduino core for building the trailer controller on a Linux host.
+ * Only covers what the firmware actually uses. Time is virtual: micros() and
+ * millis() only move when the host driver (or delay()) advances them, which
+ * keeps the framer's break detection deterministic off-target.
+*/
+
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define LED_BUILTIN 64
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+#define HOST_PIN_COUNT 65
+
+unsigned long micros();
+unsigned long millis();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+
+void pinMode(int pin, int mode);
+void digitalWrite(int pin, int value);
+int digitalRead(int pin);
+// The duty (0-255) lands in hostPinState, so a PWM'd pin reads as on.
+// digitalWrite() leaves the pin alone from then until pinMode() is called.
+void analogWrite(int pin, int value);
+float analogReadTemp();
+
+// Host-only helpers for driving the virtual clock and inspecting outputs
+// The clock counts in 64 bits from hostSetMicros(), micros() and millis()
+// are its low 32 bits as on the Pico, so they wrap after 71.6 minutes and
+// 49.7 days
+void hostSetMicros(unsigned long us);
+void hostAdvanceMicros(unsigned long us);
+uint64_t hostMicros64();
+// Switch micros()/millis()/delay() to the real monotonic clock, for programs
+// talking to a real or pseudo terminal through HardwareSerial::hostAttach()
+void hostUseRealClock();
+// Or to the CPU time of the calling thread, read the same from any thread.
+// Time stands still while the host runs other threads, so a loop sharing the
+// CPU with test clients only sees the delays it causes itself.
+void hostUseThreadClock();
+extern int hostPinState[HOST_PIN_COUNT];
+extern float hostTemperatureC;
+
+class String {
+    public:
+        String(const char* cstr = "");
+        String(const String& str);
+        String(String&& str);
+        explicit String(char c);
+        explicit String(unsigned char value, unsigned char base = DEC);
+        explicit String(int value, unsigned char base = DEC);
+        explicit String(unsigned int value, unsigned char base = DEC);
+        explicit String(long value, unsigned char base = DEC);
+        explicit String(unsigned long value, unsigned char base = DEC);
+        explicit String(float value, unsigned char decimalPlaces = 2);
+        explicit String(double value, unsigned char decimalPlaces = 2);
+        ~String();
+
+        String& operator=(const String& rhs);
+        String& operator=(String&& rhs);
+        String& operator=(const char* cstr);
+
+        bool reserve(unsigned int size);
+        unsigned int length() const { return len; }
+        bool isEmpty() const { return len == 0; }
+        const char* c_str() const { return buffer(); }
+
+        bool concat(const char* cstr, unsigned int length);
+        bool concat(const char* cstr) { return concat(cstr, strlen(cstr)); }
+        bool concat(const String& str) { return concat(str.c_str(), str.len); }
+        bool concat(char c) { return concat(&c, 1); }
+
+        String& operator+=(const String& rhs) { concat(rhs); return *this; }
+        String& operator+=(const char* cstr) { concat(cstr); return *this; }
+        String& operator+=(char c) { concat(c); return *this; }
+
+        bool equals(const String& s) const;
+        bool equals(const char* cstr) const;
+        bool operator==(const String& rhs) const { return equals(rhs); }
+        bool operator==(const char* cstr) const { return equals(cstr); }
+        bool operator!=(const String& rhs) const { return !equals(rhs); }
+        bool operator!=(const char* cstr) const { return !equals(cstr); }
+        bool startsWith(const String& prefix) const;
+        bool endsWith(const String& suffix) const;
+
+        char charAt(unsigned int index) const;
+        char operator[](unsigned int index) const { return charAt(index); }
+        int indexOf(char ch, unsigned int fromIndex = 0) const;
+        int indexOf(const String& str, unsigned int fromIndex = 0) const;
+        String substring(unsigned int beginIndex) const { return substring(beginIndex, len); }
+        String substring(unsigned int beginIndex, unsigned int endIndex) const;
+        void toCharArray(char* buf, unsigned int bufsize, unsigned int index = 0) const;
+
+        void replace(const String& find, const String& replace);
+        void remove(unsigned int index, unsigned int count = (unsigned int)-1);
+        void trim();
+        void toUpperCase();
+        void toLowerCase();
+        long toInt() const;
+        float toFloat() const;
+
+    private:
+        // Mirrors the arduino-pico String small-string buffer so allocation
+        // counts on the host match the device for short strings.
+        static const unsigned int SSO_CAPACITY = 11;
+        char sso[SSO_CAPACITY + 1];
+        char* heap;
+        unsigned int capacity;
+        unsigned int len;
+
+        char* buffer() { return heap ? heap : sso; }
+        const char* buffer() const { return heap ? heap : sso; }
+        void copy(const char* cstr, unsigned int length);
+};
+
+String operator+(const String& lhs, const String& rhs);
+String operator+(const String& lhs, const char* rhs);
+String operator+(const char* lhs, const String& rhs);
+String operator+(const String& lhs, char rhs);
+
+class Print;
+
+class Printable {
+    public:
+        virtual ~Printable() {}
+        virtual size_t printTo(Print& p) const = 0;
+};
+
+class Print {
+    public:
+        virtual ~Print() {}
+        virtual size_t write(uint8_t c) = 0;
+        virtual size_t write(const uint8_t* buffer, size_t size);
+        size_t write(const char* str) { return write((const uint8_t*)str, strlen(str)); }
+        virtual void flush() {}
+
+        size_t print(const char* str) { return write(str); }
+        size_t print(const String& str) { return write((const uint8_t*)str.c_str(), str.length()); }
+        size_t print(char c) { return write((uint8_t)c); }
+        size_t print(unsigned char value, int base = DEC) { return print((unsigned long)value, base); }
+        size_t print(int value, int base = DEC) { return print((long)value, base); }
+        size_t print(unsigned int value, int base = DEC) { return print((unsigned long)value, base); }
+        size_t print(long value, int base = DEC);
+        size_t print(unsigned long value, int base = DEC);
+        size_t print(double value, int digits = 2);
+        size_t print(const Printable& value) { return value.printTo(*this); }
+
+        size_t println() { return write("\r\n"); }
+        template <typename T> size_t println(const T& value) { size_t n = print(value); return n + println(); }
+        template <typename T> size_t println(const T& value, int format) { size_t n = print(value, format); return n + println(); }
+
+        size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+};
+
+class Stream : public Print {
+    public:
+        virtual int available() = 0;
+        virtual int read() = 0;
+        virtual int peek() = 0;
+
+        String readString();
+        String readStringUntil(char terminator);
+        long parseInt();
+};
+
+// Hardware UART backed by a timestamped byte queue: bytes only become
+// available() once the virtual clock reaches their arrival time.
+class HardwareSerial : public Stream {
+    public:
+        explicit HardwareSerial(bool echoToStdout = false) : hostEcho(echoToStdout) {}
+        void begin(unsigned long baud) { baudRate = baud; }
+        void end() {}
+        operator bool() const { return true; }
+
+        int available() override;
+        int read() override;
+        int peek() override;
+        size_t write(uint8_t c) override;
+        using Print::write;
+
+        struct HostByte { unsigned long time; uint8_t value; };
+
+        void hostQueue(uint8_t b, unsigned long arrivalMicros);
+        void hostClear();
+        size_t hostPending() const { return rx.size() - head; }
+        // Arrival time of the next byte not yet available(), false if none
+        bool hostNextArrival(unsigned long& arrivalMicros) const;
+        unsigned long baudRate = 0;
+
+        // Loopback models a LIN transceiver: everything written is shifted
+        // out at the baud rate and echoed back into RX, and logged with the
+        // time its last bit left the UART
+        bool hostLoopback = false;
+        std::vector<HostByte> hostTxLog;
+
+        // Read from and write to a file descriptor (a pty or serial port)
+        // instead of the queue, bytes are timestamped as they are read
+        void hostAttach(int fd);
+        int hostFd = -1;
+
+        // Copy writes to stdout, on for Serial
+        bool hostEcho;
+
+        // The core's receive buffer overflowed since the last call: more than
+        // hostFifoSize bytes (0 for no limit) were waiting. Only flagged, no
+        // byte is dropped on the host.
+        bool overflow();
+        size_t hostFifoSize = 0;
+
+    private:
+        bool overflowed = false;
+        unsigned long txBusyUntil = 0;
+        // head is the read position, ready is the first byte whose arrival
+        // time has not been reached yet
+        std::vector<HostByte> rx;
+        size_t head = 0;
+        size_t ready = 0;
+        void advanceReady();
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial1;
+extern HardwareSerial Serial2;
+
+// The arduino-pico core's rp2040 object, a reboot only counts on the host
+// and the heap is whatever the host program says, hostLargestFreeBlock
+// standing in for what mallinfo() gives on the Pico
+class RP2040 {
+    public:
+        void reboot() { hostReboots++; }
+        int getFreeHeap() { return hostFreeHeap; }
+        int getTotalHeap() { return hostTotalHeap; }
+        unsigned int hostReboots = 0;
+        int hostFreeHeap = 200 * 1024;
+        int hostTotalHeap = 240 * 1024;
+        int hostLargestFreeBlock = 160 * 1024;
+};
+
+extern RP2040 rp2040;
+
+#endif // HOST_ARDUINO_H
@@ -0,0 +1,23 @@
+/*
+ * The arduino-pico mDNS responder for host builds. Nothing is announced,
+ * begin() succeeds so main.cpp takes the same path as on the Pico W.
+*/
+
+#ifndef HOST_LEAMDNS_H
+#define HOST_LEAMDNS_H
+
+#include <Arduino.h>
+
+class MDNSResponder {
+    public:
+        bool begin(const char* hostname) { (void)hostname; return true; }
+        void addService(const char* service, const char* protocol, uint16_t port) {
+            (void)service;
+            (void)protocol;
+            (void)port;
+        }
+        void update() {}
+        void end() {}
+};
+
+#endif // HOST_LEAMDNS_H
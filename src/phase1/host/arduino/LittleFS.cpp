@@ -0,0 +1,95 @@
+#include "LittleFS.h"
+
+FS LittleFS;
+
+int File::available() {
+    return data && pos < data->size() ? (int)(data->size() - pos) : 0;
+}
+
+int File::read() {
+    if (!available()) {
+        return -1;
+    }
+    return (*data)[pos++];
+}
+
+int File::peek() {
+    if (!available()) {
+        return -1;
+    }
+    return (*data)[pos];
+}
+
+size_t File::read(uint8_t* buffer, size_t length) {
+    size_t n = (size_t)available();
+    if (length < n) {
+        n = length;
+    }
+    if (n) {
+        memcpy(buffer, data->data() + pos, n);
+    }
+    pos += n;
+    return n;
+}
+
+size_t File::write(uint8_t c) {
+    return write(&c, 1);
+}
+
+size_t File::write(const uint8_t* buffer, size_t size) {
+    if (!data || !writable) {
+        return 0;
+    }
+    if (pos + size > data->size()) {
+        data->resize(pos + size);
+    }
+    memcpy(data->data() + pos, buffer, size);
+    pos += size;
+    LittleFS.hostBytesWritten += size;
+    hostAdvanceMicros(LittleFS.hostWriteMicros);
+    return size;
+}
+
+bool File::seek(size_t position) {
+    if (!data || position > data->size()) {
+        return false;
+    }
+    pos = position;
+    return true;
+}
+
+File FS::open(const char* path, const char* mode) {
+    auto it = files.find(path);
+    if (mode[0] == 'r') {
+        if (it == files.end()) {
+            return File();
+        }
+        return File(path, it->second, mode[1] == '+', 0);
+    }
+    // "w" truncates, "a" appends, both create
+    if (it == files.end() || mode[0] == 'w') {
+        files[path] = std::make_shared<HostFileData>();
+        it = files.find(path);
+    }
+    return File(path, it->second, true, mode[0] == 'a' ? it->second->size() : 0);
+}
+
+bool FS::rename(const char* from, const char* to) {
+    auto it = files.find(from);
+    if (it == files.end()) {
+        return false;
+    }
+    files[to] = it->second;
+    files.erase(from);
+    return true;
+}
+
+bool FS::info(FSInfo& info) const {
+    info.totalBytes = hostTotalBytes;
+    info.usedBytes = 0;
+    for (const auto& file : files) {
+        // littlefs stores every file in whole 4 KB blocks
+        info.usedBytes += (file.second->size() + 4095) / 4096 * 4096;
+    }
+    return true;
+}
@@ -0,0 +1,76 @@
+/*
+ * In-memory LittleFS for host builds. Files live in a map keyed by path and
+ * writes land immediately, so host programs can inspect or damage the stored
+ * bytes (e.g. truncate them to model a power cut mid-write).
+*/
+
+#ifndef HOST_LITTLEFS_H
+#define HOST_LITTLEFS_H
+
+#include <Arduino.h>
+#include <map>
+#include <memory>
+#include <string>
+
+typedef std::vector<uint8_t> HostFileData;
+
+class File : public Stream {
+    public:
+        File() {}
+        File(const std::string& path, std::shared_ptr<HostFileData> data, bool writable, size_t pos)
+            : path(path), data(data), writable(writable), pos(pos) {}
+        operator bool() const { return data != nullptr; }
+
+        int available() override;
+        int read() override;
+        int peek() override;
+        size_t read(uint8_t* buffer, size_t length);
+        size_t write(uint8_t c) override;
+        size_t write(const uint8_t* buffer, size_t size) override;
+        using Print::write;
+
+        size_t size() const { return data ? data->size() : 0; }
+        size_t position() const { return pos; }
+        bool seek(size_t position);
+        const char* name() const { return path.c_str(); }
+        bool isDirectory() const { return false; }
+        void close() { data = nullptr; }
+
+    private:
+        std::string path;
+        std::shared_ptr<HostFileData> data;
+        bool writable = false;
+        size_t pos = 0;
+};
+
+struct FSInfo {
+    size_t totalBytes;
+    size_t usedBytes;
+};
+
+class FS {
+    public:
+        bool begin() { return true; }
+        void end() {}
+        File open(const char* path, const char* mode);
+        File open(const String& path, const char* mode) { return open(path.c_str(), mode); }
+        bool exists(const char* path) const { return files.count(path) != 0; }
+        bool exists(const String& path) const { return exists(path.c_str()); }
+        bool remove(const char* path) { return files.erase(path) != 0; }
+        bool remove(const String& path) { return remove(path.c_str()); }
+        bool rename(const char* from, const char* to);
+        bool mkdir(const char*) { return true; }
+        bool info(FSInfo& info) const;
+
+        // Host-only: the stored files and the total bytes ever written, for
+        // flash wear comparisons
+        std::map<std::string, std::shared_ptr<HostFileData>> files;
+        size_t hostBytesWritten = 0;
+        size_t hostTotalBytes = 512 * 1024; // board_build.filesystem_size
+        // Virtual time each write takes, for modelling slow flash
+        unsigned long hostWriteMicros = 0;
+};
+
+extern FS LittleFS;
+
+#endif // HOST_LITTLEFS_H
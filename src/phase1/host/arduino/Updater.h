@@ -0,0 +1,36 @@
+/*
+ * The arduino-pico Updater for host builds. Images are kept in memory and
+ * end(true) checks them against the MD5 given to setMD5(), nothing is ever
+ * flashed.
+*/
+
+#ifndef HOST_UPDATER_H
+#define HOST_UPDATER_H
+
+#include <Arduino.h>
+
+class UpdaterClass {
+    public:
+        bool begin(size_t maxSize);
+        bool setMD5(const char* expected);
+        size_t write(uint8_t* data, size_t length);
+        bool end(bool evenIfRemaining = false);
+        String getErrorString() const { return error; }
+        String md5String() const { return md5; }
+
+        // Host-only: the last image written
+        std::vector<uint8_t> hostImage;
+
+    private:
+        size_t limit = 0;
+        String expectedMD5;
+        String md5;
+        String error;
+};
+
+extern UpdaterClass Update;
+
+// Host-only: the MD5 end(true) checks an image against, as hex
+String hostMD5(const std::vector<uint8_t>& image);
+
+#endif // HOST_UPDATER_H
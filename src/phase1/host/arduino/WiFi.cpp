@@ -0,0 +1,193 @@
+#include "WiFi.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/sockios.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+WiFiClass WiFi;
+bool hostSocketsEnabled = true;
+
+#pragma region WiFiClass
+
+String IPAddress::toString() const {
+    char text[16];
+    snprintf(text, sizeof(text), "%u.%u.%u.%u", octets[0], octets[1], octets[2], octets[3]);
+    return String(text);
+}
+
+int WiFiClass::beginNoBlock(const char* ssid, const char* password) {
+    (void)ssid;
+    (void)password;
+    wifiMode = WIFI_STA;
+    joining = true;
+    joinStartedAt = millis();
+    return WL_DISCONNECTED;
+}
+
+int WiFiClass::status() {
+    if (wifiMode != WIFI_STA || !joining) {
+        return WL_IDLE_STATUS;
+    }
+    if (hostJoinMs && millis() - joinStartedAt >= hostJoinMs) {
+        return WL_CONNECTED;
+    }
+    return WL_DISCONNECTED;
+}
+
+bool WiFiClass::softAP(const char* ssid, const char* password) {
+    (void)ssid;
+    (void)password;
+    wifiMode = WIFI_AP;
+    joining = false;
+    return true;
+}
+
+void WiFiClass::disconnect(bool wifiOff) {
+    joining = false;
+    if (wifiOff) {
+        wifiMode = WIFI_OFF;
+    }
+}
+
+#pragma endregion WiFiClass
+
+#pragma region WiFiClient
+
+WiFiClient::Socket::~Socket() {
+    if (fd >= 0) {
+        ::close(fd);
+    }
+}
+
+WiFiClient::WiFiClient(int fd) : socket(std::make_shared<Socket>(fd)) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+uint8_t WiFiClient::connected() {
+    if (!*this) {
+        return 0;
+    }
+    uint8_t value;
+    ssize_t result = recv(socket->fd, &value, 1, MSG_PEEK | MSG_DONTWAIT);
+    return result > 0 || (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+}
+
+int WiFiClient::available() {
+    int count = 0;
+    if (!*this || ioctl(socket->fd, FIONREAD, &count) != 0) {
+        return 0;
+    }
+    return count;
+}
+
+int WiFiClient::read() {
+    uint8_t value;
+    return read(&value, 1) == 1 ? value : -1;
+}
+
+int WiFiClient::read(uint8_t* buffer, size_t length) {
+    if (!*this) {
+        return -1;
+    }
+    ssize_t result = recv(socket->fd, buffer, length, MSG_DONTWAIT);
+    return result < 0 ? -1 : (int)result;
+}
+
+size_t WiFiClient::write(const uint8_t* buffer, size_t length) {
+    if (!*this) {
+        return 0;
+    }
+    ssize_t result = send(socket->fd, buffer, length, MSG_DONTWAIT | MSG_NOSIGNAL);
+    return result < 0 ? 0 : (size_t)result;
+}
+
+int WiFiClient::availableForWrite() {
+    if (!*this) {
+        return 0;
+    }
+    int size = 0;
+    int queued = 0;
+    socklen_t optionLength = sizeof(size);
+    if (getsockopt(socket->fd, SOL_SOCKET, SO_SNDBUF, &size, &optionLength) != 0 ||
+        ioctl(socket->fd, SIOCOUTQ, &queued) != 0) {
+        return 0;
+    }
+    // The kernel reports double the buffer it was asked for, half of it is
+    // bookkeeping
+    int space = size / 2 - queued;
+    return space > 0 ? space : 0;
+}
+
+void WiFiClient::setNoDelay(bool noDelay) {
+    if (*this) {
+        int value = noDelay;
+        setsockopt(socket->fd, IPPROTO_TCP, TCP_NODELAY, &value, sizeof(value));
+    }
+}
+
+void WiFiClient::stop() {
+    if (*this) {
+        ::close(socket->fd);
+        socket->fd = -1;
+    }
+}
+
+#pragma endregion WiFiClient
+
+#pragma region WiFiServer
+
+void WiFiServer::begin() {
+    if (!hostSocketsEnabled) {
+        return;
+    }
+    fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    if (bind(fd, (sockaddr*)&address, sizeof(address)) != 0 || listen(fd, 16) != 0) {
+        perror("WiFiServer");
+        ::close(fd);
+        fd = -1;
+        return;
+    }
+    socklen_t length = sizeof(address);
+    getsockname(fd, (sockaddr*)&address, &length);
+    port = ntohs(address.sin_port);
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+void WiFiServer::stop() {
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+WiFiClient WiFiServer::accept() {
+    if (fd < 0) {
+        return WiFiClient();
+    }
+    int client = ::accept(fd, nullptr, nullptr);
+    if (client < 0) {
+        return WiFiClient();
+    }
+    // The board's lwIP send buffer (TCP_SND_BUF, 8 segments) rather than
+    // the kernel's, which grows to megabytes and would hide a client that
+    // stopped reading
+    int sendBuffer = 8 * 1460;
+    setsockopt(client, SOL_SOCKET, SO_SNDBUF, &sendBuffer, sizeof(sendBuffer));
+    WiFiClient result(client);
+    result.setNoDelay(noDelay);
+    return result;
+}
+
+#pragma endregion WiFiServer
@@ -0,0 +1,109 @@
+/*
+ * WiFiServer and WiFiClient for host builds, over non-blocking TCP sockets,
+ * so the HTTP server can be loaded by real clients on localhost. Only the
+ * calls the firmware makes, with the same non-blocking behaviour as the
+ * arduino-pico classes: reads return what has arrived and writes take what
+ * availableForWrite() says fits.
+ *
+ * WiFi itself is a model for running main.cpp on the virtual clock: a
+ * station join completes hostJoinMs after beginNoBlock() and an access point
+ * is up straight away.
+*/
+
+#ifndef HOST_WIFI_H
+#define HOST_WIFI_H
+
+#include <Arduino.h>
+#include <memory>
+
+#define WL_IDLE_STATUS 0
+#define WL_CONNECTED 3
+#define WL_DISCONNECTED 6
+
+#define WIFI_OFF 0
+#define WIFI_STA 1
+#define WIFI_AP 2
+
+class IPAddress : public Printable {
+    public:
+        IPAddress(uint8_t a = 0, uint8_t b = 0, uint8_t c = 0, uint8_t d = 0) : octets{a, b, c, d} {}
+        String toString() const;
+        size_t printTo(Print& p) const override { return p.print(toString()); }
+
+    private:
+        uint8_t octets[4];
+};
+
+class WiFiClass {
+    public:
+        void mode(int mode) { wifiMode = mode; }
+        void setHostname(const char* name) { hostname = name; }
+        int beginNoBlock(const char* ssid, const char* password = nullptr);
+        int status();
+        bool softAP(const char* ssid, const char* password = nullptr);
+        IPAddress softAPIP() { return IPAddress(192, 168, 42, 1); }
+        IPAddress localIP() { return status() == WL_CONNECTED ? IPAddress(192, 168, 1, 50) : IPAddress(); }
+        void disconnect(bool wifiOff = false);
+        void end() { disconnect(true); }
+
+        // Host-only: how long a station join takes, 0 to never connect
+        unsigned long hostJoinMs = 2000;
+        String hostname;
+
+    private:
+        int wifiMode = WIFI_OFF;
+        bool joining = false;
+        unsigned long joinStartedAt = 0;
+};
+
+extern WiFiClass WiFi;
+
+// Host-only: false keeps WiFiServer::begin() from opening a socket, for runs
+// of main.cpp that have no clients
+extern bool hostSocketsEnabled;
+
+class WiFiClient {
+    public:
+        WiFiClient() {}
+        explicit WiFiClient(int fd);
+        explicit operator bool() const { return socket && socket->fd >= 0; }
+
+        uint8_t connected();
+        int available();
+        int read();
+        int read(uint8_t* buffer, size_t length);
+        size_t write(const uint8_t* buffer, size_t length);
+        int availableForWrite();
+        void setNoDelay(bool noDelay);
+        void stop();
+
+    private:
+        struct Socket {
+            explicit Socket(int fd) : fd(fd) {}
+            Socket(const Socket&) = delete;
+            ~Socket();
+            int fd;
+        };
+        std::shared_ptr<Socket> socket;
+};
+
+class WiFiServer {
+    public:
+        explicit WiFiServer(uint16_t port) : port(port) {}
+        ~WiFiServer() { stop(); }
+
+        void begin();
+        void stop();
+        void setNoDelay(bool noDelay) { this->noDelay = noDelay; }
+        WiFiClient accept();
+
+        // Host-only: the port actually bound, for a server started on port 0
+        uint16_t hostPort() const { return port; }
+
+    private:
+        uint16_t port;
+        int fd = -1;
+        bool noDelay = false;
+};
+
+#endif // HOST_WIFI_H
@@ -0,0 +1,275 @@
+/*
+ * Host micro-benchmarks for the LIN receive and logging hot paths.
+ *
+ * Usage: bench [--min-ms N] [lin_capture.txt|.lcz ...]
+ *
+ * Runs every benchmark over a synthetic stream built from the documented
+ * trailer bus schedule, then over each recorded capture given on the command
+ * line. Results are printed one JSON object per line so they can be appended
+ * to a file and compared between builds.
+*/
+
+#include <Arduino.h>
+#include <chrono>
+#include <new>
+#include <string>
+
+#include "lin.h"
+#include "lights.h"
+#include "capture.h"
+#include "lin_stream.h"
+
+static unsigned long allocCount = 0;
+
+void* operator new(size_t size) {
+    allocCount++;
+    void* p = malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](size_t size) {
+    allocCount++;
+    void* p = malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+
+// Swallows output so formatting cost is measured without any I/O
+class NullPrint : public Print {
+    public:
+        size_t write(uint8_t) override { count++; return 1; }
+        size_t write(const uint8_t*, size_t size) override { count += size; return size; }
+        size_t count = 0;
+};
+
+struct RawFrame {
+    byte data[11];
+    short length;
+};
+
+struct Result {
+    unsigned long frames;
+    double ns;
+    unsigned long allocs;
+};
+
+typedef std::chrono::steady_clock BenchClock;
+
+static unsigned long minRunMs = 200;
+
+static void report(const char* name, const std::string& stream, const Result& r) {
+    printf("{\"bench\":\"%s\",\"stream\":\"%s\",\"frames\":%lu,\"ns_per_frame\":%.1f,\"allocs_per_frame\":%.3f}\n",
+           name, stream.c_str(), r.frames,
+           r.frames ? r.ns / r.frames : 0.0,
+           r.frames ? (double)r.allocs / r.frames : 0.0);
+    fflush(stdout);
+}
+
+// Repeats a pass over the input until minRunMs has elapsed. The pass returns
+// how many frames it handled, prepare runs before each pass and is not timed.
+template <typename Prepare, typename Pass>
+static Result runTimed(Prepare prepare, Pass pass) {
+    Result r = {0, 0.0, 0};
+    auto deadline = BenchClock::now() + std::chrono::milliseconds(minRunMs);
+    do {
+        prepare();
+        unsigned long allocsBefore = allocCount;
+        auto start = BenchClock::now();
+        unsigned long frames = pass();
+        auto end = BenchClock::now();
+        r.allocs += allocCount - allocsBefore;
+        r.ns += std::chrono::duration<double, std::nano>(end - start).count();
+        r.frames += frames;
+    } while (BenchClock::now() < deadline);
+    return r;
+}
+
+template <typename Pass>
+static Result runTimed(Pass pass) {
+    return runTimed([]() {}, pass);
+}
+
+// The documented trailer bus schedule: the 0x0F light frame every 10 ms with
+// the other IDs taking turns in the slot between. Headers for the IDs the
+// trailer ECU is supposed to answer go out without a response.
+static LinStream buildSyntheticStream(unsigned long durationMs) {
+    static const byte lightStates[] = {0x00, 0x01, 0x02, 0x04, 0x0B, 0x0F, 0x2F, 0x24};
+    static const byte zeros[8] = {0};
+    static const byte charger1[8] = {0x02, 0x00, 0x1C, 0xF3, 0x01, 0x88, 0xFF, 0xFF};
+    static const byte charger2[8] = {0x02, 0x00, 0x00, 0x1C, 0xF3, 0x01, 0x88, 0xFE};
+    static const byte id2C[8] = {0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+
+    LinStream stream;
+    unsigned long slot = 0;
+    for (unsigned long t = 0; t < durationMs * 1000; t += 5000, slot++) {
+        if (slot % 2 == 0) {
+            byte state = lightStates[(slot / 200) % sizeof(lightStates)];
+            appendFrame(stream, t, linPid(0x0F), &state, 1);
+            continue;
+        }
+        switch ((slot / 2) % 7) {
+            case 0: appendFrame(stream, t, linPid(0x10), nullptr, 0, false); break;
+            case 1: appendFrame(stream, t, linPid(0x11), nullptr, 0, false); break;
+            case 2: appendFrame(stream, t, linPid(0x13), zeros, 7); break;
+            case 3: appendFrame(stream, t, linPid(0x18), nullptr, 0, false); break;
+            case 4: appendFrame(stream, t, linPid(0x29), charger1, 8); break;
+            case 5: appendFrame(stream, t, linPid(0x2A), charger2, 8); break;
+            case 6: appendFrame(stream, t, linPid(0x2C), id2C, 8); break;
+        }
+    }
+    return stream;
+}
+
+static void prepareSerial(const LinStream& stream) {
+    Serial1.hostClear();
+    queueStream(Serial1, stream);
+    hostSetMicros(0);
+}
+
+// Feeds the queued stream through the framer the way loop() polls it: one
+// call per byte arrival, draining every complete frame. Optionally keeps the
+// frames.
+static unsigned long framerPass(lin& linStack, const LinStream& stream, byte expectedPID,
+                                std::vector<RawFrame>* frames) {
+    unsigned long count = 0;
+    short bytesRead;
+    for (const auto& b : stream) {
+        hostSetMicros(b.arrival);
+        while ((bytesRead = linStack.updateFrame(expectedPID)) > 0) {
+            count++;
+            if (frames) {
+                RawFrame f;
+                f.length = bytesRead;
+                memcpy(f.data, linStack.dataBuffer, bytesRead);
+                frames->push_back(f);
+            }
+        }
+    }
+    // Let the final frame time out
+    hostAdvanceMicros(2000);
+    while ((bytesRead = linStack.updateFrame(expectedPID)) > 0) {
+        count++;
+        if (frames) {
+            RawFrame f;
+            f.length = bytesRead;
+            memcpy(f.data, linStack.dataBuffer, bytesRead);
+            frames->push_back(f);
+        }
+    }
+    return count;
+}
+
+static void runSuite(const std::string& name, const LinStream& stream) {
+    lin linStack;
+    linStack.setupSerial();
+
+    // Collect the frames once so the per-frame benchmarks see the same input
+    std::vector<RawFrame> frames;
+    frames.reserve(stream.size() / 3);
+    prepareSerial(stream);
+    framerPass(linStack, stream, 0, &frames);
+    if (frames.empty()) {
+        fprintf(stderr, "%s: no frames decoded\n", name.c_str());
+        return;
+    }
+
+    auto prepare = [&]() { prepareSerial(stream); };
+    report("updateFrame_all", name, runTimed(prepare, [&]() {
+        return framerPass(linStack, stream, 0, nullptr);
+    }));
+    // Filtered runs still pay for every byte, so report per bus frame
+    report("updateFrame_0xCF", name, runTimed(prepare, [&]() {
+        framerPass(linStack, stream, LIN_FRAME_PID, nullptr);
+        return (unsigned long)frames.size();
+    }));
+    // The controller's usual subscription: the light frame and the 0x10 header
+    linStack.setFilter(lincore::idBit(0x0F) | lincore::idBit(0x10));
+    report("updateFrame_ids", name, runTimed(prepare, [&]() {
+        framerPass(linStack, stream, 0, nullptr);
+        return (unsigned long)frames.size();
+    }));
+    linStack.setFilter(lincore::ALL_IDS);
+
+    volatile byte sink = 0;
+    report("calculateChecksum", name, runTimed([&]() {
+        for (auto& f : frames) {
+            sink = sink + linStack.calculateChecksum(f.data, f.length - 1);
+        }
+        return (unsigned long)frames.size();
+    }));
+
+    output_enabled = true;
+    report("processLightLINFrame", name, runTimed([&]() {
+        unsigned long count = 0;
+        for (const auto& f : frames) {
+            if (f.data[1] == LIN_FRAME_PID && f.length > 2) {
+                processLightLINFrame(f.data[2]);
+                count++;
+            }
+        }
+        return count;
+    }));
+
+    String latestFrameString;
+    report("latestFrameString", name, runTimed([&]() {
+        for (const auto& f : frames) {
+            byte calculated = linStack.calculateChecksum((byte*)f.data, f.length - 1);
+            latestFrameString = formatFrameString(f.data, f.length, calculated == f.data[f.length - 1], calculated);
+        }
+        return (unsigned long)frames.size();
+    }));
+
+    std::vector<LINFrame> records(frames.size());
+    for (size_t i = 0; i < frames.size(); i++) {
+        byte calculated = linStack.calculateChecksum(frames[i].data, frames[i].length - 1);
+        buildCaptureFrame(records[i], frames[i].data, frames[i].length, i * 5000, calculated);
+    }
+    NullPrint out;
+    report("completeLogging_format", name, runTimed([&]() {
+        for (const auto& frame : records) {
+            printCaptureFrame(out, frame);
+            out.print("\r\n");
+        }
+        return (unsigned long)records.size();
+    }));
+    static CaptureEncoder encoder;
+    report("captureLINFrame_pack", name, runTimed([&]() {
+        encoder.begin();
+        for (const auto& frame : records) {
+            if (!encoder.append(frame)) {
+                encoder.clear();
+                encoder.append(frame);
+            }
+        }
+        return (unsigned long)records.size();
+    }));
+}
+
+int main(int argc, char** argv) {
+    std::vector<const char*> captures;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--min-ms") == 0 && i + 1 < argc) {
+            minRunMs = strtoul(argv[++i], nullptr, 10);
+        } else {
+            captures.push_back(argv[i]);
+        }
+    }
+
+    runSuite("synthetic", buildSyntheticStream(10000));
+
+    for (const char* path : captures) {
+        LinStream stream;
+        if (!loadCaptureFile(path, stream)) {
+            fprintf(stderr, "Could not read capture %s\n", path);
+            return 1;
+        }
+        runSuite(path, stream);
+    }
+    return 0;
+}
@@ -0,0 +1,299 @@
+/*
+ * Packed capture checks and conversion.
+ *
+ * Usage: capture [--minutes N] [--seed N]
+ *        capture unpack lin_capture.lcz > lin_capture.txt
+ *        capture pack lin_capture.txt > lin_capture.lcz
+ *
+ * With no command, drives --minutes of the car's schedule (the 0x0F light
+ * frame and the unanswered 0x10 header alternating every 10 ms, read up to
+ * 300 us late by the loop, with light changes and the odd corrupted frame)
+ * through the firmware's capture path: CaptureEncoder blocks appended to a
+ * file on the in-memory LittleFS. Then unpacks the file and compares every
+ * frame against what went in, and against the lin_capture.txt lines the same
+ * frames used to be written as. A millisecond capture from before
+ * microsecond timestamps must still unpack. Prints one JSON line with the sizes, how long a capture fits in
+ * the 0.5 MB filesystem either way and the time per frame, and exits non-zero
+ * on any mismatch.
+*/
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "capture.h"
+
+#define FILESYSTEM_BYTES (512 * 1024)
+#define CAPTURE_FILE "/logs/lin_capture.lcz"
+
+// Counts what would have been written
+class CountPrint : public Print {
+  public:
+    size_t write(uint8_t) override {
+        count++;
+        return 1;
+    }
+    size_t count = 0;
+};
+
+class StringPrint : public Print {
+  public:
+    size_t write(uint8_t c) override {
+        text += (char)c;
+        return 1;
+    }
+    String text;
+};
+
+class StdoutPrint : public Print {
+  public:
+    size_t write(uint8_t c) override { return fputc(c, stdout) == EOF ? 0 : 1; }
+};
+
+static bool sameFrame(const LINFrame& a, const LINFrame& b) {
+    return a.timestampUs == b.timestampUs && a.bus == b.bus && a.sync == b.sync && a.pid == b.pid && a.dataLength == b.dataLength &&
+           memcmp(a.data, b.data, a.dataLength) == 0 && a.checksum == b.checksum &&
+           a.checksumValid == b.checksumValid && a.expectedChecksum == b.expectedChecksum;
+}
+
+static bool readFrames(const char* path, std::vector<LINFrame>& frames) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        return false;
+    }
+    LINFrame frame;
+    byte magic[CAPTURE_MAGIC_BYTES];
+    if (fread(magic, 1, sizeof(magic), file) == sizeof(magic) && isPackedCapture(magic, sizeof(magic))) {
+        CaptureDecoder decoder;
+        decoder.begin();
+        for (byte value : magic) {
+            decoder.push(value, frame);
+        }
+        int value;
+        while ((value = fgetc(file)) != EOF) {
+            if (decoder.push(value, frame)) {
+                frames.push_back(frame);
+            }
+        }
+    } else {
+        rewind(file);
+        char line[128];
+        while (fgets(line, sizeof(line), file)) {
+            if (parseCaptureLine(line, frame)) {
+                frames.push_back(frame);
+            }
+        }
+    }
+    fclose(file);
+    return true;
+}
+
+static int unpack(const char* path) {
+    std::vector<LINFrame> frames;
+    if (!readFrames(path, frames)) {
+        fprintf(stderr, "Could not read %s\n", path);
+        return 1;
+    }
+    StdoutPrint out;
+    out.println("# LIN Frame Capture Log");
+    out.println("# Format: timestamp_ms,sync,PID,data_bytes...,checksum,status,expected_checksum");
+    out.println("# Status: OK = valid checksum, ERR = checksum mismatch");
+    out.println("# expected_checksum only shown for ERR frames");
+    out.println("# Capture duration: " + String(frames.empty() ? 0 : frames.back().timestampUs / 1000) + " ms");
+    out.println("# Total frames: " + String((unsigned long)frames.size()));
+    out.println();
+    for (const auto& frame : frames) {
+        printCaptureFrame(out, frame);
+        out.print("\r\n");
+    }
+    return 0;
+}
+
+static int pack(const char* path) {
+    std::vector<LINFrame> frames;
+    if (!readFrames(path, frames)) {
+        fprintf(stderr, "Could not read %s\n", path);
+        return 1;
+    }
+    static CaptureEncoder encoder;
+    encoder.begin();
+    for (const auto& frame : frames) {
+        if (!encoder.append(frame)) {
+            fwrite(encoder.data(), 1, encoder.length(), stdout);
+            encoder.clear();
+            encoder.append(frame);
+        }
+    }
+    fwrite(encoder.data(), 1, encoder.length(), stdout);
+    fprintf(stderr, "%lu frames in %lu bytes\n", encoder.frames, encoder.bytes);
+    return 0;
+}
+
+// Enhanced checksum of the light frame
+static byte lightChecksum(byte lights) {
+    int sum = 0xCF + lights;
+    return (byte)~(sum > 0xFF ? sum - 0xFF : sum);
+}
+
+// The bus the way the firmware logs it: sync, PID, data and checksum as read
+static void buildFrames(double minutes, unsigned seed, std::vector<LINFrame>& frames) {
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<int> percent(0, 999);
+    unsigned long endMs = (unsigned long)(minutes * 60000);
+    byte lights = 0x04;
+    byte buffer[11];
+    for (unsigned long slot = 0; slot * 10 < endMs; slot++) {
+        // Signals blink at 1.5 Hz now and then, brakes come and go
+        unsigned long timeMs = slot * 10;
+        if (timeMs % 333 < 10) {
+            int choice = percent(rng);
+            lights = choice < 300 ? lights ^ 0x01 : choice < 400 ? lights ^ 0x0B : lights & ~0x03;
+        }
+        // The framer stamps the sync byte when loop() reads it
+        unsigned long stamp = timeMs * 1000 + percent(rng) * 3 / 10;
+        LINFrame frame;
+        buffer[0] = 0x55;
+        if (slot % 2 == 0) {
+            buffer[1] = 0xCF;
+            buffer[2] = lights;
+            buffer[3] = lightChecksum(lights);
+            // A bit error now and then
+            if (percent(rng) < 2) {
+                buffer[2] ^= 0x10;
+            }
+            buildCaptureFrame(frame, buffer, 4, stamp, lightChecksum(buffer[2]));
+        } else {
+            // Header only, the PID doubles as the "checksum"
+            buffer[1] = 0x50;
+            buildCaptureFrame(frame, buffer, 2, stamp, 0x50);
+        }
+        frames.push_back(frame);
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc == 3 && std::string(argv[1]) == "unpack") {
+        return unpack(argv[2]);
+    }
+    if (argc == 3 && std::string(argv[1]) == "pack") {
+        return pack(argv[2]);
+    }
+    double minutes = 10;
+    unsigned seed = 1;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string arg = argv[i];
+        if (arg == "--minutes") minutes = atof(argv[i + 1]);
+        else if (arg == "--seed") seed = atoi(argv[i + 1]);
+        else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    std::vector<LINFrame> frames;
+    buildFrames(minutes, seed, frames);
+
+    // The firmware's path: pack, append each full block to the file
+    LittleFS.begin();
+    LittleFS.mkdir("/logs");
+    File file = LittleFS.open(CAPTURE_FILE, "w");
+    static CaptureEncoder encoder;
+    encoder.begin();
+    auto start = std::chrono::steady_clock::now();
+    for (const auto& frame : frames) {
+        if (!encoder.append(frame)) {
+            file.write(encoder.data(), encoder.length());
+            encoder.clear();
+            encoder.append(frame);
+        }
+    }
+    file.write(encoder.data(), encoder.length());
+    double encodeNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    file.close();
+
+    CountPrint text;
+    for (const auto& frame : frames) {
+        printCaptureFrame(text, frame);
+        text.print("\r\n");
+    }
+
+    // Read it back the way a download would arrive
+    unsigned long failures = 0;
+    size_t index = 0;
+    file = LittleFS.open(CAPTURE_FILE, "r");
+    size_t packedBytes = file.size();
+    CaptureDecoder decoder;
+    decoder.begin();
+    LINFrame frame;
+    int value;
+    while ((value = file.read()) >= 0) {
+        if (decoder.push(value, frame)) {
+            if (index >= frames.size() || !sameFrame(frame, frames[index])) {
+                if (failures++ < 5) {
+                    fprintf(stderr, "FAIL: frame %u differs\n", (unsigned)index);
+                }
+            }
+            index++;
+        }
+    }
+    file.close();
+    if (!decoder.valid() || index != frames.size() || packedBytes != encoder.bytes) {
+        fprintf(stderr, "FAIL: %u of %u frames unpacked\n", (unsigned)index, (unsigned)frames.size());
+        failures++;
+    }
+
+    // An LCZ1 capture has millisecond deltas
+    {
+        static CaptureEncoder legacy;
+        legacy.begin();
+        std::vector<LINFrame> msFrames(frames.begin(), frames.begin() + 200); // one block
+        for (auto& f : msFrames) {
+            f.timestampUs /= 1000;
+            legacy.append(f);
+        }
+        memcpy((byte*)legacy.data(), CAPTURE_MAGIC_MS, CAPTURE_MAGIC_BYTES);
+        CaptureDecoder decoder;
+        decoder.begin();
+        size_t n = 0;
+        for (size_t i = 0; i < legacy.length(); i++) {
+            if (decoder.push(legacy.data()[i], frame)) {
+                LINFrame expected = msFrames[n++];
+                expected.timestampUs *= 1000;
+                if (!sameFrame(frame, expected)) {
+                    failures++;
+                    fprintf(stderr, "FAIL: LCZ1 frame %u differs\n", (unsigned)(n - 1));
+                    break;
+                }
+            }
+        }
+        if (!decoder.valid() || n != msFrames.size()) {
+            fprintf(stderr, "FAIL: LCZ1 capture\n");
+            failures++;
+        }
+    }
+
+    // The text lines parse back to the same frames too
+    for (size_t i = 0; i < frames.size() && i < 1000; i++) {
+        StringPrint line;
+        printCaptureFrame(line, frames[i]);
+        LINFrame parsed;
+        if (!parseCaptureLine(line.text.c_str(), parsed) || !sameFrame(parsed, frames[i])) {
+            if (failures++ < 5) {
+                fprintf(stderr, "FAIL: text line %u differs\n", (unsigned)i);
+            }
+        }
+    }
+
+    double seconds = minutes * 60;
+    printf("{\"minutes\":%.1f,\"frames\":%u,\"packed_bytes\":%u,\"text_bytes\":%u,\"ratio\":%.1f,"
+           "\"packed_bytes_per_frame\":%.2f,\"text_bytes_per_frame\":%.1f,\"fs_minutes_packed\":%.0f,"
+           "\"fs_minutes_text\":%.1f,\"encode_ns_per_frame\":%.0f,\"failures\":%lu}\n",
+           minutes, (unsigned)frames.size(), (unsigned)packedBytes, (unsigned)text.count,
+           (double)text.count / packedBytes, (double)packedBytes / frames.size(),
+           (double)text.count / frames.size(), FILESYSTEM_BYTES / (packedBytes / seconds) / 60,
+           FILESYSTEM_BYTES / (text.count / seconds) / 60, encodeNs / frames.size(), failures);
+    return failures == 0 ? 0 : 1;
+}
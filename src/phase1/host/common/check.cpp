@@ -0,0 +1,41 @@
+#include "check.h"
+
+#include <atomic>
+#include <stdarg.h>
+#include <stdio.h>
+
+static std::atomic<int> cases(0);
+static std::atomic<int> failures(0);
+
+void fail(const char* name, const char* what) {
+    fprintf(stderr, "FAIL: %s: %s\n", name, what);
+    failures++;
+}
+
+void checkCase(const char* format, ...) {
+    char line[1024];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    // One write, so lines from several threads don't interleave
+    printf("%s\n", line);
+    cases++;
+}
+
+int checkFailures() {
+    return failures;
+}
+
+int checkSummary(const char* format, ...) {
+    char extra[512] = "";
+    if (format) {
+        va_list args;
+        va_start(args, format);
+        extra[0] = ',';
+        vsnprintf(extra + 1, sizeof(extra) - 1, format, args);
+        va_end(args);
+    }
+    printf("{\"cases\":%d%s,\"failures\":%d}\n", (int)cases, extra, (int)failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,19 @@
+/*
+ * Bookkeeping shared by the host checks: a JSON line per case, failures on
+ * stderr, and a summary line with the cases that ran and the failures, which
+ * also gives the exit status. Safe to call from test client threads.
+*/
+
+#ifndef CHECK_H
+#define CHECK_H
+
+// Reports a failure in the named case
+void fail(const char* name, const char* what);
+// Prints one case's JSON object (printf style, no newline) and counts it
+void checkCase(const char* format, ...) __attribute__((format(printf, 1, 2)));
+int checkFailures();
+// Prints {"cases":N,...,"failures":N} with any extra fields from format
+// (printf style, without the braces) and returns the exit status
+int checkSummary(const char* format = nullptr, ...) __attribute__((format(printf, 1, 2)));
+
+#endif // CHECK_H
@@ -0,0 +1,103 @@
+#include "lin_stream.h"
+#include "capture.h"
+
+byte linPid(byte id) {
+    id &= 0x3F;
+    byte p0 = ((id >> 0) ^ (id >> 1) ^ (id >> 2) ^ (id >> 4)) & 0x01;
+    byte p1 = ~((id >> 1) ^ (id >> 3) ^ (id >> 4) ^ (id >> 5)) & 0x01;
+    return id | (p0 << 6) | (p1 << 7);
+}
+
+byte linChecksum(byte pid, const byte data[], short length) {
+    int checksum = pid;
+    for (short i = 0; i < length; i++) {
+        checksum += data[i];
+        if (checksum > 0xFF) {
+            checksum -= 0xFF;
+        }
+    }
+    return (byte)~checksum;
+}
+
+unsigned long appendFrame(LinStream& stream, unsigned long startMicros, byte pid,
+                          const byte data[], short length, bool withResponse) {
+    unsigned long t = startMicros + LIN_BYTE_US;
+    stream.push_back({t, 0x00});
+    // Rest of the break plus the delimiter bit before the sync field starts
+    t = startMicros + (LIN_BREAK_BITS + 1) * LIN_BIT_US + LIN_BYTE_US;
+    stream.push_back({t, 0x55});
+    t += LIN_BYTE_US;
+    stream.push_back({t, pid});
+    if (!withResponse) {
+        return t;
+    }
+    for (short i = 0; i < length; i++) {
+        t += LIN_BYTE_US;
+        stream.push_back({t, data[i]});
+    }
+    t += LIN_BYTE_US;
+    stream.push_back({t, linChecksum(pid, data, length)});
+    return t;
+}
+
+// One logged frame on the wire at its timestamp
+static void appendCaptureFrame(LinStream& stream, const LINFrame& frame, unsigned long startMicros) {
+    unsigned long start = startMicros + frame.timestampUs;
+    unsigned long t = start + LIN_BYTE_US;
+    stream.push_back({t, 0x00});
+    t = start + (LIN_BREAK_BITS + 1) * LIN_BIT_US + LIN_BYTE_US;
+    stream.push_back({t, frame.sync});
+    t += LIN_BYTE_US;
+    stream.push_back({t, frame.pid});
+    for (int i = 0; i < frame.dataLength; i++) {
+        t += LIN_BYTE_US;
+        stream.push_back({t, frame.data[i]});
+    }
+    // A frame without data is a header nobody answered, the logged
+    // "checksum" is just the PID repeated
+    if (frame.dataLength == 0) {
+        return;
+    }
+    // Keep the recorded checksum, bad ones included
+    t += LIN_BYTE_US;
+    stream.push_back({t, frame.checksum});
+}
+
+bool loadCaptureFile(const char* path, LinStream& stream, unsigned long startMicros, byte bus) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        return false;
+    }
+    LINFrame frame;
+    byte magic[CAPTURE_MAGIC_BYTES];
+    if (fread(magic, 1, sizeof(magic), file) == sizeof(magic) && isPackedCapture(magic, sizeof(magic))) {
+        CaptureDecoder decoder;
+        decoder.begin();
+        for (byte value : magic) {
+            decoder.push(value, frame);
+        }
+        int value;
+        while ((value = fgetc(file)) != EOF) {
+            if (decoder.push(value, frame) && frame.bus == bus) {
+                appendCaptureFrame(stream, frame, startMicros);
+            }
+        }
+        fclose(file);
+        return true;
+    }
+    rewind(file);
+    char line[128];
+    while (fgets(line, sizeof(line), file)) {
+        if (parseCaptureLine(line, frame) && frame.bus == bus) {
+            appendCaptureFrame(stream, frame, startMicros);
+        }
+    }
+    fclose(file);
+    return true;
+}
+
+void queueStream(HardwareSerial& serial, const LinStream& stream) {
+    for (const auto& b : stream) {
+        serial.hostQueue(b.value, b.arrival);
+    }
+}
@@ -0,0 +1,43 @@
+/*
+ * Timed LIN byte streams for the host tools: building frames the way they
+ * appear on the UART (break byte, sync, PID, data, checksum) and loading
+ * recorded captures back into the same form.
+*/
+
+#ifndef LIN_STREAM_H
+#define LIN_STREAM_H
+
+#include <Arduino.h>
+#include <vector>
+
+#define LIN_BAUD 19200
+#define LIN_BIT_US 52 // 1s / 19200, rounded down
+#define LIN_BYTE_US (10 * LIN_BIT_US) // start + 8 data + stop
+#define LIN_BREAK_BITS 13
+
+struct TimedByte {
+    unsigned long arrival; // micros() when the byte lands in the RX FIFO
+    byte value;
+};
+
+typedef std::vector<TimedByte> LinStream;
+
+// Protected identifier (ID plus the two parity bits)
+byte linPid(byte id);
+// LIN 2.x enhanced checksum over PID and data
+byte linChecksum(byte pid, const byte data[], short length);
+
+// Append a frame whose break starts at startMicros, returns the time the last
+// byte arrives. The break shows up as a 0x00 byte once 10 bit times of
+// dominant bus have been clocked in, the same way the RP2040 UART reports it.
+unsigned long appendFrame(LinStream& stream, unsigned long startMicros, byte pid,
+                          const byte data[], short length, bool withResponse = true);
+
+// Load a lin_capture.txt or .lcz file, placing each frame at its logged
+// timestamp. Only the frames from bus, when the capture has several.
+bool loadCaptureFile(const char* path, LinStream& stream, unsigned long startMicros = 0, byte bus = 0);
+
+// Queue an entire stream onto a host UART
+void queueStream(HardwareSerial& serial, const LinStream& stream);
+
+#endif // LIN_STREAM_H
@@ -0,0 +1,112 @@
+/*
+ * The controller's LIN path on a real or pseudo terminal, for end-to-end
+ * runs against the master emulator (host/master) or a USB LIN adapter.
+ *
+ * Usage: controller --port PATH [--seconds N] [--respond] [--poll-us US]
+ *
+ * Runs the framer, the light handling and optionally the 0x10 response the
+ * way loop() does, on the real clock, polling every --poll-us. Prints one JSON
+ * line per light change and a summary line at the end.
+*/
+
+#include <Arduino.h>
+#include <fcntl.h>
+#include <string>
+#include <termios.h>
+#include <unistd.h>
+
+#include "lights.h"
+#include "lin.h"
+
+#define STATUS_PID 0x50
+
+static const byte statusResponse[5] = {0x49, 0x00, 0x2C, 0x01, 0x00};
+
+int main(int argc, char** argv) {
+    const char* port = nullptr;
+    double seconds = 10;
+    bool respond = false;
+    unsigned long pollUs = 100;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--respond") { respond = true; continue; }
+        if (i + 1 >= argc) {
+            fprintf(stderr, "Missing value for %s\n", argv[i]);
+            return 1;
+        }
+        if (arg == "--port") port = argv[++i];
+        else if (arg == "--seconds") seconds = atof(argv[++i]);
+        else if (arg == "--poll-us") pollUs = strtoul(argv[++i], nullptr, 0);
+        else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (!port) {
+        fprintf(stderr, "Need --port\n");
+        return 1;
+    }
+
+    int fd = open(port, O_RDWR | O_NOCTTY);
+    if (fd < 0) {
+        perror(port);
+        return 1;
+    }
+    // Raw, or the terminal would echo the bus back and mangle 0x0D bytes
+    struct termios tio;
+    if (tcgetattr(fd, &tio) == 0) {
+        cfmakeraw(&tio);
+        cfsetspeed(&tio, B19200);
+        tcsetattr(fd, TCSANOW, &tio);
+    }
+
+    hostUseRealClock();
+    Serial1.hostAttach(fd);
+    lin linStack;
+    linStack.setupSerial();
+    if (respond) {
+        linStack.setResponse(STATUS_PID, statusResponse, sizeof(statusResponse));
+    }
+    output_enabled = true;
+
+    unsigned long frames = 0;
+    unsigned long badChecksums = 0;
+    unsigned long lightFrames = 0;
+    unsigned long changes = 0;
+    byte lastLights = 0xFF;
+    unsigned long start = millis();
+    while (millis() - start < seconds * 1000) {
+        short bytesRead;
+        while ((bytesRead = linStack.updateFrame()) > 0) {
+            frames++;
+            if (bytesRead < 3) {
+                continue;
+            }
+            byte calculated = linStack.calculateChecksum(linStack.dataBuffer, bytesRead - 1);
+            if (calculated != linStack.dataBuffer[bytesRead - 1]) {
+                badChecksums++;
+                continue;
+            }
+            if (linStack.dataBuffer[1] != LIN_FRAME_PID) {
+                continue;
+            }
+            lightFrames++;
+            processLightLINFrame(linStack.dataBuffer[2]);
+            byte lights = left_state | right_state << 1 | tail_state << 2;
+            if (lights != lastLights) {
+                lastLights = lights;
+                changes++;
+                printf("{\"ms\":%lu,\"left\":%d,\"right\":%d,\"tail\":%d}\n",
+                       millis() - start, left_state, right_state, tail_state);
+            }
+        }
+        delayMicroseconds(pollUs);
+    }
+
+    printf("{\"frames\":%lu,\"bad_checksums\":%lu,\"light_frames\":%lu,\"light_changes\":%lu,"
+           "\"responses\":%lu,\"responses_skipped\":%lu,\"response_latency_max_us\":%lu}\n",
+           frames, badChecksums, lightFrames, changes,
+           linStack.responsesSent, linStack.responsesSkipped, linStack.maxResponseLatency);
+    close(fd);
+    return 0;
+}
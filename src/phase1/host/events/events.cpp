@@ -0,0 +1,243 @@
+/*
+ * Checks the event bus between the LIN receive path and its subscribers.
+ *
+ * Usage: events [--events N]
+ *
+ * Publishes a mix of frames, light changes, checksum errors and output
+ * toggles the way serviceLin() and the handlers do and drains them: each
+ * subscriber must get exactly the types it asked for, in the order they were
+ * published, with the frame bytes as they were at publish time, and a type
+ * nobody subscribed to must not be queued. Then fills the ring without
+ * draining and checks the overflow is dropped and counted while what was
+ * queued comes out intact, and that the subscriber table refuses one past
+ * EVENTS_MAX_SUBSCRIBERS. Finally times publishing and draining --events
+ * events with the table full, counting heap allocations on the way.
+ * Prints a JSON line per case and a summary, and exits non-zero on any
+ * failure.
+*/
+
+#include <Arduino.h>
+#include <chrono>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "check.h"
+#include "events.h"
+
+static unsigned long allocations = 0;
+
+void* operator new(size_t size) {
+    allocations++;
+    void* p = malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+// What each subscriber saw, as type and value or first data byte
+struct Seen {
+    EventType type;
+    uint8_t value;
+    uint8_t length;
+    uint8_t data2;
+    unsigned long frameUs;
+};
+static std::vector<Seen> framesAndLights;
+static std::vector<Seen> lightsOnly;
+static std::vector<Seen> checksumErrors;
+static unsigned long counted = 0;
+
+static Seen seen(const Event& event) {
+    return {event.type, event.value, event.length, event.length > 2 ? event.data[2] : (uint8_t)0, event.frameUs};
+}
+
+static void onFramesAndLights(const Event& event) {
+    framesAndLights.push_back(seen(event));
+}
+
+static void onLights(const Event& event) {
+    lightsOnly.push_back(seen(event));
+}
+
+static void onChecksumError(const Event& event) {
+    checksumErrors.push_back(seen(event));
+}
+
+static void onCount(const Event&) {
+    counted++;
+}
+
+static void clearSeen() {
+    framesAndLights.clear();
+    lightsOnly.clear();
+    checksumErrors.clear();
+}
+
+static void ordering() {
+    const char* name = "ordering";
+    byte frame[lincore::MAX_FRAME_BYTES + 4] = {0x55, 0xCF, 0x00, 0x00};
+    std::vector<Seen> wantFrames, wantLights, wantErrors;
+    unsigned long published = eventsPublished;
+
+    for (unsigned long i = 0; i < 20; i++) {
+        // The light byte wanders, every fifth frame has a bad checksum
+        byte lights = (i / 4) & 0x07;
+        frame[2] = lights;
+        frame[3] = i % 5 == 4 ? 0xEE : 0x30 - lights;
+        bool bad = i % 5 == 4;
+        if (bad) {
+            eventsPublishFrame(EVENT_CHECKSUM_ERROR, 0, frame, 4, 0x30 - lights, i * 10000, i * 10);
+            wantErrors.push_back({EVENT_CHECKSUM_ERROR, 0, 4, lights, i * 10000});
+        }
+        eventsPublishFrame(EVENT_FRAME, 0, frame, 4, 0x30 - lights, i * 10000, i * 10);
+        wantFrames.push_back({EVENT_FRAME, 0, 4, lights, i * 10000});
+        if (!bad && i % 4 == 0) {
+            eventsPublish(EVENT_LIGHTS, lights, i * 10);
+            wantFrames.push_back({EVENT_LIGHTS, lights, 0, 0, 0});
+            wantLights.push_back({EVENT_LIGHTS, lights, 0, 0, 0});
+        }
+        // Nobody is subscribed to these yet
+        eventsPublish(EVENT_OUTPUT, i & 1, i * 10);
+        // Overwritten before the drain, the event has its own copy
+        frame[2] = 0xFF;
+    }
+    // Longer than a frame can be, clipped
+    eventsPublishFrame(EVENT_FRAME, 0, frame, sizeof(frame), 0, 0, 200);
+    wantFrames.push_back({EVENT_FRAME, 0, lincore::MAX_FRAME_BYTES, 0xFF, 0});
+
+    unsigned long queued = eventsPublished - published;
+    eventsDrain();
+
+    auto same = [](const std::vector<Seen>& a, const std::vector<Seen>& b) {
+        if (a.size() != b.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < a.size(); i++) {
+            if (a[i].type != b[i].type || a[i].value != b[i].value || a[i].length != b[i].length ||
+                a[i].data2 != b[i].data2 || a[i].frameUs != b[i].frameUs) {
+                return false;
+            }
+        }
+        return true;
+    };
+    if (!same(framesAndLights, wantFrames)) fail(name, "frame and light subscriber saw the wrong events");
+    if (!same(lightsOnly, wantLights)) fail(name, "light subscriber saw the wrong events");
+    if (!same(checksumErrors, wantErrors)) fail(name, "checksum subscriber saw the wrong events");
+    if (queued != wantFrames.size() + wantErrors.size()) fail(name, "unsubscribed type was queued");
+    if (eventsDropped) fail(name, "dropped events");
+
+    checkCase("{\"case\":\"%s\",\"queued\":%lu,\"frames_and_lights\":%u,\"lights\":%u,\"checksum_errors\":%u,"
+           "\"max_queued\":%lu}",
+           name, queued, (unsigned)framesAndLights.size(), (unsigned)lightsOnly.size(),
+           (unsigned)checksumErrors.size(), eventsMaxQueued);
+    clearSeen();
+}
+
+static void overflow() {
+    const char* name = "overflow";
+    const unsigned long extra = 10;
+    for (unsigned long i = 0; i < EVENTS_RING + extra; i++) {
+        eventsPublish(EVENT_LIGHTS, i, i);
+    }
+    if (eventsDropped != extra) fail(name, "overflow not counted");
+    if (eventsMaxQueued != EVENTS_RING) fail(name, "max queued wrong");
+    eventsDrain();
+    bool inOrder = lightsOnly.size() == EVENTS_RING;
+    for (size_t i = 0; inOrder && i < lightsOnly.size(); i++) {
+        inOrder = lightsOnly[i].value == i;
+    }
+    if (!inOrder) fail(name, "queued events lost or reordered");
+
+    // And it carries on once drained
+    clearSeen();
+    eventsPublish(EVENT_LIGHTS, 0x42, 0);
+    eventsDrain();
+    if (lightsOnly.size() != 1 || lightsOnly[0].value != 0x42) fail(name, "ring stuck after overflow");
+
+    checkCase("{\"case\":\"%s\",\"published\":%lu,\"dropped\":%lu,\"delivered\":%u}", name,
+           (unsigned long)(EVENTS_RING + extra), eventsDropped, (unsigned)lightsOnly.size());
+    clearSeen();
+}
+
+static void subscriberTable() {
+    const char* name = "subscribers";
+    int accepted = 3; // from main()
+    while (eventsSubscribe(EVENT_MASK(EVENT_FRAME) | EVENT_MASK(EVENT_OUTPUT), onCount)) {
+        accepted++;
+        if (accepted > EVENTS_MAX_SUBSCRIBERS) {
+            break;
+        }
+    }
+    if (accepted != EVENTS_MAX_SUBSCRIBERS) fail(name, "table size wrong");
+    checkCase("{\"case\":\"%s\",\"accepted\":%d}", name, accepted);
+}
+
+static void timing(unsigned long count) {
+    const char* name = "timing";
+    const byte frame[] = {0x55, 0xCF, 0x04, 0x2C};
+    unsigned long dropped = eventsDropped;
+    unsigned long before = allocations;
+    counted = 0;
+    double publishNs = 0;
+    double drainNs = 0;
+    unsigned long events = 0;
+    // Half a ring at a time, like a few passes of loop() worth of frames
+    for (; events < count; events += EVENTS_RING / 2) {
+        auto start = std::chrono::steady_clock::now();
+        for (unsigned long i = 0; i < EVENTS_RING / 2; i++) {
+            eventsPublishFrame(EVENT_FRAME, 0, frame, sizeof(frame), frame[3], i * 10000, i * 10);
+        }
+        auto published = std::chrono::steady_clock::now();
+        framesAndLights.clear();
+        eventsDrain();
+        publishNs += std::chrono::duration<double, std::nano>(published - start).count();
+        drainNs += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - published).count();
+    }
+    // onFramesAndLights()'s vector was reserved in main(), so nothing should
+    unsigned long busAllocations = allocations - before;
+    if (busAllocations) fail(name, "allocated");
+    if (eventsDropped != dropped) fail(name, "dropped events");
+    if (counted != events * (EVENTS_MAX_SUBSCRIBERS - 3)) fail(name, "not every subscriber was called");
+
+    checkCase("{\"case\":\"%s\",\"events\":%lu,\"subscribers\":%d,\"publish_ns\":%.1f,\"drain_ns\":%.1f,"
+           "\"allocations\":%lu}",
+           name, events, EVENTS_MAX_SUBSCRIBERS, publishNs / events, drainNs / events, busAllocations);
+}
+
+int main(int argc, char** argv) {
+    unsigned long count = 1000000;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--events" && i + 1 < argc) {
+            count = strtoul(argv[++i], nullptr, 0);
+        } else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    Serial.hostEcho = false;
+    framesAndLights.reserve(EVENTS_RING * 2);
+    lightsOnly.reserve(EVENTS_RING * 2);
+    checksumErrors.reserve(EVENTS_RING * 2);
+    eventsSubscribe(EVENT_MASK(EVENT_FRAME) | EVENT_MASK(EVENT_LIGHTS), onFramesAndLights);
+    eventsSubscribe(EVENT_MASK(EVENT_LIGHTS), onLights);
+    eventsSubscribe(EVENT_MASK(EVENT_CHECKSUM_ERROR), onChecksumError);
+
+    ordering();
+    overflow();
+    subscriberTable();
+    timing(count);
+
+    return checkSummary();
+}
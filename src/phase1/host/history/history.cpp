@@ -0,0 +1,185 @@
+/*
+ * Checks the light history against a simulated drive.
+ *
+ * Usage: history [--hours H] [--seed N] [--queries N] [--no-flash]
+ *
+ * Drives --hours of 0x0F light bytes at the car's 50 Hz, with stretches of
+ * cruising, turn signals, braking, stops at lights, hazards and reversing,
+ * into the history on the in-memory LittleFS, keeping every change in a plain
+ * list alongside. Then compares the trip totals and --queries random time
+ * ranges against that list, and reports the bytes stored per hour and the
+ * query time. Prints one JSON line and exits non-zero on any mismatch.
+*/
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <chrono>
+#include <random>
+#include <string>
+
+#include "history.h"
+
+struct Change {
+    unsigned long timeMs;
+    byte state;
+};
+
+static std::vector<Change> reference;
+
+// The same stats worked out from the plain list of changes
+static HistoryStats referenceStats(unsigned long fromMs, unsigned long toMs, byte& initial) {
+    HistoryStats stats = {};
+    byte state = 0;
+    size_t i = 0;
+    while (i < reference.size() && reference[i].timeMs <= fromMs) {
+        state = reference[i++].state;
+    }
+    initial = state;
+    unsigned long since = fromMs;
+    auto hold = [&](unsigned long until) {
+        unsigned long held = until - since;
+        if (state & LIGHT_BRAKES) stats.brakeMs += held;
+        if (held > stats.longestMs) {
+            stats.longestMs = held;
+            stats.longestStartMs = since;
+            stats.longestState = state;
+        }
+    };
+    for (; i < reference.size() && reference[i].timeMs <= toMs; i++) {
+        byte next = reference[i].state;
+        if (next == state) {
+            continue;
+        }
+        hold(reference[i].timeMs);
+        bool brakes = next & LIGHT_BRAKES;
+        if ((next & LIGHT_LEFT) && !(state & LIGHT_LEFT) && !brakes) stats.leftBlinks++;
+        if ((next & LIGHT_RIGHT) && !(state & LIGHT_RIGHT) && !brakes) stats.rightBlinks++;
+        if (brakes && !(state & LIGHT_BRAKES)) stats.brakeEvents++;
+        stats.changes++;
+        state = next;
+        since = reference[i].timeMs;
+    }
+    hold(toMs);
+    return stats;
+}
+
+static bool sameStats(const HistoryStats& a, const HistoryStats& b) {
+    return a.changes == b.changes && a.leftBlinks == b.leftBlinks && a.rightBlinks == b.rightBlinks &&
+           a.brakeEvents == b.brakeEvents && a.brakeMs == b.brakeMs && a.longestMs == b.longestMs &&
+           a.longestStartMs == b.longestStartMs && a.longestState == b.longestState;
+}
+
+int main(int argc, char** argv) {
+    double hours = 4;
+    unsigned long seed = 1;
+    int queries = 500;
+    bool useFlash = true;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--no-flash") { useFlash = false; continue; }
+        if (i + 1 >= argc) {
+            fprintf(stderr, "Missing value for %s\n", argv[i]);
+            return 1;
+        }
+        if (arg == "--hours") hours = atof(argv[++i]);
+        else if (arg == "--seed") seed = strtoul(argv[++i], nullptr, 0);
+        else if (arg == "--queries") queries = atoi(argv[++i]);
+        else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    historyBegin(useFlash);
+    std::mt19937 rng(seed);
+    auto uniform = [&](unsigned long low, unsigned long high) {
+        return std::uniform_int_distribution<unsigned long>(low, high)(rng);
+    };
+
+    // Segments of driving, each a base state for a while with the signals
+    // blinking on top at 1.5 Hz
+    const unsigned long frameMs = 20;
+    unsigned long end = (unsigned long)(hours * 3600000);
+    unsigned long frames = 0;
+    unsigned long t = 1500; // first light frame after boot
+    byte headlights = 0;
+    while (t < end) {
+        if (uniform(0, 9) == 0) {
+            headlights ^= LIGHT_HEADLIGHTS;
+        }
+        byte base = headlights;
+        byte blink = 0;
+        unsigned long length;
+        switch (uniform(0, 9)) {
+            case 0: case 1: blink = uniform(0, 1) ? LIGHT_LEFT : LIGHT_RIGHT; length = uniform(2000, 12000); break;
+            case 2: case 3: base |= LIGHT_BRAKES | LIGHT_LEFT | LIGHT_RIGHT; length = uniform(500, 8000); break;
+            case 4: base |= LIGHT_BRAKES | LIGHT_LEFT | LIGHT_RIGHT; length = uniform(20000, 90000); break;
+            case 5: if (uniform(0, 5) == 0) { blink = LIGHT_LEFT | LIGHT_RIGHT; } length = uniform(5000, 30000); break;
+            case 6: base |= LIGHT_REVERSE; length = uniform(3000, 15000); break;
+            default: length = uniform(10000, 300000); break;
+        }
+        for (unsigned long s = 0; s < length && t < end; s += frameMs, t += frameMs) {
+            byte state = base;
+            if (blink && (s / 333) % 2 == 0) {
+                state |= blink;
+            }
+            // Bits we don't know about flicker without counting as changes
+            byte frame = state | (uniform(0, 99) == 0 ? 0x80 : 0);
+            historyRecord(frame, t);
+            frames++;
+            if (reference.empty() || reference.back().state != state) {
+                reference.push_back({t, state});
+            }
+        }
+    }
+    unsigned long now = t;
+
+    int failures = 0;
+    HistoryStats totals = historyTotals(now);
+    byte initial;
+    HistoryStats expected = referenceStats(reference.front().timeMs, now, initial);
+    if (!sameStats(totals, expected)) {
+        fprintf(stderr, "FAIL: trip totals\n");
+        failures++;
+    }
+
+    double queryUs = 0;
+    double queryMaxUs = 0;
+    for (int q = 0; q < queries; q++) {
+        unsigned long from = uniform(historyOldestMs, now);
+        unsigned long to = from + uniform(0, q % 10 == 0 ? now - from : 600000);
+        std::vector<LightChange> changes;
+        HistoryStats stats;
+        auto start = std::chrono::steady_clock::now();
+        byte state = historyQuery(from, to, now, changes, (size_t)-1, stats);
+        double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        queryUs += us;
+        queryMaxUs = us > queryMaxUs ? us : queryMaxUs;
+
+        byte expectedState;
+        HistoryStats expectedStats = referenceStats(from, to < now ? to : now, expectedState);
+        bool ok = state == expectedState && sameStats(stats, expectedStats) && changes.size() == expectedStats.changes;
+        size_t r = 0;
+        while (r < reference.size() && reference[r].timeMs <= from) {
+            r++;
+        }
+        for (size_t i = 0; ok && i < changes.size(); i++, r++) {
+            ok = reference[r].timeMs == changes[i].timeMs && reference[r].state == changes[i].state;
+        }
+        if (!ok) {
+            fprintf(stderr, "FAIL: query %lu-%lu\n", from, to);
+            failures++;
+        }
+    }
+
+    size_t stored = historyRamBytes + historyFlashBytes;
+    printf("{\"hours\":%.1f,\"frames\":%lu,\"changes\":%lu,\"left_blinks\":%lu,\"right_blinks\":%lu,"
+           "\"brake_events\":%lu,\"longest_s\":%lu,\"ram_bytes\":%zu,\"flash_bytes\":%zu,"
+           "\"bytes_per_hour\":%.0f,\"dropped_blocks\":%lu,\"oldest_ms\":%lu,"
+           "\"queries\":%d,\"query_avg_us\":%.1f,\"query_max_us\":%.1f,\"failures\":%d}\n",
+           hours, frames, totals.changes, totals.leftBlinks, totals.rightBlinks,
+           totals.brakeEvents, totals.longestMs / 1000, historyRamBytes, historyFlashBytes,
+           stored / ((now - historyOldestMs) / 3600000.0), historyDroppedBlocks, historyOldestMs,
+           queries, queries ? queryUs / queries : 0.0, queryMaxUs, failures);
+    return failures == 0 ? 0 : 1;
+}
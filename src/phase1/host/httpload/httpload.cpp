@@ -0,0 +1,729 @@
+/*
+ * Load test for the HTTP server with the LIN loop running alongside it.
+ *
+ * Usage: httpload [--seconds N] [--pages N] [--downloads N] [--uploads N] [--viewers N]
+ *
+ * Serves a UI-like set of routes on a localhost port through the socket
+ * WiFiServer shim while the main thread runs loop() the way the firmware
+ * does: poll the server, then drain the LIN framer, with the car's schedule
+ * arriving on Serial1 as the clock reaches it. The clock is the loop
+ * thread's CPU time, so the host running the clients in the middle of a
+ * poll() stops the bus along with the loop, and only the time the server
+ * itself takes counts against the frames. Client threads hit it
+ * at the same time: --pages keep-alive clients loading the main page (every
+ * fourth one reconnecting each time), --downloads slow readers pulling a
+ * 256 KB capture log, --uploads clients posting 128 KB multipart files, plus
+ * form posts, an authenticated route and one client that sends half a
+ * request and stalls. Before they start, two requests sent in one write
+ * must both be answered. The loop also publishes a status feed 50 times a
+ * second, which --viewers clients watch as event streams and one client
+ * polls, while one more viewer reads slower than that and another opens a
+ * stream and never reads it. Every response is
+ * checked, and every event must be newer than the last. Prints one JSON line
+ * with the request rate, the longest poll() and loop() gap, the events sent
+ * and skipped, the longest a viewer went without one, and the light frames
+ * decoded on time against those sent, and exits non-zero if any request
+ * failed, the server held up a light frame, a viewer went a second without
+ * an event, the lagging viewer was never skipped ahead or the stalled
+ * client or viewer wasn't dropped.
+ *
+ * The server held a light frame up if it started a step while the frame was
+ * coming in and the frame was then lost or handled more than LIGHT_LATE_US
+ * after its checksum arrived, or was taking one when the frame started and
+ * it was late. The server
+ * doesn't step while the framer is receiving, but the framer ends a frame
+ * once two of its reads are a break time apart, so a byte read a little
+ * over a byte time late still splits it. Without IRQ time accounting the
+ * kernel charges its interrupt handling to whichever thread it interrupted,
+ * mostly the loop, and that happens now and then with the server idle.
+ * Those frames are reported as light_frames_host_missed.
+*/
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <arpa/inet.h>
+#include <atomic>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+
+#include "http_server.h"
+#include "lin.h"
+#include "lin_stream.h"
+
+#define LIGHT_PID 0xCF
+#define DOWNLOAD_BYTES (256 * 1024)
+#define UPLOAD_BYTES (128 * 1024)
+#define PUBLISH_US 20000
+#define STATUS_PAD 700 // about a real status document
+// A light frame ends once the bus has been quiet for the framer's break
+// threshold, and then has to wait out at most one poll() step
+#define LIGHT_LATE_US (lincore::BREAK_THRESHOLD + 1500)
+
+// A free port on localhost, taken before the server is constructed
+static uint16_t freePort() {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    bind(fd, (sockaddr*)&address, sizeof(address));
+    getsockname(fd, (sockaddr*)&address, &length);
+    close(fd);
+    return ntohs(address.sin_port);
+}
+
+static uint16_t port = freePort();
+static HttpServer httpServer(port);
+static std::atomic<bool> running(true);
+static std::atomic<unsigned long> pageRequests(0);
+static std::atomic<unsigned long> downloadRequests(0);
+static std::atomic<unsigned long> uploadRequests(0);
+static std::atomic<unsigned long> formRequests(0);
+static std::atomic<unsigned long> statusRequests(0);
+static std::atomic<unsigned long> viewerEvents(0);
+static std::atomic<unsigned long> viewerMaxGapMs(0);
+static std::atomic<bool> slowViewerDropped(false);
+static HttpFeed statusFeed;
+static std::atomic<unsigned long> failures(0);
+
+// Upload handler state, the server only runs on the main thread
+static size_t uploadBytes = 0;
+static uint32_t uploadSum = 0;
+
+static void fail(const char* what) {
+    if (running) {
+        fprintf(stderr, "FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+// A light frame on the wire and how it went
+struct LightFrame {
+    unsigned long syncUs; // when its sync byte arrives
+    unsigned long endUs; // and its checksum
+    bool decoded = false;
+    bool late = false;
+    bool delayed = false; // the server was taking a step when it started
+    bool interrupted = false; // or started one while it was coming in
+};
+
+#pragma region Client side
+
+// The clients stand in for phones, not for work on the board, so on a small
+// host they shouldn't take the CPU from the loop
+static void clientPriority() {
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), 10);
+}
+
+static int connectToServer(int receiveBuffer = 0) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (receiveBuffer) {
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &receiveBuffer, sizeof(receiveBuffer));
+    }
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    if (connect(fd, (sockaddr*)&address, sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+    int noDelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    timeval timeout = {10, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    return fd;
+}
+
+static bool sendAll(int fd, const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t result = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (result <= 0) {
+            return false;
+        }
+        sent += result;
+    }
+    return true;
+}
+
+// Reads one response, optionally slowly, returns the status code or -1.
+// closed is set if the server is closing the connection after it.
+static int readResponse(int fd, std::string& body, size_t slowChunk = 0, bool* closed = nullptr) {
+    std::string head;
+    char c;
+    while (head.size() < 4 || head.compare(head.size() - 4, 4, "\r\n\r\n") != 0) {
+        if (recv(fd, &c, 1, 0) != 1) {
+            return -1;
+        }
+        head += c;
+    }
+    size_t lengthAt = head.find("Content-Length: ");
+    if (lengthAt == std::string::npos) {
+        return -1;
+    }
+    size_t length = strtoul(head.c_str() + lengthAt + 16, nullptr, 10);
+    if (closed) {
+        *closed = head.find("Connection: close") != std::string::npos;
+    }
+    body.clear();
+    char buffer[4096];
+    while (body.size() < length) {
+        size_t want = std::min(length - body.size(), slowChunk ? slowChunk : sizeof(buffer));
+        ssize_t result = recv(fd, buffer, want, 0);
+        if (result <= 0) {
+            return -1;
+        }
+        body.append(buffer, result);
+        if (slowChunk) {
+            usleep(2000);
+        }
+    }
+    return atoi(head.c_str() + 9);
+}
+
+// Sends a request on fd, connecting first if it's closed, and reads the
+// response. Closes fd again if the server says it will.
+static int exchange(int& fd, const std::string& request, std::string& response, size_t slowChunk = 0,
+                    int receiveBuffer = 0) {
+    if (fd < 0 && (fd = connectToServer(receiveBuffer)) < 0) {
+        return -1;
+    }
+    bool closed = false;
+    int code = sendAll(fd, request) ? readResponse(fd, response, slowChunk, &closed) : -1;
+    if (closed || code < 0) {
+        close(fd);
+        fd = -1;
+    }
+    return code;
+}
+
+static void pageClient(bool reconnect) {
+    clientPriority();
+    int fd = -1;
+    std::string body;
+    std::string request = "GET / HTTP/1.1\r\nHost: trailercontroller.local\r\n";
+    request += reconnect ? "Connection: close\r\n\r\n" : "\r\n";
+    while (running) {
+        if (exchange(fd, request, body) != 200 || body.find("Lights: left") == std::string::npos ||
+            body.find('{') != std::string::npos) {
+            fail("main page");
+            break;
+        }
+        pageRequests++;
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+static void downloadClient() {
+    clientPriority();
+    int fd = -1;
+    std::string body;
+    while (running) {
+        if (exchange(fd, "GET /getLog HTTP/1.1\r\nHost: x\r\n\r\n", body, 1460, 8192) != 200 ||
+            body.size() != DOWNLOAD_BYTES) {
+            fail("download");
+            break;
+        }
+        for (size_t i = 0; i < body.size(); i++) {
+            if (body[i] != (char)('a' + i % 26)) {
+                fail("download contents");
+                break;
+            }
+        }
+        downloadRequests++;
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+static void uploadClient() {
+    clientPriority();
+    std::string file(UPLOAD_BYTES, '\0');
+    uint32_t sum = 0;
+    for (size_t i = 0; i < file.size(); i++) {
+        // Include bytes that look like the start of a boundary
+        file[i] = i % 1000 == 0 ? '\r' : i % 1000 == 1 ? '\n' : i % 1000 == 2 ? '-' : (char)(i * 7);
+        sum += (uint8_t)file[i];
+    }
+    std::string boundary = "----hostload7MA4YWxkTrZu0gW";
+    std::string body = "--" + boundary + "\r\nContent-Disposition: form-data; name=\"note\"\r\n\r\nhello\r\n";
+    body += "--" + boundary + "\r\nContent-Disposition: form-data; name=\"file\"; filename=\"test.bin\"\r\n";
+    body += "Content-Type: application/octet-stream\r\n\r\n" + file + "\r\n--" + boundary + "--\r\n";
+    std::string request = "POST /upload HTTP/1.1\r\nHost: x\r\nContent-Type: multipart/form-data; boundary=" +
+                          boundary + "\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+    std::string expected = std::to_string(file.size()) + "," + std::to_string(sum) + ",hello";
+
+    int fd = -1;
+    std::string response;
+    while (running) {
+        if (exchange(fd, request, response) != 200 || response != expected) {
+            fail("upload");
+            break;
+        }
+        uploadRequests++;
+        usleep(50000);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+static void formClient() {
+    clientPriority();
+    std::string form = "wifi_ssid=My+Network%21&wifi_timeout=30";
+    std::string post = "POST /form HTTP/1.1\r\nHost: x\r\nContent-Type: application/x-www-form-urlencoded\r\n"
+                       "Content-Length: " + std::to_string(form.size()) + "\r\n\r\n" + form;
+    int fd = -1;
+    std::string response;
+    while (running) {
+        if (exchange(fd, post, response) != 200 || response != "My Network!/30") {
+            fail("form post");
+            break;
+        }
+        // dGVzdDpzZWNyZXQ= is test:secret
+        if (exchange(fd, "GET /auth HTTP/1.1\r\nHost: x\r\n\r\n", response) != 401 ||
+            exchange(fd, "GET /auth HTTP/1.1\r\nHost: x\r\nAuthorization: Basic dGVzdDpzZWNyZXQ=\r\n\r\n",
+                     response) != 200) {
+            fail("authentication");
+            break;
+        }
+        formRequests++;
+        usleep(20000);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+// Sends half a request and goes quiet, the server should drop it
+static void stalledClient() {
+    clientPriority();
+    int fd = connectToServer();
+    sendAll(fd, "GET / HTTP/1.1\r\nHost: x\r\n");
+    while (running) {
+        usleep(10000);
+    }
+    close(fd);
+}
+
+// The sequence number from a published status body, 0 if it isn't one
+static unsigned long statusSeq(const std::string& body) {
+    if (body.compare(0, 7, "{\"seq\":") != 0 || body.size() < STATUS_PAD) {
+        return 0;
+    }
+    return strtoul(body.c_str() + 7, nullptr, 10);
+}
+
+static void statusClient() {
+    clientPriority();
+    int fd = -1;
+    std::string body;
+    unsigned long last = 0;
+    while (running) {
+        unsigned long seq;
+        if (exchange(fd, "GET /status HTTP/1.1\r\nHost: x\r\n\r\n", body) != 200 ||
+            (seq = statusSeq(body)) < last || seq == 0) {
+            fail("status poll");
+            break;
+        }
+        last = seq;
+        statusRequests++;
+        usleep(5000);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+// Reads events off a stream, each must be a newer status than the last. A
+// lagging viewer reads slower than the feed is published, so the server has
+// to skip it ahead.
+static void viewerClient(bool lagging) {
+    clientPriority();
+    int fd = connectToServer(lagging ? 4096 : 0);
+    if (fd < 0 || !sendAll(fd, "GET /events HTTP/1.1\r\nHost: x\r\nAccept: text/event-stream\r\n\r\n")) {
+        fail("viewer connect");
+        return;
+    }
+    std::string data;
+    char buffer[4096];
+    bool headers = false;
+    unsigned long last = 0;
+    unsigned long lastEventMs = 0;
+    while (running) {
+        ssize_t result = recv(fd, buffer, lagging ? 1024 : sizeof(buffer), 0);
+        if (result <= 0) {
+            fail("viewer stream ended");
+            break;
+        }
+        if (lagging) {
+            usleep(100000);
+        }
+        data.append(buffer, result);
+        if (!headers) {
+            size_t end = data.find("\r\n\r\n");
+            if (end == std::string::npos) {
+                continue;
+            }
+            if (data.compare(0, 12, "HTTP/1.1 200") != 0 || data.find("text/event-stream") > end) {
+                fail("viewer headers");
+                break;
+            }
+            data.erase(0, end + 4);
+            headers = true;
+            lastEventMs = millis();
+        }
+        size_t end;
+        while ((end = data.find("\n\n")) != std::string::npos) {
+            std::string event = data.substr(0, end);
+            data.erase(0, end + 2);
+            if (event[0] == ':') {
+                continue;
+            }
+            unsigned long seq = event.compare(0, 6, "data: ") == 0 ? statusSeq(event.substr(6)) : 0;
+            if (seq <= last) {
+                fail("viewer event out of order");
+                running = false;
+            }
+            last = seq;
+            if (lagging) {
+                continue;
+            }
+            viewerEvents++;
+            unsigned long now = millis();
+            if (now - lastEventMs > viewerMaxGapMs) {
+                viewerMaxGapMs = now - lastEventMs;
+            }
+            lastEventMs = now;
+        }
+    }
+    close(fd);
+}
+
+// Opens a stream through a small window and never reads it, the server
+// should drop it without holding up the other viewers
+static void slowViewerClient() {
+    clientPriority();
+    int fd = connectToServer(4096);
+    std::string head;
+    char c;
+    sendAll(fd, "GET /events HTTP/1.1\r\nHost: x\r\n\r\n");
+    while (head.size() < 4 || head.compare(head.size() - 4, 4, "\r\n\r\n") != 0) {
+        if (recv(fd, &c, 1, 0) != 1) {
+            break;
+        }
+        head += c;
+    }
+    if (head.compare(0, 12, "HTTP/1.1 200") != 0) {
+        fail("slow viewer headers");
+    }
+    while (running) {
+        usleep(10000);
+    }
+    // Dropped, everything it was sent is followed by the end of the stream
+    char buffer[4096];
+    timeval timeout = {0, 200000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    ssize_t result;
+    while ((result = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+    }
+    slowViewerDropped = result == 0;
+    close(fd);
+}
+
+// Two requests in one write, sent from the loop's thread before the load
+// starts so there's a connection free to keep. The second has to be answered
+// from what the server read past the end of the first.
+static bool checkPipelining() {
+    int fd = connectToServer();
+    std::string post = "POST /form HTTP/1.1\r\nHost: x\r\nContent-Type: application/x-www-form-urlencoded\r\n"
+                       "Content-Length: 14\r\n\r\nwifi_timeout=7";
+    if (fd < 0 || !sendAll(fd, post + "GET /auth HTTP/1.1\r\nHost: x\r\n\r\n")) {
+        return false;
+    }
+    std::string responses;
+    char buffer[4096];
+    unsigned long start = millis();
+    while (responses.find("HTTP/1.1 401") == std::string::npos && millis() - start < 2000) {
+        httpServer.poll();
+        ssize_t result = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (result > 0) {
+            responses.append(buffer, result);
+        }
+    }
+    close(fd);
+    size_t first = responses.find("HTTP/1.1 200");
+    size_t second = responses.find("HTTP/1.1 401");
+    return first != std::string::npos && second != std::string::npos && responses.find("\r\n\r\n/7") < second;
+}
+
+#pragma endregion Client side
+
+static void setupRoutes() {
+    File page = LittleFS.open("/web/index.html", "w");
+    page.print("<html><head><title>Trailer Controller</title></head><body>\n");
+    for (int i = 0; i < 60; i++) {
+        page.print("<p class=\"row\">Status row with some styling and text to pad the page out</p>\n");
+    }
+    page.print("<p>Lights: {active_lights}</p><p>Frame: {lin_frame}</p></body></html>\n");
+    page.close();
+    File log = LittleFS.open("/logs/lin_capture.txt", "w");
+    for (size_t i = 0; i < DOWNLOAD_BYTES; i++) {
+        log.write((uint8_t)('a' + i % 26));
+    }
+    log.close();
+
+    httpServer.on("/", []() {
+        File file = LittleFS.open("/web/index.html", "r");
+        String html = file.readString();
+        html.replace("{active_lights}", "left off, right off, tail on");
+        html.replace("{lin_frame}", "0x55 0xCF 0x04 0x2C");
+        httpServer.send(200, "text/html", html);
+    });
+    httpServer.on("/getLog", []() {
+        File file = LittleFS.open("/logs/lin_capture.txt", "r");
+        httpServer.streamFile(file, "text/plain");
+    });
+    httpServer.on("/form", HttpServer::POST, []() {
+        httpServer.send(200, "text/plain", httpServer.arg("wifi_ssid") + "/" + httpServer.arg("wifi_timeout"));
+    });
+    httpServer.on("/auth", []() {
+        if (!httpServer.authenticate("test", "secret")) {
+            return httpServer.requestAuthentication();
+        }
+        httpServer.send(200, "text/plain", "ok");
+    });
+    httpServer.on("/upload", HttpServer::POST, []() {
+        httpServer.send(200, "text/plain", String((unsigned long)uploadBytes) + "," + String((unsigned long)uploadSum) +
+                                           "," + httpServer.arg("note"));
+    }, []() {
+        HttpUpload& upload = httpServer.upload();
+        if (upload.status == UPLOAD_FILE_START) {
+            uploadBytes = 0;
+            uploadSum = 0;
+        } else if (upload.status == UPLOAD_FILE_WRITE) {
+            uploadBytes += upload.currentSize;
+            for (size_t i = 0; i < upload.currentSize; i++) {
+                uploadSum += upload.buf[i];
+            }
+        }
+    });
+    httpServer.on("/status", []() {
+        httpServer.send(200, "application/json", statusFeed.body());
+    });
+    httpServer.on("/events", []() {
+        httpServer.stream(statusFeed);
+    });
+    httpServer.onNotFound([]() {
+        httpServer.send(404, "text/plain", "File not found");
+    });
+}
+
+int main(int argc, char** argv) {
+    double seconds = 8;
+    int pages = 6;
+    int downloads = 2;
+    int uploads = 1;
+    int viewers = 2;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string arg = argv[i];
+        if (arg == "--seconds") seconds = atof(argv[i + 1]);
+        else if (arg == "--pages") pages = atoi(argv[i + 1]);
+        else if (arg == "--downloads") downloads = atoi(argv[i + 1]);
+        else if (arg == "--uploads") uploads = atoi(argv[i + 1]);
+        else if (arg == "--viewers") viewers = atoi(argv[i + 1]);
+        else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    hostUseThreadClock();
+    setupRoutes();
+    httpServer.begin();
+    if (!checkPipelining()) {
+        fail("pipelined requests");
+    }
+
+    // The car's schedule for the whole run, released as the clock reaches it
+    unsigned long runUs = (unsigned long)(seconds * 1000000);
+    LinStream wire;
+    byte lights = 0x04;
+    std::vector<LightFrame> lightFrames;
+    for (unsigned long start = 10000; start + 20000 < runUs; start += 10000) {
+        if ((start / 10000) % 2 == 0) {
+            size_t breakAt = wire.size();
+            unsigned long endUs = appendFrame(wire, start, LIGHT_PID, &lights, 1);
+            lightFrames.push_back({wire[breakAt + 1].arrival, endUs});
+        } else {
+            appendFrame(wire, start, 0x50, nullptr, 0, false);
+        }
+    }
+    lin linStack;
+    linStack.setupSerial();
+    // As the firmware does, between frames only
+    bool stepped = false;
+    httpServer.yieldWhen([&]() {
+        unsigned long syncUs;
+        bool yield = Serial1.available() > 0 || linStack.receiving(syncUs);
+        stepped |= !yield;
+        return yield;
+    });
+    Serial1.hostClear();
+    hostUseThreadClock();
+    queueStream(Serial1, wire);
+
+    // What the loop publishes, padded out to a real status document's size
+    unsigned long published = 0;
+    unsigned long nextPublishUs = 0;
+    auto publish = [&]() {
+        published++;
+        statusFeed.publish("{\"seq\":" + String(published) + ",\"pad\":\"" + String(std::string(STATUS_PAD, 'x').c_str()) +
+                           "\"}");
+        nextPublishUs += PUBLISH_US;
+    };
+    publish();
+
+    std::vector<std::thread> clients;
+    for (int i = 0; i < pages; i++) {
+        clients.emplace_back(pageClient, i % 4 == 3);
+    }
+    for (int i = 0; i < downloads; i++) {
+        clients.emplace_back(downloadClient);
+    }
+    for (int i = 0; i < uploads; i++) {
+        clients.emplace_back(uploadClient);
+    }
+    clients.emplace_back(formClient);
+    clients.emplace_back(stalledClient);
+    clients.emplace_back(statusClient);
+    for (int i = 0; i < viewers; i++) {
+        clients.emplace_back(viewerClient, false);
+    }
+    clients.emplace_back(viewerClient, true);
+    clients.emplace_back(slowViewerClient);
+
+    // loop(): the server, then the LIN frames
+    size_t firstLight = 0; // the oldest that could still be coming in
+    size_t lightIndex = 0;
+    unsigned long maxLateUs = 0;
+    unsigned long maxLoopGapUs = 0;
+    unsigned long loops = 0;
+    unsigned long last = micros();
+    while ((long)(micros() - runUs) < 0) {
+        unsigned long syncUs;
+        bool receiving = linStack.receiving(syncUs);
+        unsigned long pollStart = micros();
+        stepped = false;
+        httpServer.poll();
+        unsigned long polled = micros();
+        while (firstLight < lightFrames.size() &&
+               (long)(lightFrames[firstLight].endUs + LIGHT_LATE_US - pollStart) < 0) {
+            firstLight++;
+        }
+        // A step under way when a frame starts only delays reading it, one
+        // between two of its bytes can split it. Steps after the framer ended
+        // a frame early are down to whatever split it.
+        for (size_t i = firstLight; stepped && i < lightFrames.size() && (long)(lightFrames[i].syncUs - polled) <= 0;
+             i++) {
+            if (receiving) {
+                lightFrames[i].interrupted = true;
+            } else if ((long)(lightFrames[i].syncUs - pollStart) > 0) {
+                lightFrames[i].delayed = true;
+            }
+        }
+        short length;
+        while ((length = linStack.updateFrame(LIGHT_PID)) > 0) {
+            if (length == 4 && linStack.dataBuffer[2] == lights &&
+                linStack.calculateChecksum(linStack.dataBuffer, 3) == linStack.dataBuffer[3]) {
+                // The latest light frame to have arrived
+                unsigned long handled = micros();
+                while (lightIndex + 1 < lightFrames.size() &&
+                       (long)(handled - lightFrames[lightIndex + 1].endUs) >= 0) {
+                    lightIndex++;
+                }
+                LightFrame& frame = lightFrames[lightIndex];
+                unsigned long lateUs = handled - frame.endUs;
+                if (lateUs > maxLateUs) {
+                    maxLateUs = lateUs;
+                }
+                frame.decoded = true;
+                frame.late = lateUs > LIGHT_LATE_US;
+            }
+        }
+        unsigned long now = micros();
+        if ((long)(now - nextPublishUs) >= 0) {
+            publish();
+        }
+        if (now - last > maxLoopGapUs) {
+            maxLoopGapUs = now - last;
+        }
+        last = now;
+        loops++;
+    }
+    running = false;
+    // Keep serving so the clients finish their last requests and exit
+    unsigned long drainUntil = micros() + 500000;
+    while ((long)(micros() - drainUntil) < 0) {
+        httpServer.poll();
+    }
+    httpServer.stop();
+    for (auto& client : clients) {
+        client.join();
+    }
+
+    unsigned long framesOk = 0;
+    unsigned long serverMissed = 0;
+    unsigned long hostMissed = 0;
+    for (const auto& frame : lightFrames) {
+        if (frame.decoded && !frame.late) {
+            framesOk++;
+        } else if (frame.interrupted || (frame.decoded && frame.delayed)) {
+            serverMissed++;
+        } else {
+            hostMissed++;
+        }
+    }
+    if (serverMissed > 0) {
+        fprintf(stderr, "FAIL: %lu light frames lost or more than %lu us late with the server stepping\n", serverMissed,
+                (unsigned long)LIGHT_LATE_US);
+        failures++;
+    }
+    if (viewers > 0 && viewerMaxGapMs > 1000) {
+        fprintf(stderr, "FAIL: a viewer went %lu ms without an event\n", (unsigned long)viewerMaxGapMs);
+        failures++;
+    }
+    if (httpServer.eventsSkipped == 0) {
+        fprintf(stderr, "FAIL: lagging viewer wasn't skipped ahead\n");
+        failures++;
+    }
+    if (!slowViewerDropped) {
+        fprintf(stderr, "FAIL: slow viewer wasn't dropped\n");
+        failures++;
+    }
+
+    unsigned long requests = pageRequests + downloadRequests + uploadRequests + formRequests * 3 + statusRequests;
+    printf("{\"seconds\":%.1f,\"requests\":%lu,\"requests_per_s\":%.0f,\"pages\":%lu,\"downloads\":%lu,"
+           "\"uploads\":%lu,\"forms\":%lu,\"status_polls\":%lu,\"failures\":%lu,"
+           "\"timed_out\":%lu,\"connections\":%lu,\"poll_max_us\":%lu,\"loop_max_gap_us\":%lu,"
+           "\"loops\":%lu,\"published\":%lu,\"events_sent\":%lu,\"events_skipped\":%lu,"
+           "\"viewer_events\":%lu,\"viewer_max_gap_ms\":%lu,\"light_frames\":%lu,\"light_frames_ok\":%lu,"
+           "\"light_max_late_us\":%lu,\"light_frames_host_missed\":%lu}\n",
+           seconds, requests, requests / seconds, (unsigned long)pageRequests, (unsigned long)downloadRequests,
+           (unsigned long)uploadRequests, (unsigned long)formRequests,
+           (unsigned long)statusRequests, (unsigned long)failures, httpServer.connectionsTimedOut,
+           httpServer.connectionsAccepted, httpServer.maxPollUs, maxLoopGapUs, loops, published,
+           httpServer.eventsSent, httpServer.eventsSkipped, (unsigned long)viewerEvents,
+           (unsigned long)viewerMaxGapMs, (unsigned long)lightFrames.size(), framesOk, maxLateUs, hostMissed);
+    return failures == 0 && httpServer.connectionsTimedOut > 0 ? 0 : 1;
+}
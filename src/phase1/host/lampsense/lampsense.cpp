@@ -0,0 +1,147 @@
+/*
+ * Host signal model for the lamp current classification.
+ *
+ * Usage: lampsense [--seed N]
+ *
+ * Models the current sense amplifiers and ADC for a handful of trailer
+ * setups (LED and incandescent lamps, missing bulbs, shorts), with noise,
+ * offset, amplifier saturation and incandescent inrush, while the outputs
+ * follow a drive pattern (left signal blinking, right on hazards in some
+ * scenarios, tail lights steady). Samples are produced in the same
+ * round-robin order as the ADC and handed to lampSenseProcess() in 10 ms
+ * blocks. Each scenario prints one JSON line with the expected and final lamp
+ * states and how long classification took, exit code is non-zero on any
+ * mismatch.
+*/
+
+#include <Arduino.h>
+#include <random>
+
+#include "lights.h"
+#include "lampsense.h"
+
+enum LoadType { LOAD_OPEN, LOAD_LED, LOAD_BULB, LOAD_SHORT };
+
+struct Load {
+    LoadType type;
+    float ma; // steady state current
+};
+
+struct Scenario {
+    const char* name;
+    Load loads[LAMP_COUNT];
+    bool hazards; // right blinks with the left, otherwise it stays off
+    float noiseCounts;
+    LampState expected[LAMP_COUNT];
+};
+
+static const Scenario scenarios[] = {
+    {"led_trailer", {{LOAD_LED, 150}, {LOAD_LED, 150}, {LOAD_LED, 300}}, true, 8,
+     {LAMP_OK, LAMP_OK, LAMP_OK}},
+    {"bulb_trailer", {{LOAD_BULB, 2100}, {LOAD_BULB, 2100}, {LOAD_BULB, 1000}}, true, 8,
+     {LAMP_OK, LAMP_OK, LAMP_OK}},
+    {"no_trailer", {{LOAD_OPEN, 0}, {LOAD_OPEN, 0}, {LOAD_OPEN, 0}}, true, 8,
+     {LAMP_OPEN, LAMP_OPEN, LAMP_OPEN}},
+    {"left_bulb_out", {{LOAD_OPEN, 0}, {LOAD_LED, 150}, {LOAD_LED, 300}}, true, 8,
+     {LAMP_OPEN, LAMP_OK, LAMP_OK}},
+    {"tail_short", {{LOAD_LED, 150}, {LOAD_LED, 150}, {LOAD_SHORT, 0}}, true, 8,
+     {LAMP_OK, LAMP_OK, LAMP_SHORT}},
+    {"right_never_on", {{LOAD_LED, 150}, {LOAD_LED, 150}, {LOAD_LED, 300}}, false, 8,
+     {LAMP_OK, LAMP_UNKNOWN, LAMP_OK}},
+    {"noisy_small_led", {{LOAD_LED, 45}, {LOAD_LED, 45}, {LOAD_LED, 45}}, true, 25,
+     {LAMP_OK, LAMP_OK, LAMP_OK}},
+};
+
+static const float offsetCounts = 6.0f; // amplifier output offset
+static const float tempCounts = 876.0f; // about 27 C
+
+static float loadCurrent(const Load& load, bool on, unsigned long msOn) {
+    if (!on) {
+        return 0.0f;
+    }
+    switch (load.type) {
+        case LOAD_LED: return load.ma;
+        // Cold filament draws about 8x until it heats up
+        case LOAD_BULB: return load.ma * (1.0f + 7.0f * expf(-(float)msOn / 15.0f));
+        case LOAD_SHORT: return 20000.0f;
+        default: return 0.0f;
+    }
+}
+
+static uint16_t adcCounts(float ma, float noise, std::mt19937& rng) {
+    std::normal_distribution<float> jitter(0.0f, noise);
+    float counts = ma / LAMP_SENSE_MA_PER_COUNT + offsetCounts + jitter(rng);
+    if (counts < 0) counts = 0;
+    if (counts > 4095) counts = 4095;
+    return (uint16_t)counts;
+}
+
+int main(int argc, char** argv) {
+    unsigned long seed = 1;
+    if (argc == 3 && strcmp(argv[1], "--seed") == 0) {
+        seed = strtoul(argv[2], nullptr, 0);
+    }
+
+    int failures = 0;
+    for (const Scenario& scenario : scenarios) {
+        std::mt19937 rng(seed);
+        lampSenseBegin();
+        output_enabled = true;
+        unsigned long onSince[LAMP_COUNT] = {0};
+        bool wasOn[LAMP_COUNT] = {false};
+        unsigned long settledAt[LAMP_COUNT] = {0};
+        uint16_t block[10 * LAMP_SENSE_CHANNELS];
+        size_t count = 0;
+
+        // 5 s of driving at 1 kHz per channel
+        for (unsigned long ms = 0; ms < 5000; ms++) {
+            // Turn signals at 1.5 Hz, tail lights on after half a second
+            bool blink = (ms % 667) < 333;
+            left_state = blink;
+            right_state = scenario.hazards && blink;
+            tail_state = ms >= 500;
+            bool on[LAMP_COUNT] = {left_state, right_state, tail_state};
+
+            for (int i = 0; i < LAMP_COUNT; i++) {
+                if (on[i] && !wasOn[i]) {
+                    onSince[i] = ms;
+                }
+                wasOn[i] = on[i];
+                float ma = loadCurrent(scenario.loads[i], on[i], ms - onSince[i]);
+                block[count++] = adcCounts(ma, scenario.noiseCounts, rng);
+            }
+            std::normal_distribution<float> tempJitter(0.0f, 2.0f);
+            block[count++] = (uint16_t)(tempCounts + tempJitter(rng));
+
+            if (count == sizeof(block) / sizeof(block[0])) {
+                lampSenseProcess(block, count, ms);
+                count = 0;
+                for (int i = 0; i < LAMP_COUNT; i++) {
+                    if (lamps[i].state == scenario.expected[i] && !settledAt[i]) {
+                        settledAt[i] = ms;
+                    } else if (lamps[i].state != scenario.expected[i]) {
+                        settledAt[i] = 0;
+                    }
+                }
+            }
+        }
+
+        bool pass = true;
+        printf("{\"scenario\":\"%s\"", scenario.name);
+        static const char* names[LAMP_COUNT] = {"left", "right", "tail"};
+        for (int i = 0; i < LAMP_COUNT; i++) {
+            bool ok = lamps[i].state == scenario.expected[i];
+            pass = pass && ok;
+            printf(",\"%s\":\"%s\",\"%s_expected\":\"%s\",\"%s_settled_ms\":%lu",
+                   names[i], lampStateName(lamps[i].state),
+                   names[i], lampStateName(scenario.expected[i]),
+                   names[i], settledAt[i]);
+        }
+        printf(",\"status_byte\":\"0x%02X\",\"temperature_c\":%.1f,\"pass\":%s}\n",
+               lampStatusByte(), lampSenseTemperatureC, pass ? "true" : "false");
+        if (!pass) {
+            failures++;
+        }
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,377 @@
+/*
+ * Checks reading two LIN buses at once and merging their frames in order.
+ *
+ * Usage: linmerge [--seconds N] [--loop-us US]
+ *
+ * Two LinReceivers, the trailer bus on Serial1 and the inductive charger's on
+ * Serial2, read on the virtual clock with the same LinMerge, holds and
+ * full-queue handling as serviceLin(). Bus 0 carries the car's schedule (the
+ * light frame and a 0x50 header alternating every 10 ms), bus 1 an 8-byte
+ * charger frame every 15 ms, offset so frames on the two overlap, with every
+ * eighth checksum broken. A pass runs every --loop-us, up to 500 so the
+ * framers are polled within a byte time.
+ *
+ * Checks each receiver reads every frame sent on its bus, every frame it
+ * reads comes out of the merge once, tagged with its bus and in that bus's
+ * order, and the merged stream is in the order the frames started. The same
+ * drive without the holds must come out of order, which is what they're
+ * for. Then a 400 ms stall every five seconds overflows the per-bus queues,
+ * and nothing the receivers read may be lost. The merged frames then go through the capture ring to a
+ * packed capture and through lin_capture.txt lines, and come back with their
+ * buses. Prints a JSON line per case and a summary, and exits non-zero on any
+ * failure.
+*/
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "capture.h"
+#include "check.h"
+#include "lin.h"
+#include "lin_merge.h"
+#include "lin_stream.h"
+#include "trigger.h"
+
+#define LIGHT_PID 0xCF
+#define STATUS_PID 0x50
+#define CHARGER_ID 0x29
+
+// A frame as sent, to compare against what comes out
+struct Sent {
+    byte bytes[lincore::MAX_FRAME_BYTES];
+    short length;
+};
+
+struct Drive {
+    LinStream wire[2];
+    std::vector<Sent> sent[2];
+};
+
+static void sent(Drive& drive, int bus, const LinStream& wire, size_t from) {
+    // From the sync byte on, the break's 0x00 isn't part of the frame
+    Sent frame = {{0}, 0};
+    for (size_t i = from + 1; i < wire.size(); i++) {
+        frame.bytes[frame.length++] = wire[i].value;
+    }
+    drive.sent[bus].push_back(frame);
+}
+
+static void buildDrive(Drive& drive, unsigned long seconds) {
+    const unsigned long endUs = seconds * 1000000UL;
+    for (unsigned long t = 1000; t < endUs; t += 10000) {
+        size_t from = drive.wire[0].size();
+        if ((t / 10000) % 2 == 0) {
+            byte lights = (t / 1000000) % 2 ? 0x05 : 0x04;
+            appendFrame(drive.wire[0], t, LIGHT_PID, &lights, 1);
+        } else {
+            appendFrame(drive.wire[0], t, STATUS_PID, nullptr, 0, false);
+        }
+        sent(drive, 0, drive.wire[0], from);
+    }
+    unsigned long n = 0;
+    for (unsigned long t = 4000; t < endUs; t += 15000, n++) {
+        size_t from = drive.wire[1].size();
+        byte data[8];
+        for (int i = 0; i < 8; i++) {
+            data[i] = (byte)(n * 7 + i);
+        }
+        // The framer takes a 0x55 for the next frame's sync, keep it out of
+        // the data and checksum
+        for (int i = 0; i < 8; i++) {
+            if (data[i] == lincore::SYNC) {
+                data[i]++;
+            }
+        }
+        if (linChecksum(linPid(CHARGER_ID), data, 8) == lincore::SYNC) {
+            data[0] ^= 0x01;
+        }
+        appendFrame(drive.wire[1], t, linPid(CHARGER_ID), data, 8);
+        if (n % 8 == 7) {
+            drive.wire[1].back().value ^= 0x5A;
+        }
+        sent(drive, 1, drive.wire[1], from);
+    }
+}
+
+struct Merged {
+    LinMergedFrame frame;
+    unsigned long releasedUs;
+};
+
+struct Result {
+    std::vector<LinMergedFrame> read[2]; // as each receiver returned them
+    std::vector<Merged> merged;
+    unsigned long forced = 0;
+    unsigned long maxWaiting = 0;
+};
+
+template <class Receiver>
+static void readBus(Receiver& receiver, LinMerge& merge, Result& result) {
+    short bytesRead;
+    while ((bytesRead = receiver.updateFrame()) > 0) {
+        byte calculated = receiver.calculateChecksum(receiver.dataBuffer, bytesRead - 1);
+        LinMergedFrame frame = {receiver.bus, (uint8_t)bytesRead, calculated, receiver.frameMicros, {0}};
+        memcpy(frame.data, receiver.dataBuffer, bytesRead);
+        result.read[receiver.bus].push_back(frame);
+        while (!merge.push(receiver.bus, receiver.dataBuffer, bytesRead, calculated, receiver.frameMicros)) {
+            result.merged.push_back({*merge.next(), micros()});
+            merge.pop();
+        }
+    }
+}
+
+// serviceLin() for both buses, from a fresh start
+// stallMs of every stallEveryMs skip their passes
+static void run(const Drive& drive, unsigned long seconds, unsigned long loopUs, bool holds, unsigned long stallEveryMs,
+                unsigned long stallMs, Result& result) {
+    Serial1.hostClear();
+    Serial2.hostClear();
+    hostSetMicros(0);
+    lin trailer;
+    LinUartReceiver charger(Serial2, 1);
+    trailer.setupSerial();
+    charger.setupSerial();
+    queueStream(Serial1, drive.wire[0]);
+    queueStream(Serial2, drive.wire[1]);
+    static LinMerge merge;
+    merge = LinMerge();
+
+    const unsigned long endUs = seconds * 1000000UL + 100000;
+    for (unsigned long t = 0; t < endUs; t += loopUs) {
+        hostSetMicros(t);
+        unsigned long ms = t / 1000;
+        if (stallMs && ms % stallEveryMs >= stallEveryMs - stallMs) {
+            continue;
+        }
+        readBus(trailer, merge, result);
+        readBus(charger, merge, result);
+        unsigned long syncUs;
+        if (holds && trailer.receiving(syncUs)) {
+            merge.holdFrom(syncUs);
+        }
+        if (holds && charger.receiving(syncUs)) {
+            merge.holdFrom(syncUs);
+        }
+        while (const LinMergedFrame* frame = merge.next()) {
+            result.merged.push_back({*frame, t});
+            merge.pop();
+        }
+    }
+    result.forced = merge.forced;
+    result.maxWaiting = merge.maxWaiting;
+}
+
+// Every frame the receivers read comes out once, in its bus's order, with
+// the right tag. Returns how many came out before one that started earlier.
+static unsigned long check(const char* name, const Result& result) {
+    size_t next[2] = {0, 0};
+    bool wrong = false;
+    unsigned long outOfOrder = 0;
+    for (size_t i = 0; i < result.merged.size(); i++) {
+        const LinMergedFrame& frame = result.merged[i].frame;
+        if (frame.bus > 1 || next[frame.bus] >= result.read[frame.bus].size()) {
+            wrong = true;
+            break;
+        }
+        const LinMergedFrame& expected = result.read[frame.bus][next[frame.bus]++];
+        if (frame.length != expected.length || frame.frameUs != expected.frameUs ||
+            frame.expectedChecksum != expected.expectedChecksum || memcmp(frame.data, expected.data, frame.length)) {
+            wrong = true;
+        }
+        if (i > 0 && (long)(frame.frameUs - result.merged[i - 1].frame.frameUs) < 0) {
+            outOfOrder++;
+        }
+    }
+    if (wrong) fail(name, "frames wrong, mistagged or out of their bus's order");
+    if (next[0] != result.read[0].size() || next[1] != result.read[1].size()) fail(name, "frames lost");
+    return outOfOrder;
+}
+
+// What the receivers read against what was sent, without stalls they match
+static void checkRead(const char* name, const Drive& drive, const Result& result) {
+    for (int bus = 0; bus < 2; bus++) {
+        bool same = result.read[bus].size() == drive.sent[bus].size();
+        for (size_t i = 0; same && i < result.read[bus].size(); i++) {
+            const LinMergedFrame& frame = result.read[bus][i];
+            same = frame.length == drive.sent[bus][i].length &&
+                   memcmp(frame.data, drive.sent[bus][i].bytes, frame.length) == 0;
+        }
+        if (!same) fail(name, bus ? "bus 1 not read as sent" : "bus 0 not read as sent");
+    }
+}
+
+static unsigned long maxHoldUs(const Result& result) {
+    unsigned long worst = 0;
+    for (const Merged& merged : result.merged) {
+        unsigned long held = merged.releasedUs - merged.frame.frameUs;
+        if (held > worst) {
+            worst = held;
+        }
+    }
+    return worst;
+}
+
+static void drive(const Drive& bus, unsigned long seconds, unsigned long loopUs, Result& result) {
+    const char* name = "merge";
+    run(bus, seconds, loopUs, true, 1, 0, result);
+    checkRead(name, bus, result);
+    unsigned long outOfOrder = check(name, result);
+    if (outOfOrder) fail(name, "merged stream out of order");
+    if (result.forced) fail(name, "queue filled without a stall");
+
+    Result unheld;
+    run(bus, seconds, loopUs, false, 1, 0, unheld);
+    unsigned long unheldOutOfOrder = check("unheld", unheld);
+    if (!unheldOutOfOrder) fail(name, "no overlap for the holds to order");
+
+    checkCase("{\"case\":\"%s\",\"frames\":[%u,%u],\"merged\":%u,\"out_of_order\":%lu,\"out_of_order_unheld\":%lu,"
+           "\"max_waiting\":%lu,\"max_hold_us\":%lu}",
+           name, (unsigned)bus.sent[0].size(), (unsigned)bus.sent[1].size(), (unsigned)result.merged.size(),
+           outOfOrder, unheldOutOfOrder, result.maxWaiting, maxHoldUs(result));
+}
+
+static void backlog(const Drive& bus, unsigned long seconds, unsigned long loopUs) {
+    const char* name = "backlog";
+    Result result;
+    run(bus, seconds, loopUs, true, 5000, 400, result);
+    unsigned long outOfOrder = check(name, result);
+    if (!result.forced) fail(name, "stall didn't fill a queue");
+    checkCase("{\"case\":\"%s\",\"stall_ms\":400,\"read\":[%u,%u],\"merged\":%u,\"forced\":%lu,\"out_of_order\":%lu}",
+           name, (unsigned)result.read[0].size(), (unsigned)result.read[1].size(), (unsigned)result.merged.size(),
+           result.forced, outOfOrder);
+}
+
+static bool sameFrame(const LINFrame& a, const LINFrame& b) {
+    return a.bus == b.bus && a.pid == b.pid && a.dataLength == b.dataLength &&
+           memcmp(a.data, b.data, a.dataLength) == 0 && a.checksum == b.checksum &&
+           a.checksumValid == b.checksumValid && a.expectedChecksum == b.expectedChecksum;
+}
+
+// Through the capture ring into a packed capture, and through text lines
+static void capture(const Result& result) {
+    const char* name = "capture";
+    const size_t count = 2000; // well inside the arena while recording
+    std::vector<LINFrame> expected;
+    TriggerConfig trigger;
+    trigger.postMs = 60000;
+    hostSetMicros(result.merged[0].frame.frameUs);
+    if (!captureArm(trigger, millis())) {
+        fail(name, "couldn't arm");
+        return;
+    }
+    unsigned long startUs = result.merged[0].frame.frameUs;
+    size_t bus1 = 0;
+    for (size_t i = 0; i < count && i < result.merged.size(); i++) {
+        const LinMergedFrame& frame = result.merged[i].frame;
+        hostSetMicros(frame.frameUs);
+        captureFrame(frame.data, frame.length, frame.expectedChecksum, frame.frameUs, millis(), frame.bus);
+        capturePoll(millis());
+        LINFrame record;
+        buildCaptureFrame(record, frame.data, frame.length, frame.frameUs - startUs, frame.expectedChecksum,
+                          frame.bus);
+        expected.push_back(record);
+        bus1 += frame.bus == 1;
+    }
+    captureStop(millis());
+    capturePoll(millis());
+
+    std::vector<LINFrame> packed;
+    File file = LittleFS.open(CAPTURE_PATH, "r");
+    CaptureDecoder decoder;
+    decoder.begin();
+    LINFrame frame;
+    int value;
+    while (file && (value = file.read()) >= 0) {
+        if (decoder.push(value, frame)) {
+            packed.push_back(frame);
+        }
+    }
+    bool packedSame = packed.size() == expected.size();
+    for (size_t i = 0; packedSame && i < packed.size(); i++) {
+        packedSame = sameFrame(packed[i], expected[i]) && packed[i].timestampUs == expected[i].timestampUs;
+    }
+    if (!packedSame) fail(name, "packed capture doesn't match the merged frames");
+
+    bool textSame = true;
+    for (const LINFrame& record : expected) {
+        String line;
+        class StringPrint : public Print {
+          public:
+            explicit StringPrint(String& out) : out(out) {}
+            size_t write(uint8_t c) override {
+                out += (char)c;
+                return 1;
+            }
+            String& out;
+        } print(line);
+        printCaptureFrame(print, record);
+        LINFrame parsed;
+        if (!parseCaptureLine(line.c_str(), parsed) || !sameFrame(parsed, record)) {
+            textSame = false;
+        }
+    }
+    if (!textSame) fail(name, "capture lines don't round trip");
+
+    checkCase("{\"case\":\"%s\",\"frames\":%u,\"bus1_frames\":%u,\"packed_frames\":%u,\"packed_bytes\":%lu}", name,
+           (unsigned)expected.size(), (unsigned)bus1, (unsigned)packed.size(), captureSavedBytes);
+}
+
+static void timing() {
+    const int iterations = 1000000;
+    static LinMerge merge;
+    const byte light[] = {0x55, LIGHT_PID, 0x04, 0x2C};
+    auto start = std::chrono::steady_clock::now();
+    unsigned long sink = 0;
+    for (int i = 0; i < iterations; i++) {
+        merge.push(i & 1, light, sizeof(light), light[3], i * 1000);
+        if (i & 1) {
+            while (const LinMergedFrame* frame = merge.next()) {
+                sink += frame->length;
+                merge.pop();
+            }
+        }
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() /
+                iterations;
+    if (sink != 4UL * iterations) fail("timing", "frames lost");
+    checkCase("{\"case\":\"timing\",\"frame_ns\":%.1f}", ns);
+}
+
+int main(int argc, char** argv) {
+    unsigned long seconds = 60;
+    unsigned long loopUs = 500;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--seconds" && i + 1 < argc) {
+            seconds = strtoul(argv[++i], nullptr, 0);
+        } else if (arg == "--loop-us" && i + 1 < argc) {
+            loopUs = strtoul(argv[++i], nullptr, 0);
+        } else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+    // The framer ends a frame on a gap between reads, so it has to be polled
+    // within a byte time
+    if (seconds < 6 || loopUs < 1 || loopUs > LIN_BYTE_US - 20) {
+        fprintf(stderr, "Need at least 6 seconds and a loop time of 1-500 us\n");
+        return 1;
+    }
+
+    Serial.hostEcho = false;
+    LittleFS.begin();
+    LittleFS.mkdir("/logs");
+
+    Drive bus;
+    buildDrive(bus, seconds);
+    Result result;
+    drive(bus, seconds, loopUs, result);
+    backlog(bus, seconds, loopUs);
+    capture(result);
+    timing();
+
+    return checkSummary();
+}
@@ -0,0 +1,370 @@
+/*
+ * Host backend for the LIN master emulator, so the controller can be driven
+ * without a car or a second board.
+ *
+ * Usage: master (--pty [--link PATH] | --port PATH) [--capture FILE]
+ *               [--seconds N] [--delay-ms MS]
+ *        master --check
+ *
+ * --pty opens a pseudo terminal and prints the slave side's name (and
+ * symlinks it to --link), for the controller host build to open with
+ * --port. --port drives a USB LIN adapter instead. The car schedule is
+ * played unless --capture gives a lin_capture.txt or .lcz to replay. After --delay-ms
+ * (for the other side to open the port) it runs for --seconds, collects what
+ * comes back after each 0x10 header, checks the enhanced checksum and prints
+ * one JSON line. Exits non-zero if any response was wrong.
+ *
+ * --check runs a capture recorded with the trailer module answering 0x10 and
+ * 0x11 through the schedule, as lin_capture.txt lines and packed, and plays
+ * it over a socket pair. The light frames must go out with their data and
+ * the answered frames as bare headers, for the controller to answer. Prints a
+ * JSON line per case and a summary, and exits non-zero on any failure.
+*/
+
+#include <Arduino.h>
+#include <lin_hal_posix.h>
+#include <lin_master.h>
+#include <stdlib.h>
+#include <string>
+#include <sys/socket.h>
+
+#include "check.h"
+#include "schedule.h"
+
+static std::vector<lincore::ScheduleEntry> schedule;
+
+static bool loadCapture(const char* path) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        return false;
+    }
+    byte magic[CAPTURE_MAGIC_BYTES];
+    if (fread(magic, 1, sizeof(magic), file) == sizeof(magic) && isPackedCapture(magic, sizeof(magic))) {
+        CaptureDecoder decoder;
+        decoder.begin();
+        LINFrame frame;
+        unsigned long lastUs = 0;
+        for (byte value : magic) {
+            decoder.push(value, frame);
+        }
+        int value;
+        while ((value = fgetc(file)) != EOF) {
+            if (decoder.push(value, frame)) {
+                appendCaptureFrame(schedule, lastUs, frame);
+            }
+        }
+        fclose(file);
+        return true;
+    }
+    rewind(file);
+    char line[256];
+    unsigned long lastUs = 0;
+    while (fgets(line, sizeof(line), file)) {
+        appendCaptureLine(schedule, lastUs, line);
+    }
+    fclose(file);
+    return true;
+}
+
+// Collects printCaptureFrame() output
+class LinePrint : public Print {
+    public:
+        size_t write(uint8_t c) override {
+            line += (char)c;
+            return 1;
+        }
+        std::string line;
+};
+
+// A drive captured with the trailer module connected: the light frame every
+// 20 ms with the left signal blinking, the "Park, connected" answer to 0x10
+// 10 ms after each, and the answer to 0x11 every fifth round
+static std::vector<LINFrame> answeredCapture() {
+    static const byte status[] = {0x49, 0x00, 0x2C, 0x01, 0x00};
+    static const byte module[] = {0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+    std::vector<LINFrame> frames;
+    auto add = [&](unsigned long us, byte pid, const byte* data, short dataLength) {
+        byte raw[lincore::MAX_FRAME_BYTES] = {lincore::SYNC, pid};
+        memcpy(&raw[2], data, dataLength);
+        raw[2 + dataLength] = lincore::checksum(raw, 2 + dataLength);
+        LINFrame frame;
+        buildCaptureFrame(frame, raw, 3 + dataLength, us, raw[2 + dataLength]);
+        frames.push_back(frame);
+    };
+    for (int round = 0; round < 25; round++) {
+        unsigned long us = round * 2 * CAR_SLOT_US + 137;
+        byte lights = 0x04 | (round / 8 % 2 ? 0x01 : 0x00);
+        add(us, CAR_LIGHT_PID, &lights, 1);
+        add(us + CAR_SLOT_US + 412, CAR_STATUS_PID, status, sizeof(status));
+        if (round % 5 == 4) {
+            add(us + CAR_SLOT_US + 2950, 0x11, module, sizeof(module));
+        }
+    }
+    return frames;
+}
+
+static bool sameSchedule(const std::vector<lincore::ScheduleEntry>& a, const std::vector<lincore::ScheduleEntry>& b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); i++) {
+        if (a[i].pid != b[i].pid || a[i].length != b[i].length || memcmp(a[i].data, b[i].data, a[i].length) != 0 ||
+            a[i].slotMicros != b[i].slotMicros) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int runCheck() {
+    std::vector<LINFrame> frames = answeredCapture();
+
+    // As lin_capture.txt lines
+    const char* name = "text";
+    std::vector<lincore::ScheduleEntry> fromText;
+    unsigned long lastUs = 0;
+    for (const LINFrame& frame : frames) {
+        LinePrint line;
+        printCaptureFrame(line, frame);
+        if (!appendCaptureLine(fromText, lastUs, line.line.c_str())) {
+            fail(name, "line didn't parse");
+        }
+    }
+    size_t headers = 0;
+    bool dataKept = true;
+    for (size_t i = 0; i < fromText.size() && i < frames.size(); i++) {
+        const lincore::ScheduleEntry& entry = fromText[i];
+        if (entry.pid == CAR_LIGHT_PID) {
+            dataKept &= entry.length == 1 && entry.data[0] == frames[i].data[0];
+        } else {
+            headers += entry.length == 0;
+        }
+    }
+    size_t answered = frames.size() - 25;
+    if (fromText.size() != frames.size()) fail(name, "wrong number of slots");
+    if (headers != answered) fail(name, "answered frame sent as master data");
+    if (!dataKept) fail(name, "light frame data lost");
+    checkCase("{\"case\":\"%s\",\"slots\":%zu,\"answered\":%zu,\"headers\":%zu}", name, fromText.size(), answered,
+           headers);
+
+    // Packed, the same schedule must come out
+    name = "packed";
+    CaptureEncoder encoder;
+    encoder.begin();
+    for (const LINFrame& frame : frames) {
+        if (!encoder.append(frame)) {
+            fail(name, "capture didn't fit in a block");
+        }
+    }
+    CaptureDecoder decoder;
+    decoder.begin();
+    std::vector<lincore::ScheduleEntry> fromPacked;
+    lastUs = 0;
+    LINFrame frame;
+    for (size_t i = 0; i < encoder.length(); i++) {
+        if (decoder.push(encoder.data()[i], frame)) {
+            appendCaptureFrame(fromPacked, lastUs, frame);
+        }
+    }
+    bool same = sameSchedule(fromText, fromPacked);
+    if (!same) fail(name, "schedule differs from the text capture's");
+    checkCase("{\"case\":\"%s\",\"bytes\":%zu,\"same\":%s}", name, encoder.length(), same ? "true" : "false");
+
+    // On the wire, over a socket pair standing in for a pty
+    name = "wire";
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        perror("socketpair");
+        return 1;
+    }
+    lincore::PosixUart uart(fds[0], true);
+    lincore::Master<lincore::PosixUart> master(uart);
+    master.begin();
+    fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+    std::vector<byte> wire;
+    auto drain = [&]() {
+        byte value;
+        while (read(fds[1], &value, 1) == 1) {
+            wire.push_back(value);
+        }
+    };
+    master.start(fromText.data(), fromText.size(), false);
+    while (master.running()) {
+        master.poll();
+        drain();
+        usleep(master.timeToNextSlot() > 200 ? 100 : 20);
+    }
+    drain();
+    close(fds[0]);
+    close(fds[1]);
+
+    // The break goes out as a 0x00 byte on a pty
+    std::vector<byte> expected;
+    for (const LINFrame& sent : frames) {
+        expected.push_back(0x00);
+        expected.push_back(lincore::SYNC);
+        expected.push_back(sent.pid);
+        if (sent.pid == CAR_LIGHT_PID) {
+            expected.insert(expected.end(), sent.data, sent.data + sent.dataLength);
+            expected.push_back(sent.checksum);
+        }
+    }
+    bool match = wire == expected;
+    if (!match) fail(name, "bytes on the wire differ from the headers and light frames");
+    checkCase("{\"case\":\"%s\",\"bytes\":%zu,\"expected\":%zu,\"slot_late_max_us\":%lu}", name, wire.size(),
+           expected.size(), master.maxLateness);
+
+    return checkSummary();
+}
+
+int main(int argc, char** argv) {
+    bool usePty = false;
+    const char* link = nullptr;
+    const char* port = nullptr;
+    const char* capture = nullptr;
+    double seconds = 10;
+    unsigned long delayMs = 2000;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--pty") { usePty = true; continue; }
+        if (arg == "--check") return runCheck();
+        if (i + 1 >= argc) {
+            fprintf(stderr, "Missing value for %s\n", argv[i]);
+            return 1;
+        }
+        if (arg == "--link") link = argv[++i];
+        else if (arg == "--port") port = argv[++i];
+        else if (arg == "--capture") capture = argv[++i];
+        else if (arg == "--seconds") seconds = atof(argv[++i]);
+        else if (arg == "--delay-ms") delayMs = strtoul(argv[++i], nullptr, 0);
+        else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    int fd;
+    if (usePty) {
+        fd = posix_openpt(O_RDWR | O_NOCTTY);
+        if (fd < 0 || grantpt(fd) != 0 || unlockpt(fd) != 0) {
+            perror("posix_openpt");
+            return 1;
+        }
+        fprintf(stderr, "Controller port: %s\n", ptsname(fd));
+        if (link) {
+            unlink(link);
+            if (symlink(ptsname(fd), link) != 0) {
+                perror("symlink");
+                return 1;
+            }
+        }
+    } else if (port) {
+        fd = open(port, O_RDWR | O_NOCTTY);
+        if (fd < 0) {
+            perror(port);
+            return 1;
+        }
+    } else {
+        fprintf(stderr, "Need --pty or --port\n");
+        return 1;
+    }
+
+    if (capture) {
+        if (!loadCapture(capture) || schedule.empty()) {
+            fprintf(stderr, "No frames in %s\n", capture);
+            return 1;
+        }
+    } else {
+        buildCarSchedule(schedule);
+    }
+
+    lincore::PosixUart uart(fd, usePty);
+    lincore::Master<lincore::PosixUart> master(uart);
+    master.begin();
+    usleep(delayMs * 1000);
+    // Drop anything the other side sent while opening the port
+    while (uart.read() >= 0) {}
+
+    // The master reads back its own frames on a transceiver but not on a pty
+    size_t echoBytes = 0;
+    byte rx[16];
+    size_t rxCount = 0;
+    const lincore::ScheduleEntry* slot = nullptr;
+    unsigned long slotStart = 0;
+    unsigned long firstByteAt = 0;
+    unsigned long headers = 0;
+    unsigned long responses = 0;
+    unsigned long wrong = 0;
+    unsigned long latencyMax = 0;
+    double latencyTotal = 0;
+
+    auto finishSlot = [&]() {
+        if (!slot || slot->length != 0) {
+            return;
+        }
+        headers++;
+        if (rxCount <= echoBytes) {
+            return;
+        }
+        // Response bytes after any echo of the header, last is the checksum
+        byte frame[lincore::MAX_FRAME_BYTES] = {lincore::SYNC, slot->pid};
+        size_t dataLength = rxCount - echoBytes - 1;
+        if (dataLength < 1 || dataLength > 8) {
+            wrong++;
+            return;
+        }
+        memcpy(&frame[2], &rx[echoBytes], dataLength);
+        responses++;
+        if (lincore::checksum(frame, 2 + dataLength) != rx[rxCount - 1]) {
+            wrong++;
+        }
+        unsigned long latency = firstByteAt - slotStart;
+        latencyMax = latency > latencyMax ? latency : latencyMax;
+        latencyTotal += latency;
+    };
+
+    auto drain = [&]() {
+        int value;
+        while ((value = uart.read()) >= 0) {
+            if (rxCount == echoBytes) {
+                firstByteAt = uart.micros();
+            }
+            if (rxCount < sizeof(rx)) {
+                rx[rxCount++] = value;
+            }
+        }
+    };
+
+    unsigned long end = uart.micros() + (unsigned long)(seconds * 1000000);
+    bool repeat = capture == nullptr;
+    master.start(schedule.data(), schedule.size(), repeat);
+    while (master.running() && (long)(uart.micros() - end) < 0) {
+        size_t index = master.currentIndex();
+        if (master.poll()) {
+            finishSlot();
+            slot = &schedule[index];
+            slotStart = uart.micros(); // header fully written
+            rxCount = 0;
+            echoBytes = usePty ? 0 : 2 + slot->length + (slot->length ? 1 : 0);
+        }
+        drain();
+        unsigned long wait = master.timeToNextSlot();
+        usleep(wait > 200 ? 100 : 20);
+    }
+    // Give the last slot's response time to arrive
+    for (int i = 0; i < 200; i++) {
+        usleep(100);
+        drain();
+    }
+    finishSlot();
+
+    printf("{\"frames\":%lu,\"slot_late_max_us\":%lu,\"headers\":%lu,\"responses\":%lu,"
+           "\"wrong\":%lu,\"latency_avg_us\":%.1f,\"latency_max_us\":%lu}\n",
+           master.framesSent, master.maxLateness, headers, responses, wrong,
+           responses ? latencyTotal / responses : 0.0, latencyMax);
+    if (link) {
+        unlink(link);
+    }
+    close(fd);
+    return wrong == 0 ? 0 : 1;
+}
@@ -0,0 +1,371 @@
+/*
+ * Checks /metrics against a loop with known stalls.
+ *
+ * Usage: metrics
+ *
+ * Runs loop() the way the firmware does, marking its sections, on the
+ * virtual clock (100 us a pass) with the car's schedule arriving on Serial1
+ * and the core's 32-byte receive buffer modelled. HttpServer is served on a
+ * localhost port, where a client thread calls a handler that takes 5 ms
+ * three times and a quick one five times. The loop stalls once in the
+ * capture section and once in the OTA section, holding off the LIN drain
+ * long enough to overflow the receive buffer. The client then scrapes
+ * /metrics, which is checked as Prometheus text (every sample under its
+ * TYPE, each family in one group, histogram buckets cumulative up to the
+ * count) and against what happened: each stall put down to the right section
+ * and handler, the handler timings, the overrun and high-water mark and the
+ * frame rate. Then times what loop() pays per pass. Prints a JSON line per
+ * case and a summary, and exits non-zero on any failure.
+*/
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <netinet/in.h>
+#include <set>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+#include "check.h"
+#include "http_server.h"
+#include "lin.h"
+#include "lin_stream.h"
+#include "metrics.h"
+
+#define LOOP_US 100
+#define LIGHT_PID 0xCF
+
+static uint16_t freePort() {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    bind(fd, (sockaddr*)&address, sizeof(address));
+    getsockname(fd, (sockaddr*)&address, &length);
+    close(fd);
+    return ntohs(address.sin_port);
+}
+
+static uint16_t port = freePort();
+static HttpServer httpServer(port);
+static lin linStack;
+static std::atomic<bool> scrapeDue(false);
+static std::atomic<bool> clientDone(false);
+static std::string scraped;
+
+#pragma region Client side
+
+// One request on a fresh connection, the body of a 200 or "" otherwise
+static std::string get(const char* path) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    if (connect(fd, (sockaddr*)&address, sizeof(address)) != 0) {
+        close(fd);
+        return "";
+    }
+    std::string request = std::string("GET ") + path + " HTTP/1.1\r\nHost: x\r\nConnection: close\r\n\r\n";
+    send(fd, request.data(), request.size(), MSG_NOSIGNAL);
+    std::string response;
+    char buffer[4096];
+    ssize_t result;
+    while ((result = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+        response.append(buffer, result);
+    }
+    close(fd);
+    size_t body = response.find("\r\n\r\n");
+    if (response.compare(0, 12, "HTTP/1.1 200") != 0 || body == std::string::npos) {
+        return "";
+    }
+    return response.substr(body + 4);
+}
+
+static void client() {
+    for (int i = 0; i < 3; i++) {
+        get("/slow");
+    }
+    for (int i = 0; i < 5; i++) {
+        get("/fast");
+    }
+    while (!scrapeDue) {
+        usleep(1000);
+    }
+    scraped = get("/metrics");
+    clientDone = true;
+}
+
+#pragma endregion Client side
+
+#pragma region Prometheus text
+
+struct Sample {
+    std::string name;
+    std::string labels;
+    double value;
+};
+
+// Checks the layout, returns "" or what's wrong, and the samples
+static std::string parse(const std::string& text, std::vector<Sample>& samples) {
+    std::map<std::string, std::string> types;
+    std::set<std::string> finished;
+    std::string family;
+    size_t start = 0;
+    while (start < text.size()) {
+        size_t end = text.find('\n', start);
+        if (end == std::string::npos) {
+            return "no newline at the end";
+        }
+        std::string line = text.substr(start, end - start);
+        start = end + 1;
+        if (line.compare(0, 7, "# HELP ") == 0) {
+            continue;
+        }
+        if (line.compare(0, 7, "# TYPE ") == 0) {
+            size_t space = line.find(' ', 7);
+            std::string name = line.substr(7, space - 7);
+            if (types.count(name)) {
+                return "TYPE twice for " + name;
+            }
+            if (!family.empty()) {
+                finished.insert(family);
+            }
+            types[name] = line.substr(space + 1);
+            family = name;
+            continue;
+        }
+        size_t nameEnd = line.find_first_of("{ ");
+        Sample sample;
+        sample.name = line.substr(0, nameEnd);
+        size_t valueAt = line.rfind(' ');
+        if (nameEnd == std::string::npos || valueAt == std::string::npos) {
+            return "bad line: " + line;
+        }
+        if (line[nameEnd] == '{') {
+            size_t close = line.find("} ", nameEnd);
+            if (close == std::string::npos) {
+                return "bad labels: " + line;
+            }
+            sample.labels = line.substr(nameEnd + 1, close - nameEnd - 1);
+        }
+        char* parsedEnd;
+        sample.value = strtod(line.c_str() + valueAt + 1, &parsedEnd);
+        if (*parsedEnd) {
+            return "bad value: " + line;
+        }
+        std::string base = sample.name;
+        for (const char* suffix : {"_bucket", "_sum", "_count"}) {
+            size_t length = strlen(suffix);
+            if (base.size() > length && base.compare(base.size() - length, length, suffix) == 0 &&
+                types.count(base.substr(0, base.size() - length)) &&
+                types[base.substr(0, base.size() - length)] == "histogram") {
+                base = base.substr(0, base.size() - length);
+            }
+        }
+        if (base != family) {
+            return finished.count(base) ? "samples of " + base + " split up" : "no TYPE before " + sample.name;
+        }
+        samples.push_back(sample);
+    }
+    return "";
+}
+
+static double value(const std::vector<Sample>& samples, const std::string& name, const std::string& labels = "",
+                    double missing = -1) {
+    for (const auto& sample : samples) {
+        if (sample.name == name && sample.labels == labels) {
+            return sample.value;
+        }
+    }
+    return missing;
+}
+
+static double total(const std::vector<Sample>& samples, const std::string& name) {
+    double sum = 0;
+    for (const auto& sample : samples) {
+        if (sample.name == name) {
+            sum += sample.value;
+        }
+    }
+    return sum;
+}
+
+#pragma endregion Prometheus text
+
+static void scrape() {
+    const char* name = "scrape";
+    Serial1.hostFifoSize = 32;
+    hostSetMicros(0);
+    LittleFS.begin();
+    File file = LittleFS.open("/web/index.html", "w");
+    file.print("<html></html>");
+    file.close();
+
+    // The car's schedule for a minute, more than the run needs
+    LinStream wire;
+    byte lights = 0x04;
+    for (unsigned long start = 10000; start < 60000000UL; start += 10000) {
+        if ((start / 10000) % 2 == 0) {
+            appendFrame(wire, start, LIGHT_PID, &lights, 1);
+        } else {
+            appendFrame(wire, start, 0x50, nullptr, 0, false);
+        }
+    }
+    linStack.setupSerial();
+    Serial1.hostClear();
+    queueStream(Serial1, wire);
+
+    httpServer.on("/slow", []() {
+        delay(5);
+        httpServer.send(200, "text/plain", "slow");
+    });
+    httpServer.on("/fast", []() {
+        httpServer.send(200, "text/plain", "fast");
+    });
+    httpServer.on("/metrics", []() {
+        httpServer.send(200, "text/plain; version=0.0.4", metricsPrometheus(millis()));
+    });
+    httpServer.begin();
+    metricsBegin(httpServer, linStack);
+    std::thread clientThread(client);
+
+    // loop(), with a capture stall at 1 s and an OTA one holding off the LIN
+    // drain for 100 ms at 1.5 s
+    bool captureStalled = false;
+    bool otaStalled = false;
+    unsigned long loops = 0;
+    while (!clientDone) {
+        metricsLoopStart(micros());
+        metricsSection(SECTION_HTTP, micros());
+        httpServer.poll();
+        metricsSection(SECTION_LIN, micros());
+        metricsUart(Serial1.available());
+        while (linStack.updateFrame() > 0) {
+            metricsFrames++;
+        }
+        metricsSection(SECTION_CAPTURE, micros());
+        if (!captureStalled && micros() >= 1000000) {
+            hostAdvanceMicros(3000);
+            captureStalled = true;
+        }
+        metricsSection(SECTION_OTA, micros());
+        if (!otaStalled && micros() >= 1500000) {
+            hostAdvanceMicros(100000);
+            otaStalled = true;
+        }
+        metricsSection(SECTION_POWER, micros());
+        metricsPoll(millis());
+        metricsLoopEnd(micros());
+        loops++;
+        hostAdvanceMicros(LOOP_US);
+        if (micros() >= 3000000) {
+            scrapeDue = true;
+        }
+    }
+    clientThread.join();
+    httpServer.stop();
+
+    std::vector<Sample> samples;
+    std::string error = scraped.empty() ? "no response" : parse(scraped, samples);
+    if (!error.empty()) {
+        fail(name, error.c_str());
+    }
+
+    // Buckets cumulative, ending at the count
+    double last = 0;
+    double inf = -1;
+    for (const auto& sample : samples) {
+        if (sample.name == "tcu_loop_duration_seconds_bucket") {
+            if (sample.value < last) fail(name, "histogram buckets not cumulative");
+            last = sample.value;
+            if (sample.labels == "le=\"+Inf\"") inf = sample.value;
+        }
+    }
+    double count = value(samples, "tcu_loop_duration_seconds_count");
+    if (inf < 0 || inf != count || count <= 0) fail(name, "histogram +Inf isn't the count");
+    if (value(samples, "tcu_loop_duration_seconds_bucket", "le=\"0.0001\"") < count - 5) {
+        fail(name, "quick passes not in the 100 us bucket");
+    }
+
+    // Every stall put down to where it happened
+    double slowStalls = value(samples, "tcu_loop_stalls_total", "section=\"http\",handler=\"/slow\"", 0);
+    double captureStalls = value(samples, "tcu_loop_stalls_total", "section=\"capture\",handler=\"\"", 0);
+    double otaStalls = value(samples, "tcu_loop_stalls_total", "section=\"ota\",handler=\"\"", 0);
+    if (slowStalls != 3) fail(name, "slow handler stalls not counted against it");
+    if (captureStalls != 1 || otaStalls != 1) fail(name, "capture and OTA stalls not counted against them");
+    if (total(samples, "tcu_loop_stalls_total") != 5) fail(name, "stalls counted that didn't happen");
+    double otaStallS = value(samples, "tcu_loop_stall_max_seconds", "section=\"ota\",handler=\"\"");
+    if (otaStallS < 0.1 || otaStallS > 0.101) fail(name, "OTA stall length wrong");
+
+    double slowMax = value(samples, "tcu_http_handler_max_seconds", "path=\"/slow\"");
+    double fastMax = value(samples, "tcu_http_handler_max_seconds", "path=\"/fast\"");
+    if (slowMax != 0.005 || fastMax != 0) fail(name, "handler times wrong");
+    if (value(samples, "tcu_http_handler_calls_total", "path=\"/slow\"") != 3 ||
+        value(samples, "tcu_http_handler_calls_total", "path=\"/fast\"") != 5) {
+        fail(name, "handler calls wrong");
+    }
+
+    // 100 ms of the schedule, ten headers and five light frames, waited
+    // behind the OTA stall
+    double overruns = value(samples, "tcu_uart_rx_overruns_total");
+    double highWater = value(samples, "tcu_uart_rx_high_water_bytes");
+    if (overruns != 1) fail(name, "overrun not counted once");
+    if (highWater < 36 || highWater > 44) fail(name, "high-water mark wrong");
+
+    // A frame every 10 ms
+    double fps = value(samples, "tcu_lin_frames_per_second");
+    if (fps < 95 || fps > 105) fail(name, "frame rate wrong");
+    if (value(samples, "tcu_heap_free_bytes") != rp2040.hostFreeHeap ||
+        value(samples, "tcu_heap_largest_free_block_bytes") != rp2040.hostLargestFreeBlock ||
+        value(samples, "tcu_littlefs_used_bytes") <= 0) {
+        fail(name, "heap or LittleFS missing");
+    }
+
+    checkCase("{\"case\":\"%s\",\"loops\":%lu,\"bytes\":%zu,\"samples\":%zu,\"stalls\":{\"slow\":%.0f,\"capture\":%.0f,"
+           "\"ota\":%.0f},\"slow_handler_s\":%.6f,\"overruns\":%.0f,\"rx_high_water\":%.0f,\"fps\":%.1f}",
+           name, loops, scraped.size(), samples.size(), slowStalls, captureStalls, otaStalls, slowMax, overruns,
+           highWater, fps);
+}
+
+// What loop() pays each pass: the start, its sections, the end and the
+// UART check
+static void timeLoop() {
+    const int iterations = 1000000;
+    unsigned long us = micros();
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        metricsLoopStart(us);
+        for (int section = SECTION_HTTP; section < SECTION_COUNT; section++) {
+            metricsSection((MetricsSection)section, us + section);
+        }
+        metricsUart(0);
+        metricsLoopEnd(us + 40);
+        us += LOOP_US;
+    }
+    double passNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() /
+                    iterations;
+    // Rendering, for the cost of a scrape
+    start = std::chrono::steady_clock::now();
+    String text = metricsPrometheus(millis());
+    double scrapeUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    checkCase("{\"case\":\"timing\",\"pass_ns\":%.1f,\"scrape_us\":%.0f,\"scrape_bytes\":%u}", passNs, scrapeUs,
+           text.length());
+}
+
+int main(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        fprintf(stderr, "Unknown option %s\n", argv[i]);
+        return 1;
+    }
+    Serial.hostEcho = false;
+    scrape();
+    timeLoop();
+    return checkSummary();
+}
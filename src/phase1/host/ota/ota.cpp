@@ -0,0 +1,216 @@
+/*
+ * Checks firmware uploads to /update that overlap.
+ *
+ * Usage: ota
+ *
+ * The main thread runs the server the way loop() does on the real clock,
+ * while a client thread posts 64 KB images, each with its MD5. In "overlap"
+ * a second image is posted whole while the first is half sent, and in
+ * "outlast" the second is half sent too and finishes after the first. The
+ * second must get a 409 either way, and the first a 200 with its own image
+ * staged. "after" then posts one more alone, which must be accepted. Prints
+ * a JSON line per case and a summary, and exits non-zero on any failure.
+*/
+
+#include <Arduino.h>
+#include <Updater.h>
+#include <arpa/inet.h>
+#include <atomic>
+#include <netinet/in.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "check.h"
+#include "http_server.h"
+#include "ota.h"
+
+#define IMAGE_BYTES 65536
+#define SETTLE_US 100000 // for the server to take what was sent
+
+static uint16_t freePort() {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    bind(fd, (sockaddr*)&address, sizeof(address));
+    getsockname(fd, (sockaddr*)&address, &length);
+    close(fd);
+    return ntohs(address.sin_port);
+}
+
+static uint16_t port = freePort();
+static HttpServer httpServer(port);
+static std::atomic<bool> clientDone(false);
+static unsigned long serviced = 0; // main thread only
+
+static void onService() {
+    serviced++;
+}
+
+#pragma region Client side
+
+static std::vector<uint8_t> makeImage(uint8_t seed) {
+    std::vector<uint8_t> image(IMAGE_BYTES);
+    for (size_t i = 0; i < image.size(); i++) {
+        image[i] = (uint8_t)(i * 7 + seed + (i >> 8));
+    }
+    return image;
+}
+
+// An upload as one POST, to be sent in parts
+static std::string uploadRequest(const std::vector<uint8_t>& image) {
+    std::string boundary = "----ota7MA4YWxkTrZu0gW";
+    std::string form = "--" + boundary + "\r\nContent-Disposition: form-data; name=\"firmware\"; " +
+                       "filename=\"firmware.bin\"\r\nContent-Type: application/octet-stream\r\n\r\n" +
+                       std::string(image.begin(), image.end()) + "\r\n--" + boundary + "--\r\n";
+    // ota:secret
+    return "POST /update?md5=" + std::string(hostMD5(image).c_str()) + " HTTP/1.0\r\nHost: x\r\n" +
+           "Authorization: Basic b3RhOnNlY3JldA==\r\nContent-Type: multipart/form-data; boundary=" + boundary +
+           "\r\nContent-Length: " + std::to_string(form.size()) + "\r\n\r\n" + form;
+}
+
+static int connectServer() {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    timeval timeout = {10, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (connect(fd, (sockaddr*)&address, sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool sendPart(int fd, const std::string& text, size_t from, size_t to) {
+    for (size_t sent = from; sent < to;) {
+        ssize_t result = send(fd, text.data() + sent, to - sent, MSG_NOSIGNAL);
+        if (result <= 0) {
+            return false;
+        }
+        sent += result;
+    }
+    return true;
+}
+
+// HTTP/1.0, so the response runs to the close
+static int readResponse(int fd, std::string& body) {
+    std::string response;
+    char buffer[4096];
+    ssize_t result;
+    while ((result = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+        response.append(buffer, result);
+    }
+    close(fd);
+    size_t bodyAt = response.find("\r\n\r\n");
+    if (response.compare(0, 5, "HTTP/") != 0 || bodyAt == std::string::npos) {
+        return -1;
+    }
+    body = response.substr(bodyAt + 4);
+    return atoi(response.c_str() + 9);
+}
+
+// Opens a connection and sends the first half of the request
+static int startUpload(const std::string& text) {
+    int fd = connectServer();
+    if (fd >= 0 && !sendPart(fd, text, 0, text.size() / 2)) {
+        close(fd);
+        return -1;
+    }
+    usleep(SETTLE_US);
+    return fd;
+}
+
+static int finishUpload(int fd, const std::string& text, std::string& body) {
+    if (fd < 0 || !sendPart(fd, text, text.size() / 2, text.size())) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    return readResponse(fd, body);
+}
+
+static void checkStaged(const char* name, int code, const std::string& body, const std::vector<uint8_t>& image) {
+    if (code != 200) {
+        fail(name, ("upload refused: " + body).c_str());
+    } else if (Update.hostImage != image) {
+        fail(name, "a different image was staged");
+    }
+}
+
+static void overlapCase(bool outlast) {
+    const char* name = outlast ? "outlast" : "overlap";
+    std::vector<uint8_t> first = makeImage(1);
+    std::vector<uint8_t> second = makeImage(2);
+    std::string firstText = uploadRequest(first);
+    std::string secondText = uploadRequest(second);
+    std::string firstBody;
+    std::string secondBody;
+    int firstCode;
+    int secondCode;
+
+    int firstFd = startUpload(firstText);
+    if (outlast) {
+        int secondFd = startUpload(secondText);
+        firstCode = finishUpload(firstFd, firstText, firstBody);
+        secondCode = finishUpload(secondFd, secondText, secondBody);
+    } else {
+        secondCode = finishUpload(startUpload(secondText), secondText, secondBody);
+        firstCode = finishUpload(firstFd, firstText, firstBody);
+    }
+
+    checkStaged(name, firstCode, firstBody, first);
+    if (secondCode != 409) {
+        fail(name, ("second upload answered " + std::to_string(secondCode) + ": " + secondBody).c_str());
+    }
+    checkCase("{\"case\":\"%s\",\"first_code\":%d,\"second_code\":%d}", name, firstCode, secondCode);
+}
+
+static void afterCase() {
+    const char* name = "after";
+    std::vector<uint8_t> image = makeImage(3);
+    std::string text = uploadRequest(image);
+    std::string body;
+    int code = finishUpload(startUpload(text), text, body);
+    checkStaged(name, code, body, image);
+    checkCase("{\"case\":\"%s\",\"code\":%d}", name, code);
+}
+
+static void client() {
+    overlapCase(false);
+    overlapCase(true);
+    afterCase();
+    clientDone = true;
+}
+
+#pragma endregion Client side
+
+int main(int argc, char** argv) {
+    if (argc > 1) {
+        fprintf(stderr, "Unknown option %s\n", argv[1]);
+        return 1;
+    }
+
+    Serial.hostEcho = false;
+    hostUseRealClock();
+    otaBegin(httpServer, "ota", "secret", onService);
+    httpServer.begin();
+
+    // loop(): the server only, otaPoll() would reboot after each update
+    std::thread script(client);
+    while (!clientDone) {
+        httpServer.poll();
+    }
+    script.join();
+    httpServer.stop();
+    if (!serviced) fail("upload", "LIN not serviced during the uploads");
+
+    return checkSummary("\"serviced\":%lu", serviced);
+}
@@ -0,0 +1,413 @@
+/*
+ * Checks capture replay through the HTTP server.
+ *
+ * Usage: replay [--seconds N]
+ *
+ * Builds an N second (default 2) drive as a capture: the light frame every
+ * 20 ms with the turn signals blinking and the tail lights coming on, an
+ * unanswered header between each, a few light frames with bad checksums
+ * that must not move the lights, and frames from a second bus that must be
+ * skipped. A client thread uploads it to /uploadReplay as lin_capture.txt
+ * (with a comment, a blank line and no line ending on the last line) and
+ * replays it at the capture's own timing, then as a packed lin_capture.lcz
+ * at 10x and flat out, while the main thread runs the server and
+ * replayPoll() the way loop() does on the real clock. Each run's light
+ * changes from /replayStatus must match what the capture says, at the right
+ * capture times and with the same digest, and it must take as long as the
+ * capture over the speed. Last, an upload during a replay must be refused
+ * and /stopReplay must end it early. Prints a JSON line per case and a
+ * summary with how late frames were handed over, and exits non-zero on any
+ * failure.
+*/
+
+#include <Arduino.h>
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <netinet/in.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include <lin_core.h>
+
+#include "capture.h"
+#include "check.h"
+#include "http_server.h"
+#include "lights.h"
+#include "lin_stream.h"
+#include "replay.h"
+
+#define LIGHT_PID 0xCF
+#define HEADER_PID 0x50
+#define FRAME_US 20000
+#define ELAPSED_SLACK_MS 250 // the host scheduler, not the replay
+
+static uint16_t freePort() {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    bind(fd, (sockaddr*)&address, sizeof(address));
+    getsockname(fd, (sockaddr*)&address, &length);
+    close(fd);
+    return ntohs(address.sin_port);
+}
+
+static uint16_t port = freePort();
+static HttpServer httpServer(port);
+static std::atomic<bool> clientDone(false);
+static unsigned long handled = 0; // main thread only
+static unsigned long serviced = 0;
+
+// What main.cpp's handleLinFrame() does with the lights, for a frame that
+// must already be due
+static void onFrame(const byte buffer[], short length, unsigned long frameUs) {
+    handled++;
+    if ((int32_t)(micros() - frameUs) < 0) {
+        fail("replay", "frame handed over before it was due");
+    }
+    if (buffer[1] == LIGHT_PID && lincore::checksum(buffer, length - 1) == buffer[length - 1]) {
+        processLightLINFrame(buffer[2]);
+    }
+}
+
+static void onService() {
+    serviced++;
+}
+
+#pragma region Capture
+
+struct Expected {
+    std::vector<LINFrame> frames;
+    unsigned long busZero = 0;
+    unsigned long otherBus = 0;
+    unsigned long spanUs = 0;
+    std::vector<std::pair<unsigned long, int>> changes; // capture us, lights
+};
+
+static LINFrame makeFrame(unsigned long us, byte pid, const byte data[], byte length, bool badChecksum, byte bus) {
+    byte raw[lincore::MAX_FRAME_BYTES] = {0x55, pid};
+    memcpy(raw + 2, data, length);
+    byte checksum = linChecksum(pid, data, length);
+    raw[2 + length] = badChecksum ? checksum ^ 0x5A : checksum;
+    LINFrame frame;
+    buildCaptureFrame(frame, raw, length ? length + 3 : 2, us, checksum, bus);
+    return frame;
+}
+
+// The capture starts 5 s into the recording, so the replay has to count from
+// its first frame
+static Expected buildDrive(unsigned long seconds) {
+    Expected drive;
+    const unsigned long offsetUs = 5000000;
+    int lights = -1;
+    for (unsigned long t = 0; t < seconds * 1000000UL; t += FRAME_US) {
+        // Left signal blinking 400 ms on and off, tail lights from 500 ms
+        byte data[2] = {0, 0x2C};
+        data[0] = ((t / 400000) % 2 == 0 ? 0x01 : 0) | (t >= 500000 ? 0x04 : 0);
+        bool bad = (t / FRAME_US) % 37 == 36;
+        if (bad) {
+            data[0] ^= 0x03;
+        }
+        drive.frames.push_back(makeFrame(offsetUs + t, LIGHT_PID, data, 2, bad, 0));
+        drive.busZero++;
+        if (!bad && data[0] != lights) {
+            lights = data[0];
+            drive.changes.push_back({t, lights});
+        }
+        drive.spanUs = t;
+        drive.frames.push_back(makeFrame(offsetUs + t + FRAME_US / 2, HEADER_PID, nullptr, 0, false, 0));
+        drive.busZero++;
+        drive.spanUs = t + FRAME_US / 2;
+        // The charger bus, everything on if it leaked into the lights
+        if ((t / FRAME_US) % 5 == 2) {
+            byte all[2] = {0x07, 0x00};
+            drive.frames.push_back(makeFrame(offsetUs + t + FRAME_US / 4, LIGHT_PID, all, 2, false, 1));
+            drive.otherBus++;
+        }
+    }
+    // Merged captures are in start order
+    std::stable_sort(drive.frames.begin(), drive.frames.end(),
+                     [](const LINFrame& a, const LINFrame& b) { return a.timestampUs < b.timestampUs; });
+    return drive;
+}
+
+// Collects printCaptureFrame() output
+class StringPrint : public Print {
+    public:
+        size_t write(uint8_t c) override {
+            text += (char)c;
+            return 1;
+        }
+        std::string text;
+};
+
+static std::string textCapture(const Expected& drive) {
+    StringPrint out;
+    out.text = "# lin_capture.txt\n\n";
+    for (size_t i = 0; i < drive.frames.size(); i++) {
+        printCaptureFrame(out, drive.frames[i]);
+        if (i + 1 < drive.frames.size()) {
+            out.text += "\n";
+        }
+    }
+    return out.text;
+}
+
+static std::string packedCapture(const Expected& drive) {
+    std::string packed;
+    CaptureEncoder encoder;
+    encoder.begin();
+    for (const LINFrame& frame : drive.frames) {
+        if (!encoder.append(frame)) {
+            packed.append((const char*)encoder.data(), encoder.length());
+            encoder.clear();
+            encoder.append(frame);
+        }
+    }
+    packed.append((const char*)encoder.data(), encoder.length());
+    return packed;
+}
+
+#pragma endregion Capture
+
+#pragma region Client side
+
+static int request(const std::string& text, std::string& body) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    timeval timeout = {10, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (connect(fd, (sockaddr*)&address, sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+    for (size_t sent = 0; sent < text.size();) {
+        ssize_t result = send(fd, text.data() + sent, text.size() - sent, MSG_NOSIGNAL);
+        if (result <= 0) {
+            close(fd);
+            return -1;
+        }
+        sent += result;
+    }
+    // HTTP/1.0, so the response runs to the close
+    std::string response;
+    char buffer[4096];
+    ssize_t result;
+    while ((result = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+        response.append(buffer, result);
+    }
+    close(fd);
+    size_t bodyAt = response.find("\r\n\r\n");
+    if (response.compare(0, 5, "HTTP/") != 0 || bodyAt == std::string::npos) {
+        return -1;
+    }
+    body = response.substr(bodyAt + 4);
+    return atoi(response.c_str() + 9);
+}
+
+static int get(const std::string& path, std::string& body) {
+    return request("GET " + path + " HTTP/1.0\r\nHost: x\r\n\r\n", body);
+}
+
+static int uploadFile(const std::string& filename, const std::string& file, std::string& body) {
+    std::string boundary = "----replay7MA4YWxkTrZu0gW";
+    std::string form = "--" + boundary + "\r\nContent-Disposition: form-data; name=\"capture\"; filename=\"" +
+                       filename + "\"\r\nContent-Type: application/octet-stream\r\n\r\n" + file + "\r\n--" +
+                       boundary + "--\r\n";
+    return request("POST /uploadReplay HTTP/1.0\r\nHost: x\r\nContent-Type: multipart/form-data; boundary=" +
+                   boundary + "\r\nContent-Length: " + std::to_string(form.size()) + "\r\n\r\n" + form, body);
+}
+
+static unsigned long jsonNumber(const std::string& json, const char* key) {
+    size_t at = json.find("\"" + std::string(key) + "\":");
+    return at == std::string::npos ? 0 : strtoul(json.c_str() + at + strlen(key) + 3, nullptr, 10);
+}
+
+static std::string jsonString(const std::string& json, const char* key) {
+    size_t at = json.find("\"" + std::string(key) + "\":\"");
+    if (at == std::string::npos) {
+        return "";
+    }
+    at += strlen(key) + 4;
+    return json.substr(at, json.find('"', at) - at);
+}
+
+// The [capture us, lights, late us] triples
+static std::vector<std::pair<unsigned long, int>> jsonChanges(const std::string& json, unsigned long& maxLateUs) {
+    std::vector<std::pair<unsigned long, int>> changes;
+    size_t at = json.find("\"changes\":[");
+    maxLateUs = 0;
+    if (at == std::string::npos) {
+        return changes;
+    }
+    const char* p = json.c_str() + at + 11;
+    while (*p == '[' || *p == ',') {
+        if (*p == ',') {
+            p++;
+        }
+        if (*p != '[') {
+            break;
+        }
+        char* end;
+        unsigned long us = strtoul(p + 1, &end, 10);
+        int lights = strtol(end + 1, &end, 10);
+        unsigned long late = strtoul(end + 1, &end, 10);
+        changes.push_back({us, lights});
+        maxLateUs = std::max(maxLateUs, late);
+        p = end + 1;
+    }
+    return changes;
+}
+
+// Polls /replayStatus until the replay is over
+static std::string waitForReplay(const char* name) {
+    std::string status;
+    for (int i = 0; i < 600; i++) {
+        if (get("/replayStatus", status) != 200) {
+            fail(name, "status request failed");
+            return "";
+        }
+        if (jsonString(status, "state") != "running") {
+            return status;
+        }
+        usleep(50000);
+    }
+    fail(name, "replay never finished");
+    return status;
+}
+
+static std::string firstDigest;
+
+static void replayCase(const char* name, const Expected& drive, const std::string& filename,
+                       const std::string& file, unsigned long speed) {
+    std::string body;
+    if (uploadFile(filename, file, body) != 200) {
+        fail(name, ("upload refused: " + body).c_str());
+        return;
+    }
+    if (get("/startReplay?speed=" + std::to_string(speed), body) != 200) {
+        fail(name, "start refused");
+        return;
+    }
+    std::string status = waitForReplay(name);
+    unsigned long maxLateUs;
+    auto changes = jsonChanges(status, maxLateUs);
+    unsigned long elapsedMs = jsonNumber(status, "elapsed_ms");
+    unsigned long wantMs = speed ? drive.spanUs / speed / 1000 : 0;
+    std::string digest = jsonString(status, "digest");
+
+    if (jsonString(status, "state") != "complete") fail(name, "not complete");
+    if (jsonNumber(status, "frames") != drive.busZero) fail(name, "wrong frame count");
+    if (jsonNumber(status, "other_bus") != drive.otherBus) fail(name, "other bus frames not skipped");
+    if (jsonString(status, "format") != (filename.find(".lcz") != std::string::npos ? "lcz" : "txt")) {
+        fail(name, "format misread");
+    }
+    if (changes != drive.changes || jsonNumber(status, "change_count") != drive.changes.size()) {
+        fail(name, "light changes differ from the capture");
+    }
+    if (firstDigest.empty()) {
+        firstDigest = digest;
+    } else if (digest != firstDigest) {
+        fail(name, "digest differs from the first run");
+    }
+    if (speed && (elapsedMs < wantMs || elapsedMs > wantMs + ELAPSED_SLACK_MS)) {
+        fail(name, "didn't keep the capture's timing");
+    }
+    if (!speed && elapsedMs > drive.spanUs / 10000) {
+        fail(name, "flat out was slower than 10x");
+    }
+
+    checkCase("{\"case\":\"%s\",\"bytes\":%u,\"speed\":%lu,\"frames\":%lu,\"changes\":%u,\"capture_ms\":%lu,"
+           "\"elapsed_ms\":%lu,\"late_max_us\":%lu,\"late_avg_us\":%lu,\"change_late_max_us\":%lu,"
+           "\"handler_max_us\":%lu,\"digest\":\"%s\"}",
+           name, (unsigned)file.size(), speed, jsonNumber(status, "frames"), (unsigned)changes.size(),
+           jsonNumber(status, "capture_ms"), elapsedMs, jsonNumber(status, "late_max_us"),
+           jsonNumber(status, "late_avg_us"), maxLateUs, jsonNumber(status, "handler_max_us"), digest.c_str());
+}
+
+static void stopCase(const Expected& drive, const std::string& file) {
+    const char* name = "stop";
+    std::string body;
+    if (get("/startReplay", body) != 200) {
+        fail(name, "start refused");
+        return;
+    }
+    usleep(200000);
+    int uploadCode = uploadFile("lin_capture.lcz", file, body);
+    if (uploadCode == 200) fail(name, "upload accepted during a replay");
+    if (get("/stopReplay", body) != 200) fail(name, "stop refused");
+    std::string status = waitForReplay(name);
+    unsigned long frames = jsonNumber(status, "frames");
+    if (status.find("\"stopped\":true") == std::string::npos) fail(name, "not marked stopped");
+    if (frames == 0 || frames >= drive.busZero) fail(name, "didn't stop part way");
+    // The capture that was running is still there to replay
+    if (get("/startReplay?speed=0", body) != 200) fail(name, "capture lost by the refused upload");
+    status = waitForReplay(name);
+    if (jsonNumber(status, "frames") != drive.busZero) fail(name, "capture damaged by the refused upload");
+
+    checkCase("{\"case\":\"%s\",\"upload_code\":%d,\"frames\":%lu,\"elapsed_ms\":%lu}", name, uploadCode, frames,
+           jsonNumber(status, "elapsed_ms"));
+}
+
+static void client(unsigned long seconds) {
+    Expected drive = buildDrive(seconds);
+    std::string text = textCapture(drive);
+    std::string packed = packedCapture(drive);
+    std::string body;
+    if (get("/startReplay", body) != 404) fail("empty", "started without a capture");
+    replayCase("txt", drive, "lin_capture.txt", text, 1);
+    replayCase("lcz", drive, "lin_capture.lcz", packed, 10);
+    replayCase("flat_out", drive, "lin_capture.lcz", packed, 0);
+    stopCase(drive, packed);
+    clientDone = true;
+}
+
+#pragma endregion Client side
+
+int main(int argc, char** argv) {
+    unsigned long seconds = 2;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--seconds" && i + 1 < argc) {
+            seconds = strtoul(argv[++i], nullptr, 10);
+        } else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (seconds < 1) {
+        seconds = 1;
+    }
+
+    Serial.hostEcho = false;
+    output_enabled = true;
+    hostUseRealClock();
+    replayBegin(httpServer, onFrame, onService);
+    httpServer.begin();
+
+    // loop(): the server, then whatever frames are due
+    std::thread script(client, seconds);
+    unsigned long maxLoopGapUs = 0;
+    unsigned long last = micros();
+    while (!clientDone) {
+        httpServer.poll();
+        replayPoll(micros());
+        unsigned long now = micros();
+        maxLoopGapUs = std::max(maxLoopGapUs, now - last);
+        last = now;
+    }
+    script.join();
+    httpServer.stop();
+    if (!serviced) fail("upload", "LIN not serviced during the upload");
+
+    return checkSummary("\"handled\":%lu,\"serviced\":%lu,\"loop_max_gap_us\":%lu", handled, serviced,
+                        maxLoopGapUs);
+}
@@ -0,0 +1,146 @@
+/*
+ * Checks the 0x10 slave response against a simulated bus.
+ *
+ * Usage: responder [--frames N] [--poll-us US] [--stall P] [--stall-us US]
+ *
+ * The car's schedule is played into the host UART, which loops everything the
+ * framer transmits back onto the bus like a LIN transceiver would. loop() is
+ * modelled as polling the framer every --poll-us, with an occasional stall of
+ * --stall-us (probability --stall per poll) standing in for a slow HTTP
+ * request. For every 0x50 header it checks whether a response went out, that
+ * it started inside the LIN response window and that the bytes on the bus
+ * carry the right data and enhanced checksum (computed independently of the
+ * framer). It also counts how many 0x10 frames the framer read back intact,
+ * which drops when a stall lands in the middle of a frame. Prints one JSON
+ * line and exits non-zero if any response was late or wrong.
+*/
+
+#include <Arduino.h>
+#include <random>
+#include <string>
+
+#include "lin.h"
+#include "lin_stream.h"
+
+#define STATUS_PID 0x50
+
+static const byte statusResponse[5] = {0x49, 0x00, 0x2C, 0x01, 0x00};
+
+int main(int argc, char** argv) {
+    unsigned long frames = 10000;
+    unsigned long pollUs = 100;
+    double stall = 0;
+    unsigned long stallUs = 5000;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string arg = argv[i];
+        if (arg == "--frames") frames = strtoul(argv[i + 1], nullptr, 0);
+        else if (arg == "--poll-us") pollUs = strtoul(argv[i + 1], nullptr, 0);
+        else if (arg == "--stall") stall = atof(argv[i + 1]);
+        else if (arg == "--stall-us") stallUs = strtoul(argv[i + 1], nullptr, 0);
+        else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    // Car schedule: light frame and the 0x10 header alternating every 10 ms
+    LinStream wire;
+    std::vector<unsigned long> pidArrivals;
+    byte light = 0x04;
+    for (unsigned long n = 0; n < frames; n++) {
+        unsigned long start = n * 10000;
+        if (n % 2 == 0) {
+            appendFrame(wire, start, linPid(0x0F), &light, 1);
+        } else {
+            pidArrivals.push_back(appendFrame(wire, start, STATUS_PID, nullptr, 0, false));
+        }
+    }
+
+    lin linStack;
+    linStack.setupSerial();
+    linStack.setResponse(STATUS_PID, statusResponse, sizeof(statusResponse));
+    Serial1.hostClear();
+    Serial1.hostLoopback = true;
+    hostSetMicros(0);
+
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<double> chance(0.0, 1.0);
+    unsigned long statusFrames = 0;
+    unsigned long statusFramesOk = 0;
+    size_t queued = 0;
+    unsigned long end = wire.back().arrival + 20000;
+    while ((int32_t)(micros() - end) < 0) {
+        unsigned long step = chance(rng) < stall ? stallUs : pollUs;
+        unsigned long next = micros() + step;
+        while (queued < wire.size() && wire[queued].arrival <= next) {
+            Serial1.hostQueue(wire[queued].value, wire[queued].arrival);
+            queued++;
+        }
+        hostSetMicros(next);
+        short bytesRead;
+        while ((bytesRead = linStack.updateFrame()) > 0) {
+            if (linStack.dataBuffer[1] != STATUS_PID) {
+                continue;
+            }
+            statusFrames++;
+            bool ok = bytesRead == 8 &&
+                      memcmp(&linStack.dataBuffer[2], statusResponse, sizeof(statusResponse)) == 0 &&
+                      linStack.calculateChecksum(linStack.dataBuffer, bytesRead - 1) == linStack.dataBuffer[bytesRead - 1];
+            if (ok) {
+                statusFramesOk++;
+            }
+        }
+    }
+
+    // Bus latency: PID stop bit to the first response start bit
+    unsigned long byteUs = 10 * 1000000UL / 19200;
+    unsigned long window = ((34 + 10 * (sizeof(statusResponse) + 1)) * 4 / 10) * 1000000UL / 19200;
+    unsigned long responses = 0;
+    unsigned long late = 0;
+    unsigned long wrong = 0;
+    byte expected[sizeof(statusResponse) + 1];
+    memcpy(expected, statusResponse, sizeof(statusResponse));
+    expected[sizeof(statusResponse)] = linChecksum(STATUS_PID, statusResponse, sizeof(statusResponse));
+    unsigned long minLatency = (unsigned long)-1;
+    unsigned long maxLatency = 0;
+    double totalLatency = 0;
+    const auto& tx = Serial1.hostTxLog;
+    size_t t = 0;
+    for (unsigned long pidArrival : pidArrivals) {
+        while (t < tx.size() && tx[t].time - byteUs < pidArrival) {
+            t++;
+        }
+        if (t >= tx.size()) {
+            break;
+        }
+        unsigned long latency = tx[t].time - byteUs - pidArrival;
+        // Belongs to the next header
+        if (latency > 10000) {
+            continue;
+        }
+        responses++;
+        if (latency > window) {
+            late++;
+        }
+        minLatency = latency < minLatency ? latency : minLatency;
+        maxLatency = latency > maxLatency ? latency : maxLatency;
+        totalLatency += latency;
+        for (size_t i = 0; i < sizeof(expected); i++) {
+            if (t + i >= tx.size() || tx[t + i].value != expected[i]) {
+                wrong++;
+                break;
+            }
+        }
+        t += sizeof(expected);
+    }
+
+    printf("{\"headers\":%zu,\"responses\":%lu,\"skipped\":%lu,\"late\":%lu,\"wrong\":%lu,"
+           "\"frames_read_back\":%lu,\"frames_ok\":%lu,\"window_us\":%lu,"
+           "\"latency_min_us\":%lu,\"latency_avg_us\":%.1f,\"latency_max_us\":%lu,"
+           "\"reported_max_us\":%lu}\n",
+           pidArrivals.size(), responses, linStack.responsesSkipped, late, wrong,
+           statusFrames, statusFramesOk, window,
+           responses ? minLatency : 0, responses ? totalLatency / responses : 0.0, maxLatency,
+           linStack.maxResponseLatency);
+    return (late == 0 && wrong == 0) ? 0 : 1;
+}
@@ -0,0 +1,399 @@
+/*
+ * Runs the whole firmware, setup() and loop() from main.cpp, on the virtual
+ * clock, so recorded drives replay much faster than real time and every run
+ * of the same input is identical to the microsecond.
+ *
+ * Usage: sim [--capture FILE] [--seconds N] [--seed N] [--loop-us US]
+ *            [--idle-s N] [--wrap-s N] [--runs N] [--wifi SSID] [--serial]
+ *            [--quiet]
+ *
+ * The bus is either a lin_capture.txt or .lcz (--capture) or a synthetic
+ * drive of --seconds: the car's schedule with the light byte wandering
+ * between idle, lights on, signals, hazards and brakes, and now and then the
+ * car asleep with the bus silent for minutes, picked by an LCG from --seed.
+ * --idle-s sets the firmware's idle sleep time. Bytes are queued onto Serial1 with their arrival times a little
+ * ahead of the clock. Each loop() is followed by advancing the clock --loop-us,
+ * or less when the next byte lands sooner, which stands in for the loop's
+ * own running time on the Pico. micros(), millis() and delay() all read the
+ * same clock, and WiFi joins (--wifi) or falls back to the access point on it.
+ * The clock starts --wrap-s seconds (30 minutes unless given) before micros()
+ * wraps, so the default hour of driving crosses the wrap. Times printed are
+ * from the start of the run.
+ *
+ * Prints one JSON line per change of the LEFT/RIGHT/TAIL pins with its time
+ * and the delay from the light frame's checksum byte, then a summary per run
+ * with the firmware's idle sleeps and its wake-to-lights times.
+ * Every run happens in its own process from the same start, and their
+ * digests of the pin changes are compared. Exits non-zero if a light change
+ * on the bus didn't reach the pins in order within 2 ms, a wake went over
+ * POWER_WAKE_BUDGET_US, or two runs differ.
+*/
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <WiFi.h>
+#include <chrono>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "lights.h"
+#include "lin_stream.h"
+#include "power.h"
+
+#define LIGHT_ID 0x0F
+#define STATUS_ID 0x10
+#define SLOT_US 10000 // 0x0F and the 0x10 header alternate every 10 ms
+#define LOOKAHEAD_US 100000 // bytes queued ahead of the clock
+#define MAX_LATENCY_US 2000
+#define BLINK_US 333333 // signals at 1.5 Hz
+
+// Firmware entry points, from main.cpp
+void setup();
+void loop();
+
+struct Options {
+    const char* capture = nullptr;
+    double seconds = 3600;
+    unsigned long seed = 1;
+    unsigned long loopUs = 100;
+    long idleS = -1; // the firmware's default
+    double wrapS = 1800;
+    int runs = 2;
+    const char* wifi = nullptr;
+    bool serial = false;
+    bool quiet = false;
+};
+
+struct LightChange {
+    unsigned long us;
+    byte lights; // left 0x01, right 0x02, tail 0x04 as in the light byte
+};
+
+struct Summary {
+    double simulatedS;
+    double realS;
+    unsigned long loops;
+    unsigned long busChanges;
+    unsigned long pinChanges;
+    unsigned long mismatches;
+    unsigned long latencyMaxUs;
+    unsigned long sleeps;
+    unsigned long asleepMs;
+    unsigned long maxWakeUs;
+    unsigned long wakesOverBudget;
+    uint64_t digest;
+};
+
+#pragma region Synthetic drive
+
+// One stretch of the drive: a light byte held, or blinking, for a while
+struct Stretch {
+    byte steady;
+    byte blink;
+    bool silent; // the car asleep
+    unsigned long endUs;
+};
+
+static unsigned long lcg(unsigned long& state) {
+    state = (state * 1103515245 + 12345) & 0x7FFFFFFF;
+    return state >> 8;
+}
+
+static Stretch nextStretch(unsigned long& state, unsigned long startUs) {
+    static const Stretch kinds[] = {
+        {0x00, 0x00, false, 0}, // parked
+        {0x04, 0x00, false, 0}, // lights on
+        {0x04, 0x01, false, 0}, // left signal
+        {0x04, 0x02, false, 0}, // right signal
+        {0x04, 0x03, false, 0}, // hazards
+        {0x0C, 0x00, false, 0}, // brakes with the lights on
+        {0x08, 0x01, false, 0}, // brakes and a left signal
+        {0x20, 0x00, false, 0}, // reverse
+        {0x00, 0x00, true, 0}, // asleep
+    };
+    Stretch stretch = kinds[lcg(state) % (sizeof(kinds) / sizeof(kinds[0]))];
+    // Seconds of driving, or minutes asleep
+    unsigned long seconds = (1 + lcg(state) % 20) * (stretch.silent ? 60 : 1);
+    stretch.endUs = startUs + seconds * 1000000UL;
+    return stretch;
+}
+
+// Appends the car's schedule from startUs up to endUs
+static unsigned long appendDrive(LinStream& stream, unsigned long startUs, unsigned long endUs,
+                                 unsigned long& state, Stretch& stretch) {
+    unsigned long t = startUs;
+    byte lightPid = linPid(LIGHT_ID);
+    byte statusPid = linPid(STATUS_ID);
+    while (t < endUs) {
+        if (t >= stretch.endUs) {
+            stretch = nextStretch(state, t);
+        }
+        if (stretch.silent) {
+            t += 2 * SLOT_US;
+            continue;
+        }
+        byte lights = stretch.steady;
+        if ((t / BLINK_US) % 2 == 0) {
+            lights |= stretch.blink;
+        }
+        appendFrame(stream, t, lightPid, &lights, 1);
+        appendFrame(stream, t + SLOT_US, statusPid, nullptr, 0, false);
+        t += 2 * SLOT_US;
+    }
+    return t;
+}
+
+#pragma endregion Synthetic drive
+
+// The light byte of every 0x0F frame with a good checksum, at its checksum
+// byte, kept when it changes the pins
+static void expectedChanges(const LinStream& stream, size_t from, byte& lights, std::vector<LightChange>& changes) {
+    byte lightPid = linPid(LIGHT_ID);
+    for (size_t i = from; i + 4 < stream.size(); i++) {
+        if (stream[i].value != 0x00 || stream[i + 1].value != 0x55 || stream[i + 2].value != lightPid) {
+            continue;
+        }
+        byte data = stream[i + 3].value;
+        if (stream[i + 4].value != linChecksum(lightPid, &data, 1)) {
+            continue;
+        }
+        if ((data & 0x07) != lights) {
+            lights = data & 0x07;
+            changes.push_back({stream[i + 4].arrival, lights});
+        }
+    }
+}
+
+static byte pinLights() {
+    return (hostPinState[LEFT_PIN] ? 0x01 : 0) | (hostPinState[RIGHT_PIN] ? 0x02 : 0) |
+           (hostPinState[TAIL_PIN] ? 0x04 : 0);
+}
+
+static uint64_t fnv(uint64_t hash, uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+        hash ^= (value >> (8 * i)) & 0xFF;
+        hash *= 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+static Summary simulate(const Options& options, bool print) {
+    Serial.hostEcho = print && options.serial;
+    WiFi.hostJoinMs = 2000;
+    hostSocketsEnabled = false;
+
+    // Lights driven, and the network to join if there is one, as if set
+    // from the settings page before this boot
+    LittleFS.begin();
+    configBegin();
+    configSetInt("output_enabled", 1);
+    if (options.idleS >= 0) {
+        configSetInt("idle_sleep_s", options.idleS);
+    }
+    if (options.wifi) {
+        configSet("wifi_ssid", options.wifi);
+        configSet("wifi_password", "simulated");
+    }
+    configCommit();
+
+    LinStream stream;
+    unsigned long endUs;
+    unsigned long state = options.seed;
+    Stretch stretch = {0, 0, false, 0};
+    unsigned long driveUs = 0;
+    if (options.capture) {
+        if (!loadCaptureFile(options.capture, stream)) {
+            fprintf(stderr, "Can't read %s\n", options.capture);
+            exit(1);
+        }
+        endUs = (stream.empty() ? 0 : stream.back().arrival) + 1000000;
+    } else {
+        endUs = (unsigned long)(options.seconds * 1e6);
+    }
+
+    std::vector<LightChange> expected;
+    std::vector<LightChange> observed;
+    byte expectedLights = 0;
+    size_t scanned = 0;
+    if (options.capture) {
+        expectedChanges(stream, 0, expectedLights, expected);
+    }
+
+    Summary summary = {};
+    summary.digest = 0xCBF29CE484222325ULL;
+    // Drive time counts from the start, the firmware's clock from before the wrap
+    uint64_t clockStartUs = (1ULL << 32) - (uint64_t)(options.wrapS * 1e6);
+    hostSetMicros(clockStartUs);
+    auto start = std::chrono::steady_clock::now();
+    setup();
+
+    size_t queued = 0;
+    byte lights = pinLights();
+    size_t matched = 0;
+    unsigned long now;
+    while ((now = hostMicros64() - clockStartUs) < endUs) {
+        if (!options.capture && driveUs < now + LOOKAHEAD_US && driveUs < endUs) {
+            // Drop what has already been queued, then a second more of the drive
+            stream.erase(stream.begin(), stream.begin() + queued);
+            scanned -= queued;
+            queued = 0;
+            driveUs = appendDrive(stream, driveUs, driveUs + 1000000, state, stretch);
+            expectedChanges(stream, scanned, expectedLights, expected);
+            scanned = stream.size();
+        }
+        while (queued < stream.size() && stream[queued].arrival <= now + LOOKAHEAD_US) {
+            Serial1.hostQueue(stream[queued].value, clockStartUs + stream[queued].arrival);
+            queued++;
+        }
+
+        loop();
+        summary.loops++;
+
+        byte pins = pinLights();
+        if (pins != lights) {
+            lights = pins;
+            LightChange change = {(unsigned long)(hostMicros64() - clockStartUs), pins};
+            long latency = -1;
+            if (matched < expected.size()) {
+                const LightChange& cause = expected[matched++];
+                latency = (long)(change.us - cause.us);
+                if (cause.lights != pins || latency < 0 || latency > MAX_LATENCY_US) {
+                    summary.mismatches++;
+                } else if ((unsigned long)latency > summary.latencyMaxUs) {
+                    summary.latencyMaxUs = latency;
+                }
+            } else {
+                summary.mismatches++; // a change the bus never asked for
+            }
+            observed.push_back(change);
+            summary.digest = fnv(fnv(summary.digest, change.us), pins);
+            if (print && !options.quiet) {
+                printf("{\"us\":%lu,\"left\":%d,\"right\":%d,\"tail\":%d,\"latency_us\":%ld}\n", change.us,
+                       pins & 0x01 ? 1 : 0, pins & 0x02 ? 1 : 0, pins & 0x04 ? 1 : 0, latency);
+            }
+        }
+
+        unsigned long step = options.loopUs;
+        unsigned long arrival;
+        if (Serial1.hostNextArrival(arrival)) {
+            long untilArrival = (int32_t)(arrival - micros());
+            if (untilArrival > 0 && (unsigned long)untilArrival < step) {
+                step = untilArrival;
+            }
+        }
+        hostAdvanceMicros(step);
+    }
+
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    summary.realS = std::chrono::duration<double>(elapsed).count();
+    summary.simulatedS = (hostMicros64() - clockStartUs) / 1e6;
+    summary.pinChanges = observed.size();
+    // Light changes on the bus that never reached the pins
+    summary.mismatches += expected.size() - matched;
+    summary.busChanges = expected.size();
+    summary.sleeps = powerSleeps;
+    summary.asleepMs = powerAsleepMs;
+    summary.maxWakeUs = powerMaxWakeUs;
+    summary.wakesOverBudget = powerWakesOverBudget;
+    return summary;
+}
+
+static bool parseOptions(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--serial") { options.serial = true; continue; }
+        if (arg == "--quiet") { options.quiet = true; continue; }
+        if (i + 1 >= argc) {
+            fprintf(stderr, "Missing value for %s\n", argv[i]);
+            return false;
+        }
+        if (arg == "--capture") options.capture = argv[++i];
+        else if (arg == "--seconds") options.seconds = atof(argv[++i]);
+        else if (arg == "--seed") options.seed = strtoul(argv[++i], nullptr, 0);
+        else if (arg == "--loop-us") options.loopUs = strtoul(argv[++i], nullptr, 0);
+        else if (arg == "--idle-s") options.idleS = atol(argv[++i]);
+        else if (arg == "--wrap-s") options.wrapS = atof(argv[++i]);
+        else if (arg == "--runs") options.runs = atoi(argv[++i]);
+        else if (arg == "--wifi") options.wifi = argv[++i];
+        else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            return false;
+        }
+    }
+    if (options.loopUs == 0 || options.runs < 1) {
+        fprintf(stderr, "--loop-us and --runs must be at least 1\n");
+        return false;
+    }
+    if (options.wrapS < 0 || options.wrapS > 4294) {
+        fprintf(stderr, "--wrap-s must be 0 to 4294\n");
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        return 1;
+    }
+
+    // The firmware keeps its state in globals, so each run gets a fresh
+    // process and hands its summary back through a pipe
+    int failures = 0;
+    uint64_t firstDigest = 0;
+    bool reproducible = true;
+    for (int run = 1; run <= options.runs; run++) {
+        int pipeFd[2];
+        if (pipe(pipeFd) != 0) {
+            perror("pipe");
+            return 1;
+        }
+        fflush(stdout);
+        pid_t child = fork();
+        if (child == 0) {
+            close(pipeFd[0]);
+            Summary summary = simulate(options, run == 1);
+            fflush(stdout);
+            ssize_t written = write(pipeFd[1], &summary, sizeof(summary));
+            _exit(written == sizeof(summary) ? 0 : 1);
+        }
+        close(pipeFd[1]);
+        Summary summary;
+        bool received = read(pipeFd[0], &summary, sizeof(summary)) == sizeof(summary);
+        close(pipeFd[0]);
+        int status = 0;
+        waitpid(child, &status, 0);
+        if (!received || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "FAIL: run %d did not finish\n", run);
+            return 1;
+        }
+
+        if (run == 1) {
+            firstDigest = summary.digest;
+        } else if (summary.digest != firstDigest) {
+            reproducible = false;
+        }
+        if (summary.mismatches || summary.wakesOverBudget) {
+            failures++;
+        }
+        printf("{\"run\":%d,\"simulated_s\":%.3f,\"real_s\":%.3f,\"speedup\":%.0f,\"loops\":%lu,"
+               "\"bus_changes\":%lu,\"pin_changes\":%lu,\"mismatches\":%lu,\"latency_max_us\":%lu,"
+               "\"sleeps\":%lu,\"asleep_s\":%.1f,\"wake_max_us\":%lu,\"wakes_over_budget\":%lu,"
+               "\"digest\":\"%016llx\"}\n",
+               run, summary.simulatedS, summary.realS, summary.simulatedS / summary.realS, summary.loops,
+               summary.busChanges, summary.pinChanges, summary.mismatches, summary.latencyMaxUs, summary.sleeps,
+               summary.asleepMs / 1000.0, summary.maxWakeUs, summary.wakesOverBudget,
+               (unsigned long long)summary.digest);
+    }
+    printf("{\"runs\":%d,\"reproducible\":%s}\n", options.runs, reproducible ? "true" : "false");
+
+    if (failures) {
+        fprintf(stderr, "FAIL: light changes missing, late or out of order, or a slow wake\n");
+    }
+    if (!reproducible) {
+        fprintf(stderr, "FAIL: runs differ\n");
+    }
+    return failures || !reproducible ? 1 : 0;
+}
@@ -0,0 +1,352 @@
+/*
+ * Saturating LIN traffic generator for stress testing the framer.
+ *
+ * Usage: stress [options]
+ *   --schedule ID:LEN,...  frame IDs and data lengths to cycle through, LEN 0
+ *                          sends a header nobody answers (default is the
+ *                          trailer bus schedule)
+ *   --frames N             frames to send (default 100000)
+ *   --seed N               random seed (default 1)
+ *   --filter PID           pass an expected PID to updateFrame() (default 0)
+ *   --ids ID,...           only keep these frame IDs, with setFilter()
+ *   --every N              keep one in N frames of each ID, with setDecimation()
+ *   --space US             idle time between frames (default 0, back-to-back)
+ *   --short-break P        probability a break is cut below 13 bits
+ *   --sync-in-data P       probability each data byte is forced to 0x55
+ *   --drop P               probability a byte is dropped
+ *   --bitflip P            probability a frame gets one flipped bit
+ *   --gap P                probability of an inter-byte gap inside a frame
+ *   --gap-us US            centre of those gaps (default BREAK_THRESHOLD)
+ *   --sweep                repeat the run with --space from 0 to 2000 us
+ *
+ * Every frame is sent at 19200 baud with no inter-byte space unless a fault
+ * adds one. Decoded frames are compared with what was meant to be sent and
+ * the results are printed as one JSON object per run. Filtered frames
+ * aren't expected, one decoded with an ID outside --ids is counted as
+ * leaked, and with --every the miss count is how many fewer than one in N
+ * came through.
+*/
+
+#include <Arduino.h>
+#include <chrono>
+#include <random>
+#include <string>
+
+#include "lin.h"
+#include "lin_stream.h"
+
+struct ScheduleEntry {
+    byte pid;
+    short length;
+};
+
+struct Options {
+    std::vector<ScheduleEntry> schedule;
+    unsigned long frames = 100000;
+    unsigned long seed = 1;
+    byte filter = 0;
+    uint64_t ids = lincore::ALL_IDS;
+    unsigned long every = 1;
+    unsigned long space = 0;
+    double shortBreak = 0;
+    double syncInData = 0;
+    double drop = 0;
+    double bitflip = 0;
+    double gap = 0;
+    unsigned long gapUs = lin::BREAK_THRESHOLD;
+    bool sweep = false;
+};
+
+// What the generator meant to put on the bus, used as ground truth
+struct SentFrame {
+    unsigned long syncArrival;
+    byte bytes[11];
+    short length;
+    bool faulted;
+    bool matched;
+};
+
+struct Stats {
+    unsigned long sent = 0;
+    unsigned long sentFaulted = 0;
+    unsigned long decoded = 0;
+    unsigned long correct = 0;
+    unsigned long misframed = 0;
+    unsigned long falseAccepted = 0;
+    unsigned long missed = 0;
+    unsigned long leaked = 0;
+    unsigned long busMicros = 0;
+    double cpuNs = 0;
+};
+
+static std::vector<ScheduleEntry> defaultSchedule() {
+    return {
+        {linPid(0x0F), 1}, {linPid(0x10), 0}, {linPid(0x0F), 1}, {linPid(0x11), 0},
+        {linPid(0x0F), 1}, {linPid(0x13), 7}, {linPid(0x0F), 1}, {linPid(0x18), 0},
+        {linPid(0x0F), 1}, {linPid(0x29), 8}, {linPid(0x0F), 1}, {linPid(0x2A), 8},
+        {linPid(0x0F), 1}, {linPid(0x2C), 8},
+    };
+}
+
+static bool parseSchedule(const char* text, std::vector<ScheduleEntry>& schedule) {
+    schedule.clear();
+    const char* p = text;
+    while (*p) {
+        char* end;
+        unsigned long id = strtoul(p, &end, 0);
+        if (end == p || *end != ':' || id > 0x3F) {
+            return false;
+        }
+        p = end + 1;
+        unsigned long length = strtoul(p, &end, 0);
+        if (end == p || length > 8) {
+            return false;
+        }
+        schedule.push_back({linPid((byte)id), (short)length});
+        p = *end == ',' ? end + 1 : end;
+    }
+    return !schedule.empty();
+}
+
+// Builds the wire stream and the ground truth side by side
+static void generate(const Options& opt, LinStream& wire, std::vector<SentFrame>& sent) {
+    std::mt19937 rng(opt.seed);
+    std::uniform_real_distribution<double> chance(0.0, 1.0);
+    std::uniform_int_distribution<int> anyByte(0, 255);
+    std::normal_distribution<double> gapJitter(0.0, 60.0);
+
+    unsigned long t = 0;
+    for (unsigned long n = 0; n < opt.frames; n++) {
+        const ScheduleEntry& entry = opt.schedule[n % opt.schedule.size()];
+        SentFrame frame = {};
+        frame.bytes[0] = 0x55;
+        frame.bytes[1] = entry.pid;
+        byte data[8];
+        for (short i = 0; i < entry.length; i++) {
+            data[i] = chance(rng) < opt.syncInData ? 0x55 : (byte)anyByte(rng);
+            frame.bytes[2 + i] = data[i];
+        }
+        frame.length = 2;
+        if (entry.length > 0) {
+            frame.bytes[2 + entry.length] = linChecksum(entry.pid, data, entry.length);
+            frame.length = entry.length + 3;
+        }
+
+        // Break: normally 13 dominant bits, a short one is 9 to 12 bits. The
+        // UART reports a 0x00 once it has clocked in a full character.
+        unsigned long breakBits = LIN_BREAK_BITS;
+        if (chance(rng) < opt.shortBreak) {
+            breakBits = 9 + rng() % 4;
+            frame.faulted = true;
+        }
+        wire.push_back({t + LIN_BYTE_US, 0x00});
+        t += (breakBits + 1) * LIN_BIT_US;
+
+        // Everything after the break, byte by byte, with the wire faults
+        byte onWire[11];
+        memcpy(onWire, frame.bytes, frame.length);
+        if (chance(rng) < opt.bitflip) {
+            int index = rng() % frame.length;
+            onWire[index] ^= (byte)(1 << (rng() % 8));
+            frame.faulted = true;
+        }
+        for (short i = 0; i < frame.length; i++) {
+            if (i > 0 && chance(rng) < opt.gap) {
+                double gap = opt.gapUs + gapJitter(rng);
+                t += gap > 0 ? (unsigned long)gap : 0;
+                frame.faulted = true;
+            }
+            t += LIN_BYTE_US;
+            if (chance(rng) < opt.drop) {
+                frame.faulted = true;
+                continue;
+            }
+            wire.push_back({t, onWire[i]});
+            if (i == 0) {
+                frame.syncArrival = t;
+            }
+        }
+        if (!frame.syncArrival) {
+            frame.syncArrival = t;
+        }
+        sent.push_back(frame);
+        t += opt.space;
+    }
+}
+
+static bool parseIds(const char* text, uint64_t& ids) {
+    ids = 0;
+    const char* p = text;
+    while (*p) {
+        char* end;
+        unsigned long id = strtoul(p, &end, 0);
+        if (end == p || id > 0x3F) {
+            return false;
+        }
+        ids |= lincore::idBit((byte)id);
+        p = *end == ',' ? end + 1 : end;
+    }
+    return ids != 0;
+}
+
+static void classify(const Options& opt, std::vector<SentFrame>& sent, size_t& next, unsigned long now,
+                     const byte* buffer, short length, lin& linStack, Stats& stats) {
+    stats.decoded++;
+    if (!(opt.ids & lincore::idBit(buffer[1]))) {
+        stats.leaked++;
+    }
+    // The frame being returned started at one of the last syncs seen
+    while (next + 1 < sent.size() && sent[next + 1].syncArrival < now) {
+        next++;
+    }
+    for (size_t i = next >= 2 ? next - 2 : 0; i <= next && i < sent.size(); i++) {
+        SentFrame& frame = sent[i];
+        if (!frame.matched && frame.length == length && memcmp(frame.bytes, buffer, length) == 0) {
+            frame.matched = true;
+            stats.correct++;
+            return;
+        }
+    }
+    stats.misframed++;
+    // A wrong frame that still passes the checksum would be acted on
+    if (length >= 3 && linStack.calculateChecksum((byte*)buffer, length - 1) == buffer[length - 1]) {
+        stats.falseAccepted++;
+    }
+}
+
+static Stats run(const Options& opt) {
+    LinStream wire;
+    std::vector<SentFrame> sent;
+    wire.reserve(opt.frames * 12);
+    sent.reserve(opt.frames);
+    generate(opt, wire, sent);
+
+    lin linStack;
+    linStack.setupSerial();
+    linStack.setFilter(opt.ids);
+    for (byte id = 0; id < 64; id++) {
+        linStack.setDecimation(id, (byte)opt.every);
+    }
+    Serial1.hostClear();
+    queueStream(Serial1, wire);
+    hostSetMicros(0);
+
+    Stats stats;
+    size_t next = 0;
+    short bytesRead;
+    auto start = std::chrono::steady_clock::now();
+    for (const auto& b : wire) {
+        hostSetMicros(b.arrival);
+        while ((bytesRead = linStack.updateFrame(opt.filter)) > 0) {
+            classify(opt, sent, next, b.arrival, linStack.dataBuffer, bytesRead, linStack, stats);
+        }
+    }
+    hostAdvanceMicros(10000);
+    while ((bytesRead = linStack.updateFrame(opt.filter)) > 0) {
+        classify(opt, sent, next, micros(), linStack.dataBuffer, bytesRead, linStack, stats);
+    }
+    auto end = std::chrono::steady_clock::now();
+    stats.cpuNs = std::chrono::duration<double, std::nano>(end - start).count();
+    stats.busMicros = wire.empty() ? 0 : wire.back().arrival;
+
+    // Which frames decimation keeps shifts whenever a misframe reads a
+    // wanted PID, so decimated runs only compare how many came through
+    unsigned long wantedFrames = 0;
+    for (const auto& frame : sent) {
+        stats.sent++;
+        bool wanted = (!opt.filter || frame.bytes[1] == opt.filter) && (opt.ids & lincore::idBit(frame.bytes[1]));
+        if (frame.faulted) {
+            stats.sentFaulted++;
+        } else if (wanted) {
+            wantedFrames++;
+            if (!frame.matched && opt.every == 1) {
+                stats.missed++;
+            }
+        }
+    }
+    if (opt.every > 1 && wantedFrames / opt.every > stats.correct) {
+        stats.missed = wantedFrames / opt.every - stats.correct;
+    }
+    return stats;
+}
+
+static void report(const Options& opt, const Stats& s) {
+    double busSeconds = s.busMicros / 1e6;
+    double cpuSeconds = s.cpuNs / 1e9;
+    printf("{\"space_us\":%lu,\"sent\":%lu,\"sent_faulted\":%lu,\"decoded\":%lu,\"correct\":%lu,"
+           "\"misframed\":%lu,\"false_accepted\":%lu,\"missed\":%lu,\"leaked\":%lu,"
+           "\"bus_frames_per_s\":%.1f,\"decode_frames_per_s\":%.0f,"
+           "\"misframe_rate\":%.6f,\"false_accept_rate\":%.6f,\"miss_rate\":%.6f}\n",
+           opt.space, s.sent, s.sentFaulted, s.decoded, s.correct,
+           s.misframed, s.falseAccepted, s.missed, s.leaked,
+           busSeconds > 0 ? s.sent / busSeconds : 0.0,
+           cpuSeconds > 0 ? s.decoded / cpuSeconds : 0.0,
+           s.sent ? (double)s.misframed / s.sent : 0.0,
+           s.sent ? (double)s.falseAccepted / s.sent : 0.0,
+           s.sent ? (double)s.missed / s.sent : 0.0);
+    fflush(stdout);
+}
+
+int main(int argc, char** argv) {
+    Options opt;
+    opt.schedule = defaultSchedule();
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--sweep") {
+            opt.sweep = true;
+        } else if (!hasValue) {
+            fprintf(stderr, "Missing value for %s\n", argv[i]);
+            return 1;
+        } else if (arg == "--schedule") {
+            if (!parseSchedule(argv[++i], opt.schedule)) {
+                fprintf(stderr, "Bad schedule, expected ID:LEN,ID:LEN,...\n");
+                return 1;
+            }
+        } else if (arg == "--frames") {
+            opt.frames = strtoul(argv[++i], nullptr, 0);
+        } else if (arg == "--seed") {
+            opt.seed = strtoul(argv[++i], nullptr, 0);
+        } else if (arg == "--filter") {
+            opt.filter = (byte)strtoul(argv[++i], nullptr, 0);
+        } else if (arg == "--ids") {
+            if (!parseIds(argv[++i], opt.ids)) {
+                fprintf(stderr, "Bad ids, expected ID,ID,...\n");
+                return 1;
+            }
+        } else if (arg == "--every") {
+            opt.every = strtoul(argv[++i], nullptr, 0);
+            if (opt.every < 1 || opt.every > 255) {
+                fprintf(stderr, "--every must be 1 to 255\n");
+                return 1;
+            }
+        } else if (arg == "--space") {
+            opt.space = strtoul(argv[++i], nullptr, 0);
+        } else if (arg == "--short-break") {
+            opt.shortBreak = atof(argv[++i]);
+        } else if (arg == "--sync-in-data") {
+            opt.syncInData = atof(argv[++i]);
+        } else if (arg == "--drop") {
+            opt.drop = atof(argv[++i]);
+        } else if (arg == "--bitflip") {
+            opt.bitflip = atof(argv[++i]);
+        } else if (arg == "--gap") {
+            opt.gap = atof(argv[++i]);
+        } else if (arg == "--gap-us") {
+            opt.gapUs = strtoul(argv[++i], nullptr, 0);
+        } else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    if (!opt.sweep) {
+        report(opt, run(opt));
+        return 0;
+    }
+    for (unsigned long space = 0; space <= 2000; space += 100) {
+        opt.space = space;
+        report(opt, run(opt));
+    }
+    return 0;
+}
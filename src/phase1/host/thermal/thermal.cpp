@@ -0,0 +1,247 @@
+/*
+ * Checks the thermal protection against modelled board temperatures.
+ *
+ * Usage: thermal [--seed N]
+ *
+ * Drives the sensor (the shim's analogReadTemp()) through a hot afternoon
+ * behind the bumper: warming up past the derate and shutdown thresholds and
+ * cooling back down, with sensor noise, while the lights follow a drive
+ * (tail lights on, the left signal blinking) through processLightLINFrame().
+ * thermalPoll() is called every 10 ms on the virtual clock, the way loop()
+ * would. Checks the tail lights are PWM'd only while derated, every output is
+ * off during shutdown even as light frames keep arriving, each state is left
+ * only once the temperature is the hysteresis below its threshold, the noise
+ * doesn't make it chatter, and the minimum, maximum, history and saved record
+ * are right. Then turns the output off while derated and checks the tail goes
+ * dark, and times thermalPoll() between samples and when sampling.
+ * Prints a JSON line per case and a summary, and exits non-zero on any
+ * failure.
+*/
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <chrono>
+#include <string>
+
+#include "check.h"
+#include "config.h"
+#include "lights.h"
+#include "thermal.h"
+
+static unsigned long lcg(unsigned long& state) {
+    state = (state * 1103515245 + 12345) & 0x7FFFFFFF;
+    return state >> 8;
+}
+
+// Up from 30 C to 95 C over 20 minutes, held for 5, and back to 40 C over 20
+static float profileC(unsigned long ms) {
+    const float minute = 60000.0f;
+    if (ms < 20 * minute) {
+        return 30.0f + 65.0f * ms / (20 * minute);
+    }
+    if (ms < 25 * minute) {
+        return 95.0f;
+    }
+    if (ms < 45 * minute) {
+        return 95.0f - 55.0f * (ms - 25 * minute) / (20 * minute);
+    }
+    return 40.0f;
+}
+
+struct Transition {
+    unsigned long ms;
+    ThermalState to;
+    float trueC; // the board, unfiltered
+};
+
+static void summerAfternoon(unsigned long seed) {
+    const char* name = "summer";
+    unsigned long noise = seed;
+    ThermalState last = thermalState();
+    std::vector<Transition> transitions;
+    unsigned long pwmMs = 0;
+    bool badOutputs = false;
+    bool leftMissing = false;
+
+    for (unsigned long ms = 0; ms <= 50 * 60000UL; ms += 10) {
+        hostSetMicros(ms * 1000);
+        float trueC = profileC(ms);
+        hostTemperatureC = trueC + ((long)(lcg(noise) % 301) - 150) / 100.0f; // +-1.5 C
+        // The car's light frame every 20 ms, left blinking at 1.5 Hz
+        if (ms % 20 == 0) {
+            processLightLINFrame(0x04 | ((ms / 333) % 2 ? 0x01 : 0x00));
+        }
+        thermalPoll(ms);
+
+        ThermalState state = thermalState();
+        if (state != last) {
+            transitions.push_back({ms, state, trueC});
+            last = state;
+        }
+        int tail = hostPinState[TAIL_PIN];
+        int left = hostPinState[LEFT_PIN];
+        switch (state) {
+            case THERMAL_NORMAL:
+                badOutputs |= tail != HIGH;
+                leftMissing |= left != (left_state ? HIGH : LOW);
+                break;
+            case THERMAL_DERATED:
+                badOutputs |= tail != LIGHTS_DERATE_DUTY;
+                leftMissing |= left != (left_state ? HIGH : LOW);
+                pwmMs += 10;
+                break;
+            case THERMAL_SHUTDOWN:
+                badOutputs |= tail != LOW || left != LOW || hostPinState[RIGHT_PIN] != LOW;
+                break;
+        }
+    }
+
+    // Up through derating to shutdown, and back down the same way
+    static const ThermalState expected[] = {THERMAL_DERATED, THERMAL_SHUTDOWN, THERMAL_DERATED, THERMAL_NORMAL};
+    bool sequence = transitions.size() == 4;
+    for (size_t i = 0; sequence && i < 4; i++) {
+        sequence = transitions[i].to == expected[i];
+    }
+    if (!sequence) {
+        fail(name, "states didn't go normal, derated, shutdown, derated, normal exactly once each");
+    } else {
+        // The filter lags the board on the way up and down, but each change
+        // is on the right side of its threshold, less the hysteresis going down
+        if (transitions[0].trueC < THERMAL_DERATE_DEFAULT_C - 2) fail(name, "derated too early");
+        if (transitions[1].trueC < THERMAL_SHUTDOWN_DEFAULT_C - 2) fail(name, "shut down too early");
+        if (transitions[2].trueC > THERMAL_SHUTDOWN_DEFAULT_C - THERMAL_HYSTERESIS_C + 2) {
+            fail(name, "came out of shutdown too early");
+        }
+        if (transitions[3].trueC > THERMAL_DERATE_DEFAULT_C - THERMAL_HYSTERESIS_C + 2) {
+            fail(name, "came out of derating too early");
+        }
+    }
+    if (badOutputs) fail(name, "outputs didn't match the state");
+    if (leftMissing) fail(name, "turn signal changed by derating");
+    if (thermalDerateEvents != 1 || thermalShutdownEvents != 1) fail(name, "wrong event counts");
+    if (thermalMaxC < 93 || thermalMaxC > 97) fail(name, "max since boot wrong");
+    if (thermalMinC < 28 || thermalMinC > 32) fail(name, "min since boot wrong");
+
+    // The record is in the journal, as a reboot would read it back
+    configBegin();
+    long record = configGetInt("thermal_record_c", -1000);
+    if (record != (long)thermalRecordC || record < 92) fail(name, "record not saved");
+
+    // Two hours of minutes, 50 so far, each the hottest of its minute
+    String json = thermalStatusJson(millis());
+    int points = 0;
+    int at = json.indexOf("\"history\":[");
+    if (at >= 0 && json.charAt(at + 11) != ']') {
+        points = 1;
+        for (unsigned int i = at; i < json.length(); i++) {
+            points += json.charAt(i) == ',';
+        }
+    }
+    if (points != 50) fail(name, "history points wrong");
+
+    std::string list;
+    for (size_t i = 0; i < transitions.size(); i++) {
+        char item[96];
+        snprintf(item, sizeof(item), "%s{\"s\":%.2f,\"to\":\"%s\",\"board_c\":%.1f}", i ? "," : "",
+                 transitions[i].ms / 1000.0, thermalStateName(transitions[i].to), transitions[i].trueC);
+        list += item;
+    }
+    checkCase("{\"case\":\"%s\",\"transitions\":[%s],\"pwm_s\":%.0f,\"min_c\":%.1f,\"max_c\":%.1f,"
+              "\"record_c\":%ld,\"history_points\":%d}",
+              name, list.c_str(), pwmMs / 1000.0, thermalMinC, thermalMaxC, record, points);
+}
+
+// Warms the board to the given temperature until the state follows, light
+// frames arriving every 20 ms as they would. Returns false if it never does.
+static bool holdUntil(float boardC, ThermalState want) {
+    unsigned long ms = millis();
+    for (unsigned long end = ms + 10 * 60000UL; ms < end && thermalState() != want; ms += 10) {
+        hostSetMicros(ms * 1000);
+        hostTemperatureC = boardC;
+        if (ms % 20 == 0) {
+            processLightLINFrame(0x04);
+        }
+        thermalPoll(ms);
+    }
+    return thermalState() == want;
+}
+
+// Turning the output off from the main page while derated, as main.cpp's
+// toggleOutputEnabled() does. The tail has to leave its PWM slice, a plain
+// digitalWrite() doesn't reach the pin while PWM drives it.
+static void disableWhileDerated() {
+    const char* name = "disable_derated";
+    if (!holdUntil(THERMAL_DERATE_DEFAULT_C + 8, THERMAL_DERATED)) {
+        fail(name, "didn't derate");
+    }
+    int derated = hostPinState[TAIL_PIN];
+    if (derated != LIGHTS_DERATE_DUTY) fail(name, "tail not PWM'd while derated");
+
+    output_enabled = false;
+    lightsAllOff();
+    int disabled = hostPinState[TAIL_PIN];
+    processLightLINFrame(0x04);
+    int afterFrame = hostPinState[TAIL_PIN];
+    if (disabled != LOW || afterFrame != LOW) fail(name, "tail left on after disabling the output");
+
+    output_enabled = true;
+    processLightLINFrame(0x04);
+    int enabled = hostPinState[TAIL_PIN];
+    if (enabled != LIGHTS_DERATE_DUTY) fail(name, "tail not PWM'd again once enabled");
+
+    if (!holdUntil(THERMAL_DERATE_DEFAULT_C - THERMAL_HYSTERESIS_C - 10, THERMAL_NORMAL)) {
+        fail(name, "didn't come out of derating");
+    }
+    int cooled = hostPinState[TAIL_PIN];
+    if (cooled != HIGH) fail(name, "tail not back on full");
+
+    checkCase("{\"case\":\"%s\",\"derated\":%d,\"disabled\":%d,\"after_frame\":%d,\"enabled\":%d,"
+           "\"cooled\":%d}",
+           name, derated, disabled, afterFrame, enabled, cooled);
+}
+
+static void timePoll() {
+    const int iterations = 1000000;
+    unsigned long ms = millis();
+    // Between samples, the cost every loop() pays
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        thermalPoll(ms);
+    }
+    double idleNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() /
+                    iterations;
+    // Sampling, once a second
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        ms += THERMAL_SAMPLE_MS;
+        thermalPoll(ms);
+    }
+    double sampleNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() /
+                      iterations;
+    checkCase("{\"case\":\"timing\",\"poll_ns\":%.1f,\"sample_ns\":%.1f}", idleNs, sampleNs);
+}
+
+int main(int argc, char** argv) {
+    unsigned long seed = 1;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--seed" && i + 1 < argc) {
+            seed = strtoul(argv[++i], nullptr, 0);
+        } else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    Serial.hostEcho = false;
+    LittleFS.begin();
+    configBegin();
+    output_enabled = true;
+    thermalBegin(THERMAL_DERATE_DEFAULT_C, THERMAL_SHUTDOWN_DEFAULT_C, true);
+
+    summerAfternoon(seed);
+    disableWhileDerated();
+    timePoll();
+
+    return checkSummary();
+}
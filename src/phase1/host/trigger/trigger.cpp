@@ -0,0 +1,435 @@
+/*
+ * Checks triggered captures against a simulated bus.
+ *
+ * Usage: trigger [--frames N]
+ *
+ * Plays the car's schedule (the 0x0F light frame and the unanswered 0x10
+ * header alternating every 10 ms) through captureFrame() on the virtual
+ * clock, calling capturePoll() every millisecond the way loop() does, once
+ * for each trigger condition with an event placed at a known time: a rare
+ * PID, the brakes coming on, a light change, a corrupted frame and the
+ * light frame going missing, plus a capture of only the light frame's ID.
+ * Each saved capture is unpacked from the
+ * in-memory LittleFS and compared frame by frame against what was sent from
+ * the pre-trigger frames to the end of the recording. Then checks a
+ * recording that outruns its queue counts the drops, that block writes
+ * longer than the UART FIFO lasts are counted, that triggers which could
+ * never fire are refused with their reason, times captureFrame()
+ * over --frames frames while armed, and re-arms for one ID with the ring
+ * full to the last byte, which must keep all of its frames. Prints a JSON line per
+ * case and a summary, and exits non-zero on any mismatch.
+*/
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "check.h"
+#include "trigger.h"
+
+#define LIGHT_PID 0xCF
+#define STATUS_PID 0x50
+#define RARE_PID 0x3C
+
+struct Sent {
+    unsigned long timeMs;
+    byte bytes[4];
+    short length;
+    byte expected;
+};
+
+static byte checksum(byte pid, byte data) {
+    int sum = pid + data;
+    return (byte)~(sum > 0xFF ? sum - 0xFF : sum);
+}
+
+// The schedule with one event at eventMs, what each case changes
+struct Scenario {
+    const char* name;
+    TriggerConfig trigger;
+    unsigned long eventMs;
+    bool eventFrame; // the trigger is a frame, rather than one missing
+};
+
+static void buildBus(const Scenario& scenario, unsigned long endMs, std::vector<Sent>& bus) {
+    for (unsigned long t = 1000; t < endMs; t += 10) {
+        bool light = (t / 10) % 2 == 0;
+        bool after = t >= scenario.eventMs;
+        Sent frame = {t, {0x55, light ? (byte)LIGHT_PID : (byte)STATUS_PID, 0, 0}, light ? (short)4 : (short)2, 0};
+        byte lights = 0x04;
+        if (light) {
+            if (strcmp(scenario.name, "data") == 0 && after) {
+                lights |= 0x0B; // brakes
+            } else if (strcmp(scenario.name, "change") == 0 && after) {
+                lights |= 0x01; // left signal
+            } else if (strcmp(scenario.name, "missing") == 0 && after) {
+                continue;
+            }
+            frame.bytes[2] = lights;
+            frame.bytes[3] = checksum(LIGHT_PID, lights);
+            frame.expected = frame.bytes[3];
+            if (strcmp(scenario.name, "checksum") == 0 && t == scenario.eventMs) {
+                frame.bytes[2] ^= 0x10;
+                frame.expected = checksum(LIGHT_PID, frame.bytes[2]);
+            }
+        } else {
+            frame.expected = STATUS_PID;
+            if (strcmp(scenario.name, "pid") == 0 && t == scenario.eventMs) {
+                frame.bytes[1] = RARE_PID;
+                frame.expected = RARE_PID;
+            }
+        }
+        bus.push_back(frame);
+    }
+}
+
+static bool readCapture(std::vector<LINFrame>& frames) {
+    File file = LittleFS.open(CAPTURE_PATH, "r");
+    if (!file) {
+        return false;
+    }
+    CaptureDecoder decoder;
+    decoder.begin();
+    LINFrame frame;
+    int value;
+    while ((value = file.read()) >= 0) {
+        if (decoder.push(value, frame)) {
+            frames.push_back(frame);
+        }
+    }
+    file.close();
+    return decoder.valid();
+}
+
+// Plays the bus with loop()'s polling up to endMs, skipping polls between
+// stallFrom and stallUntil
+static void play(const std::vector<Sent>& bus, unsigned long endMs, unsigned long stallFrom = 0,
+                 unsigned long stallUntil = 0) {
+    size_t next = 0;
+    for (unsigned long t = millis(); t < endMs; t++) {
+        hostSetMicros(t * 1000);
+        while (next < bus.size() && bus[next].timeMs <= t) {
+            captureFrame(bus[next].bytes, bus[next].length, bus[next].expected, bus[next].timeMs * 1000, t);
+            next++;
+        }
+        if (t < stallFrom || t >= stallUntil) {
+            capturePoll(t);
+        }
+    }
+}
+
+static void runScenario(const Scenario& scenario) {
+    const unsigned long endMs = scenario.eventMs + 5000;
+    std::vector<Sent> bus;
+    buildBus(scenario, endMs, bus);
+
+    // The bus has been running before the capture is armed at 2 s
+    hostSetMicros(0);
+    size_t armAt = 0;
+    while (bus[armAt].timeMs < 2000) {
+        armAt++;
+    }
+    std::vector<Sent> before(bus.begin(), bus.begin() + armAt);
+    std::vector<Sent> after(bus.begin() + armAt, bus.end());
+    play(before, 2000);
+    hostSetMicros(2000 * 1000);
+    captureArm(scenario.trigger, 2000);
+    play(after, endMs);
+
+    // Frames with IDs the capture doesn't want never reach the ring
+    std::vector<Sent> kept;
+    for (const auto& frame : bus) {
+        if (scenario.trigger.ids & lincore::idBit(frame.bytes[1])) {
+            kept.push_back(frame);
+        }
+    }
+    bus.swap(kept);
+
+    // What should have been saved: preFrames before the trigger frame (or
+    // the trigger time), through postMs after it
+    unsigned long triggerMs = scenario.eventMs;
+    if (scenario.trigger.condition == TRIGGER_NOW) {
+        triggerMs = 2000;
+    } else if (!scenario.eventFrame) {
+        // Missing: the last light frame before the gap, plus the timeout
+        unsigned long last = 0;
+        for (const auto& frame : bus) {
+            if (frame.bytes[1] == LIGHT_PID) {
+                last = frame.timeMs;
+            }
+        }
+        triggerMs = last + scenario.trigger.missingMs;
+    }
+    size_t first = 0;
+    while (first < bus.size() && bus[first].timeMs < triggerMs) {
+        first++;
+    }
+    size_t end = first + (scenario.eventFrame ? 1 : 0);
+    first = first > scenario.trigger.preFrames ? first - scenario.trigger.preFrames : 0;
+    while (end < bus.size() && bus[end].timeMs < triggerMs + scenario.trigger.postMs) {
+        end++;
+    }
+
+    std::vector<LINFrame> saved;
+    if (captureState() != CAPTURE_COMPLETE || !readCapture(saved)) {
+        fail(scenario.name, "capture not complete");
+    } else if (saved.size() != end - first) {
+        fail(scenario.name, "frame count");
+        fprintf(stderr, "  saved %u expected %u\n", (unsigned)saved.size(), (unsigned)(end - first));
+    } else {
+        unsigned long startMs = bus[first].timeMs;
+        for (size_t i = 0; i < saved.size(); i++) {
+            const Sent& sent = bus[first + i];
+            if (saved[i].timestampUs != (sent.timeMs - startMs) * 1000 || saved[i].pid != sent.bytes[1] ||
+                (sent.length == 4 && saved[i].data[0] != sent.bytes[2])) {
+                fail(scenario.name, "frame contents");
+                break;
+            }
+        }
+        if (captureTriggerUs != (triggerMs - startMs) * 1000) {
+            fail(scenario.name, "trigger time");
+        }
+    }
+    checkCase("{\"case\":\"%s\",\"trigger\":\"%s\",\"frames\":%lu,\"bytes\":%lu,\"trigger_ms\":%lu,\"dropped\":%lu}",
+           scenario.name, triggerDescription(scenario.trigger).c_str(), captureSavedFrames, captureSavedBytes,
+           captureTriggerUs / 1000, captureDroppedFrames);
+}
+
+int main(int argc, char** argv) {
+    unsigned long timedFrames = 1000000;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string arg = argv[i];
+        if (arg == "--frames") timedFrames = strtoul(argv[i + 1], nullptr, 0);
+        else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+    LittleFS.begin();
+    LittleFS.mkdir("/logs");
+
+    std::vector<Scenario> scenarios;
+    Scenario scenario;
+    scenario = {"now", TriggerConfig(), 0, false};
+    scenario.trigger.preFrames = 100;
+    scenarios.push_back(scenario);
+
+    scenario = {"ids", TriggerConfig(), 0, false};
+    scenario.trigger.ids = lincore::idBit(LIGHT_PID);
+    scenario.trigger.preFrames = 40;
+    scenarios.push_back(scenario);
+
+    scenario = {"pid", TriggerConfig(), 4010, true};
+    scenario.trigger.condition = TRIGGER_PID;
+    scenario.trigger.anyPid = false;
+    scenario.trigger.pid = RARE_PID;
+    scenario.trigger.preFrames = 50;
+    scenarios.push_back(scenario);
+
+    scenario = {"data", TriggerConfig(), 5000, true};
+    scenario.trigger.condition = TRIGGER_DATA;
+    scenario.trigger.anyPid = false;
+    scenario.trigger.pid = LIGHT_PID;
+    scenario.trigger.mask = 0x08;
+    scenario.trigger.value = 0x08;
+    scenario.trigger.preFrames = CAPTURE_MAX_PRE_FRAMES;
+    scenario.trigger.postMs = 2000;
+    scenarios.push_back(scenario);
+
+    scenario = {"change", TriggerConfig(), 3500, true};
+    scenario.trigger.condition = TRIGGER_CHANGE;
+    scenario.trigger.anyPid = false;
+    scenario.trigger.pid = LIGHT_PID;
+    scenario.trigger.mask = 0x2F;
+    scenario.trigger.preFrames = 20;
+    scenarios.push_back(scenario);
+
+    scenario = {"checksum", TriggerConfig(), 6000, true};
+    scenario.trigger.condition = TRIGGER_CHECKSUM;
+    scenario.trigger.preFrames = 10;
+    scenarios.push_back(scenario);
+
+    scenario = {"missing", TriggerConfig(), 4500, false};
+    scenario.trigger.condition = TRIGGER_MISSING;
+    scenario.trigger.anyPid = false;
+    scenario.trigger.pid = LIGHT_PID;
+    scenario.trigger.missingMs = 100;
+    scenario.trigger.preFrames = 30;
+    scenarios.push_back(scenario);
+
+    for (const auto& s : scenarios) {
+        runScenario(s);
+    }
+
+    // Flash writes stalled for longer than the ring can queue: frames are
+    // dropped and counted, never overwritten
+    {
+        Scenario stall = {"stall", TriggerConfig(), 0, false};
+        stall.trigger.postMs = 22000;
+        std::vector<Sent> bus;
+        buildBus(stall, 26000, bus);
+        bus.erase(bus.begin(), std::find_if(bus.begin(), bus.end(), [](const Sent& f) { return f.timeMs >= 2000; }));
+        hostSetMicros(2000 * 1000);
+        captureArm(stall.trigger, 2000);
+        play(bus, 26000, 3000, 21000);
+        std::vector<LINFrame> saved;
+        readCapture(saved);
+        bool ordered = true;
+        for (size_t i = 1; i < saved.size(); i++) {
+            ordered = ordered && saved[i].timestampUs > saved[i - 1].timestampUs;
+        }
+        size_t sent = 0;
+        for (const auto& frame : bus) {
+            sent += frame.timeMs < 24000;
+        }
+        if (captureDroppedFrames == 0 || saved.size() + captureDroppedFrames != sent || !ordered) {
+            fail("stall", "dropped frames");
+        }
+        checkCase("{\"case\":\"stall\",\"frames\":%lu,\"dropped\":%lu,\"sent\":%u}", captureSavedFrames,
+               captureDroppedFrames, (unsigned)sent);
+    }
+
+    // Each block write timed against the UART FIFO, one under it and one over
+    for (unsigned long writeUs : {5000UL, 20000UL}) {
+        Scenario slow = {"slow_flash", TriggerConfig(), 0, false};
+        slow.trigger.postMs = 5000;
+        std::vector<Sent> bus;
+        buildBus(slow, 8000, bus);
+        bus.erase(bus.begin(), std::find_if(bus.begin(), bus.end(), [](const Sent& f) { return f.timeMs >= 2000; }));
+        hostSetMicros(2000 * 1000);
+        captureArm(slow.trigger, 2000);
+        LittleFS.hostWriteMicros = writeUs;
+        play(bus, 8000);
+        LittleFS.hostWriteMicros = 0;
+        unsigned long blocks = (captureSavedBytes + CAPTURE_BLOCK_BYTES - 1) / CAPTURE_BLOCK_BYTES;
+        unsigned long overruns = writeUs > 32 * 10 * 1000000UL / lincore::BAUD ? blocks : 0;
+        if (captureMaxFlashUs != writeUs) fail(slow.name, "longest flash write wrong");
+        if (captureFlashOverruns != overruns) fail(slow.name, "flash overruns wrong");
+        checkCase("{\"case\":\"%s\",\"write_us\":%lu,\"blocks\":%lu,\"flash_max_us\":%lu,\"flash_overruns\":%lu}",
+               slow.name, writeUs, blocks, captureMaxFlashUs, captureFlashOverruns);
+    }
+
+    // Triggers that could never fire are refused without touching the
+    // capture in progress, each with its reason
+    {
+        const char* name = "arm_errors";
+        TriggerConfig running;
+        running.condition = TRIGGER_PID;
+        running.anyPid = false;
+        running.pid = RARE_PID;
+        bool armed = captureArm(running, millis());
+        TriggerConfig noPid;
+        noPid.condition = TRIGGER_MISSING;
+        TriggerConfig badPid = running;
+        badPid.pid = RARE_PID | 0x80;
+        TriggerConfig badIndex;
+        badIndex.condition = TRIGGER_DATA;
+        badIndex.index = 8;
+        struct {
+            const TriggerConfig& trigger;
+            CaptureArmError error;
+        } refused[] = {{noPid, CAPTURE_ARM_NO_PID}, {badPid, CAPTURE_ARM_BAD_PID}, {badIndex, CAPTURE_ARM_BAD_INDEX}};
+        int wrong = 0;
+        for (const auto& bad : refused) {
+            wrong += captureArm(bad.trigger, millis()) || captureArmError != bad.error;
+        }
+        if (!armed || captureArmError == CAPTURE_ARM_OK) fail(name, "bad trigger armed");
+        if (wrong) fail(name, "wrong reason");
+        if (captureState() != CAPTURE_ARMED || captureConfig().pid != RARE_PID) fail(name, "capture in progress disturbed");
+        checkCase("{\"case\":\"%s\",\"refused\":%d,\"wrong\":%d,\"last\":\"%s\"}", name,
+               (int)(sizeof(refused) / sizeof(refused[0])), wrong, captureArmErrorText(captureArmError));
+        captureStop(millis());
+    }
+
+    // Per-frame cost while armed, with a trigger that never fires
+    TriggerConfig never;
+    never.condition = TRIGGER_DATA;
+    never.anyPid = false;
+    never.pid = LIGHT_PID;
+    never.value = 0xFF;
+    captureArm(never, millis());
+    byte light[4] = {0x55, LIGHT_PID, 0x04, checksum(LIGHT_PID, 0x04)};
+    byte status[2] = {0x55, STATUS_PID};
+    // Timed in batches, single frames are too short for the clock
+    const unsigned long batch = 100;
+    std::vector<double> batchNs;
+    for (unsigned long i = 0; i < timedFrames; i += batch) {
+        auto start = std::chrono::steady_clock::now();
+        for (unsigned long j = i; j < i + batch; j++) {
+            if (j % 2 == 0) {
+                captureFrame(light, 4, light[3], j * 10000, j * 10);
+            } else {
+                captureFrame(status, 2, STATUS_PID, j * 10000, j * 10);
+            }
+        }
+        batchNs.push_back(std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / batch);
+    }
+    // The ring is full by now, how many frames it holds
+    String json = captureStatusJson();
+    unsigned long ringFrames = strtoul(json.c_str() + json.indexOf("\"ring_frames\":") + 14, nullptr, 10);
+    captureStop(millis());
+
+    // Re-armed for one ID with the ring full to the last byte and a frame of
+    // that ID the oldest, every one of them goes back on in order. Light
+    // frames with the wrong checksum take a byte more, so the ring can fill
+    // exactly.
+    {
+        unsigned long j = timedFrames;
+        unsigned long ringBytes = 0;
+        for (int i = 0; i < 1000 && ringBytes < CAPTURE_ARENA_BYTES; i++, j++) {
+            if (j % 2 == 0) {
+                captureFrame(light, 4, (byte)~light[3], j * 10000, j * 10);
+            } else {
+                captureFrame(status, 2, STATUS_PID, j * 10000, j * 10);
+            }
+            json = captureStatusJson();
+            ringBytes = strtoul(json.c_str() + json.indexOf("\"ring_bytes\":") + 13, nullptr, 10);
+        }
+        unsigned long held = strtoul(json.c_str() + json.indexOf("\"ring_frames\":") + 14, nullptr, 10);
+        byte pid = (j - held) % 2 == 0 ? LIGHT_PID : STATUS_PID;
+        unsigned long wanted = (held + 1) / 2;
+        TriggerConfig refilter;
+        refilter.condition = TRIGGER_PID;
+        refilter.anyPid = false;
+        refilter.pid = RARE_PID;
+        refilter.ids = lincore::idBit(pid);
+        hostSetMicros(j * 10000);
+        captureArm(refilter, j * 10);
+        json = captureStatusJson();
+        unsigned long kept = strtoul(json.c_str() + json.indexOf("\"ring_frames\":") + 14, nullptr, 10);
+        unsigned long dropped = captureDroppedFrames;
+
+        refilter.condition = TRIGGER_NOW;
+        refilter.preFrames = CAPTURE_MAX_PRE_FRAMES;
+        refilter.postMs = 0;
+        captureArm(refilter, j * 10);
+        for (unsigned long t = j * 10; t < j * 10 + 100 && captureState() != CAPTURE_COMPLETE; t++) {
+            capturePoll(t);
+        }
+        std::vector<LINFrame> saved;
+        bool ordered = readCapture(saved) && saved.size() == CAPTURE_MAX_PRE_FRAMES;
+        for (size_t i = 0; ordered && i < saved.size(); i++) {
+            ordered = saved[i].pid == pid && saved[i].timestampUs == i * 20000;
+        }
+        if (ringBytes != CAPTURE_ARENA_BYTES || kept != wanted || dropped || !ordered) {
+            fail("refilter", "frames lost or out of order");
+        }
+        checkCase("{\"case\":\"refilter\",\"ring_bytes\":%lu,\"pid\":%u,\"wanted\":%lu,\"kept\":%lu,"
+               "\"dropped\":%lu,\"saved\":%u}",
+               ringBytes, pid, wanted, kept, dropped, (unsigned)saved.size());
+    }
+
+    std::sort(batchNs.begin(), batchNs.end());
+    double totalNs = 0;
+    for (double ns : batchNs) {
+        totalNs += ns;
+    }
+
+    return checkSummary("\"timed_frames\":%lu,\"frame_ns\":%.1f,\"frame_p99_ns\":%.1f,\"ring_frames\":%lu,"
+                        "\"ring_bytes_per_frame\":%.2f",
+                        timedFrames, totalNs / batchNs.size(), batchNs[batchNs.size() * 99 / 100], ringFrames,
+                        (double)CAPTURE_ARENA_BYTES / ringFrames);
+}
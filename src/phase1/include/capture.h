@@ -0,0 +1,110 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <Arduino.h>
+
+// Logging Variables
+struct LINFrame {
+  unsigned long timestampUs; // from the start of the capture
+  byte sync;
+  byte pid;
+  byte data[8];  // Up to 8 data bytes
+  byte dataLength;  // Number of actual data bytes
+  byte checksum;
+  byte expectedChecksum;
+  bool checksumValid;
+  byte bus; // which receiver read it, 0 the trailer bus on Serial1
+};
+
+// Fill a capture record from a raw frame (sync, PID, data..., checksum)
+void buildCaptureFrame(LINFrame& frame, const byte dataBuffer[], short length, unsigned long timestampUs, byte expectedChecksum,
+                       byte bus = 0);
+// Write one capture line in the lin_capture.txt format (no line ending), the
+// timestamp in milliseconds with three decimals. Frames from any bus but 0
+// end in ",bus=N", so single bus captures read the same as ever.
+void printCaptureFrame(Print& out, const LINFrame& frame);
+// Parse one lin_capture.txt line back into a record, false for comments/blank/bad lines.
+// Older captures have whole millisecond timestamps.
+bool parseCaptureLine(const char* line, LINFrame& frame);
+// Human readable frame for the status page and serial output
+String formatFrameString(const byte dataBuffer[], short length, bool checksumValid, byte calculatedChecksum);
+
+// Packed captures (lin_capture.lcz). A capture is mostly the same few frames
+// over and over, so each record is a tag byte, the time since the previous
+// record only when it changed, and the frame itself only when it differs from
+// the last one with the same ID:
+//   tag: bits 0-5 frame ID, CAPTURE_TAG_REPEAT, CAPTURE_TAG_DELTA
+//   [delta us as a little-endian base-128 varint, if CAPTURE_TAG_DELTA]
+//   [PID, sync, data length | CAPTURE_LEN_VALID | bus << CAPTURE_LEN_BUS_SHIFT,
+//    data..., checksum, expected checksum if not valid,
+//    unless CAPTURE_TAG_REPEAT]
+// The file starts with CAPTURE_MAGIC. The car's schedule packs into two to
+// four bytes per frame against about 30 for a lin_capture.txt line. Captures
+// from before microsecond timestamps start with CAPTURE_MAGIC_MS and have
+// their deltas in milliseconds, the decoder reads both. The bus is in bits
+// that were always 0, so captures from one bus are unchanged and read as bus
+// 0, and a repeat is the same frame on the same bus.
+#define CAPTURE_MAGIC "LCZ2"
+#define CAPTURE_MAGIC_MS "LCZ1"
+#define CAPTURE_MAGIC_BYTES 4
+#define CAPTURE_TAG_REPEAT 0x40 // same frame as the last one with this ID
+#define CAPTURE_TAG_DELTA 0x80 // a new time delta follows
+#define CAPTURE_LEN_VALID 0x10
+#define CAPTURE_LEN_BUS_SHIFT 5 // buses 0-7
+#define CAPTURE_MAX_RECORD 19 // tag, 5 byte varint, PID, sync, length, 8 data, 2 checksums
+#define CAPTURE_BLOCK_BYTES 512
+#define CAPTURE_IDS 64
+
+// Packs frames into a fixed block, to be written out whenever append() says
+// it is full. No heap.
+class CaptureEncoder {
+  public:
+    // Starts a capture, the block then holds CAPTURE_MAGIC
+    void begin();
+    // false (and nothing added) if the block has no room left for a record
+    bool append(const LINFrame& frame);
+    const byte* data() const { return block; }
+    size_t length() const { return used; }
+    void clear() { used = 0; }
+
+    unsigned long frames = 0;
+    unsigned long bytes = 0; // whole capture so far, header included
+
+  private:
+    LINFrame last[CAPTURE_IDS];
+    bool seen[CAPTURE_IDS];
+    unsigned long lastTimestamp = 0;
+    unsigned long lastDelta = 0;
+    byte block[CAPTURE_BLOCK_BYTES];
+    size_t used = 0;
+};
+
+// Unpacks a capture one byte at a time, so it can be fed straight from a
+// file. push() returns true when the byte completed a frame.
+class CaptureDecoder {
+  public:
+    void begin();
+    bool push(byte value, LINFrame& frame);
+    // Whether the input so far starts with CAPTURE_MAGIC
+    bool valid() const { return !badMagic; }
+
+  private:
+    enum Field { MAGIC, TAG, DELTA, PID, SYNC, LENGTH, DATA, CHECKSUM, EXPECTED };
+
+    bool emit(LINFrame& frame);
+
+    LINFrame last[CAPTURE_IDS];
+    LINFrame current;
+    Field field = MAGIC;
+    byte position = 0; // in the magic, varint or data
+    byte tag = 0;
+    bool badMagic = false;
+    unsigned long deltaScale = 1; // 1000 for CAPTURE_MAGIC_MS
+    unsigned long timestamp = 0;
+    unsigned long delta = 0;
+};
+
+// Whether a file starts with either packed capture magic
+bool isPackedCapture(const byte header[], size_t length);
+
+#endif // CAPTURE_H
@@ -0,0 +1,39 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <Arduino.h>
+
+// Settings are kept in a single append-only journal, /config/journal.bin.
+// Each record is one key/value pair with a CRC32, later records win, and a
+// record cut short by a power loss fails its CRC and is dropped on the
+// next boot. Changes are staged with configSet() and written together by
+// configCommit(), so saving several settings is one small append rather than
+// rewriting a file per setting, and a commit either lands whole or not at
+// all. When the journal grows past CONFIG_JOURNAL_MAX it is compacted into a
+// fresh file holding only the current values, which then replaces the old
+// one with a rename.
+
+#define CONFIG_JOURNAL_PATH "/config/journal.bin"
+#define CONFIG_JOURNAL_TMP_PATH "/config/journal.tmp"
+#define CONFIG_JOURNAL_MAX 4096 // one littlefs block
+#define CONFIG_MAX_KEY 63
+#define CONFIG_MAX_VALUE 1024
+
+// Loads the journal with one sequential read. On first boot after an upgrade
+// the old per-setting text files are migrated into it and removed.
+bool configBegin();
+
+String configGet(const char* key, const char* fallback = "");
+long configGetInt(const char* key, long fallback = 0);
+void configSet(const char* key, const String& value);
+void configSetInt(const char* key, long value);
+// Appends every setting changed since the last commit, returns false if the
+// write failed (the values stay staged and go out with the next commit)
+bool configCommit();
+
+extern unsigned long configLoadMicros;
+extern size_t configJournalSize;
+extern unsigned int configCompactions;
+extern unsigned int configDroppedBytes; // torn or corrupt tail seen at boot
+
+#endif // CONFIG_H
@@ -0,0 +1,56 @@
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <Arduino.h>
+#include <lin_core.h>
+
+// Event bus between the LIN receive path and everything that watches it.
+// The lights are driven straight from the frame, everything else (the frame
+// text and serial echo, the history, the capture ring, the web push, the
+// stats) subscribes here. Publishing copies the event into a fixed ring in
+// constant time, and eventsDrain() later hands each one to the subscribers
+// that asked for its type, so the receive path costs the same however many
+// there are. Nothing allocates: the ring and the subscriber table are fixed,
+// and a full ring drops the new event and counts it, so anything that must
+// happen, like saving a setting, is done directly and not from a subscriber.
+
+#define EVENTS_RING 64 // a power of two, a full Serial1 buffer of short frames
+#define EVENTS_MAX_SUBSCRIBERS 8
+
+enum EventType : uint8_t {
+  EVENT_FRAME, // any frame the framer kept, good checksum or not
+  EVENT_LIGHTS, // the light frame's data byte changed
+  EVENT_CHECKSUM_ERROR, // a frame whose checksum didn't match
+  EVENT_OUTPUT, // the outputs were enabled or disabled
+  EVENT_TYPES
+};
+
+#define EVENT_MASK(type) (1U << (type))
+
+struct Event {
+  EventType type;
+  uint8_t bus; // frames, which receiver read it, 0 the trailer bus
+  uint8_t length; // frame bytes in data: sync, PID, data, checksum
+  uint8_t expectedChecksum;
+  uint8_t value; // EVENT_LIGHTS the new state, EVENT_OUTPUT 1 if enabled
+  unsigned long frameUs; // the framer's time for the frame's sync byte
+  unsigned long timeMs; // when it was published
+  uint8_t data[lincore::MAX_FRAME_BYTES];
+};
+
+typedef void (*EventHandler)(const Event& event);
+
+// mask is EVENT_MASK() of each type wanted. False once the table is full.
+bool eventsSubscribe(unsigned int mask, EventHandler handler);
+// EVENT_FRAME or EVENT_CHECKSUM_ERROR with the frame as the framer read it
+void eventsPublishFrame(EventType type, uint8_t bus, const byte buffer[], short length, byte expectedChecksum,
+                        unsigned long frameUs, unsigned long nowMs);
+void eventsPublish(EventType type, uint8_t value, unsigned long nowMs);
+// From loop(), delivers everything queued
+void eventsDrain();
+
+extern unsigned long eventsPublished;
+extern unsigned long eventsDropped; // ring full
+extern unsigned long eventsMaxQueued;
+
+#endif // EVENTS_H
@@ -0,0 +1,67 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <Arduino.h>
+#include <vector>
+
+// Light state history for the trip since boot, kept as transitions only.
+// Every change of the 0x0F light byte is appended to a small RAM ring of
+// blocks as a varint time delta and the new state, usually three bytes. When
+// the ring is full its oldest block is appended to HISTORY_PATH, which rolls
+// over to HISTORY_OLD_PATH past HISTORY_FILE_MAX. Each block starts with its
+// absolute time and the state before it, so a range query only decodes the
+// blocks overlapping the range, and the trip totals are kept up to date as
+// changes arrive.
+
+#define HISTORY_PATH "/history/lights.bin"
+#define HISTORY_OLD_PATH "/history/lights.old.bin"
+#define HISTORY_BLOCK_BYTES 256
+#define HISTORY_RAM_BLOCKS 4
+#define HISTORY_FILE_MAX 32768
+#define HISTORY_STATE_MASK 0x2F // bits we know, see docs/LIN-Decoding.md
+
+// 0x0F light bits
+#define LIGHT_LEFT 0x01
+#define LIGHT_RIGHT 0x02
+#define LIGHT_HEADLIGHTS 0x04
+#define LIGHT_BRAKES 0x08
+#define LIGHT_REVERSE 0x20
+
+struct LightChange {
+  unsigned long timeMs;
+  byte state;
+};
+
+struct HistoryStats {
+  unsigned long changes;
+  // Turn signal flashes, not counting both signals coming on with the brakes
+  unsigned long leftBlinks;
+  unsigned long rightBlinks;
+  unsigned long brakeEvents;
+  unsigned long brakeMs;
+  // Longest any one state was held, and when that started
+  unsigned long longestMs;
+  unsigned long longestStartMs;
+  byte longestState;
+};
+
+// Starts a new trip, removing the last one's files. Without flash the history
+// is limited to the RAM ring and older blocks are dropped.
+void historyBegin(bool useFlash);
+// Record the light byte from a valid 0x0F frame, only changes are stored
+void historyRecord(byte state, unsigned long nowMs);
+
+// Changes in (fromMs, toMs] into changes (up to maxChanges, the rest are
+// still counted) and the stats over the range. Returns the state at fromMs.
+byte historyQuery(unsigned long fromMs, unsigned long toMs, unsigned long nowMs,
+                  std::vector<LightChange>& changes, size_t maxChanges, HistoryStats& stats);
+// Totals for the trip, including the state held right now
+HistoryStats historyTotals(unsigned long nowMs);
+String historyStatsJson(const HistoryStats& stats);
+
+extern unsigned long historyOldestMs; // earliest time still covered
+extern size_t historyRamBytes; // encoded bytes in the RAM ring
+extern size_t historyFlashBytes;
+extern unsigned long historyDroppedBlocks;
+
+#endif // HISTORY_H
@@ -0,0 +1,222 @@
+#ifndef HTTP_SERVER_H
+#define HTTP_SERVER_H
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <WiFi.h>
+#include <functional>
+#include <memory>
+#include <vector>
+
+// Event-driven HTTP/1.1 server used in place of WebServer, which reads a
+// whole request and writes a whole response (streamFile() included) inside
+// one handleClient() call, so one slow phone could hold up loop() for
+// seconds. Here each connection in a small pool is a state machine, and
+// poll() moves them along round-robin by one socket read or write at a time
+// until its time budget is used up. Handlers look like WebServer ones: they
+// run once a request has fully arrived (an upload handler runs for each
+// chunk as it arrives) and queue a response, which goes out over the
+// following polls as the socket takes it. Connections stay open between
+// requests unless the client asks otherwise.
+//
+// Live state goes out through an HttpFeed: the state is serialized once per
+// change into a shared buffer, and every poll of it and every open event
+// stream sends from that one buffer rather than a copy per viewer.
+
+#define HTTP_MAX_CONNECTIONS 6
+#define HTTP_MAX_STREAMS 4 // event streams, the rest are kept for page loads
+#define HTTP_MAX_HEADER_BYTES 2048
+#define HTTP_MAX_BODY_BYTES 2048 // form posts, file uploads are streamed
+#define HTTP_IO_CHUNK 1024 // most read or written per step
+#define HTTP_UPLOAD_CHUNK 1024
+#define HTTP_IDLE_TIMEOUT_MS 5000
+#define HTTP_POLL_BUDGET_US 400 // under a LIN byte time
+#define HTTP_STREAM_HEARTBEAT_MS 15000 // a comment on a quiet stream, so dead clients are noticed
+
+enum HttpUploadStatus { UPLOAD_FILE_START, UPLOAD_FILE_WRITE, UPLOAD_FILE_END, UPLOAD_FILE_ABORTED };
+
+struct HttpUpload {
+  HttpUploadStatus status;
+  String name; // form field
+  String filename;
+  size_t totalSize; // so far
+  size_t currentSize; // in buf
+  uint8_t buf[HTTP_UPLOAD_CHUNK];
+};
+
+// A response body shared by every connection sending it, freed once the last
+// one is done with it
+typedef std::shared_ptr<const String> HttpBody;
+
+// The latest serialized copy of some live state. Publishing a body replaces
+// it for new responses, the ones already sending the old one finish with it.
+class HttpFeed {
+  public:
+    // False, and nothing is replaced, if the body hasn't changed
+    bool publish(const String& body);
+    const HttpBody& body() const { return latest; }
+    // Counts publishes, 0 until the first
+    unsigned long version() const { return published; }
+
+  private:
+    HttpBody latest;
+    unsigned long published = 0;
+};
+
+class HttpServer {
+  public:
+    enum Method { ANY, GET, POST };
+    typedef std::function<void()> Handler;
+
+    explicit HttpServer(uint16_t port) : server(port) {}
+
+    void begin();
+    void stop();
+    // Accepts new connections and steps the open ones until budgetUs has
+    // passed or none of them can make progress
+    void poll(unsigned long budgetUs = HTTP_POLL_BUDGET_US);
+    // poll() stops early once this returns true, and doesn't start on a new
+    // connection, e.g. when there are LIN bytes waiting or a frame is still
+    // coming in, since the framer can only tell where a frame ends if it
+    // reads the bytes soon after they arrive
+    void yieldWhen(std::function<bool()> check) { yieldCheck = check; }
+
+    void on(const char* path, Handler handler) { on(path, ANY, handler); }
+    // upload is called for each file part of a multipart/form-data post,
+    // then handler once the whole request is in
+    void on(const char* path, Method method, Handler handler, Handler upload = nullptr);
+    void onNotFound(Handler handler) { notFound = handler; }
+
+    // About the request being handled: query and form arguments, and the
+    // upload in progress
+    bool hasArg(const char* name) const;
+    String arg(const char* name) const;
+    String uri() const;
+    // Different for every request, so a handler can tell whose upload chunks
+    // it is getting when two posts to one route overlap. 0 outside a handler.
+    unsigned long requestId() const { return current ? current->id : 0; }
+    HttpUpload& upload() { return uploadState; }
+    bool authenticate(const char* username, const char* password) const;
+
+    void sendHeader(const String& name, const String& value, bool first = false);
+    void send(int code, const char* contentType, const String& body);
+    void send(int code, const char* contentType, const HttpBody& body);
+    // Answers with a text/event-stream of the feed: its body as an event
+    // now and after each publish. A client that can't keep up finishes the
+    // event it's on and then skips to the latest, so nothing queues up for
+    // it, and one that takes nothing for HTTP_IDLE_TIMEOUT_MS is dropped.
+    // Past HTTP_MAX_STREAMS open streams this answers 503 instead.
+    void stream(HttpFeed& feed);
+    // The file is sent over the following polls, a chunk at a time, and
+    // closed when done, so the caller must not close it
+    void streamFile(File& file, const char* contentType);
+    void requestAuthentication();
+
+    unsigned long requests = 0;
+    unsigned long connectionsAccepted = 0;
+    unsigned long connectionsTimedOut = 0;
+    unsigned long maxPollUs = 0; // longest poll(), including handlers
+    unsigned long eventsSent = 0;
+    unsigned long eventsSkipped = 0; // superseded before a slow stream got to them
+
+    // Each route's requests and its longest single call into a handler
+    // (upload chunks included)
+    void routeStats(std::function<void(const String& path, unsigned long calls, unsigned long maxUs)> visit) const;
+    // The handler that ran longest in the last poll(), "" if none ran
+    const char* slowestHandler() const { return pollSlowest; }
+    unsigned long slowestHandlerUs() const { return pollSlowestUs; }
+
+  private:
+    enum State { FREE, READING_HEADERS, READING_BODY, UPLOADING, SENDING, STREAMING };
+    enum PartState { PREAMBLE, PART_HEADERS, PART_DATA, PART_END, PARTS_DONE };
+
+    struct Route {
+      String path;
+      Method method;
+      Handler handler;
+      Handler upload;
+      mutable unsigned long calls = 0;
+      mutable unsigned long maxUs = 0;
+    };
+
+    struct Arg {
+      String name;
+      String value;
+    };
+
+    struct Connection {
+      WiFiClient client;
+      State state = FREE;
+      unsigned long lastActivity = 0;
+      bool keepAlive = true;
+
+      // Request
+      unsigned long id = 0;
+      String head;
+      byte headMatch = 0; // progress through the blank line ending the headers
+      Method method = GET;
+      String path;
+      std::vector<Arg> args;
+      String authorization;
+      String contentType;
+      size_t bodyRemaining = 0;
+      String body;
+      const Route* route = nullptr;
+
+      // multipart/form-data, parsed as it streams in
+      String boundary; // "\r\n--" + boundary
+      PartState partState = PREAMBLE;
+      std::vector<uint8_t> pending; // unparsed bytes
+      std::vector<uint8_t> pipelined; // read past the end of this request
+      String partName;
+      String partFilename;
+      String partValue;
+      size_t uploadTotal = 0;
+
+      // Response: out, then the shared body, then tail, then the file
+      String headers; // extra headers from sendHeader()
+      String out;
+      size_t outPos = 0;
+      HttpBody shared;
+      size_t sharedPos = 0;
+      const char* tail = "";
+      File file;
+      bool responded = false;
+
+      // Event stream
+      HttpFeed* feed = nullptr;
+      unsigned long feedVersion = 0; // last one sent
+    };
+
+    bool step(Connection& conn);
+    bool readHeaders(Connection& conn);
+    bool readBody(Connection& conn);
+    bool readUpload(Connection& conn);
+    bool sendResponse(Connection& conn);
+    bool nextEvent(Connection& conn);
+    static bool sending(const Connection& conn);
+    void parseHead(Connection& conn);
+    void parseMultipart(Connection& conn);
+    void emitUpload(Connection& conn, HttpUploadStatus status, const uint8_t* data, size_t length);
+    void dispatch(Connection& conn);
+    void runHandler(Connection& conn, const Handler& handler);
+    void finishRequest(Connection& conn);
+    void close(Connection& conn);
+    void startResponse(int code, const char* contentType, size_t length);
+    void reject(Connection& conn, int code, const char* message);
+    static void parseArgs(const String& text, std::vector<Arg>& args);
+
+    WiFiServer server;
+    Connection connections[HTTP_MAX_CONNECTIONS];
+    Connection* current = nullptr;
+    std::vector<Route> routes;
+    Handler notFound;
+    std::function<bool()> yieldCheck;
+    HttpUpload uploadState;
+    size_t next = 0; // round-robin start
+    unsigned long lastRequestId = 0;
+    const char* pollSlowest = "";
+    unsigned long pollSlowestUs = 0;
+};
+
+#endif // HTTP_SERVER_H
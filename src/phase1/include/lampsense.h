@@ -0,0 +1,50 @@
+#ifndef LAMPSENSE_H
+#define LAMPSENSE_H
+
+#include <Arduino.h>
+
+// Lamp current sensing, one high-side current sense amplifier per output
+// feeding ADC0-2 (GP26 left, GP27 right, GP28 tail). The ADC runs free in
+// round-robin over those and the temperature sensor, with DMA filling a ring
+// buffer, so nothing on the LIN path ever waits on a conversion. Requires the
+// sense hardware, build with -DLAMP_SENSE to enable it.
+
+// 10 mOhm shunt into a 100 V/V amplifier is 1 V/A, 3.3 V / 4096 counts
+#define LAMP_SENSE_MA_PER_COUNT 0.806f
+#define LAMP_SENSE_RATE_HZ 1000 // per channel
+#define LAMP_OPEN_MA 30.0f // below this with the output on, nothing is connected
+#define LAMP_SHORT_MA 3000.0f // above this with the output on, it's a short
+#define LAMP_BLANKING_MS 100 // ignore incandescent inrush after switching on
+#define LAMP_DEBOUNCE 3 // consecutive evaluations before a state changes
+
+enum LampState { LAMP_UNKNOWN, LAMP_OK, LAMP_OPEN, LAMP_SHORT };
+enum { LAMP_LEFT, LAMP_RIGHT, LAMP_TAIL, LAMP_COUNT };
+#define LAMP_SENSE_CHANNELS 4 // the three lamps then the temperature sensor
+
+struct LampChannel {
+  float currentMa; // filtered
+  LampState state;
+  LampState candidate;
+  byte candidateCount;
+  bool wasOn;
+  unsigned long onSince;
+};
+
+extern LampChannel lamps[LAMP_COUNT];
+extern float lampSenseTemperatureC;
+
+void lampSenseBegin();
+// Pull whatever the DMA has written since the last call and run it through
+// the filters, returns true if any lamp changed state
+bool lampSenseUpdate();
+// Filter a block of interleaved samples (left, right, tail, temperature...)
+// and classify the lamps, used by lampSenseUpdate and the host model
+bool lampSenseProcess(const uint16_t samples[], size_t count, unsigned long now);
+
+bool trailerConnected();
+// First byte of the 0x10 response: good/active bit pairs for left (bits 0-1),
+// right (bits 3-4) and tail (bits 6-7), see docs/LIN-Decoding.md
+byte lampStatusByte();
+const char* lampStateName(LampState state);
+
+#endif // LAMPSENSE_H
@@ -0,0 +1,29 @@
+#ifndef LIGHTS_H
+#define LIGHTS_H
+
+#include <Arduino.h>
+
+#define LIN_FRAME_PID 0xCF
+#define TAIL_PIN 2
+#define LEFT_PIN 3
+#define RIGHT_PIN 4
+
+#define LIGHTS_DERATE_DUTY 128 // tail lights out of 255 while derated
+
+// What the outputs may do, lowered by the thermal protection
+enum LightLimit { LIGHTS_FULL, LIGHTS_DERATED, LIGHTS_OFF };
+
+extern bool output_enabled;
+extern bool left_state;
+extern bool right_state;
+extern bool tail_state;
+
+void setLightState(int pin, bool state);
+void processLightLINFrame(byte dataByte);
+// Every output off whatever output_enabled says, the tail taken off PWM too
+void lightsAllOff();
+// Rewrites the outputs under the new limit
+void setLightLimit(LightLimit limit);
+LightLimit lightLimit();
+
+#endif // LIGHTS_H
@@ -2,14 +2,39 @@
 #define LIN_H
 
 #include <Arduino.h>
+#include <lin_core.h>
+#include <lin_hal_arduino.h>
 
-class lin {
+// A LIN receiver on one serial port, built on the shared framer in
+// src/common/lincore. Each keeps its own framer state, so one per UART
+// (Serial1, Serial2 or a SerialPIO) can read its bus alongside the others.
+// bus tags its frames once they are merged, see lin_merge.h.
+template <class SerialPort>
+class LinReceiver : public lincore::Framer<lincore::ArduinoUart<SerialPort>> {
     public:
-        void setupSerial();
-        short updateFrame(byte expectedPID = 0);
-        byte calculateChecksum(byte dataBuffer[], short length);
+        static const unsigned long BREAK_THRESHOLD = lincore::BREAK_THRESHOLD;
 
-        byte dataBuffer[11]; // Store max of 11 bytes: sync, id, up to 8 data bytes, checksum
+        LinReceiver(SerialPort& port, uint8_t bus)
+            : lincore::Framer<lincore::ArduinoUart<SerialPort>>(lincore::ArduinoUart<SerialPort>(port)), bus(bus),
+              port(&port) {}
+
+        void setupSerial() { this->begin(); }
+        byte calculateChecksum(byte dataBuffer[], short length) { return lincore::checksum(dataBuffer, length); }
+        // Bytes waiting in the port
+        int available() { return port->available(); }
+
+        const uint8_t bus;
+
+    private:
+        SerialPort* port;
+};
+
+typedef LinReceiver<decltype(Serial1)> LinUartReceiver;
+
+// The controller's own receiver, the trailer bus on Serial1
+class lin : public LinUartReceiver {
+    public:
+        lin() : LinUartReceiver(Serial1, 0) {}
 };
 
-#endif // LIN_H
\ No newline at end of file
+#endif // LIN_H
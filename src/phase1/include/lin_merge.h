@@ -0,0 +1,56 @@
+#ifndef LIN_MERGE_H
+#define LIN_MERGE_H
+
+#include <Arduino.h>
+#include <lin_core.h>
+
+// Merges the frames several LinReceivers read into one stream in the order
+// they started on the wire, each tagged with its bus. Each bus's frames are
+// already in order, so they wait in a small queue per bus and next() hands
+// out whichever waiting frame started first. A frame can only be handed out
+// once no bus has an earlier one still arriving, which the caller passes in
+// from each framer's receiving(). That holds a frame back for at most the
+// length of a frame on another bus. Fixed queues, no heap.
+
+#define LIN_MAX_BUSES 4
+#define LIN_MERGE_DEPTH 16 // per bus, a full 32-byte UART buffer of headers is 10
+
+struct LinMergedFrame {
+  uint8_t bus;
+  uint8_t length; // bytes in data: sync, PID, data, checksum
+  uint8_t expectedChecksum;
+  unsigned long frameUs; // the framer's micros() for the sync byte
+  uint8_t data[lincore::MAX_FRAME_BYTES];
+};
+
+class LinMerge {
+  public:
+    // A frame read from bus, in the order that bus read them. False, and
+    // nothing added, if the bus already has LIN_MERGE_DEPTH waiting: hand out
+    // frames with next() until it takes it, which ignores frames still
+    // arriving on other buses, so they may come out of order but aren't lost.
+    bool push(uint8_t bus, const byte buffer[], short length, byte expectedChecksum, unsigned long frameUs);
+    // Some bus has a frame arriving that started at syncUs, call once per
+    // bus that's receiving() before next()
+    void holdFrom(unsigned long syncUs);
+    // The waiting frame that started first and can go, then pop() it.
+    // nullptr once there's none, which also clears the holds.
+    const LinMergedFrame* next();
+    void pop();
+    size_t waiting() const;
+
+    unsigned long merged = 0;
+    unsigned long forced = 0; // pushes that found their bus's queue full
+    unsigned long maxWaiting = 0;
+
+  private:
+    LinMergedFrame queue[LIN_MAX_BUSES][LIN_MERGE_DEPTH];
+    // count up, the queue index is the low bits
+    unsigned long head[LIN_MAX_BUSES] = {0};
+    unsigned long tail[LIN_MAX_BUSES] = {0};
+    bool holding = false;
+    unsigned long holdUs = 0;
+    uint8_t nextBus = 0;
+};
+
+#endif // LIN_MERGE_H
@@ -0,0 +1,61 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <Arduino.h>
+
+#include "http_server.h"
+
+class lin;
+
+// Runtime metrics for /metrics, in the Prometheus text format so a collector
+// on the shop network can scrape them. The hot paths only bump counters:
+// loop() marks where it starts, each section it moves on to and where it
+// ends, and the LIN path counts frames and checks the UART once a pass.
+// Anything that costs more (heap, LittleFS, the frame rate) is worked out
+// when the page is asked for, or once a second.
+//
+// A pass of loop() that takes longer than METRICS_STALL_US is a stall. It is
+// put down to the section that took longest in it, and when that was the web
+// server, to the handler that ran longest in that poll(), and logged to
+// Serial. Stalls are counted per section and handler, for up to
+// METRICS_STALL_SOURCES of them, after which they're counted as "other".
+
+#define METRICS_STALL_US 2000 // a light frame is acted on within 2 ms
+#define METRICS_STALL_SOURCES 16
+#define METRICS_RATE_MS 1000 // frame rate window
+
+enum MetricsSection {
+  SECTION_NETWORK,
+  SECTION_HTTP,
+  SECTION_MDNS,
+  SECTION_SENSORS,
+  SECTION_LIN,
+  SECTION_CAPTURE,
+  SECTION_OTA,
+  SECTION_POWER,
+  SECTION_COUNT
+};
+
+// server for the per-handler timings and the handler behind a stall, the
+// framer for what its filter dropped
+void metricsBegin(HttpServer& server, lin& framer);
+void metricsLoopStart(unsigned long nowUs);
+// Everything until the next call, or the end of the pass, is section
+void metricsSection(MetricsSection section, unsigned long nowUs);
+void metricsLoopEnd(unsigned long nowUs);
+// Before draining Serial1: how many bytes are waiting, and any overrun
+void metricsUart(int available);
+// From loop(), the frame rate once a second
+void metricsPoll(unsigned long nowMs);
+const char* metricsSectionName(MetricsSection section);
+String metricsPrometheus(unsigned long nowMs);
+
+extern unsigned long metricsFrames; // light and others, as they're read
+extern unsigned long metricsChecksumErrors; // from the event bus
+extern unsigned long metricsRxHighWater; // most bytes seen waiting in Serial1
+extern unsigned long metricsRxOverruns;
+extern unsigned long metricsStalls;
+extern unsigned long metricsMaxLoopUs;
+extern float metricsFramesPerSecond;
+
+#endif // METRICS_H
@@ -0,0 +1,38 @@
+#ifndef OTA_H
+#define OTA_H
+
+#include <Arduino.h>
+#include "http_server.h"
+
+// Firmware updates at /update, in place of HTTPUpdateServer. The image is
+// written in OTA_SLICE_BYTES pieces with the LIN path serviced between each
+// one, which bounds the time between LIN polls but not the flash operations
+// themselves: a sector erase or page program runs with interrupts off, and
+// meanwhile the UART can only hold its 32 byte RX FIFO, about 16.7 ms of the
+// bus. The longest single flash write is measured against that and reported.
+// The upload has to carry the image's MD5 (an md5 form field ahead of the
+// file, or /update?md5=...), which is checked before the image is staged for
+// the bootloader, and the reboot waits for a moment without turn signals or
+// brakes. There is one Update, so an image posted while another is still
+// coming in is answered 409 and the first carries on.
+
+#define OTA_SLICE_BYTES 512
+#define OTA_REBOOT_DELAY_MS 1000 // let the reply reach the browser
+#define OTA_QUIET_MS 1500 // no signals or brakes for this long before rebooting
+#define OTA_MAX_DEFER_MS 60000 // reboot anyway after this
+
+// service is called between slices to keep LIN running
+void otaBegin(HttpServer& server, const String& username, const String& password, void (*service)());
+void otaUpdateCredentials(const String& username, const String& password);
+// Call from loop() with whether the turn signals or brakes are on, reboots
+// into a verified image once they have been off for OTA_QUIET_MS
+void otaPoll(bool signalling);
+
+extern String otaResult; // outcome of the last update, empty if none
+extern size_t otaBytesWritten;
+extern unsigned long otaDurationMs;
+extern unsigned long otaMaxStallUs; // longest the LIN path went unserviced during the upload
+extern unsigned long otaMaxFlashUs; // longest single flash write, interrupts off for part of it
+extern unsigned long otaFlashOverruns; // flash writes longer than the UART FIFO holds, LIN bytes may be lost
+
+#endif // OTA_H
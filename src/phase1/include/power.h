@@ -0,0 +1,54 @@
+#ifndef POWER_H
+#define POWER_H
+
+#include <Arduino.h>
+
+// Idle sleep for when the car is asleep. Once no LIN frame has been seen for
+// the idle time (and nothing else wants the controller awake, like the web
+// UI), the network is turned off and the system clock drops to
+// POWER_SLEEP_KHZ, and loop() naps between interrupts instead of spinning.
+// The UART's RX interrupt ends a nap, so the first byte on the bus wakes it:
+// the clock comes straight back up, the lights follow the next light frame,
+// and the network only restarts once they have. The time from that first
+// byte to the first light output is measured against POWER_WAKE_BUDGET_US.
+//
+// Not dormant mode: that stops the crystal, so the UART couldn't clock in
+// the bytes that wake it and waking would need a GPIO edge interrupt and the
+// oscillators restarted first. Clocked down and napping, nothing on the bus
+// is lost. The UARTs run from the USB PLL so their baud rates don't change
+// with the system clock.
+
+#define POWER_IDLE_DEFAULT_S 300 // bus quiet this long before sleeping, 0 never
+#define POWER_NAP_MS 100 // longest nap, so millis() timers still run asleep
+#define POWER_SLEEP_KHZ 48000
+#define POWER_WAKE_BUDGET_US 25000 // first byte to lights, covers a 20 ms schedule
+#define POWER_RESUME_MS 1000 // network back this long after waking, even without a light frame
+
+enum PowerState { POWER_ACTIVE, POWER_ASLEEP, POWER_WAKING };
+
+// sleepNetwork and resumeNetwork turn the network off and back on, resume
+// must return straight away the way startNetwork() does
+void powerBegin(unsigned long idleS, unsigned long nowMs, void (*sleepNetwork)(), void (*resumeNetwork)());
+void powerSetIdle(unsigned long idleS, unsigned long nowMs);
+// Something other than the bus needs the controller awake
+void powerKeepAwake(unsigned long nowMs);
+// From loop(). frameUs is each bus's framer frameMicros (up to
+// LIN_MAX_BUSES), which moves with every frame on that bus whether or not
+// the filter keeps it, so traffic on any bus keeps the controller awake.
+void powerPoll(const unsigned long frameUs[], size_t buses, unsigned long nowMs);
+// From the top of loop() while asleep: waits for a LIN byte on any bus or
+// POWER_NAP_MS, and wakes if a byte arrived
+void powerNap();
+// Each light frame acted on, ends a wake with its wake-to-output time
+void powerLightOutput(unsigned long nowUs);
+PowerState powerState();
+String powerStatusJson();
+
+extern unsigned long powerIdleS;
+extern unsigned long powerSleeps;
+extern unsigned long powerLastWakeUs; // first byte to lights, last wake
+extern unsigned long powerMaxWakeUs;
+extern unsigned long powerWakesOverBudget;
+extern unsigned long powerAsleepMs; // in total
+
+#endif // POWER_H
@@ -0,0 +1,62 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <Arduino.h>
+
+#include "http_server.h"
+
+// Bench replay of a recorded drive through the live frame path. A capture
+// (lin_capture.txt or the packed lin_capture.lcz) posted to /uploadReplay is
+// kept in flash, and /startReplay?speed=N hands its bus 0 frames to the same
+// handler serviceLin() gives the framer's, at the capture's own timing, N
+// times faster, or with speed=0 as fast as loop() comes round. Serial1 is
+// still read while it runs, but its frames are dropped. The file is read a
+// block at a time between LIN polls, and every change in the light outputs
+// is recorded with the capture time of the frame that caused it and how long
+// after that frame was due the outputs had been set. /replayStatus reports
+// them with a digest of the decisions alone, so two builds can be compared
+// against the same drive without a car or a bus simulator.
+
+#define REPLAY_PATH "/logs/replay"
+#define REPLAY_SLICE_BYTES 512 // upload written to flash this much at a time
+#define REPLAY_READ_BYTES 256 // file read per block
+#define REPLAY_LINE_BYTES 128 // longest lin_capture.txt line kept
+#define REPLAY_FRAMES_PER_POLL 16 // at most, so a backlog doesn't hold up loop()
+#define REPLAY_MAX_CHANGES 256 // recorded, the digest covers the rest
+
+enum ReplayState { REPLAY_IDLE, REPLAY_RUNNING, REPLAY_COMPLETE };
+
+// A frame as the framer hands it over (sync, PID, data, checksum) with the
+// micros() its sync byte was due
+typedef void (*ReplayHandler)(const byte buffer[], short length, unsigned long frameUs);
+
+// One change in the outputs
+struct ReplayChange {
+  unsigned long captureUs; // the frame's time in the capture
+  unsigned long lateUs; // from when it was due to the outputs being set
+  byte lights; // left | right << 1 | tail << 2
+};
+
+// Adds the routes. service is called between upload slices to keep LIN
+// running.
+void replayBegin(HttpServer& server, ReplayHandler handler, void (*service)());
+// Replays the uploaded capture from the start, speed 1 at its own timing and
+// 0 as fast as it goes. False if there isn't one.
+bool replayStart(unsigned long speed, unsigned long nowUs);
+// Ends a replay early keeping its results
+void replayStop(unsigned long nowUs);
+// From serviceLin(), hands over the frames due by nowUs, plus the time each
+// handler takes
+void replayPoll(unsigned long nowUs);
+ReplayState replayState();
+String replayStatusJson();
+
+extern unsigned long replayFrames; // handed over
+extern unsigned long replayOtherBus; // frames from other buses, skipped
+extern unsigned long replayChangeCount;
+extern unsigned long replayMaxLateUs;
+extern unsigned long replayMaxHandlerUs;
+extern uint32_t replayDigest; // FNV-1a over each change's capture time and lights
+extern const ReplayChange* replayChanges; // the first REPLAY_MAX_CHANGES
+
+#endif // REPLAY_H
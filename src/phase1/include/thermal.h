@@ -0,0 +1,41 @@
+#ifndef THERMAL_H
+#define THERMAL_H
+
+#include <Arduino.h>
+
+// Board temperature from the RP2040's sensor, sampled from loop() once a
+// second (one 2 us conversion, or the lamp sense DMA's latest when that owns
+// the ADC) and filtered, so the web pages read a cached value. Above the
+// derate threshold the tail lights drop to a PWM duty, the turn signals stay
+// full; above the shutdown threshold every output is turned off. Each comes
+// back once the temperature is THERMAL_HYSTERESIS_C below its threshold. The
+// minimum and maximum since boot, the hottest ever (kept in the config
+// journal) and the last two hours a minute at a time are kept.
+
+#define THERMAL_SAMPLE_MS 1000
+#define THERMAL_FILTER_ALPHA 0.2f // per sample, about 5 s to settle
+#define THERMAL_DERATE_DEFAULT_C 70
+#define THERMAL_SHUTDOWN_DEFAULT_C 85 // the RP2040's rated limit
+#define THERMAL_HYSTERESIS_C 5
+#define THERMAL_HISTORY_MS 60000 // one history point a minute, the hottest
+#define THERMAL_HISTORY_POINTS 120
+
+enum ThermalState { THERMAL_NORMAL, THERMAL_DERATED, THERMAL_SHUTDOWN };
+
+// persist saves a new hottest-ever to the config journal
+void thermalBegin(int derateC, int shutdownC, bool persist);
+void thermalSetThresholds(int derateC, int shutdownC);
+// From loop(), takes a sample when one is due
+void thermalPoll(unsigned long nowMs);
+ThermalState thermalState();
+const char* thermalStateName(ThermalState state);
+String thermalStatusJson(unsigned long nowMs);
+
+extern float thermalTemperatureC; // filtered, NAN before the first sample
+extern float thermalMinC; // since boot
+extern float thermalMaxC;
+extern float thermalRecordC; // hottest ever
+extern unsigned long thermalDerateEvents;
+extern unsigned long thermalShutdownEvents;
+
+#endif // THERMAL_H
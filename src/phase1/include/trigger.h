@@ -0,0 +1,94 @@
+#ifndef TRIGGER_H
+#define TRIGGER_H
+
+#include <Arduino.h>
+#include <lin_core.h>
+
+#include "capture.h"
+
+// Triggered LIN captures, like a logic analyzer. Every frame goes into a RAM
+// ring of packed records in a static arena whether or not a capture is armed, so once a trigger fires the saved
+// capture starts with the frames leading up to it. Armed, each frame is
+// checked against one trigger condition in constant time. Triggered, the
+// ring becomes the queue to flash: capturePoll() packs frames from it into
+// CAPTURE_PATH between LIN polls, a block at a time. A LittleFS write still
+// erases and programs with interrupts off, when only the UART's 32 byte RX
+// FIFO holds LIN bytes, so each write is timed and those longer than the
+// FIFO lasts are counted.
+
+#define CAPTURE_PATH "/logs/lin_capture.lcz"
+#define CAPTURE_ARENA_BYTES 8192 // a power of two, about 16 seconds of the car's bus
+#define CAPTURE_MAX_PRE_FRAMES 256 // at 17 bytes worst case, leaves half to queue
+#define CAPTURE_MAX_POST_S 600
+
+enum TriggerCondition {
+  TRIGGER_NOW, // straight away
+  TRIGGER_PID, // any frame with the PID
+  TRIGGER_DATA, // data[index] & mask == value, valid checksum
+  TRIGGER_CHANGE, // data[index] & mask differs from the last frame, valid checksum
+  TRIGGER_CHECKSUM, // checksum error
+  TRIGGER_MISSING, // no frame with the PID for missingMs
+};
+
+struct TriggerConfig {
+  TriggerCondition condition = TRIGGER_NOW;
+  bool anyPid = true; // or only frames with pid
+  byte pid = 0;
+  byte index = 0;
+  byte mask = 0xFF;
+  byte value = 0;
+  unsigned long missingMs = 100;
+  uint16_t preFrames = 0; // kept from before the trigger
+  unsigned long postMs = 1000; // recorded after it
+  uint64_t ids = lincore::ALL_IDS; // frame IDs the ring keeps, the trigger's PID always
+  uint8_t every = 1; // keep one in every N frames of IDs only the capture wants
+};
+
+enum CaptureState { CAPTURE_IDLE, CAPTURE_ARMED, CAPTURE_RECORDING, CAPTURE_COMPLETE };
+
+// Why captureArm() refused a capture. All but CAPTURE_ARM_NO_FILE are a
+// trigger that could never fire.
+enum CaptureArmError {
+  CAPTURE_ARM_OK,
+  CAPTURE_ARM_NO_PID, // pid and missing need the PID to look for
+  CAPTURE_ARM_BAD_PID, // not a protected ID, the parity bits are wrong
+  CAPTURE_ARM_BAD_INDEX, // past the 8 data bytes
+  CAPTURE_ARM_NO_FILE, // CAPTURE_PATH couldn't be created
+};
+
+// Parses a condition name (now, pid, data, change, checksum, missing)
+bool triggerConditionFromName(const String& name, TriggerCondition& condition);
+String triggerDescription(const TriggerConfig& config);
+// Parses a comma separated list of frame IDs or PIDs, e.g. "0x0F,0x10"
+bool captureIdsFromList(const String& list, uint64_t& ids);
+String captureIdsDescription(uint64_t ids);
+
+// Starts a new capture, replacing the last one. False, with the reason in
+// captureArmError, if the trigger could never fire or the file can't be
+// created. A trigger that could never fire leaves the last capture alone.
+bool captureArm(const TriggerConfig& config, unsigned long nowMs);
+const char* captureArmErrorText(CaptureArmError error);
+// Disarms, or ends a recording early keeping what was captured
+void captureStop(unsigned long nowMs);
+// Every received frame (sync, PID, data, checksum) with its expected checksum,
+// the framer's micros() for its sync byte and the bus it came from. Frames
+// from several buses must come in the order they started, see lin_merge.h.
+// Triggers only look at bus 0.
+void captureFrame(const byte buffer[], short length, byte expectedChecksum, unsigned long frameUs,
+                  unsigned long nowMs, byte bus = 0);
+// From loop(): time-based triggers, writing queued frames, finishing
+void capturePoll(unsigned long nowMs);
+CaptureState captureState();
+// The last capture armed, whose IDs the ring keeps until the next
+const TriggerConfig& captureConfig();
+String captureStatusJson();
+
+extern CaptureArmError captureArmError; // why the last captureArm() failed
+extern unsigned long captureTriggerUs; // trigger point, us into the saved capture
+extern unsigned long captureSavedFrames;
+extern unsigned long captureSavedBytes;
+extern unsigned long captureDroppedFrames; // ring full while recording or re-filtering, or out of flash
+extern unsigned long captureMaxFlashUs; // longest LittleFS write or close while recording
+extern unsigned long captureFlashOverruns; // writes longer than the UART FIFO holds, LIN bytes may be lost
+
+#endif // TRIGGER_H
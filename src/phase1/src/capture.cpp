@@ -0,0 +1,277 @@
+#include "capture.h"
+
+void buildCaptureFrame(LINFrame& frame, const byte dataBuffer[], short length, unsigned long timestampUs, byte expectedChecksum,
+                       byte bus) {
+  frame.timestampUs = timestampUs;
+  frame.bus = bus;
+  frame.sync = dataBuffer[0];
+  frame.pid = dataBuffer[1];
+  // Store data bytes (everything between PID and checksum)
+  // Header-only frames (no slave response) have no data bytes
+  frame.dataLength = length > 3 ? length - 3 : 0;  // Total - sync - PID - checksum
+  if (frame.dataLength > 8) {
+    frame.dataLength = 8; // Cap at 8 bytes
+  }
+  for (int i = 0; i < frame.dataLength && i < 8; i++) {
+    frame.data[i] = dataBuffer[2 + i];
+  }
+  frame.checksum = dataBuffer[length - 1];
+  frame.expectedChecksum = expectedChecksum;
+  frame.checksumValid = (frame.checksum == expectedChecksum);
+}
+
+static void printHexByte(Print& out, byte value) {
+  out.print(",0x");
+  if (value < 0x10) out.print("0");
+  out.print(value, HEX);
+}
+
+void printCaptureFrame(Print& out, const LINFrame& frame) {
+  unsigned long fraction = frame.timestampUs % 1000;
+  out.print(frame.timestampUs / 1000);
+  out.print(fraction < 10 ? ".00" : fraction < 100 ? ".0" : ".");
+  out.print(fraction);
+  printHexByte(out, frame.sync);
+  printHexByte(out, frame.pid);
+  // Print all data bytes
+  for (int i = 0; i < frame.dataLength; i++) {
+    printHexByte(out, frame.data[i]);
+  }
+  printHexByte(out, frame.checksum);
+  out.print(",");
+  out.print(frame.checksumValid ? "OK" : "ERR");
+  if (!frame.checksumValid) {
+    printHexByte(out, frame.expectedChecksum);
+  }
+  if (frame.bus) {
+    out.print(",bus=");
+    out.print(frame.bus);
+  }
+}
+
+bool parseCaptureLine(const char* line, LINFrame& frame) {
+  while (*line == ' ' || *line == '\t') line++;
+  if (*line < '0' || *line > '9') {
+    return false; // comment, header or blank line
+  }
+
+  char* end;
+  frame.timestampUs = strtoul(line, &end, 10) * 1000;
+  if (*end == '.') {
+    // Up to three decimals, microseconds
+    const char* digit = end + 1;
+    unsigned long scale = 100;
+    while (*digit >= '0' && *digit <= '9') {
+      frame.timestampUs += (*digit++ - '0') * scale;
+      scale /= 10;
+    }
+    end = (char*)digit;
+  }
+  // sync, PID, up to 8 data bytes and the checksum
+  byte bytes[11];
+  short count = 0;
+  const char* p = end;
+  while (*p == ',' && p[1] == '0' && (p[2] == 'x' || p[2] == 'X')) {
+    unsigned long value = strtoul(p + 3, &end, 16);
+    if (end == p + 3 || value > 0xFF || count >= 11) {
+      return false;
+    }
+    bytes[count++] = (byte)value;
+    p = end;
+  }
+  if (count < 3) {
+    return false;
+  }
+
+  frame.sync = bytes[0];
+  frame.pid = bytes[1];
+  frame.dataLength = count - 3;
+  for (int i = 0; i < frame.dataLength; i++) {
+    frame.data[i] = bytes[2 + i];
+  }
+  frame.checksum = bytes[count - 1];
+  frame.checksumValid = strncmp(p, ",OK", 3) == 0;
+  frame.expectedChecksum = frame.checksum;
+  if (!frame.checksumValid && strncmp(p, ",ERR,0x", 7) == 0) {
+    frame.expectedChecksum = (byte)strtoul(p + 7, nullptr, 16);
+  }
+  const char* bus = strstr(p, ",bus=");
+  frame.bus = bus ? (byte)strtoul(bus + 5, nullptr, 10) : 0;
+  return true;
+}
+
+String formatFrameString(const byte dataBuffer[], short length, bool checksumValid, byte calculatedChecksum) {
+  String frameString = "";
+  for (int i = 0; i < length; i++) {
+    frameString += "0x" + String(dataBuffer[i], HEX) + " ";
+  }
+
+  if (checksumValid) {
+    frameString += "OK";
+  } else {
+    frameString += "ERR 0x" + String(calculatedChecksum, HEX);
+  }
+  return frameString;
+}
+
+static bool sameFrame(const LINFrame& a, const LINFrame& b) {
+  return a.bus == b.bus && a.sync == b.sync && a.pid == b.pid && a.dataLength == b.dataLength &&
+         memcmp(a.data, b.data, a.dataLength) == 0 && a.checksum == b.checksum &&
+         a.checksumValid == b.checksumValid && (a.checksumValid || a.expectedChecksum == b.expectedChecksum);
+}
+
+void CaptureEncoder::begin() {
+  memset(seen, 0, sizeof(seen));
+  lastTimestamp = 0;
+  lastDelta = 0;
+  frames = 0;
+  memcpy(block, CAPTURE_MAGIC, CAPTURE_MAGIC_BYTES);
+  used = CAPTURE_MAGIC_BYTES;
+  bytes = used;
+}
+
+bool CaptureEncoder::append(const LINFrame& frame) {
+  if (used + CAPTURE_MAX_RECORD > CAPTURE_BLOCK_BYTES) {
+    return false;
+  }
+  size_t start = used;
+  byte id = frame.pid & 0x3F;
+  byte& tag = block[used++];
+  tag = id;
+
+  unsigned long delta = (uint32_t)(frame.timestampUs - lastTimestamp);
+  if (delta != lastDelta) {
+    tag |= CAPTURE_TAG_DELTA;
+    unsigned long value = delta;
+    while (value >= 0x80) {
+      block[used++] = (value & 0x7F) | 0x80;
+      value >>= 7;
+    }
+    block[used++] = value;
+    lastDelta = delta;
+  }
+  lastTimestamp = frame.timestampUs;
+
+  if (seen[id] && sameFrame(frame, last[id])) {
+    tag |= CAPTURE_TAG_REPEAT;
+  } else {
+    byte dataLength = frame.dataLength > 8 ? 8 : frame.dataLength;
+    block[used++] = frame.pid;
+    block[used++] = frame.sync;
+    block[used++] = dataLength | (frame.checksumValid ? CAPTURE_LEN_VALID : 0) | frame.bus << CAPTURE_LEN_BUS_SHIFT;
+    memcpy(block + used, frame.data, dataLength);
+    used += dataLength;
+    block[used++] = frame.checksum;
+    if (!frame.checksumValid) {
+      block[used++] = frame.expectedChecksum;
+    }
+    last[id] = frame;
+    seen[id] = true;
+  }
+  frames++;
+  bytes += used - start;
+  return true;
+}
+
+void CaptureDecoder::begin() {
+  memset(last, 0, sizeof(last));
+  field = MAGIC;
+  position = 0;
+  badMagic = false;
+  deltaScale = 1;
+  timestamp = 0;
+  delta = 0;
+}
+
+bool CaptureDecoder::emit(LINFrame& frame) {
+  timestamp += delta * deltaScale;
+  current.timestampUs = timestamp;
+  frame = current;
+  field = TAG;
+  return true;
+}
+
+bool CaptureDecoder::push(byte value, LINFrame& frame) {
+  switch (field) {
+    case MAGIC:
+      if (position == CAPTURE_MAGIC_BYTES - 1 && value == (byte)CAPTURE_MAGIC_MS[position]) {
+        deltaScale = 1000;
+      } else if (value != (byte)CAPTURE_MAGIC[position]) {
+        badMagic = true;
+      }
+      if (++position == CAPTURE_MAGIC_BYTES) {
+        field = TAG;
+      }
+      return false;
+
+    case TAG:
+      tag = value;
+      if (tag & CAPTURE_TAG_DELTA) {
+        delta = 0;
+        position = 0;
+        field = DELTA;
+        return false;
+      }
+      break;
+
+    case DELTA:
+      delta |= (unsigned long)(value & 0x7F) << (7 * position++);
+      if (value & 0x80) {
+        return false;
+      }
+      break;
+
+    case PID:
+      current.pid = value;
+      field = SYNC;
+      return false;
+
+    case SYNC:
+      current.sync = value;
+      field = LENGTH;
+      return false;
+
+    case LENGTH:
+      current.dataLength = (value & 0x0F) > 8 ? 8 : value & 0x0F;
+      current.checksumValid = value & CAPTURE_LEN_VALID;
+      current.bus = value >> CAPTURE_LEN_BUS_SHIFT;
+      position = 0;
+      field = current.dataLength ? DATA : CHECKSUM;
+      return false;
+
+    case DATA:
+      current.data[position++] = value;
+      if (position == current.dataLength) {
+        field = CHECKSUM;
+      }
+      return false;
+
+    case CHECKSUM:
+      current.checksum = value;
+      current.expectedChecksum = value;
+      if (!current.checksumValid) {
+        field = EXPECTED;
+        return false;
+      }
+      last[current.pid & 0x3F] = current;
+      return emit(frame);
+
+    case EXPECTED:
+      current.expectedChecksum = value;
+      last[current.pid & 0x3F] = current;
+      return emit(frame);
+  }
+
+  // The tag and any delta are in, the frame is either a repeat or follows
+  if (tag & CAPTURE_TAG_REPEAT) {
+    current = last[tag & 0x3F];
+    return emit(frame);
+  }
+  field = PID;
+  return false;
+}
+
+bool isPackedCapture(const byte header[], size_t length) {
+  return length >= CAPTURE_MAGIC_BYTES && (memcmp(header, CAPTURE_MAGIC, CAPTURE_MAGIC_BYTES) == 0 ||
+                                           memcmp(header, CAPTURE_MAGIC_MS, CAPTURE_MAGIC_BYTES) == 0);
+}
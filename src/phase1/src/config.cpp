@@ -0,0 +1,310 @@
+#include "config.h"
+
+#include <LittleFS.h>
+#include <vector>
+
+// Record layout: marker, key length, value length (2 bytes LE), key, value,
+// CRC32 (4 bytes LE) over everything before it. The top bit of the key length
+// is set on every record of a commit except the last, so a commit only takes
+// effect once all of it made it to flash.
+#define CONFIG_RECORD_MARKER 0xC7
+#define CONFIG_RECORD_OVERHEAD 8
+#define CONFIG_RECORD_MORE 0x80
+
+struct ConfigEntry {
+  String key;
+  String value;
+  bool pending; // changed since the last commit
+};
+
+static std::vector<ConfigEntry> entries;
+
+unsigned long configLoadMicros = 0;
+size_t configJournalSize = 0;
+unsigned int configCompactions = 0;
+unsigned int configDroppedBytes = 0;
+
+// Files from before the journal, migrated on first boot
+static const char* legacyFiles[] = {
+  "/config/wifi.txt",
+  "/config/ap.txt",
+  "/config/ota.txt",
+  "/config/output_enabled.txt",
+  "/config/responder_enabled.txt",
+};
+
+static uint32_t crc32(const uint8_t* data, size_t length) {
+  uint32_t crc = 0xFFFFFFFF;
+  for (size_t i = 0; i < length; i++) {
+    crc ^= data[i];
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+  }
+  return ~crc;
+}
+
+static ConfigEntry* findEntry(const char* key) {
+  for (auto& entry : entries) {
+    if (entry.key == key) {
+      return &entry;
+    }
+  }
+  return nullptr;
+}
+
+static void appendRecord(std::vector<uint8_t>& out, const ConfigEntry& entry, bool more) {
+  size_t start = out.size();
+  size_t keyLength = entry.key.length();
+  size_t valueLength = entry.value.length();
+  out.push_back(CONFIG_RECORD_MARKER);
+  out.push_back((uint8_t)keyLength | (more ? CONFIG_RECORD_MORE : 0));
+  out.push_back(valueLength & 0xFF);
+  out.push_back(valueLength >> 8);
+  out.insert(out.end(), entry.key.c_str(), entry.key.c_str() + keyLength);
+  out.insert(out.end(), entry.value.c_str(), entry.value.c_str() + valueLength);
+  uint32_t crc = crc32(&out[start], out.size() - start);
+  for (int i = 0; i < 4; i++) {
+    out.push_back((crc >> (8 * i)) & 0xFF);
+  }
+}
+
+static void applyEntry(const String& key, const String& value) {
+  ConfigEntry* entry = findEntry(key.c_str());
+  if (entry) {
+    entry->value = value;
+  } else {
+    entries.push_back(ConfigEntry{key, value, false});
+  }
+}
+
+// Applies every complete commit and returns how many bytes of the journal
+// were good. Anything after the first bad record is a torn write and is
+// ignored, along with the rest of the commit it belonged to.
+static size_t parseJournal(const uint8_t* data, size_t length) {
+  std::vector<ConfigEntry> commit;
+  size_t offset = 0;
+  size_t committed = 0;
+  while (length - offset >= CONFIG_RECORD_OVERHEAD) {
+    const uint8_t* record = data + offset;
+    bool more = record[1] & CONFIG_RECORD_MORE;
+    size_t keyLength = record[1] & ~CONFIG_RECORD_MORE;
+    size_t valueLength = record[2] | (record[3] << 8);
+    if (record[0] != CONFIG_RECORD_MARKER || keyLength == 0 || keyLength > CONFIG_MAX_KEY ||
+        valueLength > CONFIG_MAX_VALUE) {
+      break;
+    }
+    size_t recordLength = CONFIG_RECORD_OVERHEAD + keyLength + valueLength;
+    if (recordLength > length - offset) {
+      break;
+    }
+    size_t crcOffset = recordLength - 4;
+    uint32_t storedCrc = record[crcOffset] | (record[crcOffset + 1] << 8) |
+      (record[crcOffset + 2] << 16) | ((uint32_t)record[crcOffset + 3] << 24);
+    if (crc32(record, crcOffset) != storedCrc) {
+      break;
+    }
+
+    ConfigEntry entry{"", "", false};
+    entry.key.concat((const char*)record + 4, keyLength);
+    entry.value.concat((const char*)record + 4 + keyLength, valueLength);
+    commit.push_back(entry);
+    offset += recordLength;
+    if (!more) {
+      for (const auto& e : commit) {
+        applyEntry(e.key, e.value);
+      }
+      commit.clear();
+      committed = offset;
+    }
+  }
+  return committed;
+}
+
+// Writes the current values to a new file and swaps it in. The old journal
+// stays intact until the rename, so a power loss here loses nothing.
+static bool compactJournal() {
+  std::vector<uint8_t> snapshot;
+  for (size_t i = 0; i < entries.size(); i++) {
+    appendRecord(snapshot, entries[i], i + 1 < entries.size());
+  }
+
+  File file = LittleFS.open(CONFIG_JOURNAL_TMP_PATH, "w");
+  if (!file) {
+    return false;
+  }
+  size_t written = file.write(snapshot.data(), snapshot.size());
+  file.close();
+  if (written != snapshot.size()) {
+    LittleFS.remove(CONFIG_JOURNAL_TMP_PATH);
+    return false;
+  }
+  if (!LittleFS.rename(CONFIG_JOURNAL_TMP_PATH, CONFIG_JOURNAL_PATH)) {
+    // configBegin() falls back to the tmp file if this leaves no journal
+    LittleFS.remove(CONFIG_JOURNAL_PATH);
+    if (!LittleFS.rename(CONFIG_JOURNAL_TMP_PATH, CONFIG_JOURNAL_PATH)) {
+      return false;
+    }
+  }
+
+  for (auto& entry : entries) {
+    entry.pending = false;
+  }
+  configJournalSize = snapshot.size();
+  configCompactions++;
+  return true;
+}
+
+static void migrateLegacyFiles() {
+  File wifiConfig = LittleFS.open("/config/wifi.txt", "r");
+  if (wifiConfig && wifiConfig.size() > 0) {
+    String ssid = wifiConfig.readStringUntil('\n');
+    ssid.trim();
+    String password = wifiConfig.readStringUntil('\n');
+    password.trim();
+    configSet("wifi_ssid", ssid);
+    configSet("wifi_password", password);
+    configSetInt("wifi_timeout", wifiConfig.parseInt());
+    wifiConfig.close();
+  }
+
+  File apConfig = LittleFS.open("/config/ap.txt", "r");
+  if (apConfig && apConfig.size() > 0) {
+    String ssid = apConfig.readStringUntil('\n');
+    ssid.trim();
+    String password = apConfig.readStringUntil('\n');
+    password.trim();
+    configSet("ap_ssid", ssid);
+    configSet("ap_password", password);
+    apConfig.close();
+  }
+
+  File otaConfig = LittleFS.open("/config/ota.txt", "r");
+  if (otaConfig && otaConfig.size() > 0) {
+    String username = otaConfig.readStringUntil('\n');
+    username.trim();
+    String password = otaConfig.readStringUntil('\n');
+    password.trim();
+    configSet("ota_username", username);
+    configSet("ota_password", password);
+    otaConfig.close();
+  }
+
+  File outputConfig = LittleFS.open("/config/output_enabled.txt", "r");
+  if (outputConfig && outputConfig.size() > 0) {
+    configSetInt("output_enabled", outputConfig.parseInt());
+    outputConfig.close();
+  }
+
+  File responderConfig = LittleFS.open("/config/responder_enabled.txt", "r");
+  if (responderConfig && responderConfig.size() > 0) {
+    configSetInt("responder_enabled", responderConfig.parseInt());
+    responderConfig.close();
+  }
+
+  // Only drop the old files once their values are safely in the journal
+  if (!entries.empty() && configCommit()) {
+    for (const char* path : legacyFiles) {
+      LittleFS.remove(path);
+    }
+    Serial.println("Migrated " + String((unsigned int)entries.size()) + " settings to the config journal");
+  }
+}
+
+bool configBegin() {
+  unsigned long start = micros();
+  entries.clear();
+  configJournalSize = 0;
+  configDroppedBytes = 0;
+
+  bool fromTmp = false;
+  File file = LittleFS.open(CONFIG_JOURNAL_PATH, "r");
+  if (!file) {
+    // Power lost between removing the old journal and renaming the new one
+    file = LittleFS.open(CONFIG_JOURNAL_TMP_PATH, "r");
+    fromTmp = (bool)file;
+  } else if (LittleFS.exists(CONFIG_JOURNAL_TMP_PATH)) {
+    // Half-written compaction, the journal itself is still complete
+    LittleFS.remove(CONFIG_JOURNAL_TMP_PATH);
+  }
+
+  if (file) {
+    std::vector<uint8_t> journal(file.size());
+    size_t length = file.read(journal.data(), journal.size());
+    file.close();
+    configJournalSize = parseJournal(journal.data(), length);
+    configDroppedBytes = journal.size() - configJournalSize;
+    // New records can't go after a torn one, so rewrite without it
+    if (configDroppedBytes > 0 || fromTmp) {
+      compactJournal();
+    }
+  } else {
+    migrateLegacyFiles();
+  }
+
+  configLoadMicros = (uint32_t)(micros() - start);
+  return true;
+}
+
+String configGet(const char* key, const char* fallback) {
+  ConfigEntry* entry = findEntry(key);
+  return entry ? entry->value : String(fallback);
+}
+
+long configGetInt(const char* key, long fallback) {
+  ConfigEntry* entry = findEntry(key);
+  return entry ? entry->value.toInt() : fallback;
+}
+
+void configSet(const char* key, const String& value) {
+  if (strlen(key) == 0 || strlen(key) > CONFIG_MAX_KEY || value.length() > CONFIG_MAX_VALUE) {
+    return;
+  }
+  ConfigEntry* entry = findEntry(key);
+  if (!entry) {
+    entries.push_back(ConfigEntry{String(key), value, true});
+  } else if (entry->value != value) {
+    entry->value = value;
+    entry->pending = true;
+  }
+}
+
+void configSetInt(const char* key, long value) {
+  configSet(key, String(value));
+}
+
+bool configCommit() {
+  std::vector<const ConfigEntry*> pending;
+  for (const auto& entry : entries) {
+    if (entry.pending) {
+      pending.push_back(&entry);
+    }
+  }
+  std::vector<uint8_t> batch;
+  for (size_t i = 0; i < pending.size(); i++) {
+    appendRecord(batch, *pending[i], i + 1 < pending.size());
+  }
+  if (batch.empty()) {
+    return true;
+  }
+  if (configJournalSize + batch.size() > CONFIG_JOURNAL_MAX) {
+    return compactJournal();
+  }
+
+  File file = LittleFS.open(CONFIG_JOURNAL_PATH, "a");
+  if (!file) {
+    return false;
+  }
+  size_t written = file.write(batch.data(), batch.size());
+  file.close();
+  if (written != batch.size()) {
+    // Whatever made it out is a torn record, start over from a clean file
+    return compactJournal();
+  }
+
+  for (auto& entry : entries) {
+    entry.pending = false;
+  }
+  configJournalSize += batch.size();
+  return true;
+}
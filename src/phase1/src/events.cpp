@@ -0,0 +1,92 @@
+#include "events.h"
+
+unsigned long eventsPublished = 0;
+unsigned long eventsDropped = 0;
+unsigned long eventsMaxQueued = 0;
+
+struct Subscriber {
+  unsigned int mask;
+  EventHandler handler;
+};
+
+static Subscriber subscribers[EVENTS_MAX_SUBSCRIBERS];
+static size_t subscriberCount = 0;
+static unsigned int subscribedMask = 0;
+
+// head and tail only ever count up, the ring index is the low bits
+static Event ring[EVENTS_RING];
+static unsigned long head = 0;
+static unsigned long tail = 0;
+
+bool eventsSubscribe(unsigned int mask, EventHandler handler) {
+  if (subscriberCount == EVENTS_MAX_SUBSCRIBERS) {
+    return false;
+  }
+  subscribers[subscriberCount++] = {mask, handler};
+  subscribedMask |= mask;
+  return true;
+}
+
+// The next free slot, or nullptr if nobody wants the type or the ring is full
+static Event* reserve(EventType type, unsigned long nowMs) {
+  if (!(subscribedMask & EVENT_MASK(type))) {
+    return nullptr;
+  }
+  unsigned long queued = head - tail;
+  if (queued == EVENTS_RING) {
+    eventsDropped++;
+    return nullptr;
+  }
+  if (queued + 1 > eventsMaxQueued) {
+    eventsMaxQueued = queued + 1;
+  }
+  Event* event = &ring[head % EVENTS_RING];
+  event->type = type;
+  event->timeMs = nowMs;
+  return event;
+}
+
+void eventsPublishFrame(EventType type, uint8_t bus, const byte buffer[], short length, byte expectedChecksum,
+                        unsigned long frameUs, unsigned long nowMs) {
+  Event* event = reserve(type, nowMs);
+  if (!event) {
+    return;
+  }
+  if (length > lincore::MAX_FRAME_BYTES) {
+    length = lincore::MAX_FRAME_BYTES;
+  }
+  event->bus = bus;
+  event->length = length;
+  event->expectedChecksum = expectedChecksum;
+  event->value = 0;
+  event->frameUs = frameUs;
+  memcpy(event->data, buffer, length);
+  head++;
+  eventsPublished++;
+}
+
+void eventsPublish(EventType type, uint8_t value, unsigned long nowMs) {
+  Event* event = reserve(type, nowMs);
+  if (!event) {
+    return;
+  }
+  event->bus = 0;
+  event->length = 0;
+  event->value = value;
+  event->frameUs = 0;
+  head++;
+  eventsPublished++;
+}
+
+void eventsDrain() {
+  while (tail != head) {
+    const Event& event = ring[tail % EVENTS_RING];
+    unsigned int bit = EVENT_MASK(event.type);
+    for (size_t i = 0; i < subscriberCount; i++) {
+      if (subscribers[i].mask & bit) {
+        subscribers[i].handler(event);
+      }
+    }
+    tail++;
+  }
+}
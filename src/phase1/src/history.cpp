@@ -0,0 +1,337 @@
+#include "history.h"
+
+#include <LittleFS.h>
+
+// Block layout on flash: start time (4 bytes LE), state before the block,
+// data length (2 bytes LE), then the records. A record is the time since the
+// previous record in the block as a little-endian base-128 varint, then the
+// new state.
+#define HISTORY_BLOCK_HEADER 7
+#define HISTORY_MAX_RECORD 6
+
+struct HistoryBlock {
+  unsigned long startMs;
+  byte prevState;
+  uint16_t length;
+  unsigned long lastMs; // last record, for the next delta
+  byte data[HISTORY_BLOCK_BYTES];
+};
+
+struct FlashBlock {
+  unsigned long startMs;
+  byte prevState;
+  uint16_t length;
+  uint32_t offset;
+  bool old; // in HISTORY_OLD_PATH
+};
+
+// Runs through a sequence of changes keeping the stats, for both the trip
+// totals and range queries
+struct HistoryAccumulator {
+  HistoryStats stats;
+  byte state;
+  unsigned long since;
+
+  void start(byte initial, unsigned long timeMs) {
+    memset(&stats, 0, sizeof(stats));
+    state = initial;
+    since = timeMs;
+  }
+
+  void endRun(unsigned long timeMs) {
+    unsigned long held = timeMs - since;
+    if (state & LIGHT_BRAKES) {
+      stats.brakeMs += held;
+    }
+    if (held > stats.longestMs) {
+      stats.longestMs = held;
+      stats.longestStartMs = since;
+      stats.longestState = state;
+    }
+  }
+
+  void change(byte next, unsigned long timeMs) {
+    endRun(timeMs);
+    byte rising = next & ~state;
+    // The car marks both signals with the brakes on
+    if (!(next & LIGHT_BRAKES)) {
+      if (rising & LIGHT_LEFT) stats.leftBlinks++;
+      if (rising & LIGHT_RIGHT) stats.rightBlinks++;
+    }
+    if (rising & LIGHT_BRAKES) {
+      stats.brakeEvents++;
+    }
+    stats.changes++;
+    state = next;
+    since = timeMs;
+  }
+
+  HistoryStats finish(unsigned long timeMs) const {
+    HistoryAccumulator copy = *this;
+    copy.endRun(timeMs);
+    return copy.stats;
+  }
+};
+
+static HistoryBlock ring[HISTORY_RAM_BLOCKS];
+static size_t ringFirst = 0;
+static size_t ringCount = 0;
+static std::vector<FlashBlock> flashBlocks;
+static bool flashEnabled = false;
+static bool recording = false; // seen a light frame this trip
+static byte currentState = 0;
+static HistoryAccumulator totals;
+
+unsigned long historyOldestMs = 0;
+size_t historyRamBytes = 0;
+size_t historyFlashBytes = 0;
+unsigned long historyDroppedBlocks = 0;
+
+static HistoryBlock& ringBlock(size_t i) {
+  return ring[(ringFirst + i) % HISTORY_RAM_BLOCKS];
+}
+
+void historyBegin(bool useFlash) {
+  flashEnabled = useFlash;
+  ringFirst = 0;
+  ringCount = 0;
+  flashBlocks.clear();
+  recording = false;
+  currentState = 0;
+  historyOldestMs = 0;
+  historyRamBytes = 0;
+  historyFlashBytes = 0;
+  historyDroppedBlocks = 0;
+  if (flashEnabled) {
+    LittleFS.mkdir("/history");
+    LittleFS.remove(HISTORY_PATH);
+    LittleFS.remove(HISTORY_OLD_PATH);
+  }
+}
+
+static void rollFlashFile() {
+  LittleFS.remove(HISTORY_OLD_PATH);
+  LittleFS.rename(HISTORY_PATH, HISTORY_OLD_PATH);
+  std::vector<FlashBlock> kept;
+  historyFlashBytes = 0;
+  for (auto& block : flashBlocks) {
+    if (block.old) {
+      historyDroppedBlocks++;
+      continue;
+    }
+    block.old = true;
+    historyFlashBytes += HISTORY_BLOCK_HEADER + block.length;
+    kept.push_back(block);
+  }
+  flashBlocks.swap(kept);
+}
+
+static bool writeFlashBlock(const HistoryBlock& block) {
+  File file = LittleFS.open(HISTORY_PATH, "a");
+  if (!file) {
+    return false;
+  }
+  if (file.size() + HISTORY_BLOCK_HEADER + block.length > HISTORY_FILE_MAX) {
+    file.close();
+    rollFlashFile();
+    file = LittleFS.open(HISTORY_PATH, "a");
+    if (!file) {
+      return false;
+    }
+  }
+  FlashBlock entry = {block.startMs, block.prevState, block.length, (uint32_t)file.size(), false};
+  byte header[HISTORY_BLOCK_HEADER] = {
+    (byte)block.startMs, (byte)(block.startMs >> 8), (byte)(block.startMs >> 16), (byte)(block.startMs >> 24),
+    block.prevState, (byte)block.length, (byte)(block.length >> 8),
+  };
+  bool ok = file.write(header, sizeof(header)) == sizeof(header) &&
+            file.write(block.data, block.length) == block.length;
+  file.close();
+  if (ok) {
+    flashBlocks.push_back(entry);
+    historyFlashBytes += HISTORY_BLOCK_HEADER + block.length;
+  }
+  return ok;
+}
+
+// Frees the oldest RAM block, moving it to flash if there is any
+static void spillOldestBlock() {
+  HistoryBlock& oldest = ringBlock(0);
+  if (!flashEnabled || !writeFlashBlock(oldest)) {
+    historyDroppedBlocks++;
+  }
+  historyRamBytes -= oldest.length;
+  ringFirst = (ringFirst + 1) % HISTORY_RAM_BLOCKS;
+  ringCount--;
+  if (!flashBlocks.empty()) {
+    historyOldestMs = flashBlocks.front().startMs;
+  } else {
+    historyOldestMs = ringBlock(0).startMs;
+  }
+}
+
+static HistoryBlock& startBlock(unsigned long nowMs) {
+  if (ringCount == HISTORY_RAM_BLOCKS) {
+    spillOldestBlock();
+  }
+  ringCount++;
+  HistoryBlock& block = ringBlock(ringCount - 1);
+  block.startMs = nowMs;
+  block.lastMs = nowMs;
+  block.prevState = currentState;
+  block.length = 0;
+  return block;
+}
+
+void historyRecord(byte state, unsigned long nowMs) {
+  state &= HISTORY_STATE_MASK;
+  if (recording && state == currentState) {
+    return;
+  }
+  if (!recording) {
+    recording = true;
+    totals.start(state, nowMs);
+    historyOldestMs = nowMs;
+  } else {
+    totals.change(state, nowMs);
+  }
+
+  HistoryBlock* block = ringCount ? &ringBlock(ringCount - 1) : nullptr;
+  if (!block || block->length + HISTORY_MAX_RECORD > HISTORY_BLOCK_BYTES) {
+    block = &startBlock(nowMs);
+  }
+  uint16_t start = block->length;
+  unsigned long delta = nowMs - block->lastMs;
+  while (delta >= 0x80) {
+    block->data[block->length++] = (delta & 0x7F) | 0x80;
+    delta >>= 7;
+  }
+  block->data[block->length++] = delta;
+  block->data[block->length++] = state;
+  block->lastMs = nowMs;
+  historyRamBytes += block->length - start;
+  currentState = state;
+}
+
+// Reads back one block, from RAM or flash, calling visit(time, state) for each
+// record until it returns false. Returns false if the walk should stop.
+template <class Visit>
+static bool decodeBlock(const byte* data, uint16_t length, unsigned long startMs, Visit visit) {
+  unsigned long timeMs = startMs;
+  uint16_t pos = 0;
+  while (pos < length) {
+    unsigned long delta = 0;
+    byte shift = 0;
+    while (pos < length && (data[pos] & 0x80)) {
+      delta |= (unsigned long)(data[pos++] & 0x7F) << shift;
+      shift += 7;
+    }
+    if (pos + 1 >= length) {
+      break;
+    }
+    delta |= (unsigned long)data[pos++] << shift;
+    timeMs += delta;
+    if (!visit(timeMs, data[pos++])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+byte historyQuery(unsigned long fromMs, unsigned long toMs, unsigned long nowMs,
+                  std::vector<LightChange>& changes, size_t maxChanges, HistoryStats& stats) {
+  size_t total = flashBlocks.size() + ringCount;
+  auto blockStart = [&](size_t i) {
+    return i < flashBlocks.size() ? flashBlocks[i].startMs : ringBlock(i - flashBlocks.size()).startMs;
+  };
+
+  // Start from the last block that began at or before the range
+  size_t first = 0;
+  while (first + 1 < total && blockStart(first + 1) <= fromMs) {
+    first++;
+  }
+  byte state = currentState;
+  if (first < total) {
+    state = first < flashBlocks.size() ? flashBlocks[first].prevState : ringBlock(first - flashBlocks.size()).prevState;
+  }
+
+  HistoryAccumulator range;
+  bool started = false;
+  byte initial = state;
+  auto visit = [&](unsigned long timeMs, byte next) {
+    if (timeMs <= fromMs) {
+      state = next;
+      return true;
+    }
+    if (!started) {
+      initial = state;
+      range.start(state, fromMs);
+      started = true;
+    }
+    if (timeMs > toMs) {
+      return false;
+    }
+    // The trip's first record is stored even when the lights are off
+    if (next == range.state) {
+      return true;
+    }
+    range.change(next, timeMs);
+    if (changes.size() < maxChanges) {
+      changes.push_back({timeMs, next});
+    }
+    return true;
+  };
+
+  File files[2];
+  byte buffer[HISTORY_BLOCK_BYTES];
+  for (size_t i = first; i < total && blockStart(i) <= toMs; i++) {
+    bool more;
+    if (i < flashBlocks.size()) {
+      const FlashBlock& block = flashBlocks[i];
+      File& file = files[block.old];
+      if (!file) {
+        file = LittleFS.open(block.old ? HISTORY_OLD_PATH : HISTORY_PATH, "r");
+      }
+      if (!file || !file.seek(block.offset + HISTORY_BLOCK_HEADER) ||
+          file.read(buffer, block.length) != block.length) {
+        continue;
+      }
+      more = decodeBlock(buffer, block.length, block.startMs, visit);
+    } else {
+      const HistoryBlock& block = ringBlock(i - flashBlocks.size());
+      more = decodeBlock(block.data, block.length, block.startMs, visit);
+    }
+    if (!more) {
+      break;
+    }
+  }
+  files[0].close();
+  files[1].close();
+
+  if (!started) {
+    initial = state;
+    range.start(state, fromMs);
+  }
+  unsigned long endMs = toMs < nowMs ? toMs : nowMs;
+  stats = range.finish(endMs > fromMs ? endMs : fromMs);
+  return initial;
+}
+
+HistoryStats historyTotals(unsigned long nowMs) {
+  if (!recording) {
+    HistoryStats empty = {};
+    return empty;
+  }
+  return totals.finish(nowMs);
+}
+
+String historyStatsJson(const HistoryStats& stats) {
+  return "{\"changes\":" + String(stats.changes) +
+         ",\"left_blinks\":" + String(stats.leftBlinks) +
+         ",\"right_blinks\":" + String(stats.rightBlinks) +
+         ",\"brake_events\":" + String(stats.brakeEvents) +
+         ",\"brake_ms\":" + String(stats.brakeMs) +
+         ",\"longest_ms\":" + String(stats.longestMs) +
+         ",\"longest_start_ms\":" + String(stats.longestStartMs) +
+         ",\"longest_state\":" + String(stats.longestState) + "}";
+}
@@ -0,0 +1,778 @@
+#include "http_server.h"
+
+#include <algorithm>
+
+static const char* statusText(int code) {
+  switch (code) {
+    case 200: return "OK";
+    case 302: return "Found";
+    case 400: return "Bad Request";
+    case 401: return "Unauthorized";
+    case 403: return "Forbidden";
+    case 404: return "Not Found";
+    case 413: return "Payload Too Large";
+    case 431: return "Request Header Fields Too Large";
+    case 503: return "Service Unavailable";
+    default: return "Internal Server Error";
+  }
+}
+
+static int hexValue(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+static String urlDecode(const String& text) {
+  String decoded;
+  decoded.reserve(text.length());
+  for (unsigned int i = 0; i < text.length(); i++) {
+    char c = text[i];
+    if (c == '+') {
+      c = ' ';
+    } else if (c == '%' && i + 2 < text.length() && hexValue(text[i + 1]) >= 0 && hexValue(text[i + 2]) >= 0) {
+      c = hexValue(text[i + 1]) << 4 | hexValue(text[i + 2]);
+      i += 2;
+    }
+    decoded += c;
+  }
+  return decoded;
+}
+
+static bool base64Decode(const String& text, String& decoded) {
+  static const char* alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  uint32_t bits = 0;
+  int count = 0;
+  for (unsigned int i = 0; i < text.length() && text[i] != '='; i++) {
+    const char* found = strchr(alphabet, text[i]);
+    if (!found || !*found) {
+      return false;
+    }
+    bits = bits << 6 | (found - alphabet);
+    count += 6;
+    if (count >= 8) {
+      count -= 8;
+      decoded += (char)(bits >> count);
+    }
+  }
+  return true;
+}
+
+static int findBytes(const std::vector<uint8_t>& data, const String& needle, size_t from = 0) {
+  const char* begin = needle.c_str();
+  auto found = std::search(data.begin() + from, data.end(), begin, begin + needle.length());
+  return found == data.end() ? -1 : found - data.begin();
+}
+
+// A quoted parameter from a header, e.g. name="firmware"
+static String headerParam(const String& header, const char* name) {
+  String key = String(name) + "=";
+  int start = header.indexOf(key);
+  if (start < 0) {
+    return "";
+  }
+  start += key.length();
+  int end;
+  if (header[start] == '"') {
+    start++;
+    end = header.indexOf('"', start);
+  } else {
+    end = header.indexOf(';', start);
+  }
+  return header.substring(start, end < 0 ? header.length() : end);
+}
+
+bool HttpFeed::publish(const String& body) {
+  if (latest && *latest == body) {
+    return false;
+  }
+  latest = std::make_shared<const String>(body);
+  published++;
+  return true;
+}
+
+void HttpServer::begin() {
+  server.begin();
+  server.setNoDelay(true);
+}
+
+void HttpServer::stop() {
+  for (auto& conn : connections) {
+    if (conn.state != FREE) {
+      close(conn);
+    }
+  }
+  server.stop();
+}
+
+void HttpServer::on(const char* path, Method method, Handler handler, Handler upload) {
+  routes.push_back({path, method, handler, upload});
+}
+
+void HttpServer::poll(unsigned long budgetUs) {
+  unsigned long start = micros();
+  pollSlowest = "";
+  pollSlowestUs = 0;
+  auto keepGoing = [&]() {
+    return (uint32_t)(micros() - start) < budgetUs && !(yieldCheck && yieldCheck());
+  };
+  if (!keepGoing()) {
+    return;
+  }
+  for (auto& conn : connections) {
+    if (conn.state != FREE) {
+      continue;
+    }
+    WiFiClient client = server.accept();
+    if (!client) {
+      break;
+    }
+    client.setNoDelay(true);
+    conn.client = client;
+    conn.state = READING_HEADERS;
+    conn.lastActivity = millis();
+    connectionsAccepted++;
+  }
+
+  bool progress = true;
+  while (progress && keepGoing()) {
+    progress = false;
+    for (size_t i = 0; i < HTTP_MAX_CONNECTIONS && keepGoing(); i++) {
+      Connection& conn = connections[(next + i) % HTTP_MAX_CONNECTIONS];
+      if (conn.state != FREE && step(conn)) {
+        progress = true;
+      }
+    }
+    next = (next + 1) % HTTP_MAX_CONNECTIONS;
+  }
+
+  unsigned long elapsed = (uint32_t)(micros() - start);
+  if (elapsed > maxPollUs) {
+    maxPollUs = elapsed;
+  }
+}
+
+bool HttpServer::step(Connection& conn) {
+  bool progress = false;
+  switch (conn.state) {
+    case READING_HEADERS: progress = readHeaders(conn); break;
+    case READING_BODY: progress = readBody(conn); break;
+    case UPLOADING: progress = readUpload(conn); break;
+    case SENDING:
+    case STREAMING: progress = sendResponse(conn); break;
+    case FREE: return false;
+  }
+  if (progress) {
+    conn.lastActivity = millis();
+    return true;
+  }
+  if (conn.state == FREE) {
+    return false;
+  }
+
+  // Nothing to do, drop clients that went away or stalled
+  bool gone = !conn.client.connected() && conn.client.available() <= 0;
+  // A stream between events is waiting on the feed, not the client
+  bool idle = millis() - conn.lastActivity > HTTP_IDLE_TIMEOUT_MS && (conn.state != STREAMING || sending(conn));
+  if (gone || idle) {
+    if (idle && !(conn.state == READING_HEADERS && conn.head.length() == 0)) {
+      connectionsTimedOut++;
+    }
+    if (conn.state == UPLOADING && conn.partState == PART_DATA && conn.partFilename.length() > 0) {
+      emitUpload(conn, UPLOAD_FILE_ABORTED, nullptr, 0);
+    }
+    close(conn);
+  }
+  return false;
+}
+
+bool HttpServer::readHeaders(Connection& conn) {
+  uint8_t buffer[HTTP_IO_CHUNK];
+  size_t count;
+  if (!conn.pending.empty()) {
+    // Left over from the last request on this connection
+    count = std::min(conn.pending.size(), sizeof(buffer));
+    memcpy(buffer, conn.pending.data(), count);
+    conn.pending.erase(conn.pending.begin(), conn.pending.begin() + count);
+  } else {
+    int available = conn.client.available();
+    if (available <= 0) {
+      return false;
+    }
+    int read = conn.client.read(buffer, std::min((size_t)available, sizeof(buffer)));
+    if (read <= 0) {
+      return false;
+    }
+    count = read;
+  }
+
+  static const char* blankLine = "\r\n\r\n";
+  for (size_t i = 0; i < count; i++) {
+    if (buffer[i] == blankLine[conn.headMatch]) {
+      conn.headMatch++;
+    } else {
+      conn.headMatch = buffer[i] == '\r' ? 1 : 0;
+    }
+    if (conn.headMatch == 4) {
+      conn.head.concat((const char*)buffer, i + 1);
+      conn.pending.insert(conn.pending.begin(), buffer + i + 1, buffer + count);
+      parseHead(conn);
+      return true;
+    }
+  }
+  conn.head.concat((const char*)buffer, count);
+  if (conn.head.length() > HTTP_MAX_HEADER_BYTES) {
+    reject(conn, 431, "Request headers too large");
+  }
+  return true;
+}
+
+void HttpServer::parseHead(Connection& conn) {
+  String& head = conn.head;
+  // Some clients send a spare line ending after a body
+  while (head.startsWith("\r\n")) {
+    head.remove(0, 2);
+  }
+  int lineEnd = head.indexOf("\r\n");
+  int methodEnd = head.indexOf(' ');
+  int targetEnd = head.indexOf(' ', methodEnd + 1);
+  if (lineEnd < 0 || methodEnd < 0 || targetEnd < 0 || targetEnd > lineEnd) {
+    reject(conn, 400, "Bad request");
+    return;
+  }
+  conn.id = ++lastRequestId;
+  conn.method = head.startsWith("POST ") ? POST : GET;
+  String target = head.substring(methodEnd + 1, targetEnd);
+  conn.keepAlive = head.substring(targetEnd + 1, lineEnd) == "HTTP/1.1";
+  int query = target.indexOf('?');
+  conn.path = query < 0 ? target : target.substring(0, query);
+  conn.args.clear();
+  if (query >= 0) {
+    parseArgs(target.substring(query + 1), conn.args);
+  }
+
+  size_t contentLength = 0;
+  conn.authorization = "";
+  conn.contentType = "";
+  int lineStart = lineEnd + 2;
+  while ((lineEnd = head.indexOf("\r\n", lineStart)) > lineStart) {
+    String line = head.substring(lineStart, lineEnd);
+    lineStart = lineEnd + 2;
+    int colon = line.indexOf(':');
+    if (colon < 0) {
+      continue;
+    }
+    String name = line.substring(0, colon);
+    String value = line.substring(colon + 1);
+    name.toLowerCase();
+    value.trim();
+    if (name == "content-length") {
+      contentLength = value.toInt();
+    } else if (name == "content-type") {
+      conn.contentType = value;
+    } else if (name == "authorization") {
+      conn.authorization = value;
+    } else if (name == "connection") {
+      value.toLowerCase();
+      if (value == "close") {
+        conn.keepAlive = false;
+      } else if (value == "keep-alive") {
+        conn.keepAlive = true;
+      }
+    }
+  }
+  head = "";
+  conn.headMatch = 0;
+
+  conn.route = nullptr;
+  for (const auto& route : routes) {
+    if (route.path == conn.path && (route.method == ANY || route.method == conn.method)) {
+      conn.route = &route;
+      break;
+    }
+  }
+
+  // Anything buffered past the headers is the start of the body, and past
+  // that a pipelined request, kept for when this one is done
+  size_t buffered = std::min(conn.pending.size(), contentLength);
+  conn.pipelined.assign(conn.pending.begin() + buffered, conn.pending.end());
+  conn.pending.resize(buffered);
+  conn.bodyRemaining = contentLength - buffered;
+  conn.body = "";
+
+  if (conn.route && conn.route->upload && conn.contentType.startsWith("multipart/form-data")) {
+    String boundary = headerParam(conn.contentType, "boundary");
+    if (boundary.length() == 0) {
+      reject(conn, 400, "Missing multipart boundary");
+      return;
+    }
+    // The first boundary has no line ending in front, add one so they all
+    // look the same
+    conn.boundary = "\r\n--" + boundary;
+    conn.pending.insert(conn.pending.begin(), {'\r', '\n'});
+    conn.partState = PREAMBLE;
+    conn.uploadTotal = 0;
+    conn.state = UPLOADING;
+    parseMultipart(conn);
+    if (conn.bodyRemaining == 0) {
+      dispatch(conn);
+    }
+    return;
+  }
+
+  if (contentLength > HTTP_MAX_BODY_BYTES) {
+    reject(conn, 413, "Request body too large");
+    return;
+  }
+  if (contentLength > 0) {
+    conn.body.concat((const char*)conn.pending.data(), conn.pending.size());
+    conn.pending.clear();
+    conn.state = READING_BODY;
+    if (conn.bodyRemaining == 0) {
+      readBody(conn);
+    }
+    return;
+  }
+  dispatch(conn);
+}
+
+bool HttpServer::readBody(Connection& conn) {
+  if (conn.bodyRemaining > 0) {
+    int available = conn.client.available();
+    if (available <= 0) {
+      return false;
+    }
+    char buffer[HTTP_IO_CHUNK];
+    int read = conn.client.read((uint8_t*)buffer, std::min({(size_t)available, conn.bodyRemaining, sizeof(buffer)}));
+    if (read <= 0) {
+      return false;
+    }
+    conn.body.concat(buffer, read);
+    conn.bodyRemaining -= read;
+  }
+  if (conn.bodyRemaining == 0) {
+    if (conn.contentType.startsWith("application/x-www-form-urlencoded")) {
+      parseArgs(conn.body, conn.args);
+    }
+    dispatch(conn);
+  }
+  return true;
+}
+
+bool HttpServer::readUpload(Connection& conn) {
+  int available = conn.client.available();
+  if (available <= 0 || conn.bodyRemaining == 0) {
+    return false;
+  }
+  uint8_t buffer[HTTP_IO_CHUNK];
+  int read = conn.client.read(buffer, std::min({(size_t)available, conn.bodyRemaining, sizeof(buffer)}));
+  if (read <= 0) {
+    return false;
+  }
+  conn.bodyRemaining -= read;
+  conn.pending.insert(conn.pending.end(), buffer, buffer + read);
+  parseMultipart(conn);
+  if (conn.bodyRemaining == 0) {
+    // Body ended in the middle of a file
+    if (conn.partState == PART_DATA && conn.partFilename.length() > 0) {
+      emitUpload(conn, UPLOAD_FILE_ABORTED, nullptr, 0);
+    }
+    dispatch(conn);
+  }
+  return true;
+}
+
+void HttpServer::parseMultipart(Connection& conn) {
+  std::vector<uint8_t>& data = conn.pending;
+  const String& delimiter = conn.boundary;
+  for (;;) {
+    switch (conn.partState) {
+      case PREAMBLE: {
+        int found = findBytes(data, delimiter);
+        if (found < 0) {
+          if (data.size() >= delimiter.length()) {
+            data.erase(data.begin(), data.end() - (delimiter.length() - 1));
+          }
+          return;
+        }
+        data.erase(data.begin(), data.begin() + found + delimiter.length());
+        conn.partState = PART_END;
+        break;
+      }
+      case PART_END:
+        // "--" after a boundary ends the body, a line ending starts a part
+        if (data.size() < 2) {
+          return;
+        }
+        if (data[0] == '\r' && data[1] == '\n') {
+          data.erase(data.begin(), data.begin() + 2);
+          conn.partState = PART_HEADERS;
+        } else {
+          conn.partState = PARTS_DONE;
+        }
+        break;
+      case PART_HEADERS: {
+        int found = findBytes(data, "\r\n\r\n");
+        if (found < 0) {
+          if (data.size() > HTTP_MAX_HEADER_BYTES) {
+            conn.partState = PARTS_DONE;
+          }
+          return;
+        }
+        String headers;
+        headers.concat((const char*)data.data(), found);
+        data.erase(data.begin(), data.begin() + found + 4);
+        conn.partName = headerParam(headers, "name");
+        conn.partFilename = headerParam(headers, "filename");
+        conn.partValue = "";
+        conn.partState = PART_DATA;
+        if (conn.partFilename.length() > 0) {
+          emitUpload(conn, UPLOAD_FILE_START, nullptr, 0);
+        }
+        break;
+      }
+      case PART_DATA: {
+        int found = findBytes(data, delimiter);
+        // Without a delimiter, hold back anything that could be its start
+        size_t length = found >= 0 ? found : data.size() > delimiter.length() ? data.size() - (delimiter.length() - 1) : 0;
+        bool isFile = conn.partFilename.length() > 0;
+        for (size_t offset = 0; offset < length; offset += HTTP_UPLOAD_CHUNK) {
+          size_t chunk = std::min(length - offset, (size_t)HTTP_UPLOAD_CHUNK);
+          if (isFile) {
+            emitUpload(conn, UPLOAD_FILE_WRITE, data.data() + offset, chunk);
+          } else if (conn.partValue.length() + chunk <= HTTP_MAX_BODY_BYTES) {
+            conn.partValue.concat((const char*)data.data() + offset, chunk);
+          }
+        }
+        if (found < 0) {
+          data.erase(data.begin(), data.begin() + length);
+          return;
+        }
+        data.erase(data.begin(), data.begin() + found + delimiter.length());
+        if (isFile) {
+          emitUpload(conn, UPLOAD_FILE_END, nullptr, 0);
+        } else {
+          conn.args.push_back({conn.partName, conn.partValue});
+        }
+        conn.partFilename = "";
+        conn.partState = PART_END;
+        break;
+      }
+      case PARTS_DONE:
+        data.clear();
+        return;
+    }
+  }
+}
+
+void HttpServer::emitUpload(Connection& conn, HttpUploadStatus status, const uint8_t* data, size_t length) {
+  if (!conn.route || !conn.route->upload) {
+    return;
+  }
+  uploadState.status = status;
+  uploadState.name = conn.partName;
+  uploadState.filename = conn.partFilename;
+  if (status == UPLOAD_FILE_START) {
+    conn.uploadTotal = 0;
+  }
+  conn.uploadTotal += length;
+  uploadState.totalSize = conn.uploadTotal;
+  uploadState.currentSize = length;
+  if (length > 0) {
+    memcpy(uploadState.buf, data, length);
+  }
+  current = &conn;
+  runHandler(conn, conn.route->upload);
+  current = nullptr;
+}
+
+void HttpServer::dispatch(Connection& conn) {
+  // With every connection in use there may be clients waiting to connect, so
+  // don't let this one hold its place
+  bool full = true;
+  for (const auto& other : connections) {
+    if (other.state == FREE) {
+      full = false;
+    }
+  }
+  if (full) {
+    conn.keepAlive = false;
+  }
+
+  current = &conn;
+  conn.responded = false;
+  conn.headers = "";
+  requests++;
+  if (conn.route) {
+    conn.route->calls++;
+    runHandler(conn, conn.route->handler);
+  } else if (notFound) {
+    runHandler(conn, notFound);
+  }
+  if (!conn.responded) {
+    send(500, "text/plain", "No response");
+  }
+  current = nullptr;
+  conn.state = conn.feed ? STREAMING : SENDING;
+}
+
+void HttpServer::runHandler(Connection& conn, const Handler& handler) {
+  unsigned long start = micros();
+  handler();
+  unsigned long elapsed = (uint32_t)(micros() - start);
+  if (conn.route && elapsed > conn.route->maxUs) {
+    conn.route->maxUs = elapsed;
+  }
+  if (elapsed >= pollSlowestUs) {
+    pollSlowest = conn.route ? conn.route->path.c_str() : "(not found)";
+    pollSlowestUs = elapsed;
+  }
+}
+
+void HttpServer::reject(Connection& conn, int code, const char* message) {
+  current = &conn;
+  conn.keepAlive = false;
+  conn.headers = "";
+  send(code, "text/plain", message);
+  current = nullptr;
+  conn.state = SENDING;
+}
+
+bool HttpServer::sending(const Connection& conn) {
+  return conn.outPos < conn.out.length() || (conn.shared && conn.sharedPos < conn.shared->length()) || *conn.tail ||
+         conn.file;
+}
+
+bool HttpServer::sendResponse(Connection& conn) {
+  if (!sending(conn)) {
+    if (conn.state == STREAMING) {
+      return nextEvent(conn);
+    }
+    finishRequest(conn);
+    return true;
+  }
+  int space = conn.client.availableForWrite();
+  if (space <= 0) {
+    return false;
+  }
+  size_t budget = std::min((size_t)space, (size_t)HTTP_IO_CHUNK);
+  if (conn.outPos < conn.out.length()) {
+    size_t length = std::min(budget, conn.out.length() - conn.outPos);
+    size_t written = conn.client.write((const uint8_t*)conn.out.c_str() + conn.outPos, length);
+    conn.outPos += written;
+    return written > 0;
+  }
+  if (conn.shared && conn.sharedPos < conn.shared->length()) {
+    size_t length = std::min(budget, conn.shared->length() - conn.sharedPos);
+    size_t written = conn.client.write((const uint8_t*)conn.shared->c_str() + conn.sharedPos, length);
+    conn.sharedPos += written;
+    return written > 0;
+  }
+  if (*conn.tail) {
+    size_t written = conn.client.write((const uint8_t*)conn.tail, std::min(budget, strlen(conn.tail)));
+    conn.tail += written;
+    return written > 0;
+  }
+  uint8_t buffer[HTTP_IO_CHUNK];
+  size_t length = conn.file.read(buffer, budget);
+  if (length == 0) {
+    conn.file.close();
+    return true;
+  }
+  size_t written = conn.client.write(buffer, length);
+  if (written < length) {
+    conn.file.seek(conn.file.position() - (length - written));
+  }
+  return written > 0;
+}
+
+// Queues the feed's latest body as the next event once the last one is out,
+// skipping any published while it was going
+bool HttpServer::nextEvent(Connection& conn) {
+  unsigned long version = conn.feed->version();
+  if (version != conn.feedVersion && conn.feed->body()) {
+    if (conn.feedVersion != 0) {
+      eventsSkipped += version - conn.feedVersion - 1;
+    }
+    conn.feedVersion = version;
+    conn.out = "data: ";
+    conn.outPos = 0;
+    conn.shared = conn.feed->body();
+    conn.sharedPos = 0;
+    conn.tail = "\n\n";
+    eventsSent++;
+    return true;
+  }
+  if (millis() - conn.lastActivity >= HTTP_STREAM_HEARTBEAT_MS) {
+    conn.out = ":\n\n";
+    conn.outPos = 0;
+    return true;
+  }
+  return false;
+}
+
+void HttpServer::finishRequest(Connection& conn) {
+  conn.out = "";
+  conn.outPos = 0;
+  conn.shared.reset();
+  conn.sharedPos = 0;
+  conn.body = "";
+  conn.args.clear();
+  conn.route = nullptr;
+  if (!conn.keepAlive) {
+    close(conn);
+    return;
+  }
+  // readHeaders() takes the next request from here before the socket
+  conn.pending.swap(conn.pipelined);
+  conn.pipelined.clear();
+  conn.state = READING_HEADERS;
+}
+
+void HttpServer::close(Connection& conn) {
+  if (conn.file) {
+    conn.file.close();
+  }
+  conn.client.stop();
+  conn = Connection();
+}
+
+void HttpServer::parseArgs(const String& text, std::vector<Arg>& args) {
+  int start = 0;
+  while (start < (int)text.length()) {
+    int end = text.indexOf('&', start);
+    if (end < 0) {
+      end = text.length();
+    }
+    String pair = text.substring(start, end);
+    int equals = pair.indexOf('=');
+    if (pair.length() > 0) {
+      if (equals < 0) {
+        args.push_back({urlDecode(pair), ""});
+      } else {
+        args.push_back({urlDecode(pair.substring(0, equals)), urlDecode(pair.substring(equals + 1))});
+      }
+    }
+    start = end + 1;
+  }
+}
+
+void HttpServer::routeStats(
+    std::function<void(const String& path, unsigned long calls, unsigned long maxUs)> visit) const {
+  for (const auto& route : routes) {
+    visit(route.path, route.calls, route.maxUs);
+  }
+}
+
+bool HttpServer::hasArg(const char* name) const {
+  if (!current) {
+    return false;
+  }
+  for (const auto& arg : current->args) {
+    if (arg.name == name) {
+      return true;
+    }
+  }
+  return false;
+}
+
+String HttpServer::arg(const char* name) const {
+  if (current) {
+    for (const auto& arg : current->args) {
+      if (arg.name == name) {
+        return arg.value;
+      }
+    }
+  }
+  return "";
+}
+
+String HttpServer::uri() const {
+  return current ? current->path : "";
+}
+
+bool HttpServer::authenticate(const char* username, const char* password) const {
+  if (!current || !current->authorization.startsWith("Basic ")) {
+    return false;
+  }
+  String decoded;
+  if (!base64Decode(current->authorization.substring(6), decoded)) {
+    return false;
+  }
+  return decoded == String(username) + ":" + password;
+}
+
+void HttpServer::sendHeader(const String& name, const String& value, bool first) {
+  if (!current) {
+    return;
+  }
+  String line = name + ": " + value + "\r\n";
+  current->headers = first ? line + current->headers : current->headers + line;
+}
+
+void HttpServer::startResponse(int code, const char* contentType, size_t length) {
+  Connection& conn = *current;
+  conn.out = "HTTP/1.1 " + String(code) + " " + statusText(code) + "\r\n";
+  conn.out += "Content-Type: " + String(contentType) + "\r\n";
+  conn.out += "Content-Length: " + String((unsigned long)length) + "\r\n";
+  conn.out += conn.keepAlive ? "Connection: keep-alive\r\n" : "Connection: close\r\n";
+  conn.out += conn.headers;
+  conn.out += "\r\n";
+  conn.outPos = 0;
+  conn.responded = true;
+}
+
+void HttpServer::send(int code, const char* contentType, const String& body) {
+  if (!current) {
+    return;
+  }
+  startResponse(code, contentType, body.length());
+  current->out += body;
+}
+
+void HttpServer::send(int code, const char* contentType, const HttpBody& body) {
+  if (!current) {
+    return;
+  }
+  startResponse(code, contentType, body ? body->length() : 0);
+  current->shared = body;
+  current->sharedPos = 0;
+}
+
+void HttpServer::stream(HttpFeed& feed) {
+  if (!current) {
+    return;
+  }
+  int streams = 0;
+  for (const auto& conn : connections) {
+    if (conn.state == STREAMING) {
+      streams++;
+    }
+  }
+  if (streams >= HTTP_MAX_STREAMS) {
+    send(503, "text/plain", "Too many live viewers");
+    return;
+  }
+  Connection& conn = *current;
+  conn.out = "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\nCache-Control: no-cache\r\n";
+  conn.out += conn.headers;
+  conn.out += "\r\n";
+  conn.outPos = 0;
+  conn.responded = true;
+  conn.feed = &feed;
+  conn.feedVersion = 0;
+}
+
+void HttpServer::streamFile(File& file, const char* contentType) {
+  if (!current) {
+    return;
+  }
+  startResponse(200, contentType, file.size());
+  current->file = file;
+}
+
+void HttpServer::requestAuthentication() {
+  sendHeader("WWW-Authenticate", "Basic realm=\"Login Required\"");
+  send(401, "text/plain", "Authentication required");
+}
@@ -0,0 +1,181 @@
+#include "lampsense.h"
+#include "lights.h"
+
+#ifdef ARDUINO_ARCH_RP2040
+#include <hardware/adc.h>
+#include <hardware/dma.h>
+#endif
+
+#define LAMP_FILTER_ALPHA 0.3f // per processed block, roughly 10 ms each
+#define LAMP_RING_SAMPLES 256 // 64 ms of all four channels
+#define LAMP_RING_BITS 9 // log2 of the ring size in bytes, for the DMA wrap
+
+LampChannel lamps[LAMP_COUNT];
+float lampSenseTemperatureC = NAN;
+
+#ifdef ARDUINO_ARCH_RP2040
+static uint16_t sampleRing[LAMP_RING_SAMPLES] __attribute__((aligned(LAMP_RING_SAMPLES * sizeof(uint16_t))));
+static int dmaChannel = -1;
+static size_t readIndex = 0;
+#endif
+
+static bool lampCommandedOn(int lamp) {
+  if (!output_enabled || lightLimit() == LIGHTS_OFF) {
+    return false;
+  }
+  switch (lamp) {
+    case LAMP_LEFT: return left_state;
+    case LAMP_RIGHT: return right_state;
+    default: return tail_state;
+  }
+}
+
+static float countsToCelsius(float counts) {
+  // Same conversion as analogReadTemp()
+  return 27.0f - ((counts * 3.3f / 4096.0f) - 0.706f) / 0.001721f;
+}
+
+void lampSenseBegin() {
+  for (int i = 0; i < LAMP_COUNT; i++) {
+    lamps[i] = LampChannel{0.0f, LAMP_UNKNOWN, LAMP_UNKNOWN, 0, false, 0};
+  }
+#ifdef ARDUINO_ARCH_RP2040
+  adc_init();
+  adc_gpio_init(26);
+  adc_gpio_init(27);
+  adc_gpio_init(28);
+  adc_set_temp_sensor_enabled(true);
+  adc_select_input(0);
+  adc_set_round_robin(0x17); // inputs 0, 1, 2 and 4 (temperature)
+  adc_fifo_setup(true, true, 1, false, false);
+  adc_set_clkdiv(48000000.0f / (LAMP_SENSE_RATE_HZ * LAMP_SENSE_CHANNELS) - 1);
+
+  // Write side wraps around the ring on its own, the CPU only ever reads
+  dmaChannel = dma_claim_unused_channel(true);
+  dma_channel_config cfg = dma_channel_get_default_config(dmaChannel);
+  channel_config_set_transfer_data_size(&cfg, DMA_SIZE_16);
+  channel_config_set_read_increment(&cfg, false);
+  channel_config_set_write_increment(&cfg, true);
+  channel_config_set_ring(&cfg, true, LAMP_RING_BITS);
+  channel_config_set_dreq(&cfg, DREQ_ADC);
+  dma_channel_configure(dmaChannel, &cfg, sampleRing, &adc_hw->fifo, 0xFFFFFFFF, true);
+  adc_run(true);
+#endif
+}
+
+bool lampSenseUpdate() {
+#ifdef ARDUINO_ARCH_RP2040
+  if (dmaChannel < 0) {
+    return false;
+  }
+  // 0xFFFFFFFF transfers lasts days at this rate, but restart it before it
+  // runs out rather than stop sampling
+  if (dma_channel_hw_addr(dmaChannel)->transfer_count < LAMP_RING_SAMPLES) {
+    dma_channel_set_trans_count(dmaChannel, 0xFFFFFFFF, true);
+  }
+  uintptr_t writeAddr = dma_channel_hw_addr(dmaChannel)->write_addr;
+  size_t writeIndex = (writeAddr - (uintptr_t)sampleRing) / sizeof(uint16_t);
+  // Only whole round-robin sweeps, so index 0 of a block is always the left lamp
+  writeIndex -= writeIndex % LAMP_SENSE_CHANNELS;
+  if (writeIndex == readIndex) {
+    return false;
+  }
+
+  uint16_t block[LAMP_RING_SAMPLES];
+  size_t count = 0;
+  for (size_t i = readIndex; i != writeIndex; i = (i + 1) % LAMP_RING_SAMPLES) {
+    block[count++] = sampleRing[i];
+  }
+  readIndex = writeIndex;
+  return lampSenseProcess(block, count, millis());
+#else
+  return false;
+#endif
+}
+
+static LampState classify(float currentMa) {
+  if (currentMa < LAMP_OPEN_MA) {
+    return LAMP_OPEN;
+  }
+  if (currentMa > LAMP_SHORT_MA) {
+    return LAMP_SHORT;
+  }
+  return LAMP_OK;
+}
+
+bool lampSenseProcess(const uint16_t samples[], size_t count, unsigned long now) {
+  uint32_t sums[LAMP_SENSE_CHANNELS] = {0};
+  size_t sweeps = count / LAMP_SENSE_CHANNELS;
+  if (sweeps == 0) {
+    return false;
+  }
+  for (size_t i = 0; i < sweeps * LAMP_SENSE_CHANNELS; i++) {
+    sums[i % LAMP_SENSE_CHANNELS] += samples[i] & 0x0FFF; // bit 15 is the ADC error flag
+  }
+
+  float tempCounts = (float)sums[LAMP_COUNT] / sweeps;
+  lampSenseTemperatureC = countsToCelsius(tempCounts);
+
+  bool changed = false;
+  for (int i = 0; i < LAMP_COUNT; i++) {
+    LampChannel& lamp = lamps[i];
+    float blockMa = (float)sums[i] / sweeps * LAMP_SENSE_MA_PER_COUNT;
+    lamp.currentMa += LAMP_FILTER_ALPHA * (blockMa - lamp.currentMa);
+
+    bool on = lampCommandedOn(i);
+    if (on && !lamp.wasOn) {
+      lamp.onSince = now;
+    }
+    lamp.wasOn = on;
+    // Current only says something while the output is driven and has had
+    // time to settle, otherwise keep the last verdict (turn signals spend
+    // half their time off)
+    if (!on || now - lamp.onSince < LAMP_BLANKING_MS) {
+      lamp.candidateCount = 0;
+      continue;
+    }
+
+    LampState measured = classify(lamp.currentMa);
+    if (measured != lamp.candidate) {
+      lamp.candidate = measured;
+      lamp.candidateCount = 0;
+    }
+    if (lamp.candidateCount < LAMP_DEBOUNCE) {
+      lamp.candidateCount++;
+    }
+    if (lamp.candidateCount >= LAMP_DEBOUNCE && lamp.state != measured) {
+      lamp.state = measured;
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+bool trailerConnected() {
+  for (int i = 0; i < LAMP_COUNT; i++) {
+    if (lamps[i].state == LAMP_OK) {
+      return true;
+    }
+  }
+  return false;
+}
+
+byte lampStatusByte() {
+  byte status = 0;
+  if (lamps[LAMP_LEFT].state == LAMP_OK) status |= 0x01;
+  if (lampCommandedOn(LAMP_LEFT)) status |= 0x02;
+  if (lamps[LAMP_RIGHT].state == LAMP_OK) status |= 0x08;
+  if (lampCommandedOn(LAMP_RIGHT)) status |= 0x10;
+  if (lamps[LAMP_TAIL].state == LAMP_OK) status |= 0x40;
+  if (lampCommandedOn(LAMP_TAIL)) status |= 0x80;
+  return status;
+}
+
+const char* lampStateName(LampState state) {
+  switch (state) {
+    case LAMP_OK: return "OK";
+    case LAMP_OPEN: return "Open";
+    case LAMP_SHORT: return "Short";
+    default: return "--";
+  }
+}
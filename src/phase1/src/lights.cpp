@@ -0,0 +1,64 @@
+#include "lights.h"
+
+bool output_enabled = false;
+bool left_state = false;
+bool right_state = false;
+bool tail_state = false;
+
+static LightLimit limit = LIGHTS_FULL;
+static bool tailPwm = false;
+
+void setLightState(int pin, bool state) {
+  if (!output_enabled) {
+    return;
+  }
+  if (limit == LIGHTS_OFF) {
+    state = false;
+  }
+  if (pin == TAIL_PIN && state && limit == LIGHTS_DERATED) {
+    // Only set up once, a new analogWrite() each frame would restart the period
+    if (!tailPwm) {
+      analogWrite(pin, LIGHTS_DERATE_DUTY);
+      tailPwm = true;
+    }
+    return;
+  }
+  if (pin == TAIL_PIN && tailPwm) {
+    pinMode(pin, OUTPUT); // back from the PWM slice to a plain output
+    tailPwm = false;
+  }
+  digitalWrite(pin, state);
+}
+
+void processLightLINFrame(byte dataByte) {
+  // First bit is left light, second bit is right light, third bit is tail light
+  // This is a four pin trailer connector, so brakes and reverse do not matter, but are present in the LIN frame
+  // See docs if you need to add support for those
+  left_state = dataByte & 0x01;
+  right_state = dataByte & 0x02;
+  tail_state = dataByte & 0x04;
+  setLightState(LEFT_PIN, left_state);
+  setLightState(RIGHT_PIN, right_state);
+  setLightState(TAIL_PIN, tail_state);
+}
+
+void setLightLimit(LightLimit newLimit) {
+  limit = newLimit;
+  setLightState(LEFT_PIN, left_state);
+  setLightState(RIGHT_PIN, right_state);
+  setLightState(TAIL_PIN, tail_state);
+}
+
+void lightsAllOff() {
+  if (tailPwm) {
+    pinMode(TAIL_PIN, OUTPUT);
+    tailPwm = false;
+  }
+  digitalWrite(LEFT_PIN, false);
+  digitalWrite(RIGHT_PIN, false);
+  digitalWrite(TAIL_PIN, false);
+}
+
+LightLimit lightLimit() {
+  return limit;
+}
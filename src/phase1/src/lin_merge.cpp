@@ -0,0 +1,71 @@
+#include "lin_merge.h"
+
+// Frame times wrap at 2^32 us on the board
+static bool before(unsigned long a, unsigned long b) {
+  return (int32_t)(a - b) < 0;
+}
+
+bool LinMerge::push(uint8_t bus, const byte buffer[], short length, byte expectedChecksum, unsigned long frameUs) {
+  if (bus >= LIN_MAX_BUSES) {
+    return true; // nowhere to put it
+  }
+  if (head[bus] - tail[bus] == LIN_MERGE_DEPTH) {
+    forced++;
+    return false;
+  }
+  if (length > lincore::MAX_FRAME_BYTES) {
+    length = lincore::MAX_FRAME_BYTES;
+  }
+  LinMergedFrame& frame = queue[bus][head[bus] % LIN_MERGE_DEPTH];
+  frame.bus = bus;
+  frame.length = length;
+  frame.expectedChecksum = expectedChecksum;
+  frame.frameUs = frameUs;
+  memcpy(frame.data, buffer, length);
+  head[bus]++;
+  size_t count = waiting();
+  if (count > maxWaiting) {
+    maxWaiting = count;
+  }
+  return true;
+}
+
+void LinMerge::holdFrom(unsigned long syncUs) {
+  if (!holding || before(syncUs, holdUs)) {
+    holdUs = syncUs;
+    holding = true;
+  }
+}
+
+const LinMergedFrame* LinMerge::next() {
+  const LinMergedFrame* first = nullptr;
+  for (uint8_t bus = 0; bus < LIN_MAX_BUSES; bus++) {
+    if (head[bus] == tail[bus]) {
+      continue;
+    }
+    const LinMergedFrame* frame = &queue[bus][tail[bus] % LIN_MERGE_DEPTH];
+    // Ties go to the lower bus
+    if (!first || before(frame->frameUs, first->frameUs)) {
+      first = frame;
+      nextBus = bus;
+    }
+  }
+  if (!first || (holding && !before(first->frameUs, holdUs))) {
+    holding = false;
+    return nullptr;
+  }
+  return first;
+}
+
+void LinMerge::pop() {
+  tail[nextBus]++;
+  merged++;
+}
+
+size_t LinMerge::waiting() const {
+  size_t count = 0;
+  for (uint8_t bus = 0; bus < LIN_MAX_BUSES; bus++) {
+    count += head[bus] - tail[bus];
+  }
+  return count;
+}
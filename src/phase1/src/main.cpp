@@ -4,29 +4,38 @@
 */
 
 #include <WiFi.h>
-#include <WebServer.h>
-#include <HTTPUpdateServer.h>
 #include <LittleFS.h>
 #include <LEAmDNS.h>
 #include <vector>
 
 #include "lin.h"
+#include "lin_merge.h"
+#include "lights.h"
+#include "capture.h"
+#include "lampsense.h"
+#include "config.h"
+#include "history.h"
+#include "ota.h"
+#include "trigger.h"
+#include "power.h"
+#include "thermal.h"
+#include "metrics.h"
+#include "events.h"
+#include "replay.h"
+#include "http_server.h"
 #define VERSION "2025-11-30.6"
 
-#define LIN_FRAME_PID 0xCF
-#define TAIL_PIN 2
-#define LEFT_PIN 3
-#define RIGHT_PIN 4
-
 const char* left_arrow_icon = "◄";
 const char* right_arrow_icon = "►";
 const char* headlight_icon = "💡";
 
-bool output_enabled = false;
 bool process_frames = true;
-bool left_state = false;
-bool right_state = false;
-bool tail_state = false;
+
+// Response to the car's 0x10 header, "Park, connected" from docs/LIN-Decoding.md
+// This needs a LIN transceiver on the TX pin, so it stays off until enabled
+#define LIN_STATUS_PID 0x50
+byte statusResponse[5] = {0x49, 0x00, 0x2C, 0x01, 0x00};
+bool responder_enabled = false;
 
 const char* AP_SSID     = "TCU-Access-Point";
 const char* AP_PASSWORD = "123456789";
@@ -37,55 +46,89 @@ const char* OTA_PASSWORD = "123456789";
 String wifiSSID;
 String wifiPassword;
 int wifiTimeout = 30;
+unsigned long idleSleepS = POWER_IDLE_DEFAULT_S;
+int derateC = THERMAL_DERATE_DEFAULT_C;
+int shutdownC = THERMAL_SHUTDOWN_DEFAULT_C;
 String apSSID;
 String apPassword;
 String otaUsername;
 String otaPassword;
 
 bool led_state = false;
-WebServer httpServer(80);
-HTTPUpdateServer httpUpdater;
+HttpServer httpServer(80);
 
 String latestFrameString = "";
+bool statusDirty = true; // latestFrameString changed since publishStatus()
 bool lfsReady = false;
 bool autoRefresh = false;
 
+// What the live view shows, serialized into statusFeed by publishStatus()
+// only when some of it changes, and sent from that one buffer to every
+// /status poll and /events stream
+HttpFeed statusFeed;
+struct LiveStatus {
+  bool left;
+  bool right;
+  bool tail;
+  bool output;
+  long temperatureF10; // tenths of a degree
+  ThermalState thermal;
+  String frame;
+};
+LiveStatus liveStatus;
+
+// The main page as last rendered, see handleRoot()
+HttpBody rootPage;
+unsigned long rootPageVersion = 0;
+unsigned long rootPageAt = 0;
+
 // LIN Variables
 lin linStack;
+#ifdef LIN_BUS2
+// A second transceiver on Serial2's pins (GP8 TX, GP9 RX), e.g. the
+// inductive charger's bus, sniffed and recorded alongside the trailer's
+LinUartReceiver chargerLin(Serial2, 1);
+#endif
+LinMerge linMerge;
 
 // Logging Variables
-struct LINFrame {
-  unsigned long timestamp;
-  byte sync;
-  byte pid;
-  byte data[8];  // Up to 8 data bytes
-  byte dataLength;  // Number of actual data bytes
-  byte checksum;
-  byte expectedChecksum;
-  bool checksumValid;
-};
-
-bool isLogging = false;
-unsigned long loggingStartTime = 0;
-const unsigned int LOGGING_DURATION_S = 1;
-const unsigned long LOGGING_DURATION_MS = LOGGING_DURATION_S * 1000;
-const unsigned int EXPECTED_FRAME_RATE_HZ = 100; // Conservative estimate
-const unsigned int EXPECTED_FRAME_COUNT = (LOGGING_DURATION_MS / 1000) * EXPECTED_FRAME_RATE_HZ;
-std::vector<LINFrame> frameBuffer;
+const unsigned int LOGGING_DURATION_S = 1; // default, /startLogging?seconds= asks for longer
 
 // mDNS Responder
+#define MDNS_HOSTNAME "trailercontroller"
 MDNSResponder mdns; // Declare mDNS responder
-
-void flashLED(int count, int delay_ms) {
-  digitalWrite(LED_BUILTIN, false);
-  delay(100);
-  for (int i = 0; i < count; i++) {
-    digitalWrite(LED_BUILTIN, true);
-    delay(delay_ms);
-    digitalWrite(LED_BUILTIN, false);
-    delay(delay_ms);
-  }
-}
+bool mdnsStarted = false;
+
+// WiFi connection state, see updateNetwork()
+enum NetworkState { NET_IDLE, NET_CONNECTING, NET_STATION, NET_ACCESS_POINT };
+NetworkState networkState = NET_IDLE;
+unsigned long networkStartedAt = 0;
+unsigned long lastNetworkBlink = 0;
+
+// Network settings changed from the settings page, applied live once the
+// reply has gone out, see restartNetwork()
+bool networkRestartPending = false;
+unsigned long networkRestartAt = 0;
+bool reconfiguring = false;
+unsigned long reconfigStartedAt = 0;
+unsigned long reconfigDurationMs = 0;
+unsigned long reconfigMaxLoopUs = 0; // longest gap between LIN polls while reconfiguring
+unsigned long lastLoopMicros = 0;
+unsigned long lastHttpRequests = 0; // web requests keep idle sleep away
+unsigned long metricsScrapes = 0; // but not a collector scraping /metrics
+
+// The light test from /runTest, stepped from loop() by updateTestSequence()
+// so LIN and the web server keep running while it goes
+enum TestStep { TEST_IDLE, TEST_LEFT, TEST_RIGHT, TEST_TAIL, TEST_FLASH };
+TestStep testStep = TEST_IDLE;
+unsigned long testStepAt = 0;
+int testLedToggles = 0;
+bool testOutputEnabled = false; // put back when it ends
+
+// Boot timing, milliseconds since reset
+unsigned long linReadyMs = 0;
+unsigned long firstLightMs = 0;
+unsigned long networkReadyMs = 0;
 
 String populateActiveLights() {
   String activeLights = "";
@@ -117,122 +160,345 @@ void setupAccessPoint(char* ssid, char* password) {
   Serial.println(IP);
 }
 
-bool setupClient(char* ssid, char* password, int timeout) {
+void startClient(char* ssid, char* password) {
   Serial.print("Connecting to ");
   Serial.println(ssid);
   WiFi.mode(WIFI_STA);
   //if password provided, use it, otherwise assume open network
+  // beginNoBlock returns straight away, updateNetwork() watches for the connection
   if (strlen(password) > 0) {
-    WiFi.begin(ssid, password);
+    WiFi.beginNoBlock(ssid, password);
   } else {
-    WiFi.begin(ssid);
+    WiFi.beginNoBlock(ssid);
   }
-  Serial.println("");
+  networkState = NET_CONNECTING;
+  networkStartedAt = millis();
+}
 
-  // Wait for connection, with timeout
-  unsigned long timeoutMs = millis() + (timeout * 1000);
-  while (WiFi.status() != WL_CONNECTED) {
-    led_state = !led_state;
-    digitalWrite(LED_BUILTIN, led_state);
-    delay(500);
-    Serial.print(".");
-    if (millis() > timeoutMs) {
+void startAccessPointFromConfig() {
+  // Fallback to AP mode if WiFi fails/has not been configured
+  char apSSIDArray[32];
+  char apPasswordArray[32];
+  apSSID.toCharArray(apSSIDArray, 32);
+  apPassword.toCharArray(apPasswordArray, 32);
+  setupAccessPoint(apSSIDArray, apPasswordArray);
+  networkState = NET_ACCESS_POINT;
+}
+
+void startNetwork() {
+  // Set hostname for the server
+  WiFi.setHostname(MDNS_HOSTNAME);
+
+  if (wifiSSID.length() > 0 && wifiPassword.length() > 0) {
+    char wifiSSIDArray[32];
+    char wifiPasswordArray[32];
+    wifiSSID.toCharArray(wifiSSIDArray, 32);
+    wifiPassword.toCharArray(wifiPasswordArray, 32);
+    startClient(wifiSSIDArray, wifiPasswordArray);
+  } else {
+    startAccessPointFromConfig();
+  }
+}
+
+// Tear down the current connection and start again with the new settings.
+// Same non-blocking path as boot, so the lights keep running throughout.
+void restartNetwork() {
+  Serial.println("Applying new network settings");
+  if (mdnsStarted) {
+    mdns.end();
+    mdnsStarted = false;
+  }
+  WiFi.disconnect();
+  networkState = NET_IDLE;
+  reconfiguring = true;
+  reconfigStartedAt = millis();
+  reconfigMaxLoopUs = 0;
+  startNetwork();
+}
+
+// Networking comes up in the background so the lights never wait on it.
+// Called every loop, only does anything while a connection is in progress.
+void updateNetwork() {
+  if (networkRestartPending && (long)(millis() - networkRestartAt) >= 0) {
+    networkRestartPending = false;
+    restartNetwork();
+  }
+
+  if (networkState == NET_CONNECTING) {
+    if (WiFi.status() == WL_CONNECTED) {
+      Serial.println("");
+      Serial.print("Connected to ");
+      Serial.println(wifiSSID);
+      Serial.print("IP address: ");
+      Serial.println(WiFi.localIP());
+      networkState = NET_STATION;
+    } else if (millis() - networkStartedAt > (unsigned long)wifiTimeout * 1000) {
       Serial.print("Failed to connect to WiFi with SSID '");
-      Serial.print(ssid);
+      Serial.print(wifiSSID);
       Serial.print("' pass '");
-      Serial.print(password);
+      Serial.print(wifiPassword);
       Serial.println("'");
-      return false;
+      startAccessPointFromConfig();
+    } else if (millis() - lastNetworkBlink >= 500) {
+      lastNetworkBlink = millis();
+      led_state = !led_state;
+      digitalWrite(LED_BUILTIN, led_state);
+      Serial.print(".");
     }
   }
-  led_state = true;
+
+  if (networkState >= NET_STATION && !mdnsStarted) {
+    if (!networkReadyMs) {
+      networkReadyMs = millis();
+    }
+    if (reconfiguring) {
+      reconfiguring = false;
+      reconfigDurationMs = millis() - reconfigStartedAt;
+      Serial.println("Network reconfigured in " + String(reconfigDurationMs) + " ms, longest LIN poll gap " +
+        String(reconfigMaxLoopUs) + " us");
+    }
+    led_state = false;
+    digitalWrite(LED_BUILTIN, led_state);
+
+    // Start mDNS service using LEAmDNS
+    if (mdns.begin(MDNS_HOSTNAME)) {
+      Serial.println("mDNS responder started. Hostname: " + String(MDNS_HOSTNAME) + ".local");
+      mdns.addService("http", "tcp", 80); // Add HTTP service on port 80
+    } else {
+      Serial.println("Error setting up mDNS responder");
+    }
+    mdnsStarted = true;
+  }
+}
+
+// Idle sleep turns the network right off, see power.h
+void sleepNetwork() {
+  if (mdnsStarted) {
+    mdns.end();
+    mdnsStarted = false;
+  }
+  httpServer.stop();
+  WiFi.end();
+  networkState = NET_IDLE;
+  networkRestartPending = false;
+  led_state = false;
   digitalWrite(LED_BUILTIN, led_state);
-  Serial.println("");
-  Serial.print("Connected to ");
-  Serial.println(ssid);
-  Serial.print("IP address: ");
-  Serial.println(WiFi.localIP());
-  return true;
+}
+
+// Back on after a wake, once the lights are running again
+void resumeNetwork() {
+  startNetwork();
+  httpServer.begin();
+}
+
+String populateBootTiming() {
+  String timing = "LIN " + String(linReadyMs) + " ms, first light frame ";
+  timing += firstLightMs ? String(firstLightMs) + " ms" : "--";
+  timing += ", network ";
+  timing += networkReadyMs ? String(networkReadyMs) + " ms" : "--";
+  if (reconfigDurationMs) {
+    timing += ", last settings change " + String(reconfigDurationMs) + " ms with at most " +
+      String(reconfigMaxLoopUs) + " us between LIN polls";
+  }
+  if (powerSleeps) {
+    timing += ", woke to lights in " + String(powerLastWakeUs) + " us (at most " + String(powerMaxWakeUs) +
+      " us over " + String(powerSleeps) + " sleeps)";
+  }
+  if (otaResult.length() > 0) {
+    timing += ", last update " + otaResult + " with at most " + String(otaMaxStallUs) + " us between LIN polls and " +
+      String(otaMaxFlashUs) + " us in one flash write";
+  }
+  return timing;
 }
 
 float getOnboardTemperature() {
-  // Get the temperature in Celsius
-  float temperature_celsius = analogReadTemp();
-  
+  // Sampled and filtered in the background by thermalPoll()
+  float temperature_celsius = thermalTemperatureC;
+
   // Convert to Fahrenheit
   return temperature_celsius * 9.0 / 5.0 + 32.0;
 }
 
-void setLightState(int pin, bool state) {
-  if (output_enabled) {
-    digitalWrite(pin, state);
+// Back to the output setting the test found, with the lights left to the
+// frames or whoever stopped it
+void endTestSequence() {
+  if (testStep == TEST_IDLE) {
+    return;
+  }
+  testStep = TEST_IDLE;
+  setLightState(LEFT_PIN, false);
+  setLightState(RIGHT_PIN, false);
+  setLightState(TAIL_PIN, false);
+  digitalWrite(LED_BUILTIN, false);
+  output_enabled = testOutputEnabled;
+  process_frames = true;
+}
+
+// Each light for a second, then four flashes of the LED. Starting again
+// while it runs restarts it.
+void startTestSequence() {
+  endTestSequence();
+  testOutputEnabled = output_enabled;
+  output_enabled = true;
+  process_frames = false;
+
+  setLightState(RIGHT_PIN, false);
+  setLightState(TAIL_PIN, false);
+  setLightState(LEFT_PIN, true);
+  testStep = TEST_LEFT;
+  testStepAt = millis();
+}
+
+void updateTestSequence() {
+  if (testStep == TEST_IDLE) {
+    return;
+  }
+  unsigned long now = millis();
+  switch (testStep) {
+    case TEST_LEFT:
+      if (now - testStepAt < 1000) {
+        return;
+      }
+      setLightState(LEFT_PIN, false);
+      setLightState(RIGHT_PIN, true);
+      testStep = TEST_RIGHT;
+      break;
+    case TEST_RIGHT:
+      if (now - testStepAt < 1000) {
+        return;
+      }
+      setLightState(RIGHT_PIN, false);
+      setLightState(TAIL_PIN, true);
+      testStep = TEST_TAIL;
+      break;
+    case TEST_TAIL:
+      if (now - testStepAt < 1000) {
+        return;
+      }
+      setLightState(TAIL_PIN, false);
+      digitalWrite(LED_BUILTIN, false);
+      testLedToggles = 8;
+      testStep = TEST_FLASH;
+      break;
+    case TEST_FLASH:
+      if (now - testStepAt < 100) {
+        return;
+      }
+      if (testLedToggles == 0) {
+        endTestSequence();
+        return;
+      }
+      digitalWrite(LED_BUILTIN, testLedToggles % 2 == 0);
+      testLedToggles--;
+      break;
+    case TEST_IDLE:
+      return;
   }
+  testStepAt = now;
 }
 
 void toggleOutputEnabled() {
+  endTestSequence();
   output_enabled = !output_enabled;
   process_frames = true;
-  // if filesystem is ready, set the state in a file so we can read it on boot
+  // Saved here so we can read it on boot, a full event ring can't lose it
   if (lfsReady) {
-    File file = LittleFS.open("/config/output_enabled.txt", "w");
-    if (file) {
-      file.println(output_enabled ? "1" : "0");
-      file.close();
-    }
+    configSetInt("output_enabled", output_enabled);
+    configCommit();
   }
+  // Only a notification for whoever subscribes
+  eventsPublish(EVENT_OUTPUT, output_enabled, millis());
 
   if (!output_enabled) {
     // If we're disabling the output, turn off all the lights
-    digitalWrite(LEFT_PIN, false);
-    digitalWrite(RIGHT_PIN, false);
-    digitalWrite(TAIL_PIN, false);
+    lightsAllOff();
   }
 
   Serial.print("Output enabled: ");
   Serial.println(output_enabled);
 }
 
-void processLightLINFrame(byte dataByte) {
-  // First bit is left light, second bit is right light, third bit is tail light
-  // This is a four pin trailer connector, so brakes and reverse do not matter, but are present in the LIN frame
-  // See docs if you need to add support for those
-  left_state = dataByte & 0x01;
-  right_state = dataByte & 0x02;
-  tail_state = dataByte & 0x04;
-  setLightState(LEFT_PIN, left_state);
-  setLightState(RIGHT_PIN, right_state);
-  setLightState(TAIL_PIN, tail_state);
+// Keep the 0x10 response in line with the lamp diagnostics and light states
+void updateStatusResponse() {
+#ifdef LAMP_SENSE
+  statusResponse[0] = lampStatusByte();
+#endif
+  if (responder_enabled) {
+    linStack.setResponse(LIN_STATUS_PID, statusResponse, sizeof(statusResponse));
+  }
 }
 
-void runTestSequence() {
-  bool original_output_enabled = output_enabled;
-  output_enabled = true;
-  process_frames = false;
+String populateLampStatus() {
+#ifdef LAMP_SENSE
+  String status = trailerConnected() ? "Trailer connected" : "No trailer";
+  status += " (Left " + String(lampStateName(lamps[LAMP_LEFT].state));
+  status += ", Right " + String(lampStateName(lamps[LAMP_RIGHT].state));
+  status += ", Tail " + String(lampStateName(lamps[LAMP_TAIL].state)) + ")";
+  return status;
+#else
+  return "Not fitted";
+#endif
+}
 
-  // Set all lights to false
-  setLightState(LEFT_PIN, false);
-  setLightState(RIGHT_PIN, false);
-  setLightState(TAIL_PIN, false);
+void toggleResponderEnabled() {
+  responder_enabled = !responder_enabled;
+  if (responder_enabled) {
+    updateStatusResponse();
+  } else {
+    linStack.clearResponse();
+  }
+  if (lfsReady) {
+    configSetInt("responder_enabled", responder_enabled);
+    configCommit();
+  }
 
-  setLightState(LEFT_PIN, true);
-  delay(1000);
-  setLightState(LEFT_PIN, false);
-  setLightState(RIGHT_PIN, true);
-  delay(1000);
-  setLightState(RIGHT_PIN, false);
-  setLightState(TAIL_PIN, true);
-  delay(1000);
-  setLightState(TAIL_PIN, false);
-  flashLED(4, 100);
+  Serial.print("0x10 responder enabled: ");
+  Serial.println(responder_enabled);
+}
 
-  output_enabled = original_output_enabled;
-  process_frames = true;
+String populateResponderStatus() {
+  if (!responder_enabled) {
+    return "Disabled";
+  }
+  return String(linStack.responsesSent) + " sent, " + String(linStack.responsesSkipped) + " too late, last " +
+    String(linStack.lastResponseLatency) + " us, max " + String(linStack.maxResponseLatency) + " us";
+}
+
+// A few compares on most passes of loop(), the JSON is only built when
+// something changed
+void publishStatus() {
+  long temperature = lround(getOnboardTemperature() * 10);
+  ThermalState thermal = thermalState();
+  if (statusFeed.version() > 0 && left_state == liveStatus.left && right_state == liveStatus.right &&
+      tail_state == liveStatus.tail && output_enabled == liveStatus.output &&
+      temperature == liveStatus.temperatureF10 && thermal == liveStatus.thermal && !statusDirty) {
+    return;
+  }
+  statusDirty = false;
+  liveStatus = {left_state, right_state, tail_state, output_enabled, temperature, thermal, latestFrameString};
+  String json = "{\"seq\":" + String(statusFeed.version() + 1) + ",\"ms\":" + String(millis()) +
+                ",\"left\":" + String(left_state ? "true" : "false") +
+                ",\"right\":" + String(right_state ? "true" : "false") +
+                ",\"tail\":" + String(tail_state ? "true" : "false") +
+                ",\"output\":" + String(output_enabled ? "true" : "false") +
+                ",\"temp_f\":" + String(temperature / 10.0, 1) +
+                ",\"thermal\":\"" + thermalStateName(thermal) + "\"" +
+                ",\"frame\":\"" + latestFrameString + "\"}";
+  statusFeed.publish(json);
 }
 
 #pragma region HTTP Handlers
 
 void handleRoot() {
+  endTestSequence();
   process_frames = true;
+  // Every viewer on auto refresh asks for this each second, so it's rendered
+  // again only when the live state changed or the counters on it are a
+  // second old, and they're all sent the same copy
+  if (rootPage && rootPageVersion == statusFeed.version() && millis() - rootPageAt < 1000) {
+    httpServer.send(200, "text/html", rootPage);
+    return;
+  }
   // open index.html from /web folder
   File file = LittleFS.open("/web/index.html", "r");
   if (!file) {
@@ -246,10 +512,18 @@ void handleRoot() {
   html.replace("{auto_refresh}", autoRefresh ? "<meta http-equiv=\"refresh\" content=\"1\">" : "");
   html.replace("{output_status}", output_enabled ? "Active" : "Disabled");
   html.replace("{lin_frame}", latestFrameString);
+  html.replace("{responder_status}", populateResponderStatus());
+  html.replace("{lamp_status}", populateLampStatus());
+  html.replace("{boot_timing}", populateBootTiming());
   html.replace("{tcu_temp}", String(getOnboardTemperature()));
+  html.replace("{thermal_status}", String(thermalStateName(thermalState())) + ", " +
+    String(thermalMinC * 9.0 / 5.0 + 32.0, 1) + " to " + String(thermalMaxC * 9.0 / 5.0 + 32.0, 1) + " F since boot");
   html.replace("{logging_duration}", String(LOGGING_DURATION_S));
   html.replace("{version}", VERSION);
-  httpServer.send(200, "text/html", html);
+  rootPage = std::make_shared<const String>(html);
+  rootPageVersion = statusFeed.version();
+  rootPageAt = millis();
+  httpServer.send(200, "text/html", rootPage);
 }
 
 void handleRunTestPage() {
@@ -261,7 +535,7 @@ void handleRunTestPage() {
   }
   httpServer.streamFile(file, "text/html");
 
-  runTestSequence();
+  startTestSequence();
 }
 
 void handleSettingsPage() {
@@ -278,6 +552,9 @@ void handleSettingsPage() {
   html.replace("{current_ap_ssid}", apSSID);
   html.replace("{current_ap_password}", apPassword);
   html.replace("{current_ota_username}", otaUsername);
+  html.replace("{current_idle_sleep_s}", String(idleSleepS));
+  html.replace("{current_derate_c}", String(derateC));
+  html.replace("{current_shutdown_c}", String(shutdownC));
   httpServer.send(200, "text/html", html);
 }
 
@@ -300,19 +577,40 @@ void handleUpdateSettings() {
     newWifiPassword = httpServer.arg("wifi_password");
   newWifiSSID.trim();
   newWifiPassword.trim();
+  bool wifiChanged = newWifiSSID != wifiSSID || newWifiPassword != wifiPassword;
   wifiSSID = newWifiSSID;
   wifiPassword = newWifiPassword;
 
+  // Only used while connecting, picked up by the next connection attempt
   if (httpServer.hasArg("wifi_timeout")) {
     wifiTimeout = httpServer.arg("wifi_timeout").toInt();
   }
 
+  if (httpServer.hasArg("idle_sleep_s")) {
+    long idle = httpServer.arg("idle_sleep_s").toInt();
+    idleSleepS = idle < 0 ? 0 : idle;
+    powerSetIdle(idleSleepS, millis());
+  }
+
+  if (httpServer.hasArg("derate_c") && httpServer.hasArg("shutdown_c")) {
+    int newDerateC = httpServer.arg("derate_c").toInt();
+    int newShutdownC = httpServer.arg("shutdown_c").toInt();
+    // Derating has to come first, with room for its hysteresis
+    if (newDerateC >= THERMAL_HYSTERESIS_C && newShutdownC > newDerateC) {
+      derateC = newDerateC;
+      shutdownC = newShutdownC;
+      thermalSetThresholds(derateC, shutdownC);
+    }
+  }
+
+  bool apChanged = false;
   if (httpServer.hasArg("ap_ssid") && httpServer.hasArg("ap_password")) {
     String newApSSID = httpServer.arg("ap_ssid");
     String newApPassword = httpServer.arg("ap_password");
     newApSSID.trim();
     newApPassword.trim();
     if (newApSSID.length() > 0 && newApPassword.length() > 0) {
+      apChanged = newApSSID != apSSID || newApPassword != apPassword;
       apSSID = newApSSID;
       apPassword = newApPassword;
     }
@@ -326,42 +624,48 @@ void handleUpdateSettings() {
     if (newOtaUsername.length() > 0 && newOtaPassword.length() > 0) {
       otaUsername = newOtaUsername;
       otaPassword = newOtaPassword;
+      otaUpdateCredentials(otaUsername, otaPassword);
     }
   }
 
-  // Save the settings to the filesystem
+  // Save the settings to the filesystem, all in one journal write
   if (lfsReady) {
-    File wifiConfig = LittleFS.open("/config/wifi.txt", "w");
-    if (wifiConfig) {
-      wifiConfig.println(wifiSSID);
-      wifiConfig.println(wifiPassword);
-      wifiConfig.println(wifiTimeout);
-      wifiConfig.close();
-    }
-
-    File apConfig = LittleFS.open("/config/ap.txt", "w");
-    if (apConfig) {
-      apConfig.println(apSSID);
-      apConfig.println(apPassword);
-      apConfig.close();
-    }
-
-    File otaConfig = LittleFS.open("/config/ota.txt", "w");
-    if (otaConfig) {
-      otaConfig.println(otaUsername);
-      otaConfig.println(otaPassword);
-      otaConfig.close();
-    }
+    configSet("wifi_ssid", wifiSSID);
+    configSet("wifi_password", wifiPassword);
+    configSetInt("wifi_timeout", wifiTimeout);
+    configSetInt("idle_sleep_s", idleSleepS);
+    configSetInt("derate_c", derateC);
+    configSetInt("shutdown_c", shutdownC);
+    configSet("ap_ssid", apSSID);
+    configSet("ap_password", apPassword);
+    configSet("ota_username", otaUsername);
+    configSet("ota_password", otaPassword);
+    configCommit();
   }
 
-  // reboot to use new settings
-  httpServer.send(200, "text/plain", "Settings updated, rebooting...");
-  delay(1000);
-  watchdog_reboot(0, 0, 0);
+  // Everything applies without a reboot. New WiFi details, or new AP details
+  // while running as the AP, need the network restarted, which waits a
+  // moment so this reply reaches the browser first.
+  if (wifiChanged || (apChanged && networkState == NET_ACCESS_POINT)) {
+    networkRestartPending = true;
+    networkRestartAt = millis() + 1000;
+    httpServer.send(200, "text/plain", "Settings updated, reconnecting WiFi...");
+  } else {
+    httpServer.send(200, "text/plain", "Settings updated");
+  }
 }
 
 void handleToggleOutputPage() {
   toggleOutputEnabled();
+  rootPage.reset();
+  // redirect to the main page
+  httpServer.sendHeader("Location", "/",true);
+  httpServer.send(302, "text/plain", "");
+}
+
+void handleToggleResponderPage() {
+  toggleResponderEnabled();
+  rootPage.reset();
   // redirect to the main page
   httpServer.sendHeader("Location", "/",true);
   httpServer.send(302, "text/plain", "");
@@ -369,12 +673,14 @@ void handleToggleOutputPage() {
 
 void handleToggleAutoRefresh() {
   autoRefresh = !autoRefresh;
+  rootPage.reset();
   // redirect to the main page
   httpServer.sendHeader("Location", "/",true);
   httpServer.send(302, "text/plain", "");
 }
 
 void handleControlPage() {
+  endTestSequence();
   // Turn on output but turn off lin processing
   output_enabled = true;
   process_frames = false;
@@ -404,6 +710,7 @@ void handleControlPage() {
   setLightState(LEFT_PIN, left_state);
   setLightState(RIGHT_PIN, right_state);
   setLightState(TAIL_PIN, tail_state);
+  rootPage.reset();
 
   // open control.html from /web folder
   File file = LittleFS.open("/web/control.html", "r");
@@ -418,32 +725,90 @@ void handleControlPage() {
 }
 
 
+// Number argument, decimal or 0x hex
+static unsigned long numberArg(const char* name, unsigned long fallback) {
+  return httpServer.hasArg(name) ? strtoul(httpServer.arg(name).c_str(), nullptr, 0) : fallback;
+}
+
+// The framer keeps the light frame and whatever the capture ring wants, so
+// frames nobody wants are dropped at their PID byte. Capture decimation only
+// thins IDs the lights and the trigger don't need.
+void updateLinFilter() {
+  const TriggerConfig& capture = captureConfig();
+  uint64_t needed = lincore::idBit(LIN_FRAME_PID);
+  if (!capture.anyPid) {
+    needed |= lincore::idBit(capture.pid);
+  }
+  linStack.setFilter(needed | capture.ids);
+  for (byte id = 0; id < 64; id++) {
+    linStack.setDecimation(id, needed & lincore::idBit(id) ? 1 : capture.every);
+  }
+#ifdef LIN_BUS2
+  // Only the capture wants the other bus
+  chargerLin.setFilter(capture.ids);
+  for (byte id = 0; id < 64; id++) {
+    chargerLin.setDecimation(id, capture.every);
+  }
+#endif
+}
+
+// Arms a capture, e.g. /startLogging?trigger=change&pid=0xCF&mask=0x0F&pre=100&seconds=5
+// for the light state changing, keeping 100 frames from before it. ids=0x0F,0x10
+// only captures those frame IDs and every=N keeps one in N of them.
 void handleStartLogging() {
-  // Clear any existing log file and frame buffer
-  if (lfsReady) {
-    LittleFS.remove("/logs/lin_capture.txt");
+  TriggerConfig trigger;
+  if (httpServer.hasArg("trigger") && !triggerConditionFromName(httpServer.arg("trigger"), trigger.condition)) {
+    httpServer.send(400, "text/plain", "Unknown trigger, use now, pid, data, change, checksum or missing");
+    return;
   }
-  frameBuffer.clear();
-  frameBuffer.reserve(EXPECTED_FRAME_COUNT); // Pre-allocate based on expected frame rate
-  
-  isLogging = true;
-  loggingStartTime = millis();
+  trigger.anyPid = !httpServer.hasArg("pid") || httpServer.arg("pid").length() == 0;
+  unsigned long pid = numberArg("pid", 0);
+  unsigned long index = numberArg("index", 0);
+  if (pid > 0xFF || index > 0xFF) {
+    httpServer.send(400, "text/plain", captureArmErrorText(pid > 0xFF ? CAPTURE_ARM_BAD_PID : CAPTURE_ARM_BAD_INDEX));
+    return;
+  }
+  trigger.pid = pid;
+  trigger.index = index;
+  trigger.mask = numberArg("mask", 0xFF);
+  trigger.value = numberArg("value", 0);
+  trigger.missingMs = numberArg("missing_ms", 100);
+  trigger.preFrames = numberArg("pre", 0);
+  unsigned long seconds = numberArg("seconds", LOGGING_DURATION_S);
+  trigger.postMs = (seconds < 1 ? 1 : seconds) * 1000;
+  if (httpServer.hasArg("ids") && httpServer.arg("ids").length() &&
+      !captureIdsFromList(httpServer.arg("ids"), trigger.ids)) {
+    httpServer.send(400, "text/plain", "Bad ids, use a comma separated list like 0x0F,0x10");
+    return;
+  }
+  unsigned long every = numberArg("every", 1);
+  trigger.every = every < 1 ? 1 : every > 255 ? 255 : every;
+
+  if (!lfsReady) {
+    httpServer.send(500, "text/plain", "Filesystem not ready");
+    return;
+  }
+  if (!captureArm(trigger, millis())) {
+    updateLinFilter();
+    // A trigger that could never fire is the request's fault, a file that
+    // won't open the board's
+    httpServer.send(captureArmError == CAPTURE_ARM_NO_FILE ? 500 : 400, "text/plain",
+                    captureArmErrorText(captureArmError));
+    return;
+  }
+  updateLinFilter();
+  endTestSequence();
   process_frames = true;
-  
-  httpServer.send(200, "text/plain", "Logging started");
+  httpServer.send(200, "text/plain", captureState() == CAPTURE_ARMED ? "Armed" : "Logging started");
+}
+
+void handleStopLogging() {
+  captureStop(millis());
+  httpServer.send(200, "text/plain", "Logging stopped");
 }
 
 void handleLoggingStatus() {
-  String status = "idle";
-  if (isLogging) {
-    unsigned long elapsed = millis() - loggingStartTime;
-    if (elapsed < LOGGING_DURATION_MS) {
-      status = "logging";
-    } else {
-      status = "complete";
-    }
-  }
-  httpServer.send(200, "text/plain", status);
+  httpServer.send(200, "application/json", captureStatusJson());
 }
 
 void handleGetLog() {
@@ -452,22 +817,81 @@ void handleGetLog() {
     return;
   }
   
-  File file = LittleFS.open("/logs/lin_capture.txt", "r");
+  // Packed, the host capture tool turns it back into lin_capture.txt
+  File file = LittleFS.open(CAPTURE_PATH, "r");
   if (!file) {
     httpServer.send(404, "text/plain", "Log file not found");
     return;
   }
   
-  httpServer.sendHeader("Content-Disposition", "attachment; filename=lin_capture.txt");
-  httpServer.streamFile(file, "text/plain");
-  file.close();
+  httpServer.sendHeader("Content-Disposition", "attachment; filename=lin_capture.lcz");
+  httpServer.streamFile(file, "application/octet-stream");
 }
 
 void handleLoggingConfig() {
-  String json = "{\"duration\":" + String(LOGGING_DURATION_S) + "}";
+  String json = "{\"duration\":" + String(LOGGING_DURATION_S) + ",\"max_duration\":" + String(CAPTURE_MAX_POST_S) +
+                ",\"max_pre_frames\":" + String(CAPTURE_MAX_PRE_FRAMES) + "}";
   httpServer.send(200, "application/json", json);
 }
 
+// Light changes between from and to (ms since boot, default the whole trip)
+// with counters over that range, e.g. /history?from=60000&to=120000
+void handleHistory() {
+  unsigned long now = millis();
+  unsigned long from = httpServer.hasArg("from") ? strtoul(httpServer.arg("from").c_str(), nullptr, 10) : 0;
+  unsigned long to = httpServer.hasArg("to") ? strtoul(httpServer.arg("to").c_str(), nullptr, 10) : now;
+  size_t limit = httpServer.hasArg("limit") ? httpServer.arg("limit").toInt() : 500;
+
+  std::vector<LightChange> changes;
+  HistoryStats stats;
+  byte initial = historyQuery(from, to, now, changes, limit, stats);
+
+  String json = "{\"now\":" + String(now) + ",\"oldest\":" + String(historyOldestMs) +
+                ",\"from\":" + String(from) + ",\"to\":" + String(to) +
+                ",\"state\":" + String(initial) + ",\"changes\":[";
+  for (size_t i = 0; i < changes.size(); i++) {
+    if (i > 0) {
+      json += ",";
+    }
+    json += "[" + String(changes[i].timeMs) + "," + String(changes[i].state) + "]";
+  }
+  json += "],\"truncated\":" + String(stats.changes > changes.size() ? "true" : "false") +
+          ",\"stats\":" + historyStatsJson(stats) + "}";
+  httpServer.send(200, "application/json", json);
+}
+
+// Trip totals, kept as changes arrive so this never reads the history back
+void handleHistoryStats() {
+  String json = "{\"now\":" + String(millis()) + ",\"oldest\":" + String(historyOldestMs) +
+                ",\"ram_bytes\":" + String((unsigned int)historyRamBytes) +
+                ",\"flash_bytes\":" + String((unsigned int)historyFlashBytes) +
+                ",\"dropped_blocks\":" + String(historyDroppedBlocks) +
+                ",\"totals\":" + historyStatsJson(historyTotals(millis())) + "}";
+  httpServer.send(200, "application/json", json);
+}
+
+void handleThermal() {
+  httpServer.send(200, "application/json", thermalStatusJson(millis()));
+}
+
+void handleMetrics() {
+  metricsScrapes++;
+  httpServer.send(200, "text/plain; version=0.0.4", metricsPrometheus(millis()));
+}
+
+void handlePowerStatus() {
+  httpServer.send(200, "application/json", powerStatusJson());
+}
+
+// The live state, the same buffer the event streams send
+void handleStatus() {
+  httpServer.send(200, "application/json", statusFeed.body());
+}
+
+void handleEvents() {
+  httpServer.stream(statusFeed);
+}
+
 void handleLoggingPage() {
   File file = LittleFS.open("/web/logging.html", "r");
   if (!file) {
@@ -475,60 +899,143 @@ void handleLoggingPage() {
     return;
   }
   httpServer.streamFile(file, "text/html");
-  file.close();
 }
 
 #pragma endregion HTTP Handlers
 
-void completeLogging() {
-  isLogging = false;
-  
-  // Write buffered frames to file
-  if (lfsReady && frameBuffer.size() > 0) {
-    File logFile = LittleFS.open("/logs/lin_capture.txt", "w");
-    if (logFile) {
-      logFile.println("# LIN Frame Capture Log");
-      logFile.println("# Format: timestamp_ms,sync,PID,data_bytes...,checksum,status,expected_checksum");
-      logFile.println("# Status: OK = valid checksum, ERR = checksum mismatch");
-      logFile.println("# expected_checksum only shown for ERR frames");
-      logFile.println("# Capture duration: " + String(LOGGING_DURATION_MS) + " ms");
-      logFile.println("# Total frames: " + String(frameBuffer.size()));
-      logFile.println();
-      
-      for (const auto& frame : frameBuffer) {
-        logFile.print(frame.timestamp);
-        logFile.print(",0x");
-        if (frame.sync < 0x10) logFile.print("0");
-        logFile.print(frame.sync, HEX);
-        logFile.print(",0x");
-        if (frame.pid < 0x10) logFile.print("0");
-        logFile.print(frame.pid, HEX);
-        // Print all data bytes
-        for (int i = 0; i < frame.dataLength; i++) {
-          logFile.print(",0x");
-          if (frame.data[i] < 0x10) logFile.print("0");
-          logFile.print(frame.data[i], HEX);
-        }
-        logFile.print(",0x");
-        if (frame.checksum < 0x10) logFile.print("0");
-        logFile.print(frame.checksum, HEX);
-        logFile.print(",");
-        logFile.print(frame.checksumValid ? "OK" : "ERR");
-        if (!frame.checksumValid) {
-          logFile.print(",0x");
-          if (frame.expectedChecksum < 0x10) logFile.print("0");
-          logFile.print(frame.expectedChecksum, HEX);
-        }
-        logFile.print("\r\n");  // Use explicit CR+LF for better compatibility
-        logFile.flush();  // Force flush after each frame
+// Hands a frame to the event bus once linMerge has put it in order
+void publishMerged(const LinMergedFrame& frame, unsigned long nowMs) {
+  byte receivedChecksum = frame.data[frame.length - 1];
+  // A header alone has no checksum to get wrong
+  if (receivedChecksum != frame.expectedChecksum && frame.length >= 4) {
+    eventsPublishFrame(EVENT_CHECKSUM_ERROR, frame.bus, frame.data, frame.length, frame.expectedChecksum,
+                       frame.frameUs, nowMs);
+  }
+  eventsPublishFrame(EVENT_FRAME, frame.bus, frame.data, frame.length, frame.expectedChecksum, frame.frameUs, nowMs);
+}
+
+void mergeFrame(uint8_t bus, const byte buffer[], short length, byte expectedChecksum, unsigned long frameUs,
+                unsigned long nowMs) {
+  // A full queue hands out what's waiting first, out of order at worst
+  // rather than lost
+  while (!linMerge.push(bus, buffer, length, expectedChecksum, frameUs)) {
+    publishMerged(*linMerge.next(), nowMs);
+    linMerge.pop();
+  }
+}
+
+#ifdef LIN_BUS2
+// Frames from the other buses are only recorded and published
+template <class Receiver>
+void readBus(Receiver& receiver) {
+  short bytesRead;
+  while ((bytesRead = receiver.updateFrame()) > 0) {
+    metricsFrames++;
+    byte calculatedChecksum = receiver.calculateChecksum(receiver.dataBuffer, bytesRead - 1);
+    mergeFrame(receiver.bus, receiver.dataBuffer, bytesRead, calculatedChecksum, receiver.frameMicros, millis());
+  }
+}
+#endif
+
+byte lastLights = 0;
+bool lightsKnown = false;
+
+// Everything done with a bus 0 frame (sync, PID, data, checksum): the
+// framer's from serviceLin(), or a replayed capture's, see replay.h. Only the
+// lights are driven from here, everything else gets the frames from the
+// event bus when it's drained, in the order they started across every bus.
+void handleLinFrame(const byte buffer[], short length, unsigned long frameUs) {
+  unsigned long nowMs = millis();
+  // Check if the checksum is valid
+  byte calculatedChecksum = lincore::checksum(buffer, length - 1);
+  byte receivedChecksum = buffer[length - 1];
+  bool checksumValid = (calculatedChecksum == receivedChecksum);
+
+  // Only process light frame if the checksum is valid
+  if (buffer[1] == LIN_FRAME_PID && checksumValid) {
+    byte lights = buffer[2];
+    processLightLINFrame(lights);
+    powerLightOutput(micros());
+    if (!firstLightMs) {
+      firstLightMs = nowMs;
+      Serial.println("First light frame at " + String(firstLightMs) + " ms");
+    }
+    if (responder_enabled) {
+      updateStatusResponse();
+    }
+    if (!lightsKnown || lights != lastLights) {
+      lastLights = lights;
+      lightsKnown = true;
+      eventsPublish(EVENT_LIGHTS, lights, nowMs);
+    }
+  }
+
+  mergeFrame(linStack.bus, buffer, length, calculatedChecksum, frameUs, nowMs);
+}
+
+// Reads and acts on whatever LIN frames have arrived. Called from loop() and
+// between slices of a firmware upload.
+void serviceLin() {
+  if (process_frames) {
+    metricsUart(Serial1.available());
+    // Process all available frames - keep calling updateFrame until no more frames available
+    short bytesRead;
+    while ((bytesRead = linStack.updateFrame()) > 0) {
+      metricsFrames++;
+      // A replay stands in for the bus while it runs
+      if (replayState() != REPLAY_RUNNING) {
+        handleLinFrame(linStack.dataBuffer, bytesRead, linStack.frameMicros);
       }
-      
-      logFile.close();
-      Serial.println("Log file written with " + String(frameBuffer.size()) + " frames");
+    }
+    replayPoll(micros());
+#ifdef LIN_BUS2
+    readBus(chargerLin);
+#endif
+
+    // Everything that started before any frame still arriving goes out now
+    unsigned long syncUs;
+    if (linStack.receiving(syncUs)) {
+      linMerge.holdFrom(syncUs);
+    }
+#ifdef LIN_BUS2
+    if (chargerLin.receiving(syncUs)) {
+      linMerge.holdFrom(syncUs);
+    }
+#endif
+    unsigned long nowMs = millis();
+    while (const LinMergedFrame* frame = linMerge.next()) {
+      publishMerged(*frame, nowMs);
+      linMerge.pop();
     }
   }
 }
 
+// serviceLin() for the OTA upload, which doesn't return to loop() for a while
+void serviceBus() {
+  serviceLin();
+  eventsDrain();
+}
+
+// The frame text for the page, /status and the serial echo
+void onLightFrame(const Event& event) {
+  if (event.bus != linStack.bus || event.data[1] != LIN_FRAME_PID) {
+    return;
+  }
+  bool checksumValid = event.data[event.length - 1] == event.expectedChecksum;
+  latestFrameString = formatFrameString(event.data, event.length, checksumValid, event.expectedChecksum);
+  statusDirty = true;
+  Serial.print(latestFrameString);
+}
+
+void onLightsChanged(const Event& event) {
+  historyRecord(event.value, event.timeMs);
+}
+
+// Frames go to the capture ring and its trigger in constant time, flash
+// writes wait for capturePoll()
+void onCaptureFrame(const Event& event) {
+  captureFrame(event.data, event.length, event.expectedChecksum, event.frameUs, event.timeMs, event.bus);
+}
 
 void setup(void) {
   // set control pins as an output and set them to LOW
@@ -545,6 +1052,10 @@ void setup(void) {
   Serial.begin(115200);
   Serial.println("Booting");
 
+#ifdef LAMP_SENSE
+  lampSenseBegin();
+#endif
+
   // Setup LittleFS
   lfsReady = LittleFS.begin();
   if (!lfsReady) {
@@ -552,78 +1063,52 @@ void setup(void) {
   }
 
   // Load configuration
+  // Only the local flash, so this is quick and the LIN setup below can use it
   if (lfsReady) {
-    File wifiConfig = LittleFS.open("/config/wifi.txt", "r");
-    if (wifiConfig && wifiConfig.size() > 0) {
-      wifiSSID = wifiConfig.readStringUntil('\n');
-      wifiSSID.trim();
-      wifiPassword = wifiConfig.readStringUntil('\n');
-      wifiPassword.trim();
-      wifiTimeout = wifiConfig.parseInt();
-      wifiConfig.close();
-    }
-
-    File apConfig = LittleFS.open("/config/ap.txt", "r");
-    if (apConfig && apConfig.size() > 0) {
-      apSSID = apConfig.readStringUntil('\n');
-      apSSID.trim();
-      apPassword = apConfig.readStringUntil('\n');
-      apPassword.trim();
-      apConfig.close();
-    }
-
-    File otaConfig = LittleFS.open("/config/ota.txt", "r");
-    if (otaConfig && otaConfig.size() > 0) {
-      otaUsername = otaConfig.readStringUntil('\n');
-      otaUsername.trim();
-      otaPassword = otaConfig.readStringUntil('\n');
-      otaPassword.trim();
-      otaConfig.close();
-    }
+    configBegin();
+    wifiSSID = configGet("wifi_ssid");
+    wifiPassword = configGet("wifi_password");
+    wifiTimeout = configGetInt("wifi_timeout", wifiTimeout);
+    idleSleepS = configGetInt("idle_sleep_s", idleSleepS);
+    derateC = configGetInt("derate_c", derateC);
+    shutdownC = configGetInt("shutdown_c", shutdownC);
+    apSSID = configGet("ap_ssid");
+    apPassword = configGet("ap_password");
+    otaUsername = configGet("ota_username");
+    otaPassword = configGet("ota_password");
 
     // If we were active before, we should stay active until disabled
     // We might reboot just because the doors are all closed in park
     // So we should remember the state
-    File outputConfig = LittleFS.open("/config/output_enabled.txt", "r");
-    if (outputConfig && outputConfig.size() > 0) {
-      output_enabled = outputConfig.parseInt();
-      outputConfig.close();
-    }
-  }
+    output_enabled = configGetInt("output_enabled", output_enabled);
+    responder_enabled = configGetInt("responder_enabled", responder_enabled);
 
-  // Setup WiFi
-  bool wifiConnected = false;
-  if (wifiSSID.length() > 0 && wifiPassword.length() > 0) {
-    char wifiSSIDArray[32];
-    char wifiPasswordArray[32];
-    wifiSSID.toCharArray(wifiSSIDArray, 32);
-    wifiPassword.toCharArray(wifiPasswordArray, 32);
-    wifiConnected = setupClient(wifiSSIDArray, wifiPasswordArray, wifiTimeout);
-  }
-
-  if (!wifiConnected) {
-    // Fallback to AP mode if WiFi fails/has not been configured
-    char apSSIDArray[32];
-    char apPasswordArray[32];
-    apSSID.toCharArray(apSSIDArray, 32);
-    apPassword.toCharArray(apPasswordArray, 32);
-    setupAccessPoint(apSSIDArray, apPasswordArray);
+    Serial.println("Config loaded in " + String(configLoadMicros) + " us (" + String((unsigned int)configJournalSize) + " bytes)");
+    if (configDroppedBytes > 0) {
+      Serial.println("Dropped " + String(configDroppedBytes) + " bytes of incomplete config writes");
+    }
   }
 
-  // Set hostname for the server
-  const char* hostname = "trailercontroller";
-  WiFi.setHostname(hostname);
+  historyBegin(lfsReady);
+  eventsSubscribe(EVENT_MASK(EVENT_FRAME), onLightFrame);
+  eventsSubscribe(EVENT_MASK(EVENT_LIGHTS), onLightsChanged);
+  eventsSubscribe(EVENT_MASK(EVENT_FRAME), onCaptureFrame);
+  thermalBegin(derateC, shutdownC, lfsReady);
 
-  // Start mDNS service using LEAmDNS
-  if (mdns.begin(hostname)) {
-    Serial.println("mDNS responder started. Hostname: " + String(hostname) + ".local");
-    mdns.addService("http", "tcp", 80); // Add HTTP service on port 80
-  } else {
-    Serial.println("Error setting up mDNS responder");
-  }
-
-  // Setup LIN
+  // Setup LIN before any networking so the lights work straight away
   linStack.setupSerial();
+#ifdef LIN_BUS2
+  chargerLin.setupSerial();
+#endif
+  updateLinFilter();
+  updateStatusResponse();
+  // Moves the UARTs onto the USB PLL, so after the LIN setup
+  powerBegin(idleSleepS, millis(), sleepNetwork, resumeNetwork);
+  linReadyMs = millis();
+  Serial.println("LIN ready at " + String(linReadyMs) + " ms");
+
+  // Setup WiFi, connecting continues in updateNetwork()
+  startNetwork();
 
   // Setup OTA
   if (otaUsername.length() == 0) {
@@ -632,7 +1117,7 @@ void setup(void) {
   if (otaPassword.length() == 0) {
     otaPassword = OTA_PASSWORD;
   }
-  httpUpdater.setup(&httpServer, otaUsername, otaPassword);
+  otaBegin(httpServer, otaUsername, otaPassword, serviceBus);
 
   // Setup HTTP server
   httpServer.on("/", handleRoot);
@@ -641,84 +1126,100 @@ void setup(void) {
   httpServer.on("/updateSettings", handleUpdateSettings);
   httpServer.on("/toggleOutput", handleToggleOutputPage);
   httpServer.on("/autoRefresh", handleToggleAutoRefresh);
+  httpServer.on("/toggleResponder", handleToggleResponderPage);
   httpServer.on("/control", handleControlPage);
   httpServer.on("/logging", handleLoggingPage);
   httpServer.on("/loggingConfig", handleLoggingConfig);
   httpServer.on("/startLogging", handleStartLogging);
+  httpServer.on("/stopLogging", handleStopLogging);
   httpServer.on("/loggingStatus", handleLoggingStatus);
   httpServer.on("/getLog", handleGetLog);
+  httpServer.on("/history", handleHistory);
+  httpServer.on("/historyStats", handleHistoryStats);
+  httpServer.on("/powerStatus", handlePowerStatus);
+  httpServer.on("/thermal", handleThermal);
+  httpServer.on("/status", handleStatus);
+  httpServer.on("/events", handleEvents);
+  httpServer.on("/metrics", handleMetrics);
   httpServer.onNotFound([]() {
     httpServer.send(404, "text/plain", "File not found");
   });
+  // Between frames only, a step that lands between two bytes of one would
+  // end it early
+  httpServer.yieldWhen([]() {
+    unsigned long syncUs;
+#ifdef LIN_BUS2
+    if (Serial2.available() > 0 || chargerLin.receiving(syncUs)) {
+      return true;
+    }
+#endif
+    return Serial1.available() > 0 || linStack.receiving(syncUs);
+  });
   httpServer.begin();
+  metricsBegin(httpServer, linStack);
+  replayBegin(httpServer, handleLinFrame, serviceBus);
 
   Serial.println("HTTP server started");
-  led_state = false;
-  digitalWrite(LED_BUILTIN, led_state);
 }
 
 void loop(void) {
-  httpServer.handleClient();
+  // Asleep, loop() naps here until a LIN byte arrives, see power.h
+  powerNap();
+  metricsLoopStart(micros());
+
+  if (reconfiguring) {
+    unsigned long gap = (uint32_t)(micros() - lastLoopMicros);
+    if (gap > reconfigMaxLoopUs) {
+      reconfigMaxLoopUs = gap;
+    }
+  }
+  lastLoopMicros = micros();
 
-  // Handle mDNS queries
-  mdns.update();
+  updateNetwork();
+  updateTestSequence();
+  metricsSection(SECTION_HTTP, micros());
+  httpServer.poll();
 
-  // Handle logging completion
-  if (isLogging && (millis() - loggingStartTime >= LOGGING_DURATION_MS)) {
-    completeLogging();
+  // Handle mDNS queries
+  metricsSection(SECTION_MDNS, micros());
+  if (mdnsStarted) {
+    mdns.update();
   }
 
-  // Handle LIN frames
-  if (process_frames) {
-    // Process all available frames - keep calling updateFrame until no more frames available
-    short bytesRead;
-    while ((bytesRead = linStack.updateFrame(isLogging ? 0 : LIN_FRAME_PID)) > 0) {
-      // Check if the checksum is valid
-      byte calculatedChecksum = linStack.calculateChecksum(linStack.dataBuffer, bytesRead - 1);
-      byte receivedChecksum = linStack.dataBuffer[bytesRead - 1];
-      bool checksumValid = (calculatedChecksum == receivedChecksum);
-      
-      // If logging, just capture the frame data without processing for display
-      if (isLogging) {
-        if (millis() - loggingStartTime >= LOGGING_DURATION_MS) {
-          break;
-        }
-
-        LINFrame frame;
-        frame.timestamp = millis() - loggingStartTime;
-        frame.sync = linStack.dataBuffer[0];
-        frame.pid = linStack.dataBuffer[1];
-        // Store data bytes (everything between PID and checksum)
-        frame.dataLength = bytesRead - 3;  // Total - sync - PID - checksum
-        if (frame.dataLength > 8) {
-          frame.dataLength = 8; // Cap at 8 bytes
-        }
-        for (int i = 0; i < frame.dataLength && i < 8; i++) {
-          frame.data[i] = linStack.dataBuffer[2 + i];
-        }
-        frame.checksum = receivedChecksum;
-        frame.expectedChecksum = calculatedChecksum;
-        frame.checksumValid = checksumValid;
-        frameBuffer.push_back(frame);
-      } else {
-        // Only build the display string when not logging
-        latestFrameString = "";
-        for (int i = 0; i < bytesRead; i++) {
-          latestFrameString += "0x" + String(linStack.dataBuffer[i], HEX) + " ";
-        }
-        
-        if (checksumValid) {
-          latestFrameString += "OK";
-          // Only process light frame if it's the expected PID and checksum is valid
-          if (linStack.dataBuffer[1] == LIN_FRAME_PID) {
-            processLightLINFrame(linStack.dataBuffer[2]);
-          }
-        } else {
-          latestFrameString += "ERR 0x" + String(calculatedChecksum, HEX);
-        }
-        
-        Serial.print(latestFrameString);
-      }
-    }
+  metricsSection(SECTION_SENSORS, micros());
+#ifdef LAMP_SENSE
+  // Filter whatever the ADC has sampled since the last pass
+  if (lampSenseUpdate()) {
+    updateStatusResponse();
+  }
+#endif
+  thermalPoll(millis());
+
+  metricsSection(SECTION_LIN, micros());
+  serviceLin();
+  eventsDrain();
+  publishStatus();
+  // Triggers and capture writes, after the frames that just arrived
+  metricsSection(SECTION_CAPTURE, micros());
+  capturePoll(millis());
+  metricsSection(SECTION_OTA, micros());
+  otaPoll(left_state || right_state || (lightsKnown && (lastLights & LIGHT_BRAKES)));
+
+  // The web UI, manual control, a recording and a replay keep it awake like
+  // bus traffic
+  metricsSection(SECTION_POWER, micros());
+  unsigned long uiRequests = httpServer.requests - metricsScrapes;
+  if (uiRequests != lastHttpRequests || !process_frames || captureState() == CAPTURE_RECORDING ||
+      replayState() == REPLAY_RUNNING) {
+    lastHttpRequests = uiRequests;
+    powerKeepAwake(millis());
   }
-}
\ No newline at end of file
+#ifdef LIN_BUS2
+  const unsigned long busFrameUs[] = {linStack.frameMicros, chargerLin.frameMicros};
+#else
+  const unsigned long busFrameUs[] = {linStack.frameMicros};
+#endif
+  powerPoll(busFrameUs, sizeof(busFrameUs) / sizeof(busFrameUs[0]), millis());
+  metricsPoll(millis());
+  metricsLoopEnd(micros());
+}
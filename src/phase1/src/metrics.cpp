@@ -0,0 +1,331 @@
+#include "metrics.h"
+#include "lin.h"
+#include "events.h"
+
+#include <LittleFS.h>
+#include <stdlib.h>
+
+#ifdef ARDUINO_ARCH_RP2040
+#include <hardware/uart.h>
+#include <malloc.h>
+#endif
+
+unsigned long metricsFrames = 0;
+unsigned long metricsChecksumErrors = 0;
+unsigned long metricsRxHighWater = 0;
+unsigned long metricsRxOverruns = 0;
+unsigned long metricsStalls = 0;
+unsigned long metricsMaxLoopUs = 0;
+float metricsFramesPerSecond = 0;
+
+// Upper bounds of the loop time buckets, the last one is +Inf
+static const unsigned long bucketUs[] = {50, 100, 200, 500, 1000, 2000, 5000, 10000, 20000, 50000, 100000, 1000000};
+#define BUCKETS (sizeof(bucketUs) / sizeof(bucketUs[0]))
+
+static uint64_t loopBuckets[BUCKETS + 1];
+static uint64_t loopCount = 0;
+static uint64_t loopSumUs = 0;
+
+static HttpServer* server = nullptr;
+static lin* framer = nullptr;
+static unsigned long loopStartUs = 0;
+static unsigned long sectionStartUs = 0;
+static MetricsSection section = SECTION_NETWORK;
+static MetricsSection longest = SECTION_NETWORK;
+static unsigned long longestUs = 0;
+
+struct StallSource {
+  MetricsSection section;
+  const char* handler; // "" outside the web server
+  unsigned long count;
+  unsigned long maxUs;
+  unsigned long lastMs;
+};
+static StallSource stallSources[METRICS_STALL_SOURCES];
+static size_t stallSourceCount = 0;
+static StallSource otherStalls = {SECTION_COUNT, "", 0, 0, 0}; // once the table is full
+
+static unsigned long rateStartMs = 0;
+static unsigned long rateStartFrames = 0;
+
+const char* metricsSectionName(MetricsSection value) {
+  switch (value) {
+    case SECTION_NETWORK: return "network";
+    case SECTION_HTTP: return "http";
+    case SECTION_MDNS: return "mdns";
+    case SECTION_SENSORS: return "sensors";
+    case SECTION_LIN: return "lin";
+    case SECTION_CAPTURE: return "capture";
+    case SECTION_OTA: return "ota";
+    case SECTION_POWER: return "power";
+    default: return "other";
+  }
+}
+
+static void onChecksumError(const Event&) {
+  metricsChecksumErrors++;
+}
+
+void metricsBegin(HttpServer& httpServer, lin& linStack) {
+  server = &httpServer;
+  framer = &linStack;
+  rateStartMs = millis();
+  rateStartFrames = metricsFrames;
+  eventsSubscribe(EVENT_MASK(EVENT_CHECKSUM_ERROR), onChecksumError);
+}
+
+void metricsLoopStart(unsigned long nowUs) {
+  loopStartUs = nowUs;
+  sectionStartUs = nowUs;
+  section = SECTION_NETWORK;
+  longest = SECTION_NETWORK;
+  longestUs = 0;
+}
+
+void metricsSection(MetricsSection next, unsigned long nowUs) {
+  unsigned long elapsed = (uint32_t)(nowUs - sectionStartUs);
+  if (elapsed > longestUs) {
+    longestUs = elapsed;
+    longest = section;
+  }
+  section = next;
+  sectionStartUs = nowUs;
+}
+
+static void recordStall(unsigned long loopUs, unsigned long nowMs) {
+  const char* handler = longest == SECTION_HTTP && server ? server->slowestHandler() : "";
+  metricsStalls++;
+  StallSource* source = nullptr;
+  for (size_t i = 0; i < stallSourceCount; i++) {
+    if (stallSources[i].section == longest && strcmp(stallSources[i].handler, handler) == 0) {
+      source = &stallSources[i];
+      break;
+    }
+  }
+  if (!source && stallSourceCount < METRICS_STALL_SOURCES) {
+    source = &stallSources[stallSourceCount++];
+    *source = {longest, handler, 0, 0, 0};
+  } else if (!source) {
+    source = &otherStalls;
+  }
+  source->count++;
+  source->lastMs = nowMs;
+  if (loopUs > source->maxUs) {
+    source->maxUs = loopUs;
+  }
+  Serial.println("Loop stall: " + String(loopUs) + " us, " + String(longestUs) + " us in " +
+                 metricsSectionName(longest) + (handler[0] ? String(" ") + handler : String("")));
+}
+
+void metricsLoopEnd(unsigned long nowUs) {
+  metricsSection(section, nowUs);
+  unsigned long elapsed = (uint32_t)(nowUs - loopStartUs);
+  size_t bucket = 0;
+  while (bucket < BUCKETS && elapsed > bucketUs[bucket]) {
+    bucket++;
+  }
+  loopBuckets[bucket]++;
+  loopCount++;
+  loopSumUs += elapsed;
+  if (elapsed > metricsMaxLoopUs) {
+    metricsMaxLoopUs = elapsed;
+  }
+  if (elapsed > METRICS_STALL_US) {
+    recordStall(elapsed, millis());
+  }
+}
+
+void metricsUart(int available) {
+  if (available > 0 && (unsigned long)available > metricsRxHighWater) {
+    metricsRxHighWater = available;
+  }
+  // The core's receive buffer filled before loop() drained it
+  if (Serial1.overflow()) {
+    metricsRxOverruns++;
+  }
+#ifdef ARDUINO_ARCH_RP2040
+  // The UART's own FIFO filled before its interrupt emptied it
+  if (uart_get_hw(uart0)->rsr & UART_UARTRSR_OE_BITS) {
+    uart_get_hw(uart0)->rsr = UART_UARTRSR_OE_BITS;
+    metricsRxOverruns++;
+  }
+#endif
+}
+
+void metricsPoll(unsigned long nowMs) {
+  unsigned long elapsed = nowMs - rateStartMs;
+  if (elapsed < METRICS_RATE_MS) {
+    return;
+  }
+  metricsFramesPerSecond = (metricsFrames - rateStartFrames) * 1000.0f / elapsed;
+  rateStartMs = nowMs;
+  rateStartFrames = metricsFrames;
+}
+
+#pragma region Prometheus text
+
+static String number(uint64_t value) {
+  char digits[21];
+  int at = sizeof(digits) - 1;
+  digits[at] = '\0';
+  do {
+    digits[--at] = '0' + value % 10;
+    value /= 10;
+  } while (value > 0);
+  return String(digits + at);
+}
+
+// Microseconds as seconds, without trailing zeros
+static String seconds(uint64_t us) {
+  String text = number(us / 1000000);
+  unsigned long fraction = us % 1000000;
+  if (fraction) {
+    char digits[8];
+    snprintf(digits, sizeof(digits), ".%06lu", fraction);
+    int end = strlen(digits);
+    while (digits[end - 1] == '0') {
+      end--;
+    }
+    digits[end] = '\0';
+    text += digits;
+  }
+  return text;
+}
+
+// Paths and names only, so quotes and backslashes are all there is to escape
+static String label(const char* value) {
+  String escaped;
+  for (const char* c = value; *c; c++) {
+    if (*c == '"' || *c == '\\') {
+      escaped += '\\';
+    }
+    escaped += *c;
+  }
+  return escaped;
+}
+
+static void header(String& text, const char* name, const char* type, const char* help) {
+  text += "# HELP " + String(name) + " " + help + "\n";
+  text += "# TYPE " + String(name) + " " + type + "\n";
+}
+
+static void sample(String& text, const char* name, const String& value) {
+  text += String(name) + " " + value + "\n";
+}
+
+// The free heap less the holes between blocks in use, what's left is one
+// block at the top of the heap. mallinfo() only totals the holes, so a
+// bigger one could go unreported, but nothing is allocated to find out.
+static size_t largestFreeBlock(size_t freeBytes) {
+#ifdef ARDUINO_ARCH_RP2040
+  struct mallinfo info = mallinfo();
+  size_t holes = info.fordblks - info.keepcost;
+  return freeBytes > holes ? freeBytes - holes : 0;
+#else
+  (void)freeBytes;
+  return rp2040.hostLargestFreeBlock;
+#endif
+}
+
+static void eachStallSource(std::function<void(const StallSource& source, const String& labels)> visit) {
+  for (size_t i = 0; i <= stallSourceCount; i++) {
+    const StallSource& source = i < stallSourceCount ? stallSources[i] : otherStalls;
+    if (source.count > 0) {
+      visit(source, "{section=\"" + String(metricsSectionName(source.section)) + "\",handler=\"" +
+                    label(source.handler) + "\"} ");
+    }
+  }
+}
+
+String metricsPrometheus(unsigned long nowMs) {
+  String text;
+  text.reserve(4096);
+
+  header(text, "tcu_loop_duration_seconds", "histogram", "Time taken by each pass of loop().");
+  uint64_t cumulative = 0;
+  for (size_t i = 0; i <= BUCKETS; i++) {
+    cumulative += loopBuckets[i];
+    String le = i < BUCKETS ? seconds(bucketUs[i]) : String("+Inf");
+    text += "tcu_loop_duration_seconds_bucket{le=\"" + le + "\"} " + number(cumulative) + "\n";
+  }
+  sample(text, "tcu_loop_duration_seconds_sum", seconds(loopSumUs));
+  sample(text, "tcu_loop_duration_seconds_count", number(loopCount));
+  header(text, "tcu_loop_max_duration_seconds", "gauge", "Longest pass of loop() since boot.");
+  sample(text, "tcu_loop_max_duration_seconds", seconds(metricsMaxLoopUs));
+
+  // Each family's samples have to be together
+  header(text, "tcu_loop_stalls_total", "counter",
+         "Passes of loop() over the stall budget, by the section and handler that took longest.");
+  eachStallSource([&](const StallSource& source, const String& labels) {
+    text += "tcu_loop_stalls_total" + labels + String(source.count) + "\n";
+  });
+  header(text, "tcu_loop_stall_max_seconds", "gauge", "Longest stall by section and handler.");
+  eachStallSource([&](const StallSource& source, const String& labels) {
+    text += "tcu_loop_stall_max_seconds" + labels + seconds(source.maxUs) + "\n";
+  });
+  header(text, "tcu_loop_stall_last_timestamp_seconds", "gauge", "Uptime at the last stall by section and handler.");
+  eachStallSource([&](const StallSource& source, const String& labels) {
+    text += "tcu_loop_stall_last_timestamp_seconds" + labels + seconds((uint64_t)source.lastMs * 1000) + "\n";
+  });
+  header(text, "tcu_loop_stall_budget_seconds", "gauge", "A pass of loop() longer than this is a stall.");
+  sample(text, "tcu_loop_stall_budget_seconds", seconds(METRICS_STALL_US));
+
+  if (server) {
+    header(text, "tcu_http_requests_total", "counter", "HTTP requests handled.");
+    sample(text, "tcu_http_requests_total", String(server->requests));
+    header(text, "tcu_http_handler_calls_total", "counter", "Requests by route.");
+    server->routeStats([&](const String& path, unsigned long calls, unsigned long) {
+      text += "tcu_http_handler_calls_total{path=\"" + label(path.c_str()) + "\"} " + String(calls) + "\n";
+    });
+    header(text, "tcu_http_handler_max_seconds", "gauge", "Longest single call into each route's handler.");
+    server->routeStats([&](const String& path, unsigned long, unsigned long maxUs) {
+      text += "tcu_http_handler_max_seconds{path=\"" + label(path.c_str()) + "\"} " + seconds(maxUs) + "\n";
+    });
+    header(text, "tcu_http_poll_max_seconds", "gauge", "Longest HttpServer poll(), handlers included.");
+    sample(text, "tcu_http_poll_max_seconds", seconds(server->maxPollUs));
+  }
+
+  header(text, "tcu_uart_rx_high_water_bytes", "gauge", "Most bytes seen waiting in the LIN UART's receive buffer.");
+  sample(text, "tcu_uart_rx_high_water_bytes", String(metricsRxHighWater));
+  header(text, "tcu_uart_rx_overruns_total", "counter", "Times LIN bytes were lost to a full receive FIFO or buffer.");
+  sample(text, "tcu_uart_rx_overruns_total", String(metricsRxOverruns));
+  header(text, "tcu_lin_frames_total", "counter", "LIN frames read.");
+  sample(text, "tcu_lin_frames_total", String(metricsFrames));
+  if (framer) {
+    header(text, "tcu_lin_frames_filtered_total", "counter", "LIN frames dropped by the ID filter or decimation.");
+    sample(text, "tcu_lin_frames_filtered_total", String(framer->framesFiltered));
+  }
+  header(text, "tcu_lin_frames_per_second", "gauge", "LIN frames read over the last second.");
+  sample(text, "tcu_lin_frames_per_second", String(metricsFramesPerSecond, 1));
+  header(text, "tcu_lin_checksum_errors_total", "counter", "LIN frames whose checksum didn't match.");
+  sample(text, "tcu_lin_checksum_errors_total", String(metricsChecksumErrors));
+
+  header(text, "tcu_events_published_total", "counter", "Events queued on the event bus.");
+  sample(text, "tcu_events_published_total", String(eventsPublished));
+  header(text, "tcu_events_dropped_total", "counter", "Events lost to a full event bus ring.");
+  sample(text, "tcu_events_dropped_total", String(eventsDropped));
+  header(text, "tcu_events_max_queued", "gauge", "Most events waiting to be drained at once.");
+  sample(text, "tcu_events_max_queued", String(eventsMaxQueued));
+
+  size_t freeHeap = rp2040.getFreeHeap();
+  header(text, "tcu_heap_free_bytes", "gauge", "Free heap.");
+  sample(text, "tcu_heap_free_bytes", String((unsigned long)freeHeap));
+  header(text, "tcu_heap_total_bytes", "gauge", "Heap size.");
+  sample(text, "tcu_heap_total_bytes", String((unsigned long)rp2040.getTotalHeap()));
+  header(text, "tcu_heap_largest_free_block_bytes", "gauge", "Free heap in one block at its top.");
+  sample(text, "tcu_heap_largest_free_block_bytes", String((unsigned long)largestFreeBlock(freeHeap)));
+
+  FSInfo info;
+  if (LittleFS.info(info)) {
+    header(text, "tcu_littlefs_used_bytes", "gauge", "LittleFS space in use.");
+    sample(text, "tcu_littlefs_used_bytes", String((unsigned long)info.usedBytes));
+    header(text, "tcu_littlefs_total_bytes", "gauge", "LittleFS size.");
+    sample(text, "tcu_littlefs_total_bytes", String((unsigned long)info.totalBytes));
+  }
+
+  header(text, "tcu_uptime_seconds", "gauge", "Time since boot.");
+  sample(text, "tcu_uptime_seconds", seconds((uint64_t)nowMs * 1000));
+  return text;
+}
+
+#pragma endregion Prometheus text
@@ -0,0 +1,248 @@
+#include "ota.h"
+
+#include <LittleFS.h>
+#include <Updater.h>
+#include <lin_core.h>
+
+// What the UART's RX FIFO holds while a flash operation has interrupts off
+static const unsigned long UART_FIFO_US = 32 * 10 * 1000000UL / lincore::BAUD;
+
+static HttpServer* server = nullptr;
+static String username;
+static String password;
+static void (*serviceLin)() = nullptr;
+
+// The request whose image is being written, or was and hasn't been
+// answered yet, 0 if none. The flags are its, cleared once
+// handleUploadDone() has answered it.
+static unsigned long owner = 0;
+static bool verified = false;
+static bool receiving = false;
+// Requests whose image arrived while another was being written, answered
+// with a 409. A connection has one request at a time, so one slot each.
+static unsigned long refused[HTTP_MAX_CONNECTIONS];
+static size_t nextRefused = 0;
+static unsigned long startedAt = 0;
+static unsigned long lastService = 0;
+static bool rebootPending = false;
+static unsigned long rebootAfter = 0;
+static unsigned long lastSignalling = 0;
+
+String otaResult = "";
+size_t otaBytesWritten = 0;
+unsigned long otaDurationMs = 0;
+unsigned long otaMaxStallUs = 0;
+unsigned long otaMaxFlashUs = 0;
+unsigned long otaFlashOverruns = 0;
+
+static const char* OTA_PAGE =
+  "<!DOCTYPE html><html><head><meta name=\"viewport\" content=\"width=device-width, initial-scale=1\">"
+  "<title>Firmware Update</title></head><body><h2>Firmware Update</h2>"
+  "<form method=\"POST\" enctype=\"multipart/form-data\">"
+  "<p>MD5 <input type=\"text\" name=\"md5\" size=\"34\" placeholder=\"md5sum firmware.bin\"></p>"
+  "<p><input type=\"file\" accept=\".bin\" name=\"firmware\"></p>"
+  "<p><input type=\"submit\" value=\"Update\"></p></form></body></html>";
+
+static void service() {
+  unsigned long gap = (uint32_t)(micros() - lastService);
+  if (gap > otaMaxStallUs) {
+    otaMaxStallUs = gap;
+  }
+  if (serviceLin) {
+    serviceLin();
+  }
+  lastService = micros();
+}
+
+// Times one flash call, which may erase and program with interrupts off
+template <class Write>
+static bool timedFlash(Write write) {
+  unsigned long start = micros();
+  bool ok = write();
+  unsigned long took = (uint32_t)(micros() - start);
+  if (took > otaMaxFlashUs) {
+    otaMaxFlashUs = took;
+  }
+  if (took > UART_FIFO_US) {
+    otaFlashOverruns++;
+  }
+  return ok;
+}
+
+static String flashReport() {
+  String report = "longest flash write " + String(otaMaxFlashUs) + " us against " + String(UART_FIFO_US) +
+                  " us of UART FIFO";
+  if (otaFlashOverruns) {
+    report += ", " + String(otaFlashOverruns) + " long enough to lose LIN bytes";
+  }
+  return report;
+}
+
+static void fail(const String& reason) {
+  otaResult = reason;
+  if (receiving) {
+    Update.end(); // drops the partial image
+  }
+  receiving = false;
+}
+
+static bool takeRefused(unsigned long request) {
+  for (auto& slot : refused) {
+    if (slot == request) {
+      slot = 0;
+      return true;
+    }
+  }
+  return false;
+}
+
+static void handleUpload() {
+  HttpUpload& upload = server->upload();
+  unsigned long request = server->requestId();
+  // Only the upload that started Update gets to write to it, end it or drop
+  // it, another one would restart it under the first
+  if (upload.status != UPLOAD_FILE_START && request != owner) {
+    return;
+  }
+  switch (upload.status) {
+    case UPLOAD_FILE_START: {
+      if (receiving && request != owner) {
+        refused[nextRefused++ % HTTP_MAX_CONNECTIONS] = request;
+        return;
+      }
+      // Anyone else is answered 401 by handleUploadDone()
+      if (!server->authenticate(username.c_str(), password.c_str())) {
+        return;
+      }
+      owner = request;
+      verified = false;
+      otaBytesWritten = 0;
+      otaMaxStallUs = 0;
+      otaMaxFlashUs = 0;
+      otaFlashOverruns = 0;
+      startedAt = millis();
+      lastService = micros();
+      String md5 = server->arg("md5");
+      md5.trim();
+      md5.toLowerCase();
+      if (md5.length() != 32) {
+        fail("An MD5 of the image is required, in an md5 field ahead of the file or /update?md5=...");
+        return;
+      }
+      FSInfo info;
+      LittleFS.info(info);
+      if (!Update.begin(info.totalBytes - info.usedBytes) || !Update.setMD5(md5.c_str())) {
+        fail("Update not started: " + Update.getErrorString());
+        return;
+      }
+      receiving = true;
+      Serial.println("OTA update started: " + upload.filename);
+      break;
+    }
+    case UPLOAD_FILE_WRITE:
+      if (!receiving) {
+        return;
+      }
+      for (size_t offset = 0; offset < upload.currentSize; offset += OTA_SLICE_BYTES) {
+        size_t length = upload.currentSize - offset;
+        if (length > OTA_SLICE_BYTES) {
+          length = OTA_SLICE_BYTES;
+        }
+        if (!timedFlash([&]() { return Update.write(upload.buf + offset, length) == length; })) {
+          fail("Write failed: " + Update.getErrorString());
+          return;
+        }
+        otaBytesWritten += length;
+        service();
+      }
+      break;
+    case UPLOAD_FILE_END:
+      if (!receiving) {
+        return;
+      }
+      receiving = false;
+      service();
+      // end() checks the MD5 of what was written and only stages the image if
+      // it matches
+      if (timedFlash([]() { return Update.end(true); })) {
+        verified = true;
+        otaResult = "OK, MD5 " + Update.md5String() + " verified";
+      } else {
+        otaResult = "Rejected: " + Update.getErrorString();
+      }
+      otaDurationMs = millis() - startedAt;
+      Serial.println("OTA update: " + otaResult + ", " + String((unsigned int)otaBytesWritten) + " bytes in " +
+        String(otaDurationMs) + " ms, LIN unserviced for at most " + String(otaMaxStallUs) + " us, " +
+        flashReport());
+      break;
+    case UPLOAD_FILE_ABORTED:
+      verified = false;
+      fail("Upload aborted");
+      break;
+  }
+}
+
+static void handleUploadDone() {
+  // The flags only speak for the owner's file part, and the credentials are
+  // checked here too in case this request had none
+  unsigned long request = server->requestId();
+  bool busy = takeRefused(request);
+  bool hadFile = request == owner;
+  bool ok = hadFile && verified;
+  if (hadFile) {
+    owner = 0;
+    verified = false;
+  }
+  if (!server->authenticate(username.c_str(), password.c_str())) {
+    return server->requestAuthentication();
+  }
+  if (busy) {
+    server->send(409, "text/plain", "Update failed: another update is in progress");
+    return;
+  }
+  if (!ok) {
+    server->send(500, "text/plain", "Update failed: " + (hadFile ? otaResult : String("no firmware in the upload")));
+    return;
+  }
+  server->send(200, "text/plain", "Update OK, " + String((unsigned int)otaBytesWritten) + " bytes in " +
+    String(otaDurationMs) + " ms, LIN unserviced for at most " + String(otaMaxStallUs) + " us, " + flashReport() +
+    ". Rebooting once the turn signals and brakes are off...");
+  rebootPending = true;
+  rebootAfter = millis() + OTA_REBOOT_DELAY_MS;
+}
+
+void otaBegin(HttpServer& webServer, const String& user, const String& pass, void (*service)()) {
+  server = &webServer;
+  username = user;
+  password = pass;
+  serviceLin = service;
+  server->on("/update", HttpServer::GET, []() {
+    if (!server->authenticate(username.c_str(), password.c_str())) {
+      return server->requestAuthentication();
+    }
+    server->send(200, "text/html", OTA_PAGE);
+  });
+  server->on("/update", HttpServer::POST, handleUploadDone, handleUpload);
+}
+
+void otaUpdateCredentials(const String& user, const String& pass) {
+  username = user;
+  password = pass;
+}
+
+void otaPoll(bool signalling) {
+  if (signalling) {
+    lastSignalling = millis();
+  }
+  if (!rebootPending || (long)(millis() - rebootAfter) < 0) {
+    return;
+  }
+  // Rebooting turns the outputs off until LIN is back up, so pick a moment
+  // when only the tail lights could be on
+  bool quiet = millis() - lastSignalling >= OTA_QUIET_MS;
+  if (quiet || millis() - rebootAfter >= OTA_MAX_DEFER_MS) {
+    Serial.println("Rebooting into the new firmware");
+    Serial.flush();
+    rp2040.reboot();
+  }
+}
@@ -0,0 +1,188 @@
+#include "power.h"
+
+#include <lin_core.h>
+
+#include "lin_merge.h"
+
+#ifdef ARDUINO_ARCH_RP2040
+#include <hardware/clocks.h>
+#include <hardware/uart.h>
+#include <pico/stdlib.h>
+#endif
+
+unsigned long powerIdleS = POWER_IDLE_DEFAULT_S;
+unsigned long powerSleeps = 0;
+unsigned long powerLastWakeUs = 0;
+unsigned long powerMaxWakeUs = 0;
+unsigned long powerWakesOverBudget = 0;
+unsigned long powerAsleepMs = 0;
+
+static PowerState state = POWER_ACTIVE;
+static void (*sleepNetwork)() = nullptr;
+static void (*resumeNetwork)() = nullptr;
+static unsigned long lastFrameUs[LIN_MAX_BUSES];
+static unsigned long lastActiveMs = 0;
+static unsigned long sleptAtMs = 0;
+static unsigned long wokeAtUs = 0;
+static unsigned long wokeAtMs = 0;
+static unsigned long runKhz = 0;
+static unsigned long clockKhz = 0;
+
+static void setClock(unsigned long khz) {
+#ifdef ARDUINO_ARCH_RP2040
+  set_sys_clock_khz(khz, false);
+  // set_sys_clock_khz() puts clk_peri back on clk_sys, the UARTs stay on the
+  // USB PLL so their baud divisors hold
+  clock_configure(clk_peri, 0, CLOCKS_CLK_PERI_CTRL_AUXSRC_VALUE_CLKSRC_PLL_USB, 48 * MHZ, 48 * MHZ);
+#endif
+  clockKhz = khz;
+}
+
+static void resume() {
+  state = POWER_ACTIVE;
+  lastActiveMs = millis();
+  if (resumeNetwork) {
+    resumeNetwork();
+  }
+}
+
+static void enterSleep(unsigned long nowMs) {
+  Serial.println("LIN idle for " + String(powerIdleS) + " s, sleeping");
+  if (sleepNetwork) {
+    sleepNetwork();
+  }
+  setClock(POWER_SLEEP_KHZ);
+  state = POWER_ASLEEP;
+  sleptAtMs = nowMs;
+  powerSleeps++;
+}
+
+static void wake() {
+  // Straight back to full speed, the rest of the frame is on its way
+  setClock(runKhz);
+  wokeAtUs = micros();
+  wokeAtMs = millis();
+  powerAsleepMs += wokeAtMs - sleptAtMs;
+  lastActiveMs = wokeAtMs;
+  state = POWER_WAKING;
+}
+
+void powerBegin(unsigned long idleS, unsigned long nowMs, void (*sleepFn)(), void (*resumeFn)()) {
+  sleepNetwork = sleepFn;
+  resumeNetwork = resumeFn;
+  powerIdleS = idleS;
+  lastActiveMs = nowMs;
+#ifdef ARDUINO_ARCH_RP2040
+  runKhz = clock_get_hz(clk_sys) / 1000;
+  clock_configure(clk_peri, 0, CLOCKS_CLK_PERI_CTRL_AUXSRC_VALUE_CLKSRC_PLL_USB, 48 * MHZ, 48 * MHZ);
+  // Both set up for the old clk_peri
+  uart_set_baudrate(uart0, lincore::BAUD);
+#ifdef LIN_BUS2
+  uart_set_baudrate(uart1, lincore::BAUD);
+#endif
+#else
+  runKhz = 133000;
+#endif
+  clockKhz = runKhz;
+}
+
+void powerSetIdle(unsigned long idleS, unsigned long nowMs) {
+  powerIdleS = idleS;
+  lastActiveMs = nowMs;
+}
+
+void powerKeepAwake(unsigned long nowMs) {
+  lastActiveMs = nowMs;
+}
+
+void powerPoll(const unsigned long frameUs[], size_t buses, unsigned long nowMs) {
+  for (size_t bus = 0; bus < buses && bus < LIN_MAX_BUSES; bus++) {
+    if (frameUs[bus] != lastFrameUs[bus]) {
+      lastFrameUs[bus] = frameUs[bus];
+      lastActiveMs = nowMs;
+    }
+  }
+  switch (state) {
+    case POWER_ACTIVE:
+      if (powerIdleS && nowMs - lastActiveMs >= powerIdleS * 1000) {
+        enterSleep(nowMs);
+      }
+      break;
+    case POWER_WAKING:
+      // Woken by a header nobody answers or noise, no light frame to wait for
+      if (nowMs - wokeAtMs >= POWER_RESUME_MS) {
+        resume();
+      }
+      break;
+    case POWER_ASLEEP:
+      break;
+  }
+}
+
+// A byte waiting on any bus
+static bool busByte() {
+#ifdef LIN_BUS2
+  return Serial1.available() || Serial2.available();
+#else
+  return Serial1.available();
+#endif
+}
+
+void powerNap() {
+  if (state != POWER_ASLEEP) {
+    return;
+  }
+#ifdef ARDUINO_ARCH_RP2040
+  // Any interrupt ends the wait early, the UARTs' RX ones included
+  absolute_time_t until = make_timeout_time_ms(POWER_NAP_MS);
+  while (!busByte() && !best_effort_wfe_or_timeout(until)) {
+  }
+#else
+  // The host clock jumps to the next byte, as if its interrupt ended the nap
+  unsigned long napUs = POWER_NAP_MS * 1000UL;
+  unsigned long arrival;
+  if (Serial1.hostNextArrival(arrival) && (uint32_t)(arrival - micros()) < napUs) {
+    napUs = (uint32_t)(arrival - micros());
+  }
+#ifdef LIN_BUS2
+  if (Serial2.hostNextArrival(arrival) && (uint32_t)(arrival - micros()) < napUs) {
+    napUs = (uint32_t)(arrival - micros());
+  }
+#endif
+  if (!busByte()) {
+    delayMicroseconds(napUs);
+  }
+#endif
+  if (busByte()) {
+    wake();
+  }
+}
+
+void powerLightOutput(unsigned long nowUs) {
+  if (state != POWER_WAKING) {
+    return;
+  }
+  powerLastWakeUs = (uint32_t)(nowUs - wokeAtUs);
+  if (powerLastWakeUs > powerMaxWakeUs) {
+    powerMaxWakeUs = powerLastWakeUs;
+  }
+  if (powerLastWakeUs > POWER_WAKE_BUDGET_US) {
+    powerWakesOverBudget++;
+  }
+  Serial.println("Woke to lights in " + String(powerLastWakeUs) + " us");
+  resume();
+}
+
+PowerState powerState() {
+  return state;
+}
+
+String powerStatusJson() {
+  static const char* names[] = {"active", "asleep", "waking"};
+  unsigned long asleepMs = powerAsleepMs + (state == POWER_ASLEEP ? millis() - sleptAtMs : 0);
+  return "{\"state\":\"" + String(names[state]) + "\",\"idle_s\":" + String(powerIdleS) +
+         ",\"clock_khz\":" + String(clockKhz) + ",\"sleeps\":" + String(powerSleeps) +
+         ",\"asleep_ms\":" + String(asleepMs) + ",\"last_wake_us\":" + String(powerLastWakeUs) +
+         ",\"max_wake_us\":" + String(powerMaxWakeUs) + ",\"budget_us\":" + String(POWER_WAKE_BUDGET_US) +
+         ",\"over_budget\":" + String(powerWakesOverBudget) + "}";
+}
@@ -0,0 +1,347 @@
+#include "replay.h"
+
+#include <LittleFS.h>
+#include <lin_core.h>
+
+#include "capture.h"
+#include "lights.h"
+
+static HttpServer* server = nullptr;
+static ReplayHandler handler = nullptr;
+static void (*serviceLin)() = nullptr;
+static ReplayState state = REPLAY_IDLE;
+
+// The upload
+static File upload;
+static bool uploading = false;
+static bool stored = false; // by this request
+static bool uploaded = false; // there's a capture in REPLAY_PATH
+static String uploadResult = "";
+static size_t uploadBytes = 0;
+
+// The replay, the next frame is read ahead until it's due
+static File file;
+static bool packed = false;
+static CaptureDecoder decoder;
+static byte block[REPLAY_READ_BYTES];
+static size_t blockUsed = 0;
+static size_t blockPosition = 0;
+static char line[REPLAY_LINE_BYTES];
+static size_t lineUsed = 0;
+static LINFrame next;
+static bool nextReady = false;
+static unsigned long speed = 1;
+static bool stopped = false;
+static unsigned long startUs = 0;
+static unsigned long elapsedUs = 0;
+static unsigned long firstCaptureUs = 0;
+static unsigned long lastCaptureUs = 0;
+static uint64_t totalLateUs = 0;
+static byte lights = 0;
+static ReplayChange changes[REPLAY_MAX_CHANGES];
+
+unsigned long replayFrames = 0;
+unsigned long replayOtherBus = 0;
+unsigned long replayChangeCount = 0;
+unsigned long replayMaxLateUs = 0;
+unsigned long replayMaxHandlerUs = 0;
+uint32_t replayDigest = 0;
+const ReplayChange* replayChanges = changes;
+
+static uint32_t fnv(uint32_t hash, unsigned long value) {
+  for (int i = 0; i < 4; i++) {
+    hash = (hash ^ ((value >> (8 * i)) & 0xFF)) * 16777619UL;
+  }
+  return hash;
+}
+
+// A lin_capture.txt byte, true once it ends a line that parsed into a frame.
+// Lines too long to be a frame are dropped whole.
+static bool lineByte(byte value, LINFrame& frame) {
+  if (value != '\n') {
+    if (lineUsed < REPLAY_LINE_BYTES - 1) {
+      line[lineUsed] = value;
+    }
+    lineUsed++;
+    return false;
+  }
+  bool complete = lineUsed < REPLAY_LINE_BYTES;
+  if (complete) {
+    line[lineUsed] = '\0';
+    complete = parseCaptureLine(line, frame);
+  }
+  lineUsed = 0;
+  return complete;
+}
+
+// The next bus 0 frame in the file, false at its end
+static bool readFrame(LINFrame& frame) {
+  while (true) {
+    if (blockPosition == blockUsed) {
+      blockUsed = file.read(block, sizeof(block));
+      blockPosition = 0;
+      if (blockUsed == 0) {
+        // A last line without a line ending
+        return !packed && lineUsed && lineByte('\n', frame) && frame.bus == 0;
+      }
+    }
+    byte value = block[blockPosition++];
+    if (packed ? decoder.push(value, frame) : lineByte(value, frame)) {
+      if (frame.bus == 0) {
+        return true;
+      }
+      replayOtherBus++;
+    }
+  }
+}
+
+static void finish(unsigned long nowUs) {
+  file.close();
+  elapsedUs = (uint32_t)(nowUs - startUs);
+  state = REPLAY_COMPLETE;
+  Serial.println("Replay " + String(stopped ? "stopped" : "complete") + ": " + String(replayFrames) + " frames, " +
+                 String(replayChangeCount) + " light changes in " + String(elapsedUs / 1000) + " ms, at most " +
+                 String(replayMaxLateUs) + " us late");
+}
+
+bool replayStart(unsigned long newSpeed, unsigned long nowUs) {
+  if (state == REPLAY_RUNNING) {
+    file.close();
+  }
+  file = LittleFS.open(REPLAY_PATH, "r");
+  if (!file) {
+    state = REPLAY_IDLE;
+    return false;
+  }
+  byte header[CAPTURE_MAGIC_BYTES];
+  packed = file.read(header, sizeof(header)) == sizeof(header) && isPackedCapture(header, sizeof(header));
+  file.seek(0);
+  decoder.begin();
+  blockUsed = 0;
+  blockPosition = 0;
+  lineUsed = 0;
+  nextReady = false;
+  speed = newSpeed;
+  stopped = false;
+  startUs = nowUs;
+  elapsedUs = 0;
+  lastCaptureUs = 0;
+  totalLateUs = 0;
+  replayFrames = 0;
+  replayOtherBus = 0;
+  replayChangeCount = 0;
+  replayMaxLateUs = 0;
+  replayMaxHandlerUs = 0;
+  replayDigest = 0x811C9DC5UL;
+  state = REPLAY_RUNNING;
+  return true;
+}
+
+void replayStop(unsigned long nowUs) {
+  if (state == REPLAY_RUNNING) {
+    stopped = true;
+    finish(nowUs);
+  }
+}
+
+void replayPoll(unsigned long nowUs) {
+  if (state != REPLAY_RUNNING) {
+    return;
+  }
+  for (int i = 0; i < REPLAY_FRAMES_PER_POLL; i++) {
+    if (!nextReady) {
+      if (!readFrame(next)) {
+        finish(nowUs);
+        return;
+      }
+      nextReady = true;
+      if (replayFrames == 0) {
+        firstCaptureUs = next.timestampUs;
+      }
+    }
+    unsigned long captureUs = (uint32_t)(next.timestampUs - firstCaptureUs);
+    unsigned long dueUs = speed ? (uint32_t)(startUs + captureUs / speed) : nowUs;
+    if ((int32_t)(nowUs - dueUs) < 0) {
+      return;
+    }
+
+    // Back into the bytes the framer would have read. A frame without data
+    // is a header nobody answered, whose logged "checksum" is the PID.
+    byte buffer[lincore::MAX_FRAME_BYTES];
+    short length = 0;
+    buffer[length++] = next.sync;
+    buffer[length++] = next.pid;
+    if (next.dataLength > 0) {
+      memcpy(buffer + length, next.data, next.dataLength);
+      length += next.dataLength;
+      buffer[length++] = next.checksum;
+    }
+    // The clock is only read to time the handler, the next frame is due or
+    // not by when this one was done
+    handler(buffer, length, dueUs);
+    unsigned long doneUs = micros();
+    nextReady = false;
+    replayFrames++;
+    lastCaptureUs = captureUs;
+
+    unsigned long lateUs = (uint32_t)(doneUs - dueUs);
+    totalLateUs += lateUs;
+    if (lateUs > replayMaxLateUs) {
+      replayMaxLateUs = lateUs;
+    }
+    if ((uint32_t)(doneUs - nowUs) > replayMaxHandlerUs) {
+      replayMaxHandlerUs = (uint32_t)(doneUs - nowUs);
+    }
+    byte now = (left_state ? 0x01 : 0) | (right_state ? 0x02 : 0) | (tail_state ? 0x04 : 0);
+    // The first frame's decision counts as a change, whatever was on before
+    if (replayFrames == 1 || now != lights) {
+      lights = now;
+      if (replayChangeCount < REPLAY_MAX_CHANGES) {
+        changes[replayChangeCount] = {captureUs, lateUs, lights};
+      }
+      replayChangeCount++;
+      replayDigest = fnv(fnv(replayDigest, captureUs), lights);
+    }
+    nowUs = doneUs;
+  }
+}
+
+ReplayState replayState() {
+  return state;
+}
+
+String replayStatusJson() {
+  static const char* STATE_NAMES[] = {"idle", "running", "complete"};
+  unsigned long elapsed = state == REPLAY_RUNNING ? (uint32_t)(micros() - startUs) : elapsedUs;
+  String json = "{\"state\":\"" + String(STATE_NAMES[state]) + "\",\"stopped\":" + String(stopped ? "true" : "false") +
+                ",\"uploaded\":" + String(uploaded ? "true" : "false") + ",\"upload\":\"" + uploadResult +
+                "\",\"format\":\"" + String(packed ? "lcz" : "txt") + "\",\"speed\":" + String(speed) +
+                ",\"frames\":" + String(replayFrames) + ",\"other_bus\":" + String(replayOtherBus) +
+                ",\"capture_ms\":" + String(lastCaptureUs / 1000) + ",\"elapsed_ms\":" + String(elapsed / 1000) +
+                ",\"late_max_us\":" + String(replayMaxLateUs) +
+                ",\"late_avg_us\":" + String(replayFrames ? (unsigned long)(totalLateUs / replayFrames) : 0UL) +
+                ",\"handler_max_us\":" + String(replayMaxHandlerUs) + ",\"digest\":\"" + String(replayDigest, HEX) +
+                "\",\"change_count\":" + String(replayChangeCount) + ",\"changes\":[";
+  unsigned long recorded = replayChangeCount < REPLAY_MAX_CHANGES ? replayChangeCount : REPLAY_MAX_CHANGES;
+  for (unsigned long i = 0; i < recorded; i++) {
+    if (i > 0) {
+      json += ",";
+    }
+    json += "[" + String(changes[i].captureUs) + "," + String(changes[i].lights) + "," + String(changes[i].lateUs) + "]";
+  }
+  return json + "]}";
+}
+
+#pragma region HTTP
+
+static void service() {
+  if (serviceLin) {
+    serviceLin();
+  }
+}
+
+static void fail(const String& reason) {
+  uploadResult = reason;
+  // A half written capture is no use, one that was refused is kept
+  if (uploading) {
+    upload.close();
+    LittleFS.remove(REPLAY_PATH);
+    uploaded = false;
+  }
+  uploading = false;
+}
+
+static void handleUpload() {
+  HttpUpload& part = server->upload();
+  switch (part.status) {
+    case UPLOAD_FILE_START:
+      uploading = false;
+      stored = false;
+      uploadBytes = 0;
+      if (state == REPLAY_RUNNING) {
+        fail("A replay is running, stop it first");
+        return;
+      }
+      upload = LittleFS.open(REPLAY_PATH, "w");
+      if (!upload) {
+        fail("Can't create " REPLAY_PATH);
+        return;
+      }
+      uploading = true;
+      uploaded = false;
+      state = REPLAY_IDLE;
+      break;
+    case UPLOAD_FILE_WRITE:
+      if (!uploading) {
+        return;
+      }
+      for (size_t offset = 0; offset < part.currentSize; offset += REPLAY_SLICE_BYTES) {
+        size_t length = part.currentSize - offset;
+        if (length > REPLAY_SLICE_BYTES) {
+          length = REPLAY_SLICE_BYTES;
+        }
+        if (upload.write(part.buf + offset, length) != length) {
+          fail("Write failed after " + String((unsigned int)uploadBytes) + " bytes, out of flash?");
+          return;
+        }
+        uploadBytes += length;
+        service();
+      }
+      break;
+    case UPLOAD_FILE_END:
+      if (!uploading) {
+        return;
+      }
+      upload.close();
+      uploading = false;
+      stored = true;
+      uploaded = true;
+      uploadResult = String((unsigned int)uploadBytes) + " bytes";
+      Serial.println("Replay capture uploaded: " + part.filename + ", " + uploadResult);
+      break;
+    case UPLOAD_FILE_ABORTED:
+      fail("Upload aborted");
+      break;
+  }
+}
+
+static void handleUploadDone() {
+  if (!stored) {
+    server->send(500, "text/plain", "Upload failed: " + uploadResult);
+    return;
+  }
+  stored = false;
+  server->send(200, "text/plain", "Uploaded " + uploadResult);
+}
+
+// /startReplay?speed=N, 1 if not given
+static void handleStart() {
+  unsigned long newSpeed = server->hasArg("speed") ? strtoul(server->arg("speed").c_str(), nullptr, 10) : 1;
+  if (!replayStart(newSpeed, micros())) {
+    server->send(404, "text/plain", "No capture uploaded");
+    return;
+  }
+  server->send(200, "text/plain", newSpeed ? "Replaying at " + String(newSpeed) + "x" : String("Replaying flat out"));
+}
+
+static void handleStop() {
+  replayStop(micros());
+  server->send(200, "text/plain", "Replay stopped");
+}
+
+static void handleStatus() {
+  server->send(200, "application/json", replayStatusJson());
+}
+
+#pragma endregion HTTP
+
+void replayBegin(HttpServer& webServer, ReplayHandler frameHandler, void (*service)()) {
+  server = &webServer;
+  handler = frameHandler;
+  serviceLin = service;
+  uploaded = LittleFS.exists(REPLAY_PATH);
+  server->on("/uploadReplay", HttpServer::POST, handleUploadDone, handleUpload);
+  server->on("/startReplay", handleStart);
+  server->on("/stopReplay", handleStop);
+  server->on("/replayStatus", handleStatus);
+}
@@ -0,0 +1,185 @@
+#include "thermal.h"
+#include "config.h"
+#include "lights.h"
+
+#include <limits.h>
+
+#ifdef LAMP_SENSE
+#include "lampsense.h"
+#elif defined(ARDUINO_ARCH_RP2040)
+#include <hardware/adc.h>
+#endif
+
+float thermalTemperatureC = NAN;
+float thermalMinC = NAN;
+float thermalMaxC = NAN;
+float thermalRecordC = NAN;
+unsigned long thermalDerateEvents = 0;
+unsigned long thermalShutdownEvents = 0;
+
+static ThermalState state = THERMAL_NORMAL;
+static int derateAtC = THERMAL_DERATE_DEFAULT_C;
+static int shutdownAtC = THERMAL_SHUTDOWN_DEFAULT_C;
+static bool persistRecord = false;
+static unsigned long lastSample = 0;
+static bool sampled = false;
+
+// Hottest of each minute in tenths of a degree, oldest first from historyHead
+static int16_t history[THERMAL_HISTORY_POINTS];
+static size_t historyHead = 0;
+static size_t historyCount = 0;
+static unsigned long historyStartedAt = 0;
+static float minuteMaxC = NAN;
+
+static float readSensor() {
+#ifdef LAMP_SENSE
+  // The ADC is busy sampling in round-robin, which includes the sensor
+  return lampSenseTemperatureC;
+#elif defined(ARDUINO_ARCH_RP2040)
+  // One conversion, analogReadTemp() would also wait a millisecond for the
+  // sensor it just switched on, which thermalBegin() leaves on
+  adc_select_input(4);
+  uint16_t raw = adc_read();
+  return 27.0f - ((raw * 3.3f / 4096.0f) - 0.706f) / 0.001721f;
+#else
+  return analogReadTemp();
+#endif
+}
+
+const char* thermalStateName(ThermalState value) {
+  switch (value) {
+    case THERMAL_DERATED: return "derated";
+    case THERMAL_SHUTDOWN: return "shutdown";
+    default: return "normal";
+  }
+}
+
+static void enter(ThermalState next) {
+  if (next == state) {
+    return;
+  }
+  if (next == THERMAL_DERATED && state == THERMAL_NORMAL) {
+    thermalDerateEvents++;
+  } else if (next == THERMAL_SHUTDOWN) {
+    thermalShutdownEvents++;
+  }
+  state = next;
+  setLightLimit(state == THERMAL_SHUTDOWN ? LIGHTS_OFF : state == THERMAL_DERATED ? LIGHTS_DERATED : LIGHTS_FULL);
+  Serial.println("Thermal " + String(thermalStateName(state)) + " at " + String(thermalTemperatureC, 1) + " C");
+}
+
+// Thresholds on the way up, less the hysteresis on the way down
+static void updateState() {
+  float t = thermalTemperatureC;
+  if (t >= shutdownAtC) {
+    enter(THERMAL_SHUTDOWN);
+  } else if (state == THERMAL_SHUTDOWN && t >= shutdownAtC - THERMAL_HYSTERESIS_C) {
+    // still cooling down
+  } else if (t >= derateAtC) {
+    enter(THERMAL_DERATED);
+  } else if (state != THERMAL_NORMAL && t >= derateAtC - THERMAL_HYSTERESIS_C) {
+    enter(THERMAL_DERATED);
+  } else {
+    enter(THERMAL_NORMAL);
+  }
+}
+
+static void recordHistory(unsigned long nowMs) {
+  if (isnan(minuteMaxC) || thermalTemperatureC > minuteMaxC) {
+    minuteMaxC = thermalTemperatureC;
+  }
+  if (nowMs - historyStartedAt < THERMAL_HISTORY_MS) {
+    return;
+  }
+  size_t index = (historyHead + historyCount) % THERMAL_HISTORY_POINTS;
+  history[index] = (int16_t)lroundf(minuteMaxC * 10);
+  if (historyCount < THERMAL_HISTORY_POINTS) {
+    historyCount++;
+  } else {
+    historyHead = (historyHead + 1) % THERMAL_HISTORY_POINTS;
+  }
+  historyStartedAt = nowMs;
+  minuteMaxC = NAN;
+}
+
+void thermalBegin(int derateC, int shutdownC, bool persist) {
+  thermalSetThresholds(derateC, shutdownC);
+  persistRecord = persist;
+  if (persist) {
+    long record = configGetInt("thermal_record_c", LONG_MIN);
+    thermalRecordC = record == LONG_MIN ? NAN : record;
+  }
+#if !defined(LAMP_SENSE) && defined(ARDUINO_ARCH_RP2040)
+  adc_init();
+  adc_set_temp_sensor_enabled(true);
+#endif
+}
+
+void thermalSetThresholds(int derateC, int shutdownC) {
+  derateAtC = derateC;
+  shutdownAtC = shutdownC;
+  if (!isnan(thermalTemperatureC)) {
+    updateState();
+  }
+}
+
+void thermalPoll(unsigned long nowMs) {
+  if (sampled && nowMs - lastSample < THERMAL_SAMPLE_MS) {
+    return;
+  }
+  float reading = readSensor();
+  if (isnan(reading)) {
+    return; // lamp sense hasn't filled a block yet
+  }
+  if (!sampled) {
+    thermalTemperatureC = reading;
+    historyStartedAt = nowMs;
+    sampled = true;
+  } else {
+    thermalTemperatureC += THERMAL_FILTER_ALPHA * (reading - thermalTemperatureC);
+  }
+  lastSample = nowMs;
+
+  if (isnan(thermalMinC) || thermalTemperatureC < thermalMinC) {
+    thermalMinC = thermalTemperatureC;
+  }
+  if (isnan(thermalMaxC) || thermalTemperatureC > thermalMaxC) {
+    thermalMaxC = thermalTemperatureC;
+  }
+  // A new record is saved a whole degree at a time, to keep journal writes rare
+  if (isnan(thermalRecordC) || thermalTemperatureC >= thermalRecordC + 1) {
+    thermalRecordC = floorf(thermalTemperatureC);
+    if (persistRecord) {
+      configSetInt("thermal_record_c", (long)thermalRecordC);
+      configCommit();
+    }
+  }
+
+  recordHistory(nowMs);
+  updateState();
+}
+
+ThermalState thermalState() {
+  return state;
+}
+
+static String jsonNumber(float value) {
+  return isnan(value) ? String("null") : String(value, 1);
+}
+
+String thermalStatusJson(unsigned long nowMs) {
+  String json = "{\"now\":" + String(nowMs) + ",\"state\":\"" + String(thermalStateName(state)) +
+                "\",\"temperature_c\":" + jsonNumber(thermalTemperatureC) + ",\"min_c\":" + jsonNumber(thermalMinC) +
+                ",\"max_c\":" + jsonNumber(thermalMaxC) + ",\"record_c\":" + jsonNumber(thermalRecordC) +
+                ",\"derate_c\":" + String(derateAtC) + ",\"shutdown_c\":" + String(shutdownAtC) +
+                ",\"hysteresis_c\":" + String(THERMAL_HYSTERESIS_C) + ",\"derate_events\":" +
+                String(thermalDerateEvents) + ",\"shutdown_events\":" + String(thermalShutdownEvents) +
+                ",\"history_ms\":" + String(THERMAL_HISTORY_MS) + ",\"history\":[";
+  for (size_t i = 0; i < historyCount; i++) {
+    if (i > 0) {
+      json += ",";
+    }
+    json += String(history[(historyHead + i) % THERMAL_HISTORY_POINTS] / 10.0f, 1);
+  }
+  return json + "]}";
+}
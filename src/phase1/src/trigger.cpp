@@ -0,0 +1,485 @@
+#include "trigger.h"
+
+#include <LittleFS.h>
+
+// About 16.7 ms of the bus, all the UART keeps while flash has interrupts off
+static const unsigned long UART_FIFO_US = 32 * 10 * 1000000UL / lincore::BAUD;
+
+// Ring records, packed back to back in a static arena and wrapping at its
+// end:
+//   length | flags: bits 0-3 the bytes after the sync (PID, data, checksum),
+//     RECORD_EXPECTED, RECORD_SYNC, RECORD_LONG_DELTA, RECORD_BUS
+//   time since the previous record in us, 2 bytes little-endian, or 4 with
+//     RECORD_LONG_DELTA
+//   [bus, if RECORD_BUS, it wasn't bus 0]
+//   [sync, if RECORD_SYNC, it wasn't 0x55]
+//   PID, data, checksum as received
+//   [expected checksum, if RECORD_EXPECTED, it didn't match]
+// The car's light frame takes 6 bytes and a header 5, where a LINFrame took
+// 20.
+#define RECORD_LENGTH 0x0F
+#define RECORD_EXPECTED 0x10
+#define RECORD_SYNC 0x20
+#define RECORD_LONG_DELTA 0x40
+#define RECORD_BUS 0x80
+#define RECORD_MAX_BYTES 18 // header, 4 byte delta, bus, sync, 10 bytes, expected
+
+static_assert((CAPTURE_ARENA_BYTES & (CAPTURE_ARENA_BYTES - 1)) == 0, "the arena wraps with a mask");
+static byte arena[CAPTURE_ARENA_BYTES];
+static size_t ringHead = 0; // oldest record
+static size_t ringBytes = 0;
+static size_t ringCount = 0;
+// Frame times wrap at 2^32 us on the board, the same on the host
+static uint32_t ringFirstUs = 0; // the oldest record's frame time
+static uint32_t ringLastUs = 0; // the newest's
+
+static TriggerConfig config;
+static CaptureState state = CAPTURE_IDLE;
+static uint32_t startUs = 0; // first saved frame
+static unsigned long recordUntil = 0; // millis()
+static unsigned long lastMatchMs = 0; // for TRIGGER_MISSING
+static bool changeSeen = false;
+static byte lastValue = 0;
+
+static CaptureEncoder encoder;
+static File file;
+
+unsigned long captureTriggerUs = 0;
+unsigned long captureSavedFrames = 0;
+unsigned long captureSavedBytes = 0;
+unsigned long captureDroppedFrames = 0;
+CaptureArmError captureArmError = CAPTURE_ARM_OK;
+unsigned long captureMaxFlashUs = 0;
+unsigned long captureFlashOverruns = 0;
+
+static const char* CONDITION_NAMES[] = {"now", "pid", "data", "change", "checksum", "missing"};
+
+bool triggerConditionFromName(const String& name, TriggerCondition& condition) {
+  for (size_t i = 0; i < sizeof(CONDITION_NAMES) / sizeof(CONDITION_NAMES[0]); i++) {
+    if (name == CONDITION_NAMES[i]) {
+      condition = (TriggerCondition)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+static String hexByte(byte value) {
+  return String("0x") + (value < 0x10 ? "0" : "") + String(value, HEX);
+}
+
+String triggerDescription(const TriggerConfig& trigger) {
+  String frames = trigger.anyPid ? String("any frame") : "PID " + hexByte(trigger.pid);
+  String field = "data[" + String(trigger.index) + "] & " + hexByte(trigger.mask);
+  switch (trigger.condition) {
+    case TRIGGER_NOW: return "now";
+    case TRIGGER_PID: return frames;
+    case TRIGGER_DATA: return frames + " with " + field + " == " + hexByte(trigger.value);
+    case TRIGGER_CHANGE: return frames + " with " + field + " changed";
+    case TRIGGER_CHECKSUM: return "checksum error on " + frames;
+    case TRIGGER_MISSING: return "no " + frames + " for " + String(trigger.missingMs) + " ms";
+  }
+  return "";
+}
+
+bool captureIdsFromList(const String& list, uint64_t& ids) {
+  ids = 0;
+  const char* next = list.c_str();
+  while (*next) {
+    char* end;
+    unsigned long value = strtoul(next, &end, 0);
+    if (end == next || value > 0xFF || (*end && *end != ',')) {
+      return false;
+    }
+    ids |= lincore::idBit(value);
+    next = *end ? end + 1 : end;
+  }
+  return ids != 0;
+}
+
+String captureIdsDescription(uint64_t ids) {
+  if (ids == lincore::ALL_IDS) {
+    return "all";
+  }
+  String list;
+  for (byte id = 0; id < 64; id++) {
+    if (ids & lincore::idBit(id)) {
+      if (list.length()) {
+        list += ",";
+      }
+      list += hexByte(id);
+    }
+  }
+  return list;
+}
+
+static byte arenaAt(size_t offset) {
+  return arena[(ringHead + offset) & (CAPTURE_ARENA_BYTES - 1)];
+}
+
+static uint32_t recordDelta(size_t offset) {
+  byte header = arenaAt(offset);
+  uint32_t delta = arenaAt(offset + 1) | (uint32_t)arenaAt(offset + 2) << 8;
+  if (header & RECORD_LONG_DELTA) {
+    delta |= (uint32_t)arenaAt(offset + 3) << 16 | (uint32_t)arenaAt(offset + 4) << 24;
+  }
+  return delta;
+}
+
+static size_t recordBytes(size_t offset) {
+  byte header = arenaAt(offset);
+  return 3 + (header & RECORD_LONG_DELTA ? 2 : 0) + (header & RECORD_BUS ? 1 : 0) + (header & RECORD_SYNC ? 1 : 0) +
+         (header & RECORD_LENGTH) + (header & RECORD_EXPECTED ? 1 : 0);
+}
+
+static void dropOldest() {
+  size_t bytes = recordBytes(0);
+  ringHead = (ringHead + bytes) & (CAPTURE_ARENA_BYTES - 1);
+  ringBytes -= bytes;
+  ringCount--;
+  if (ringCount > 0) {
+    ringFirstUs += recordDelta(0);
+  }
+}
+
+// Packs a received frame onto the ring, false if there isn't room
+static bool ringPush(const byte buffer[], short length, byte expectedChecksum, uint32_t frameUs, byte bus) {
+  byte record[RECORD_MAX_BYTES];
+  uint32_t delta = ringCount ? frameUs - ringLastUs : 0;
+  byte header = (length - 1) & RECORD_LENGTH;
+  size_t used = 1;
+  record[used++] = delta;
+  record[used++] = delta >> 8;
+  if (delta > 0xFFFF) {
+    header |= RECORD_LONG_DELTA;
+    record[used++] = delta >> 16;
+    record[used++] = delta >> 24;
+  }
+  if (bus) {
+    header |= RECORD_BUS;
+    record[used++] = bus;
+  }
+  if (buffer[0] != lincore::SYNC) {
+    header |= RECORD_SYNC;
+    record[used++] = buffer[0];
+  }
+  memcpy(record + used, buffer + 1, length - 1);
+  used += length - 1;
+  if (expectedChecksum != buffer[length - 1]) {
+    header |= RECORD_EXPECTED;
+    record[used++] = expectedChecksum;
+  }
+  record[0] = header;
+  if (ringBytes + used > CAPTURE_ARENA_BYTES) {
+    return false;
+  }
+
+  size_t tail = ringHead + ringBytes;
+  for (size_t i = 0; i < used; i++) {
+    arena[(tail + i) & (CAPTURE_ARENA_BYTES - 1)] = record[i];
+  }
+  if (ringCount == 0) {
+    ringFirstUs = frameUs;
+  }
+  ringLastUs = frameUs;
+  ringBytes += used;
+  ringCount++;
+  return true;
+}
+
+// The oldest record as it was received, returns its length
+static short readOldest(byte raw[], byte& expectedChecksum, byte& bus) {
+  byte header = arenaAt(0);
+  size_t offset = header & RECORD_LONG_DELTA ? 5 : 3;
+  bus = header & RECORD_BUS ? arenaAt(offset++) : 0;
+  raw[0] = header & RECORD_SYNC ? arenaAt(offset++) : lincore::SYNC;
+  short length = (header & RECORD_LENGTH) + 1;
+  for (short i = 1; i < length; i++) {
+    raw[i] = arenaAt(offset++);
+  }
+  expectedChecksum = header & RECORD_EXPECTED ? arenaAt(offset) : raw[length - 1];
+  return length;
+}
+
+// Keeps the pre-trigger frames (and the trigger frame, if there is one) and
+// starts recording from there
+static void fire(uint32_t triggerUs, unsigned long nowMs, bool withFrame) {
+  size_t keep = config.preFrames + (withFrame ? 1 : 0);
+  while (ringCount > keep) {
+    dropOldest();
+  }
+  state = CAPTURE_RECORDING;
+  recordUntil = nowMs + config.postMs;
+  startUs = ringCount ? ringFirstUs : triggerUs;
+  captureTriggerUs = triggerUs - startUs;
+  Serial.println("Capture triggered: " + triggerDescription(config));
+}
+
+static bool matches(const LINFrame& frame, unsigned long nowMs) {
+  if (!config.anyPid && frame.pid != config.pid) {
+    return false;
+  }
+  bool hasField = frame.checksumValid && config.index < frame.dataLength;
+  byte field = hasField ? frame.data[config.index] & config.mask : 0;
+  switch (config.condition) {
+    case TRIGGER_PID:
+      return true;
+    case TRIGGER_DATA:
+      return hasField && field == config.value;
+    case TRIGGER_CHANGE: {
+      if (!hasField) {
+        return false;
+      }
+      bool changed = changeSeen && field != lastValue;
+      changeSeen = true;
+      lastValue = field;
+      return changed;
+    }
+    case TRIGGER_CHECKSUM:
+      // Headers nobody answered have no checksum to get wrong
+      return frame.dataLength > 0 && !frame.checksumValid;
+    case TRIGGER_MISSING:
+      lastMatchMs = nowMs;
+      return false;
+    case TRIGGER_NOW:
+      break;
+  }
+  return false;
+}
+
+const char* captureArmErrorText(CaptureArmError error) {
+  switch (error) {
+    case CAPTURE_ARM_OK: return "Armed";
+    case CAPTURE_ARM_NO_PID: return "This trigger needs pid";
+    case CAPTURE_ARM_BAD_PID: return "Bad pid, use the protected ID such as 0xCF for frame 0x0F";
+    case CAPTURE_ARM_BAD_INDEX: return "Bad index, use a data byte from 0 to 7";
+    case CAPTURE_ARM_NO_FILE: return "Couldn't create the capture file";
+  }
+  return "";
+}
+
+// A trigger that could never fire
+static CaptureArmError checkTrigger(const TriggerConfig& trigger) {
+  bool needsPid = trigger.condition == TRIGGER_PID || trigger.condition == TRIGGER_MISSING;
+  bool usesField = trigger.condition == TRIGGER_DATA || trigger.condition == TRIGGER_CHANGE;
+  if (needsPid && trigger.anyPid) {
+    return CAPTURE_ARM_NO_PID;
+  }
+  if (!trigger.anyPid && !lincore::pidValid(trigger.pid)) {
+    return CAPTURE_ARM_BAD_PID;
+  }
+  if (usesField && trigger.index >= 8) {
+    return CAPTURE_ARM_BAD_INDEX;
+  }
+  return CAPTURE_ARM_OK;
+}
+
+bool captureArm(const TriggerConfig& trigger, unsigned long nowMs) {
+  captureArmError = checkTrigger(trigger);
+  if (captureArmError != CAPTURE_ARM_OK) {
+    return false;
+  }
+  if (file) {
+    file.close();
+  }
+  config = trigger;
+  if (config.preFrames > CAPTURE_MAX_PRE_FRAMES) {
+    config.preFrames = CAPTURE_MAX_PRE_FRAMES;
+  }
+  if (config.postMs > CAPTURE_MAX_POST_S * 1000UL) {
+    config.postMs = CAPTURE_MAX_POST_S * 1000UL;
+  }
+  if (!config.anyPid) {
+    config.ids |= lincore::idBit(config.pid);
+  }
+  if (config.every < 1) {
+    config.every = 1;
+  }
+  // The ring may hold IDs the last capture kept that this one doesn't. The
+  // rest go back on in order, the deltas work out modulo 2^32. A record only
+  // grows (by a long delta) after one that was left off, so they all fit,
+  // but the first goes on with no delta rather than one back from the newest
+  // record left to go through. Should one not fit it's counted as dropped.
+  unsigned long dropped = 0;
+  if (config.ids != lincore::ALL_IDS) {
+    bool first = true;
+    uint32_t firstUs = 0;
+    for (size_t i = ringCount; i > 0; i--) {
+      byte raw[lincore::MAX_FRAME_BYTES];
+      byte expected;
+      byte bus;
+      uint32_t frameUs = ringFirstUs;
+      short length = readOldest(raw, expected, bus);
+      dropOldest();
+      if (!(config.ids & lincore::idBit(raw[1]))) {
+        continue;
+      }
+      if (first) {
+        ringLastUs = frameUs;
+      }
+      if (!ringPush(raw, length, expected, frameUs, bus)) {
+        dropped++;
+        continue;
+      }
+      if (first) {
+        firstUs = frameUs;
+        first = false;
+      }
+    }
+    if (!first) {
+      ringFirstUs = firstUs;
+    }
+  }
+  // Replace the last capture, including one from before captures were packed
+  LittleFS.remove("/logs/lin_capture.txt");
+  LittleFS.remove(CAPTURE_PATH);
+  file = LittleFS.open(CAPTURE_PATH, "w");
+  encoder.begin();
+  captureTriggerUs = 0;
+  captureSavedFrames = 0;
+  captureSavedBytes = 0;
+  captureDroppedFrames = dropped;
+  captureMaxFlashUs = 0;
+  captureFlashOverruns = 0;
+  changeSeen = false;
+  lastMatchMs = nowMs;
+  if (!file) {
+    state = CAPTURE_IDLE;
+    captureArmError = CAPTURE_ARM_NO_FILE;
+    return false;
+  }
+  state = CAPTURE_ARMED;
+  if (config.condition == TRIGGER_NOW) {
+    fire(micros(), nowMs, false);
+  }
+  return true;
+}
+
+void captureStop(unsigned long nowMs) {
+  if (state == CAPTURE_ARMED) {
+    state = CAPTURE_IDLE;
+    file.close();
+    LittleFS.remove(CAPTURE_PATH);
+  } else if (state == CAPTURE_RECORDING && (long)(recordUntil - nowMs) > 0) {
+    recordUntil = nowMs;
+  }
+}
+
+void captureFrame(const byte buffer[], short length, byte expectedChecksum, unsigned long frameUs,
+                  unsigned long nowMs, byte bus) {
+  // The framer also passes frames other parts of the firmware want
+  if (!(config.ids & lincore::idBit(buffer[1]))) {
+    return;
+  }
+  if (state == CAPTURE_RECORDING) {
+    if ((long)(nowMs - recordUntil) >= 0) {
+      return;
+    }
+    // The ring is the write queue now, don't overwrite what isn't saved
+    if (!ringPush(buffer, length, expectedChecksum, frameUs, bus)) {
+      captureDroppedFrames++;
+    }
+    return;
+  }
+  while (!ringPush(buffer, length, expectedChecksum, frameUs, bus)) {
+    dropOldest();
+  }
+  // The conditions are about the trailer bus, others are only recorded
+  if (state == CAPTURE_ARMED && bus == 0) {
+    LINFrame frame;
+    buildCaptureFrame(frame, buffer, length, frameUs, expectedChecksum);
+    if (matches(frame, nowMs)) {
+      fire(frameUs, nowMs, true);
+    }
+  }
+}
+
+// A write or close since startUs, which may have erased and programmed
+static void flashTook(unsigned long startUs) {
+  unsigned long took = (uint32_t)(micros() - startUs);
+  if (took > captureMaxFlashUs) {
+    captureMaxFlashUs = took;
+  }
+  if (took > UART_FIFO_US) {
+    captureFlashOverruns++;
+  }
+}
+
+static void writeBlock() {
+  if (encoder.length() == 0) {
+    return;
+  }
+  if (file) {
+    unsigned long start = micros();
+    size_t written = file.write(encoder.data(), encoder.length());
+    flashTook(start);
+    if (written == encoder.length()) {
+      captureSavedBytes += encoder.length();
+    } else {
+      // Out of space, keep what made it
+      file.close();
+    }
+  }
+  encoder.clear();
+}
+
+void capturePoll(unsigned long nowMs) {
+  if (state == CAPTURE_ARMED && config.condition == TRIGGER_MISSING &&
+      (long)(nowMs - lastMatchMs) >= (long)config.missingMs) {
+    fire(micros(), nowMs, false);
+  }
+  if (state != CAPTURE_RECORDING) {
+    return;
+  }
+
+  // Pack queued frames, writing at most one block per pass
+  while (ringCount > 0) {
+    byte raw[lincore::MAX_FRAME_BYTES];
+    byte expected;
+    byte bus;
+    short length = readOldest(raw, expected, bus);
+    LINFrame frame;
+    buildCaptureFrame(frame, raw, length, ringFirstUs - startUs, expected, bus);
+    if (!file) {
+      captureDroppedFrames++;
+    } else if (!encoder.append(frame)) {
+      writeBlock();
+      return;
+    } else {
+      captureSavedFrames++;
+    }
+    dropOldest();
+  }
+
+  if ((long)(nowMs - recordUntil) >= 0) {
+    writeBlock();
+    if (file) {
+      unsigned long start = micros();
+      file.close();
+      flashTook(start);
+    }
+    state = CAPTURE_COMPLETE;
+    Serial.println("Capture written with " + String(captureSavedFrames) + " frames in " +
+                   String(captureSavedBytes) + " bytes, " + String(captureDroppedFrames) + " frames dropped, " +
+                   "longest flash write " + String(captureMaxFlashUs) + " us");
+  }
+}
+
+CaptureState captureState() {
+  return state;
+}
+
+const TriggerConfig& captureConfig() {
+  return config;
+}
+
+String captureStatusJson() {
+  static const char* STATE_NAMES[] = {"idle", "armed", "logging", "complete"};
+  return "{\"state\":\"" + String(STATE_NAMES[state]) + "\",\"trigger\":\"" + triggerDescription(config) +
+         "\",\"pre_frames\":" + String(config.preFrames) + ",\"post_ms\":" + String(config.postMs) +
+         ",\"trigger_ms\":" + String(captureTriggerUs / 1000) + ",\"frames\":" + String(captureSavedFrames) +
+         ",\"bytes\":" + String(captureSavedBytes) + ",\"dropped\":" + String(captureDroppedFrames) +
+         ",\"flash_max_us\":" + String(captureMaxFlashUs) + ",\"flash_overruns\":" + String(captureFlashOverruns) +
+         ",\"ids\":\"" + captureIdsDescription(config.ids) + "\",\"every\":" + String(config.every) +
+         ",\"ring_frames\":" + String((unsigned long)ringCount) + ",\"ring_bytes\":" + String((unsigned long)ringBytes) + "}";
+}